@@ -0,0 +1,163 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+/*
+ * Parser micro-benchmark: the hand-written single-pass parser versus the
+ * previous sscanf-based implementation, over the same in-memory lines.
+ *
+ *   make bench
+ *   ./bench_parser [lines] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parser.h"
+
+// The fixed-buffer entry and sscanf parser as they were before the rewrite
+typedef struct
+{
+    char timestamp[64];
+    char ip[64];
+    char method[16];
+    char url[1024];
+    int status;
+    char userAgent[1024];
+    time_t epoch;
+} LegacyEntry;
+
+static int legacy_parse(const char *line, LegacyEntry *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    char ip[64] = {0}, timebuf[64] = {0}, method[16] = {0}, url[1024] = {0}, proto[32] = {0}, ua[1024] = {0};
+    int status = 0;
+    int matched = sscanf(line,
+                         "%63s - - [%63[^]]] \"%15s %1023s %31[^\"]\" %d %*s %*[^\" ] \"%1023[^\"]\"",
+                         ip, timebuf, method, url, proto, &status, ua);
+    if (matched < 6)
+        return 0;
+
+    strncpy(out->ip, ip, sizeof(out->ip) - 1);
+    strncpy(out->timestamp, timebuf, sizeof(out->timestamp) - 1);
+    strncpy(out->method, method, sizeof(out->method) - 1);
+    strncpy(out->url, url, sizeof(out->url) - 1);
+    out->status = status;
+    strncpy(out->userAgent, ua, sizeof(out->userAgent) - 1);
+    return 1;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *methods[] = {"GET", "GET", "GET", "POST", "PUT", "DELETE"};
+static const char *urls[] = {"/", "/index.html", "/api/v1/orders/%d", "/static/app.%d.js",
+                             "/search?q=term&page=%d"};
+static const char *agents[] = {"Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0",
+                               "curl/8.1.2", "Googlebot/2.1 (+http://www.google.com/bot.html)"};
+static const int statuses[] = {200, 200, 200, 304, 404, 500};
+
+#define NELEM(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+// Unusual lines both parsers must read the same way (checked before timing)
+static const char *edge_lines[] = {
+    "1.2.3.4 - - [10/Oct/2023:13:55:36 +0000] \"GET /x\"y HTTP/1.1\" 200 5 \"-\" \"x\"", // raw quote in the URL
+};
+
+static int check_edge_lines(void)
+{
+    int bad = 0;
+    for (int i = 0; i < NELEM(edge_lines); i++)
+    {
+        LegacyEntry le;
+        LogEntry e;
+        const char *line = edge_lines[i];
+        int ok_legacy = legacy_parse(line, &le);
+        int ok_new = parse_apache_or_nginx(line, strlen(line), &e, NULL, 0);
+        if (ok_legacy != ok_new ||
+            (ok_new && (e.status != le.status || e.url.len != strlen(le.url) ||
+                        memcmp(e.url.p, le.url, e.url.len) != 0)))
+        {
+            fprintf(stderr, "parsers disagree on: %s\n", line);
+            bad = 1;
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    int nlines = argc > 1 ? atoi(argv[1]) : 200000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (nlines <= 0 || rounds <= 0)
+    {
+        fprintf(stderr, "usage: bench_parser [lines] [rounds]\n");
+        return 1;
+    }
+
+    if (check_edge_lines())
+        return 1;
+
+    // Lines are stored NUL-terminated so both parsers see identical input
+    char **lines = (char **)malloc((size_t)nlines * sizeof(char *));
+    size_t *lens = (size_t *)malloc((size_t)nlines * sizeof(size_t));
+    if (!lines || !lens)
+    {
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    for (int i = 0; i < nlines; i++)
+    {
+        char url[128], buf[512];
+        snprintf(url, sizeof(url), urls[rand() % NELEM(urls)], rand() % 10000);
+        int n = snprintf(buf, sizeof(buf),
+                         "%d.%d.%d.%d - - [17/May/2015:10:%02d:%02d +0000] \"%s %s HTTP/1.1\" %d %d \"-\" \"%s\"",
+                         rand() % 256, rand() % 256, rand() % 256, rand() % 256, (i / 60) % 60, i % 60,
+                         methods[rand() % NELEM(methods)], url, statuses[rand() % NELEM(statuses)],
+                         rand() % 100000, agents[rand() % NELEM(agents)]);
+        lines[i] = strdup(buf);
+        lens[i] = (size_t)n;
+    }
+
+    LegacyEntry le;
+    LogEntry e;
+    long long ok_legacy = 0, ok_new = 0;
+    unsigned sink = 0;
+
+    double t0 = now_sec();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < nlines; i++)
+        {
+            ok_legacy += legacy_parse(lines[i], &le);
+            sink += (unsigned)le.status;
+        }
+    double t_legacy = now_sec() - t0;
+
+    t0 = now_sec();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < nlines; i++)
+        {
+            ok_new += parse_apache_or_nginx(lines[i], lens[i], &e, NULL, 0);
+            logentry_load(&e, LF_ALL); // same work as the old parser: every field
+            sink += (unsigned)e.status;
+        }
+    double t_new = now_sec() - t0;
+
+    double total = (double)nlines * rounds;
+    printf("lines=%d rounds=%d (checksum %u)\n", nlines, rounds, sink);
+    printf("  sscanf      : %10.0f lines/s  (%lld parsed)\n", total / t_legacy, ok_legacy);
+    printf("  single-pass : %10.0f lines/s  (%lld parsed)\n", total / t_new, ok_new);
+    printf("  speedup     : %.2fx\n", t_legacy / t_new);
+
+    for (int i = 0; i < nlines; i++)
+        free(lines[i]);
+    free(lines);
+    free(lens);
+    return ok_legacy == ok_new ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+/*
+ * Substring search micro-benchmark: the per-byte loop matches() used to run
+ * versus the scalar, SSE2 and AVX2 kernels in strsearch.c, case-sensitive
+ * and --ci, over User-Agent and URL strings like the ones --search scans.
+ * Every kernel is first checked against the old loop on random input.
+ *
+ *   make bench
+ *   ./bench_search [strings] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "strsearch.h"
+
+// The loop slice_contains() used before the SIMD kernels
+static const char *legacy_contains(const char *hay, size_t n, const char *needle, size_t nn, int ci)
+{
+    if (nn == 0)
+        return hay;
+    if (n < nn)
+        return NULL;
+    for (size_t i = 0; i + nn <= n; i++)
+    {
+        size_t j = 0;
+        while (j < nn)
+        {
+            unsigned char a = (unsigned char)hay[i + j];
+            unsigned char b = (unsigned char)needle[j];
+            if (ci)
+            {
+                if (a >= 'A' && a <= 'Z')
+                    a = (unsigned char)(a + 32);
+                if (b >= 'A' && b <= 'Z')
+                    b = (unsigned char)(b + 32);
+            }
+            if (a != b)
+                break;
+            j++;
+        }
+        if (j == nn)
+            return hay + i;
+    }
+    return NULL;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *agents[] = {
+    "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/119.0 Safari/537.36",
+    "Mozilla/5.0 (iPhone; CPU iPhone OS 17_1 like Mac OS X) AppleWebKit/605.1.15 Mobile/15E148",
+    "curl/8.1.2", "Googlebot/2.1 (+http://www.google.com/bot.html)"};
+static const char *urls[] = {"/", "/index.html", "/api/v1/orders/%d?expand=items", "/static/app.%d.js",
+                             "/search?q=term&page=%d", "/account/login?next=/cart/%d"};
+static const char *needles[] = {"firefox", "login", "Googlebot", "/api/v2/", "x"};
+
+#define NELEM(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+// Random haystacks over a tiny alphabet, so partial matches are frequent
+static int self_check(void)
+{
+    char hay[300], nd[8];
+    int bad = 0;
+    srand(7);
+    for (int iter = 0; iter < 200000 && !bad; iter++)
+    {
+        size_t n = (size_t)(rand() % 200), m = (size_t)(rand() % 6);
+        for (size_t i = 0; i < n; i++)
+            hay[i] = "aAbB-"[rand() % 5];
+        for (size_t i = 0; i < m; i++)
+            nd[i] = "aAbB-"[rand() % 5];
+        for (int ci = 0; ci <= 1; ci++)
+        {
+            const char *want = legacy_contains(hay, n, nd, m, ci);
+            for (int lvl = LF_SIMD_SCALAR; lvl <= LF_SIMD_AVX2; lvl++)
+                if (lf_memmem_at((LfSimdLevel)lvl, ci, hay, n, nd, m) != want)
+                {
+                    fprintf(stderr, "mismatch: level=%s ci=%d n=%zu m=%zu\n",
+                            lf_simd_name((LfSimdLevel)lvl), ci, n, m);
+                    bad = 1;
+                }
+        }
+    }
+    return !bad;
+}
+
+int main(int argc, char *argv[])
+{
+    int nstr = argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (nstr <= 0 || rounds <= 0)
+    {
+        fprintf(stderr, "usage: bench_search [strings] [rounds]\n");
+        return 1;
+    }
+    if (!self_check())
+        return 1;
+
+    char **strs = (char **)malloc((size_t)nstr * sizeof(char *));
+    size_t *lens = (size_t *)malloc((size_t)nstr * sizeof(size_t));
+    if (!strs || !lens)
+    {
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    for (int i = 0; i < nstr; i++)
+    {
+        char buf[256];
+        if (i % 2)
+            snprintf(buf, sizeof(buf), "%s", agents[rand() % NELEM(agents)]);
+        else
+            snprintf(buf, sizeof(buf), urls[rand() % NELEM(urls)], rand() % 100000);
+        strs[i] = strdup(buf);
+        lens[i] = strlen(buf);
+    }
+
+    printf("strings=%d rounds=%d best=%s\n", nstr, rounds, lf_simd_name(lf_simd_level()));
+    printf("  %-10s %-3s %8s %8s %8s %8s   (million strings/s)\n", "needle", "ci", "loop", "scalar", "sse2", "avx2");
+    for (int k = 0; k < NELEM(needles); k++)
+    {
+        const char *nd = needles[k];
+        size_t m = strlen(nd);
+        for (int ci = 0; ci <= 1; ci++)
+        {
+            double secs[4];
+            long long hits[4];
+            for (int impl = 0; impl < 4; impl++)
+            {
+                hits[impl] = 0;
+                double t0 = now_sec();
+                for (int r = 0; r < rounds; r++)
+                    for (int i = 0; i < nstr; i++)
+                        hits[impl] += impl == 0 ? legacy_contains(strs[i], lens[i], nd, m, ci) != NULL
+                                                : lf_memmem_at((LfSimdLevel)(impl - 1), ci, strs[i],
+                                                               lens[i], nd, m) != NULL;
+                secs[impl] = now_sec() - t0;
+            }
+            double total = (double)nstr * rounds;
+            printf("  %-10s %-3s %8.1f %8.1f %8.1f %8.1f   avx2 vs loop %.1fx, hits %lld\n",
+                   nd, ci ? "yes" : "no", total / secs[0] / 1e6, total / secs[1] / 1e6,
+                   total / secs[2] / 1e6, total / secs[3] / 1e6, secs[0] / secs[3], hits[0]);
+            for (int impl = 1; impl < 4; impl++)
+                if (hits[impl] != hits[0])
+                {
+                    fprintf(stderr, "hit count mismatch for %s\n", nd);
+                    return 1;
+                }
+        }
+    }
+
+    for (int i = 0; i < nstr; i++)
+        free(strs[i]);
+    free(strs);
+    free(lens);
+    return 0;
+}
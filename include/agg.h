@@ -0,0 +1,49 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef AGG_H
+#define AGG_H
+#include <stdio.h>
+#include <time.h>
+#include "cli.h"
+#include "logstore.h"
+
+/*
+ * Streaming group-by aggregation (--group-by, --agg, --stats).
+ *
+ * Matching entries are folded into a table instead of being printed. The
+ * table is open-addressed (linear probing) and keyed on the group-by field
+ * values, which are copied once per group into an arena; adding an entry to
+ * an existing group allocates nothing. Worker threads fill their own tables,
+ * which are merged at the end. Rows are printed sorted by group key.
+ *
+ * Quantile columns (p99(bytes), --quantiles) keep a mergeable log-linear
+ * histogram per group (see hdr.h), so they need constant memory per group.
+ *
+ * --distinct counts distinct values per group with HyperLogLog (see hll.h).
+ * --bucket groups by time bucket ahead of any --group-by fields; in tail
+ * mode, agg_take_closed() hands out the buckets that have ended.
+ *
+ * With --top K the table is replaced by a bounded-memory heavy-hitter
+ * summary (see topk.h) over a single field.
+ */
+typedef struct Agg Agg;
+
+int aggspec_parse_keys(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz);
+int aggspec_parse_columns(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz);
+int aggspec_parse_quantiles(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz);
+int aggspec_parse_bucket(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz);
+
+Agg *agg_new(const AggSpec *spec);
+void agg_add(Agg *a, LogEntry *e);
+void agg_merge(Agg *dst, const Agg *src);
+long long agg_added(const Agg *a);
+void agg_write(const Agg *a, OutputFormat format, FILE *out);
+void agg_summary(const Agg *a, FILE *err);
+Agg *agg_take_closed(Agg *a, time_t now, int keep_newest);
+int agg_save(const Agg *a, FILE *fp);
+Agg *agg_load(const AggSpec *spec, FILE *fp);
+void agg_free(Agg *a);
+
+#endif // AGG_H
@@ -6,6 +6,7 @@
 #define CLI_H
 
 #include <stdio.h>
+#include "logstore.h"
 
 typedef enum
 {
@@ -26,6 +27,19 @@ typedef struct
     int case_insensitive;
     int tail;
     int from_start;
+    FieldSet fields; // --fields projection, valid when has_fields
+    int has_fields;
+    int threads;   // worker threads for chunked file scans (1 = sequential)
+    int unordered; // let parallel output follow completion order
+    int jobs;       // inputs scanned concurrently (1 = one after another)
+    int interleave; // with jobs > 1, write blocks as they arrive, not per input
+    int no_seek;    // never bisect files on the query's time window
+    long seek_slack; // seconds of out-of-order tolerance for time seeks
+    int no_index;    // ignore <file>.lfidx sidecar indexes
+    AggSpec agg;     // --group-by/--agg/--stats/--top, valid when aggregate
+    int aggregate;
+    int interval;    // with --tail, seconds between aggregate snapshots
+    const char *state_file; // with --tail, where read offsets (and the aggregate) are checkpointed
 } CLIOptions;
 
 CLIOptions parseCLI(int argc, char *argv[]);
@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef DECOMP_H
+#define DECOMP_H
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Streaming decompression of gzip and zstd input (see linesrc.h).
+ *
+ * Decoding runs on worker threads, ahead of the thread that parses, and
+ * hands the output over in 1 MiB pieces through a bounded queue. A mapped
+ * file can be cut into segments that are decoded in parallel:
+ *
+ *   - zstd frames record their compressed size, so segments are cut at
+ *     exact frame boundaries;
+ *   - gzip members do not, so a cut is placed at the first plausible member
+ *     header past each cut point (checked by inflating the start of it).
+ *     A segment decodes every member that starts inside it, and the reader
+ *     only accepts the next segment if the previous one ended exactly where
+ *     it starts; otherwise that segment is decoded again from the right
+ *     offset. Output is therefore always that of a sequential decode.
+ *
+ * Files with a single member or frame (what gzip and zstd write by
+ * default) are decoded by one worker. zstd needs a build with libzstd
+ * (HAVE_ZSTD).
+ */
+
+typedef enum
+{
+    DECOMP_NONE,
+    DECOMP_GZIP,
+    DECOMP_ZSTD
+} DecompKind;
+
+typedef struct Decomp Decomp;
+
+DecompKind decomp_detect(const void *p, size_t n);
+Decomp *decomp_open_map(DecompKind kind, const void *map, size_t len);
+Decomp *decomp_open_stream(DecompKind kind, FILE *fp, const void *head, size_t n);
+void decomp_set_threads(Decomp *d, int threads);
+ssize_t decomp_read(Decomp *d, char *buf, size_t cap);
+void decomp_close(Decomp *d);
+
+#endif // DECOMP_H
@@ -6,6 +6,7 @@
 #define FORMATTER_H
 #pragma once
 #include "logstore.h"
+#include "outbuf.h"
 
 enum OutputFormat
 {
@@ -14,8 +15,13 @@ enum OutputFormat
     CSV
 };
 
-void printLogText(LogEntry *entry, FILE *out);
-void printLogJSON(LogEntry *entry, FILE *out);
-void printLogCSV(LogEntry *entry, FILE *out);
+// fields == NULL prints the default columns
+void printLogText(LogEntry *entry, const FieldSet *fields, OutBuf *out);
+void printLogJSON(LogEntry *entry, const FieldSet *fields, OutBuf *out);
+void printLogCSV(LogEntry *entry, const FieldSet *fields, OutBuf *out);
+
+const char *logfield_name(LogField f);
+void fieldset_default(FieldSet *out);
+int fieldset_parse(const char *spec, FieldSet *out, char *errmsg, size_t errmsg_sz);
 
 #endif // FORMATTER_H
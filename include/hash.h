@@ -0,0 +1,61 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef HASH_H
+#define HASH_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Fast non-cryptographic 64-bit hash for raw field bytes.
+ *
+ * Consumes 8 bytes per step with a multiply-rotate mix and finishes with
+ * the murmur3 fmix64 avalanche, so every output bit depends on every input
+ * byte. Values depend on host byte order; only use them in process or in
+ * files that never leave the host (the sidecar index).
+ */
+
+static inline uint64_t lf_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t lf_fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t lf_hash64(const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)n * 0x87c37b91114253d5ULL);
+    uint64_t k;
+
+    while (n >= 8)
+    {
+        memcpy(&k, p, 8);
+        k *= 0x87c37b91114253d5ULL;
+        k = lf_rotl64(k, 31);
+        k *= 0x4cf5ad432745937fULL;
+        h ^= k;
+        h = lf_rotl64(h, 27) * 5 + 0x52dce729;
+        p += 8;
+        n -= 8;
+    }
+    k = 0;
+    memcpy(&k, p, n);
+    k *= 0x87c37b91114253d5ULL;
+    k = lf_rotl64(k, 31);
+    k *= 0x4cf5ad432745937fULL;
+    h ^= k;
+    return lf_fmix64(h);
+}
+
+#endif // HASH_H
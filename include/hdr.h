@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef HDR_H
+#define HDR_H
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of non-negative integers, in the style of
+ * HdrHistogram, for --quantiles and p99(...) aggregates.
+ *
+ * Values below 128 get a bucket each. Above that, every power-of-two range
+ * is split into 128 equal buckets, so a bucket is never wider than 1/128
+ * of the values in it and a reported quantile is within 0.8% of a value
+ * that really occurred at that rank. Buckets are allocated 128 at a time,
+ * only for the ranges that are used, so a histogram takes a few KiB
+ * however many values it holds. Two histograms merge exactly by adding
+ * their counts.
+ */
+typedef struct Hdr Hdr;
+
+Hdr *hdr_new(void);
+void hdr_add(Hdr *h, uint64_t v);
+void hdr_merge(Hdr *dst, const Hdr *src);
+uint64_t hdr_count(const Hdr *h);
+uint64_t hdr_quantile(const Hdr *h, double q);
+int hdr_save(const Hdr *h, FILE *fp);
+int hdr_load(Hdr *h, FILE *fp);
+void hdr_free(Hdr *h);
+
+#endif // HDR_H
@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef INDEX_H
+#define INDEX_H
+#include <stdint.h>
+#include <stddef.h>
+#include "query.h"
+#include "logstore.h"
+
+/*
+ * Sparse sidecar index (<log>.lfidx).
+ *
+ * One summary per block of N lines: its byte range, line counts, min/max
+ * epoch, which status codes and methods occur, and a Bloom filter of the
+ * client IPs. Queries test their terms against the summaries and skip
+ * blocks that cannot contain a match without reading them. The file is
+ * host-endian and tied to the log's device, inode, size and mtime.
+ */
+
+#define INDEX_SUFFIX ".lfidx"
+#define INDEX_DEFAULT_BLOCK_LINES 8192
+#define INDEX_STATUS_BITS 640 // status codes 0..638; 639 = anything else
+#define INDEX_BLOOM_BITS 65536
+#define INDEX_BLOOM_HASHES 4
+
+typedef struct
+{
+    uint64_t offset, end; // byte range [offset, end), line-aligned
+    int64_t t_min, t_max; // epochs of decodable lines; t_min > t_max if none
+    uint32_t lines, failed;
+    uint32_t methods; // INDEX_M_* bits
+    uint32_t reserved;
+    uint64_t status[INDEX_STATUS_BITS / 64];
+    uint64_t bloom[INDEX_BLOOM_BITS / 64];
+} IndexBlock;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t block_lines;
+    uint64_t dev, ino;
+    uint64_t file_size; // log size when the index was written
+    int64_t mtime;
+    uint64_t indexed;   // bytes covered by blocks (ends on a line boundary)
+    uint64_t tail_hash; // hash of the last bytes before `indexed`
+    uint64_t nblocks;
+} IndexHeader;
+
+typedef struct
+{
+    IndexHeader hdr;
+    IndexBlock *blocks;
+} LogIndex;
+
+int index_build(const char *path, unsigned block_lines);
+int index_load(const char *path, int fd, const char *data, size_t len, LogIndex *idx);
+void index_block_init(IndexBlock *b, uint64_t offset);
+void index_block_add(IndexBlock *b, LogEntry *e);
+int index_queryable(const Query *q);
+int index_block_may_match(const IndexBlock *b, const Query *q);
+void index_free(LogIndex *idx);
+int index_main(int argc, char *argv[]);
+
+#endif // INDEX_H
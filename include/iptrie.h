@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef IPTRIE_H
+#define IPTRIE_H
+#include <stddef.h>
+
+/*
+ * Sets of IPv4/IPv6 addresses and CIDR ranges, for `ip IN 10.0.0.0/8` and
+ * `ip IN @blocklist.txt`.
+ *
+ * Prefixes are compiled into a multibit trie with a stride of one byte.
+ * Each node has two 256-bit bitmaps: one marks the bytes covered by a
+ * prefix ending at that node, the other marks the bytes that have a child.
+ * Children are stored next to each other and found by a popcount over the
+ * child bitmap, so empty slots take no space. Prefix lengths that are not
+ * a multiple of 8 are expanded into the byte ranges they cover. A lookup
+ * visits one node per address byte: at most 4 for IPv4 and 16 for IPv6,
+ * however many prefixes the set holds.
+ *
+ * IPv4 and IPv6 prefixes are kept in separate tries. IPv4-mapped IPv6
+ * addresses (::ffff:a.b.c.d) are treated as IPv4.
+ */
+typedef struct IpTrie IpTrie;
+
+int ip_parse(const char *s, size_t n, unsigned char addr[16], int *v6);
+
+IpTrie *iptrie_new(void);
+int iptrie_add(IpTrie *t, const char *s, size_t n);
+int iptrie_load(IpTrie *t, const char *path, char *err, size_t errsz);
+int iptrie_build(IpTrie *t);
+int iptrie_contains(const IpTrie *t, const unsigned char *addr, int v6);
+size_t iptrie_count(const IpTrie *t);
+void iptrie_free(IpTrie *t);
+
+#endif // IPTRIE_H
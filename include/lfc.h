@@ -0,0 +1,99 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef LFC_H
+#define LFC_H
+#include <stdio.h>
+#include <stdint.h>
+#include "index.h"
+#include "logfire.h"
+
+/*
+ * Columnar cache format (.lfc), written by `logfire convert --to lfc`.
+ *
+ * Parsed entries are stored in blocks of N rows (65536 by default), one
+ * chunk per column, each deflate-compressed on its own (or kept as is when
+ * that saves less than a quarter, which is cheaper to read):
+ *
+ *   - method, protocol, status and the time-zone suffix: a per-block
+ *     dictionary of distinct values plus one varint code per row
+ *   - timestamp: zigzag varint deltas of the epoch; the text is rebuilt
+ *     from epoch + zone, and lines whose text would not come back byte for
+ *     byte keep it verbatim in a side column
+ *   - ip: 4 or 16 address bytes, or the text when it is not an address in
+ *     canonical form
+ *   - url, referrer, User-Agent: a varint length per row, then the bytes
+ *   - bytes: zigzag varints; request time: raw doubles
+ *
+ * Every block carries the same summary as a sidecar index block (time
+ * range, status codes, methods, IP Bloom filter), so queries skip blocks
+ * without decompressing them. Reading maps the file, inflates only the
+ * columns the query, the output and any aggregation use, and hands the
+ * rows to the normal filter/output path as ready-made entries: no text is
+ * parsed. Unparsable lines are counted but not stored.
+ *
+ * The file is host-endian and, like the sidecar index, only meant to be
+ * read on the host that wrote it.
+ */
+
+#define LFC_SUFFIX ".lfc"
+#define LFC_DEFAULT_BLOCK_ROWS 65536
+
+typedef enum
+{
+    LFC_C_EPOCH,
+    LFC_C_ZONE,   // dictionary: "c +0000" (text rebuilt), "r" (verbatim, epoch ok), "x" (verbatim)
+    LFC_C_TSTEXT, // verbatim timestamps, empty for rebuilt ones
+    LFC_C_IP,
+    LFC_C_METHOD,
+    LFC_C_URL,
+    LFC_C_PROTOCOL,
+    LFC_C_STATUS,
+    LFC_C_BYTES,
+    LFC_C_REFERRER,
+    LFC_C_USERAGENT,
+    LFC_C_REQUEST_TIME,
+    LFC_NCOLS
+} LfcColumn;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t size;     // stored bytes
+    uint32_t raw_size; // decoded bytes; equal to size when stored uncompressed
+} LfcChunk;
+
+typedef struct
+{
+    IndexBlock zone; // offset/end: source byte range of the block's lines
+    uint32_t rows;
+    uint32_t reserved;
+    LfcChunk col[LFC_NCOLS];
+} LfcBlock;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ncols;
+    uint32_t block_rows;
+    uint32_t reserved;
+    uint64_t rows;   // stored entries
+    uint64_t failed; // source lines that did not parse
+    uint64_t nblocks;
+    uint64_t dir_offset; // nblocks LfcBlock records
+} LfcHeader;
+
+typedef struct LfcReader LfcReader;
+
+int lfc_detect(FILE *in);
+LfcReader *lfc_open(const ScanPlan *plan, FILE *in, const char *label, ScanStats *st);
+int lfc_next(LfcReader *r, OutBuf *out, int *first_json, ScanStats *st);
+void lfc_close(LfcReader *r);
+int lfc_scan(const ScanPlan *plan, FILE *in, const char *label, OutBuf *out,
+             int *first_json, ScanStats *st);
+int lfc_convert(const char *path, const char *dest, unsigned block_rows);
+int lfc_main(int argc, char *argv[]);
+
+#endif // LFC_H
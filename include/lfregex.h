@@ -0,0 +1,32 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef LFREGEX_H
+#define LFREGEX_H
+#include <stddef.h>
+
+/*
+ * Linear-time regular expressions for the query '~' operator.
+ *
+ * Patterns are compiled to a Thompson NFA, which is run as a DFA whose
+ * states are built lazily, one transition at a time, and cached per thread.
+ * Each cache is limited in size. When it is full it is flushed and rebuilt,
+ * so memory is bounded and every input byte costs at most one NFA step.
+ * There is no backtracking, so no pattern can take exponential time.
+ *
+ * Supported: literals, '.', [classes] with ranges and negation, \d \w \s
+ * (and \D \W \S), escapes, ^ and $, groups (including (?:...)), '|', and
+ * the quantifiers * + ? {m} {m,} {m,n}. Lazy quantifiers are accepted and
+ * match the same lines. Backreferences and \b are not supported.
+ * Matching is a search: the pattern may match anywhere in the subject
+ * unless it is anchored.
+ */
+typedef struct LfRegex LfRegex;
+
+LfRegex *lfre_compile(const char *pattern, int ci, char *err, size_t errsz);
+int lfre_match(const LfRegex *re, const char *s, size_t n);
+size_t lfre_required_literal(const LfRegex *re, char *buf, size_t bufsz, int *ci);
+void lfre_free(LfRegex *re);
+
+#endif // LFREGEX_H
@@ -0,0 +1,55 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef LINESRC_H
+#define LINESRC_H
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Zero-copy line source.
+ *
+ * Regular files are mmap'd and lines are handed out as pointer+length spans
+ * straight into the mapping. Anything that cannot be mapped (stdin, pipes,
+ * sockets) is read in large blocks into one reusable buffer and spans point
+ * into that buffer instead. Either way there is no per-line allocation; a
+ * span stays valid until the next call to linesrc_next().
+ *
+ * gzip and zstd input (recognised by its magic number, mapped or not) is
+ * decompressed on worker threads and read in buffered mode; see decomp.h.
+ *
+ * Spans never include the trailing '\n' and are NOT NUL-terminated.
+ */
+typedef struct
+{
+    FILE *fp;
+
+    const char *map; // mmap'd file contents, or NULL in buffered mode
+    size_t map_len;
+    size_t pos;   // read offset inside map
+    size_t limit; // end of the range being read (map_len unless restricted)
+    size_t *ranges; // further [start, end) pairs to visit after this one
+    size_t nranges, next_range;
+
+    char *buf; // buffered mode: block buffer
+    size_t cap;
+    size_t start, end; // unconsumed bytes are buf[start..end)
+    int eof;
+    int probed;       // first block checked for compression
+    struct Decomp *z; // compressed input: buffered mode reads decoded data from here
+    int threads;      // decoder threads for compressed input
+
+
+    unsigned long long bytes; // bytes consumed so far (including newlines)
+} LineSource;
+
+int linesrc_open(LineSource *ls, FILE *fp);
+int linesrc_next(LineSource *ls, const char **line, size_t *len);
+int linesrc_next_block(LineSource *ls, const char **blk, size_t *len);
+void linesrc_range(LineSource *ls, size_t start, size_t end);
+int linesrc_ranges(LineSource *ls, const size_t *ranges, size_t n);
+void linesrc_set_threads(LineSource *ls, int threads);
+void linesrc_close(LineSource *ls);
+
+#endif // LINESRC_H
@@ -8,8 +8,58 @@
 #include "formatter.h"
 #include "logstore.h"
 #include "cli.h"
+#include "query.h"
+#include "linesrc.h"
+#include "agg.h"
+#include "outbuf.h"
 
 extern enum OutputFormat currentFormat;
+
+// Filter and output settings derived once from CLIOptions
+typedef struct
+{
+    const CLIOptions *opt;
+    Query q;
+    int use_q;
+    const char *keyword;    // keyword filter for matches(), or NULL
+    const FieldSet *fields; // output projection, NULL = default columns
+    int has_window;         // query bounds the timestamp: seek on ordered files
+    time_t t_lo, t_hi;
+    QueryLiteral lits[QUERY_MAX_LITERALS]; // prefilter: every match contains one of these
+    int nlits;                             // 0 = no prefilter
+    const AggSpec *agg;     // --group-by/--agg: aggregate instead of printing, or NULL
+} ScanPlan;
+
+// Per-stream line counters; exact when summed across chunks/workers
+typedef struct
+{
+    long long total;
+    long long parsed;
+    long long failed;
+    long long skipped;        // never parsed: the prefilter literal is not in the line
+    unsigned long long bytes; // input bytes consumed
+    Agg *agg;                 // with ScanPlan.agg: matches are added here instead of printed
+} ScanStats;
+
+void scan_plan_init(ScanPlan *plan, const CLIOptions *opt);
+void scan_plan_free(ScanPlan *plan);
+int scan_filter(const ScanPlan *plan, LogEntry *e);
+
+void scan_emit(const ScanPlan *plan, LogEntry *e, OutBuf *out, int *first_json);
+
+void scan_line(const ScanPlan *plan, const char *line, size_t len, const char *label,
+               OutBuf *out, FILE *err, int *first_json, ScanStats *st);
+void scan_block(const ScanPlan *plan, const char *p, size_t n, const char *label,
+                OutBuf *out, FILE *err, int *first_json, ScanStats *st);
+void scan_parallel(const ScanPlan *plan, const LineSource *src, const char *label,
+                   OutBuf *out, int *first_json, ScanStats *st);
+void scan_prune(const ScanPlan *plan, LineSource *src, const char *label, ScanStats *st);
+int scan_stream(const ScanPlan *plan, FILE *in, const char *label, OutBuf *out,
+                int *first_json, ScanStats *st);
+void scan_summary(const char *label, const ScanStats *st, double secs);
+double now_sec(void);
+
 void process_stream(FILE *in, const char *label, const CLIOptions *opt, FILE *out);
+void process_inputs(const CLIOptions *opt, FILE *out);
 
 #endif // LOGFIRE_H
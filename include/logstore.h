@@ -4,17 +4,113 @@
  */
 #ifndef LOGSTORE_H
 #define LOGSTORE_H
+#include <stddef.h>
 #include <time.h>
 
+// A field value: pointer+length into the source line (not NUL-terminated)
 typedef struct
 {
-    char timestamp[64];
-    char ip[64];
-    char method[16];
-    char url[1024];
+    const char *p;
+    size_t len;
+} LogSlice;
+
+typedef enum
+{
+    LF_TIMESTAMP,
+    LF_IP,
+    LF_METHOD,
+    LF_URL,
+    LF_PROTOCOL,
+    LF_STATUS,
+    LF_BYTES,
+    LF_REFERRER,
+    LF_USERAGENT,
+    LF_REQUEST_TIME, // nginx $request_time, when logged after the User-Agent
+    LF_COUNT
+} LogField;
+
+#define LF_BIT(f) (1u << (f))
+#define LF_ALL (LF_BIT(LF_COUNT) - 1u)
+// Fields that live after the status code and are only located on demand
+#define LF_LAZY (LF_BIT(LF_BYTES) | LF_BIT(LF_REFERRER) | LF_BIT(LF_USERAGENT) | LF_BIT(LF_REQUEST_TIME))
+// What the formatters print when no --fields projection is given
+#define LF_DEFAULT_OUTPUT (LF_BIT(LF_TIMESTAMP) | LF_BIT(LF_IP) | LF_BIT(LF_METHOD) | \
+                           LF_BIT(LF_URL) | LF_BIT(LF_STATUS) | LF_BIT(LF_USERAGENT))
+
+// Decode state kept in LogEntry.loaded next to the LF_BIT() field bits
+#define LE_EPOCH LF_BIT(LF_COUNT)        // epoch decode attempted
+#define LE_EPOCH_OK LF_BIT(LF_COUNT + 1) // ... and succeeded
+#define LE_ADDR LF_BIT(LF_COUNT + 2)     // binary client address parse attempted
+#define LE_ADDR_OK LF_BIT(LF_COUNT + 3)  // ... and succeeded
+
+// Ordered output projection (--fields ip,status,url)
+typedef struct
+{
+    LogField list[LF_COUNT];
+    int count;
+    unsigned mask;
+} FieldSet;
+
+// Aggregate functions for --agg
+typedef enum
+{
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG,
+    AGG_QUANTILE, // p50(bytes), --quantiles bytes:0.5
+    AGG_DISTINCT  // distinct(ip), --distinct ip: approximate
+} AggFn;
+
+#define AGG_MAX_COLUMNS 16
+
+// Grouped aggregation (--group-by status,method --agg count,sum(bytes))
+typedef struct
+{
+    LogField keys[LF_COUNT]; // group-by fields, in order; none = one row
+    int nkeys;
+    struct
+    {
+        AggFn fn;
+        LogField field; // numeric input (status, bytes, requestTime), any field for distinct; unused for count
+        double q;       // AGG_QUANTILE: 0..1
+    } cols[AGG_MAX_COLUMNS];
+    int ncols;
+    long bucket;       // --bucket: seconds; keys[0] is then LF_TIMESTAMP, grouped by time bucket
+    int top;           // --top K: the K most frequent values of top_by instead of groups
+    LogField top_by;
+    long top_counters; // Space-Saving counters; counts overstate by at most matches/top_counters
+} AggSpec;
+
+/*
+ * View over one parsed line. String fields are slices into `line`, so the
+ * line must outlive the entry. The parser always locates the fields up to
+ * and including the status code (they decide whether a line is valid);
+ * bytes, referrer, User-Agent and request time are located lazily by
+ * logentry_load().
+ */
+typedef struct
+{
+    const char *line;
+    size_t len;
+    const char *rest; // first byte after the status code
+
+    LogSlice timestamp;
+    LogSlice ip;
+    LogSlice method;
+    LogSlice url;
+    LogSlice protocol;
+    LogSlice referrer;
+    LogSlice userAgent;
     int status;
-    char userAgent[1024];
-    time_t epoch;
+    long long bytes; // response size; 0 when logged as "-"
+    double request_time; // seconds; < 0 when not logged
+    time_t epoch; // decoded on demand, see logentry_epoch()
+    unsigned char addr[16]; // client address, see logentry_addr()
+    int addr_v6;
+
+    unsigned loaded; // LF_BIT() of fields that have been located/decoded
 } LogEntry;
 
 #endif // LOGSTORE_H
@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef OUTBUF_H
+#define OUTBUF_H
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "logstore.h"
+
+/*
+ * Buffered output writer for matching entries.
+ *
+ * Entries are formatted straight into one large reusable buffer: integers
+ * are converted by hand and JSON/CSV escaping copies clean runs in bulk,
+ * found 16 bytes at a time. A full buffer goes out with one write(2);
+ * writes larger than half the buffer (a worker's finished chunk) go out
+ * together with what is buffered through writev(2), without a copy.
+ *
+ * A writer on a FILE flushes that stream first, so it can be mixed with
+ * stdio output to the same stream as long as it is flushed before stdio
+ * is used again. A writer without a FILE just grows in memory; workers use
+ * those and hand the bytes (buf, len) to the real writer.
+ */
+typedef struct
+{
+    char *buf;
+    size_t len, cap;
+    FILE *fp; // destination, or NULL for a memory buffer
+    int fd;   // fileno(fp), or -1 when it has none (then fwrite is used)
+} OutBuf;
+
+void outbuf_init(OutBuf *b, FILE *fp);
+void outbuf_flush(OutBuf *b);
+void outbuf_free(OutBuf *b);
+void outbuf_grow(OutBuf *b, size_t need);
+void outbuf_write(OutBuf *b, const void *p, size_t n);
+
+void outbuf_i64(OutBuf *b, long long v);
+void outbuf_fixed3(OutBuf *b, double v);
+void outbuf_json(OutBuf *b, LogSlice s);
+void outbuf_csv(OutBuf *b, LogSlice s);
+
+size_t json_clean_prefix(const char *p, size_t n);
+size_t json_escape_char(unsigned char c, char *esc);
+
+static inline void outbuf_putc(OutBuf *b, char c)
+{
+    if (b->len == b->cap)
+        outbuf_grow(b, 1);
+    b->buf[b->len++] = c;
+}
+
+static inline void outbuf_puts(OutBuf *b, const char *s)
+{
+    outbuf_write(b, s, strlen(s));
+}
+
+#endif // OUTBUF_H
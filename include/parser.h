@@ -5,9 +5,21 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
 #include "logstore.h"
 
+// Length limits inherited from the original sscanf format; longer rejects the line
+#define PARSE_MAX_IP 64
+#define PARSE_MAX_TIMESTAMP 64
+#define PARSE_MAX_METHOD 16
+#define PARSE_MAX_PROTOCOL 32
+
 char *read_line_dyn(FILE *fp);
-int parse_apache_or_nginx(const char *line, LogEntry *out, char *errmsg, size_t errmsg_sz);
+int parse_apache_or_nginx(const char *line, size_t len, LogEntry *out, char *errmsg, size_t errmsg_sz);
+void logentry_load(LogEntry *e, unsigned fields);
+LogSlice logentry_field(LogEntry *e, LogField f);
+int logentry_epoch(LogEntry *e, time_t *out);
+int logentry_addr(LogEntry *e);
+int parse_apache_time(const char *s, size_t n, time_t *out);
 
 #endif // PARSER_H
@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "logfire.h"
+
+/*
+ * Threaded scan of input that cannot be split up front (--threads N on
+ * stdin, pipes and --tail).
+ *
+ * The calling thread is the reader: it hands in runs of whole lines with
+ * pipeline_submit(), which copies them into a batch in a bounded ring and
+ * blocks while the ring is full. N worker threads claim batches in
+ * sequence order and run the normal per-line pipeline over them into
+ * per-batch buffers. One writer thread writes finished batches in
+ * sequence order (or as they finish, with --unordered), adds up their
+ * counters, and flushes the output whenever it has caught up.
+ *
+ * When aggregating, each worker folds its batches into a private table;
+ * pipeline_sync() and pipeline_close() merge those into the caller's.
+ * Until then the caller must not touch the output, the counters or the
+ * aggregate it passed in.
+ */
+
+typedef struct Pipeline Pipeline;
+
+Pipeline *pipeline_open(const ScanPlan *plan, int workers, OutBuf *out, int *first_json, ScanStats *st);
+void pipeline_submit(Pipeline *p, const char *data, size_t n, const char *label);
+void pipeline_sync(Pipeline *p);
+void pipeline_close(Pipeline *p);
+
+int scan_pipeline(const ScanPlan *plan, LineSource *src, const char *label, OutBuf *out,
+                  int *first_json, ScanStats *st);
+
+#endif // PIPELINE_H
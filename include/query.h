@@ -13,7 +13,9 @@ typedef enum
     QF_METHOD,
     QF_URL,
     QF_TIMESTAMP,
-    QF_USERAGENT
+    QF_USERAGENT,
+    QF_BYTES,       // numeric comparisons only
+    QF_REQUEST_TIME // seconds; numeric comparisons only, false when not logged
 } QueryField;
 
 typedef enum
@@ -24,9 +26,49 @@ typedef enum
     QOP_LT,
     QOP_GTE,
     QOP_LTE,
-    QOP_CONTAINS // ':' maps to EQ for numeric, CONTAINS/wildcard for strings
+    QOP_CONTAINS, // ':' maps to EQ for numeric, CONTAINS/wildcard for strings
+    QOP_REGEX,    // '~': regular expression search
+    QOP_IN        // "field IN (a,b,...)": exact match against a set
 } QueryOp;
 
+typedef enum
+{
+    QM_ANY,      // "*"
+    QM_EXACT,    // no wildcards
+    QM_PREFIX,   // "abc*"
+    QM_SUFFIX,   // "*abc"
+    QM_CONTAINS, // "*abc*"
+    QM_GLOB,     // anything else with * or ?
+    QM_RANGES,   // numeric glob on status, as integer ranges
+    QM_CMP,      // numeric/time comparison (status, bytes, request_time, timestamp)
+    QM_REGEX,    // '~' pattern (status: matched against its decimal text)
+    QM_SET,      // IN list, hashed (status: decimal text)
+    QM_CIDR      // ip IN addresses/CIDRs, as a radix trie
+} QueryMatchKind;
+
+typedef struct QueryGlob QueryGlob;
+typedef struct QuerySet QuerySet;
+
+typedef struct
+{
+    long long lo, hi;
+} QueryRange;
+
+// Matcher compiled from a term's value by query_parse()
+typedef struct
+{
+    QueryMatchKind kind;
+    int ci;           // lit and glob are already lowercased
+    char *lit;        // literal part of EXACT/PREFIX/SUFFIX/CONTAINS
+    size_t lit_len;
+    QueryGlob *glob;  // QM_GLOB, or numeric globs that have no range form
+    QueryRange *ranges;
+    int nranges;
+    struct LfRegex *re; // QM_REGEX
+    QuerySet *set;      // QM_SET
+    struct IpTrie *trie; // QM_CIDR
+} QueryMatch;
+
 typedef struct
 {
     QueryField field;
@@ -34,19 +76,72 @@ typedef struct
     char value[1024]; // raw value (string); for status/timestamp we also pre-parse
     int value_i;      // numeric (status) if applicable
     time_t value_t;   // timestamp if applicable
+    double value_d;   // bytes / request_time
     int has_i;
     int has_t;
+    QueryMatch m;
+    int cost; // estimated evaluation cost; terms are sorted cheapest first
 } QueryTerm;
 
+// Instructions of the compiled boolean expression
+typedef enum
+{
+    QI_TERM, // acc = terms[arg] matches
+    QI_NOT,  // acc = !acc
+    QI_JF,   // if (!acc) goto arg
+    QI_JT    // if (acc) goto arg
+} QueryInsnOp;
+
 typedef struct
 {
-    QueryTerm terms[16]; // up to 16 AND terms v1
+    QueryInsnOp op;
+    int arg;
+} QueryInsn;
+
+#define QUERY_MAX_LITERALS 8 // alternatives the prefilter searches for at once
+
+/*
+ * A parsed expression: AND, OR, NOT, parentheses and IN over field terms.
+ * The expression tree is compiled to a short jump program whose result is
+ * the accumulator; sibling operands of AND/OR run cheapest first and stop
+ * as soon as the outcome is known. Terms that every match must satisfy
+ * (direct operands of the top-level AND) come first in terms[], so time
+ * windows and index pruning only look at those. The literal prefilter
+ * also follows OR branches (see lits).
+ */
+typedef struct
+{
+    QueryTerm *terms; // terms[0..nand) are top-level AND terms, cheapest first
     int count;
+    int cap;
+    int nand;
+    QueryInsn *code; // empty: matches every entry
+    int ncode;
     int case_insensitive;
+    int lits[QUERY_MAX_LITERALS]; // terms whose literals every match contains one of
+    int nlits;
 } Query;
 
+// A literal for the raw-line prefilter (see query_required_literals())
+typedef struct
+{
+    char s[256];
+    size_t len;
+    int ci; // match case-insensitively; s is lowercased
+} QueryLiteral;
+
 int query_parse(const char *expr, int case_insensitive, Query *out, char *errmsg, size_t errmsg_sz);
-int query_match(const LogEntry *e, const Query *q);
-int matches(const LogEntry *e, const char *needle, int case_insensitive);
+int query_match(LogEntry *e, const Query *q);
+void query_free(Query *q);
+int query_status_match(const QueryTerm *t, int status);
+int query_text_match(const QueryTerm *t, const char *s, size_t n);
+unsigned query_fields(const Query *q);
+int query_required_literals(const Query *q, QueryLiteral *out);
+int query_time_bounds(const Query *q, time_t *lo, time_t *hi);
+int matches(LogEntry *e, const char *needle, int case_insensitive);
+
+// Fields read by matches() (the --search keyword filter)
+#define SEARCH_FIELDS (LF_BIT(LF_METHOD) | LF_BIT(LF_URL) | LF_BIT(LF_TIMESTAMP) | \
+                       LF_BIT(LF_IP) | LF_BIT(LF_USERAGENT))
 
 #endif
@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef STRSEARCH_H
+#define STRSEARCH_H
+#include <stddef.h>
+
+/*
+ * Substring search over length-delimited text.
+ *
+ * The kernels compare the needle's first and last byte against 16 (SSE2) or
+ * 32 (AVX2) haystack positions at once and verify only the candidates where
+ * both agree. The case-insensitive variant folds ASCII letters only, by
+ * OR-ing 0x20 into the haystack bytes compared against a letter. The best
+ * kernel the CPU supports is picked at runtime; other architectures get
+ * the scalar version.
+ */
+typedef enum
+{
+    LF_SIMD_SCALAR,
+    LF_SIMD_SSE2,
+    LF_SIMD_AVX2
+} LfSimdLevel;
+
+LfSimdLevel lf_simd_level(void);
+const char *lf_simd_name(LfSimdLevel level);
+
+const char *lf_memmem(const char *hay, size_t n, const char *needle, size_t m);
+const char *lf_memmem_ci(const char *hay, size_t n, const char *needle, size_t m);
+const char *lf_memmem_at(LfSimdLevel level, int ci, const char *hay, size_t n,
+                         const char *needle, size_t m);
+
+#endif // STRSEARCH_H
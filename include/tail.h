@@ -0,0 +1,12 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef TAIL_H
+#define TAIL_H
+#include <stdio.h>
+#include "cli.h"
+
+void tail_files(const char *const *paths, int npaths, int from_start, const CLIOptions *opt, FILE *out);
+
+#endif // TAIL_H
@@ -0,0 +1,15 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef TIMESEEK_H
+#define TIMESEEK_H
+#include <stddef.h>
+#include <time.h>
+
+#define TIMESEEK_DEFAULT_SLACK 60 // seconds of out-of-order tolerance
+
+int time_seek_range(const char *data, size_t len, time_t lo, time_t hi, long slack,
+                    size_t *start, size_t *end);
+
+#endif // TIMESEEK_H
@@ -0,0 +1,47 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef TOPK_H
+#define TOPK_H
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Heavy hitters in bounded memory (--top K --by FIELD), using the
+ * Space-Saving algorithm (Metwally et al., 2005).
+ *
+ * A fixed number of counters m is kept. A key that already has a counter
+ * increments it; a new key takes over the counter with the smallest count c
+ * and starts at c + 1, remembering c as its possible overestimate. Counts
+ * therefore never undercount, each overstates its key's true count by at
+ * most its recorded error, and every error is at most N/m after N
+ * additions. Any key that occurs more than N/m times is guaranteed to hold
+ * a counter. Counters are found through an open-addressed hash table and
+ * the minimum through a binary heap, so an addition is O(log m).
+ *
+ * Two summaries can be merged (for threads and multiple inputs); the
+ * result keeps the same N/m bound for the combined stream.
+ */
+typedef struct TopK TopK;
+
+typedef struct
+{
+    const char *key; // valid until the summary is next modified
+    size_t len;
+    long long count; // upper bound of the true count
+    long long err;   // count - err is a lower bound
+} TopKItem;
+
+TopK *topk_new(size_t counters);
+void topk_add(TopK *t, const char *key, size_t len);
+void topk_merge(TopK *dst, const TopK *src);
+size_t topk_list(const TopK *t, TopKItem *items, size_t k);
+long long topk_total(const TopK *t);
+size_t topk_capacity(const TopK *t);
+int topk_save(const TopK *t, FILE *fp);
+int topk_load(TopK *t, FILE *fp);
+void topk_free(TopK *t);
+
+#endif // TOPK_H
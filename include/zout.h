@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#ifndef ZOUT_H
+#define ZOUT_H
+#include <stdio.h>
+
+/*
+ * Compressed output (--output FILE.gz / FILE.zst).
+ *
+ * zout_open() wraps the destination in a FILE that every output path
+ * (the buffered writer, stdio, aggregation tables) can write to. Bytes
+ * are cut into independent blocks that worker threads compress; finished
+ * blocks are written in order by whichever thread hands in the next one,
+ * and a fixed number of blocks in flight keeps memory bounded. Each block
+ * becomes its own gzip member or zstd frame, so the result is a normal
+ * multi-member file that gunzip/zstd -d (and logfire --threads) read.
+ *
+ * zstd needs a build with libzstd (HAVE_ZSTD).
+ */
+
+typedef enum
+{
+    ZOUT_NONE,
+    ZOUT_GZIP,
+    ZOUT_ZSTD
+} ZoutKind;
+
+ZoutKind zout_kind(const char *path);
+int zout_supported(ZoutKind kind);
+FILE *zout_open(FILE *dest, ZoutKind kind, int threads);
+
+#endif // ZOUT_H
@@ -0,0 +1,1345 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "agg.h"
+#include "formatter.h"
+#include "parser.h"
+#include "hash.h"
+#include "topk.h"
+#include "hdr.h"
+#include "hll.h"
+
+#define AGG_MIN_SLOTS 1024
+#define AGG_NUM_LEN 8 // numeric key values: 8 bytes, big-endian
+
+/*
+ * Group keys are the group-by values back to back, each as a 4-byte length
+ * followed by the bytes. status and bytes are stored as big-endian 64-bit
+ * integers, so comparing keys bytewise sorts them numerically. With
+ * --bucket, the timestamp is stored as the bucket's start time, likewise
+ * 8 bytes (sign bit flipped), or as an empty value if it does not decode.
+ */
+typedef struct
+{
+    uint64_t hash;
+    size_t koff; // key bytes in Agg.keys
+    size_t klen;
+    long long n; // entries in the group
+} AggRow;
+
+// One aggregate of one group
+typedef struct
+{
+    double v;    // sum (sum, avg), min or max
+    long long n; // values seen; request times that were not logged are skipped
+    Hdr *h;      // quantiles: histogram, held by the first column on that field
+    Hll *d;      // distinct: HyperLogLog counter
+} AggCell;
+
+struct Agg
+{
+    const AggSpec *spec;
+    AggRow *rows;
+    AggCell *cells; // spec->ncols per row
+    size_t nrows, rowcap;
+    uint32_t *slots; // row index + 1; 0 = empty
+    size_t nslots;   // power of two
+    char *keys;      // interned group keys
+    size_t keys_len, keys_cap;
+    char *kbuf; // key of the entry being added
+    size_t kbuf_cap;
+    TopK *top; // --top: a heavy-hitter summary replaces the table
+    int hist[AGG_MAX_COLUMNS]; // column whose histogram a quantile column reads
+    long long added;           // entries added, including merged ones
+};
+
+static const char *fn_names[] = {"count", "sum", "min", "max", "avg", "p", "distinct"};
+
+static void *xrealloc(void *p, size_t n)
+{
+    void *q = realloc(p, n ? n : 1);
+    if (!q)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return q;
+}
+
+/**
+ * @brief Parses a --group-by field list ("status,method").
+ *
+ * Takes the same names as --fields.
+ *
+ * @return 1 on success, 0 on an unknown or empty field list.
+ */
+int aggspec_parse_keys(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz)
+{
+    FieldSet fs;
+    if (!fieldset_parse(spec, &fs, errmsg, errmsg_sz))
+        return 0;
+    for (int i = 0; i < fs.count; i++)
+    {
+        if (fs.list[i] == LF_REQUEST_TIME)
+        {
+            snprintf(errmsg, errmsg_sz, "cannot group by request_time; use --quantiles request_time:0.5,0.99");
+            return 0;
+        }
+        out->keys[i] = fs.list[i];
+    }
+    out->nkeys = fs.count;
+    return 1;
+}
+
+// Numeric field name for an aggregate; LF_COUNT if it is not one
+static LogField numeric_field(const char *s, size_t n)
+{
+    if (n == 5 && strncasecmp(s, "bytes", 5) == 0)
+        return LF_BYTES;
+    if (n == 6 && strncasecmp(s, "status", 6) == 0)
+        return LF_STATUS;
+    if ((n == 12 && strncasecmp(s, "request_time", 12) == 0) ||
+        (n == 11 && strncasecmp(s, "requesttime", 11) == 0))
+        return LF_REQUEST_TIME;
+    return LF_COUNT;
+}
+
+static int add_column(AggSpec *out, AggFn fn, LogField field, double q, char *errmsg, size_t errmsg_sz)
+{
+    if (out->ncols == AGG_MAX_COLUMNS)
+    {
+        snprintf(errmsg, errmsg_sz, "too many aggregates (max %d)", AGG_MAX_COLUMNS);
+        return 0;
+    }
+    out->cols[out->ncols].fn = fn;
+    out->cols[out->ncols].field = field;
+    out->cols[out->ncols].q = q;
+    out->ncols++;
+    return 1;
+}
+
+// Quantile as a fraction: "0.99" from --quantiles, or the "99" of p99 as a percentage
+static int parse_quantile(const char *s, size_t n, double scale, double *q)
+{
+    char buf[32], *endp;
+    if (n == 0 || n >= sizeof(buf))
+        return 0;
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+    *q = strtod(buf, &endp) / scale;
+    return endp == buf + n && *q >= 0 && *q <= 1;
+}
+
+/**
+ * @brief Parses an --agg column list ("count,sum(bytes),p99(request_time)").
+ *
+ * count takes no argument (an empty "count()" is accepted); sum, min, max,
+ * avg and the percentiles pNN (p50, p99.9, ...) take a numeric field:
+ * bytes, status or request_time; distinct takes any other field. Columns are
+ * appended to any already given.
+ *
+ * @return 1 on success, 0 on a malformed list.
+ */
+int aggspec_parse_columns(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz)
+{
+    int given = 0;
+    const char *p = spec;
+    while (*p)
+    {
+        const char *comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        while (n && *p == ' ')
+            p++, n--;
+        while (n && p[n - 1] == ' ')
+            n--;
+        if (n)
+        {
+            const char *lp = memchr(p, '(', n);
+            size_t name_len = lp ? (size_t)(lp - p) : n;
+            const char *arg = NULL;
+            size_t arg_len = 0;
+            if (lp)
+            {
+                if (p[n - 1] != ')')
+                {
+                    snprintf(errmsg, errmsg_sz, "missing ')' in %.*s", (int)n, p);
+                    return 0;
+                }
+                arg = lp + 1;
+                arg_len = (size_t)(p + n - 1 - arg);
+            }
+
+            int fn;
+            double q = 0;
+            for (fn = AGG_COUNT; fn <= AGG_DISTINCT; fn++)
+                if (fn != AGG_QUANTILE && strlen(fn_names[fn]) == name_len &&
+                    strncasecmp(fn_names[fn], p, name_len) == 0)
+                    break;
+            if (fn > AGG_DISTINCT)
+                fn = (*p == 'p' || *p == 'P') && parse_quantile(p + 1, name_len - 1, 100, &q) ? AGG_QUANTILE : -1;
+            if (fn < 0)
+            {
+                snprintf(errmsg, errmsg_sz, "unknown aggregate: %.*s", (int)name_len, p);
+                return 0;
+            }
+
+            LogField field = LF_BYTES;
+            if (fn == AGG_COUNT)
+            {
+                if (arg_len)
+                {
+                    snprintf(errmsg, errmsg_sz, "count takes no field");
+                    return 0;
+                }
+            }
+            else if (fn == AGG_DISTINCT)
+            {
+                char name[32];
+                FieldSet fs;
+                snprintf(name, sizeof(name), "%.*s", (int)arg_len, arg);
+                if (arg_len >= sizeof(name) || !fieldset_parse(name, &fs, errmsg, errmsg_sz) ||
+                    fs.count != 1 || fs.list[0] == LF_REQUEST_TIME)
+                {
+                    snprintf(errmsg, errmsg_sz, "%.*s: needs one field (ip, url, userAgent, ...)", (int)n, p);
+                    return 0;
+                }
+                field = fs.list[0];
+            }
+            else if ((field = numeric_field(arg, arg_len)) == LF_COUNT)
+            {
+                snprintf(errmsg, errmsg_sz, "%.*s: needs a numeric field (bytes, status, request_time)",
+                         (int)n, p);
+                return 0;
+            }
+            if (!add_column(out, (AggFn)fn, field, q, errmsg, errmsg_sz))
+                return 0;
+            given++;
+        }
+        if (!comma)
+            break;
+        p = comma + 1;
+    }
+    if (given == 0)
+    {
+        snprintf(errmsg, errmsg_sz, "empty aggregate list");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Parses a --quantiles spec ("bytes:0.5,0.99") into pNN columns.
+ *
+ * Columns are appended to any already given.
+ *
+ * @return 1 on success, 0 on a malformed spec.
+ */
+int aggspec_parse_quantiles(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz)
+{
+    const char *colon = strchr(spec, ':');
+    LogField field = colon ? numeric_field(spec, (size_t)(colon - spec)) : LF_COUNT;
+    if (field == LF_COUNT)
+    {
+        snprintf(errmsg, errmsg_sz, "expected FIELD:Q1,Q2,... with a numeric field (bytes, status, request_time)");
+        return 0;
+    }
+    const char *p = colon + 1;
+    for (;;)
+    {
+        const char *comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        double q;
+        if (!parse_quantile(p, n, 1, &q))
+        {
+            snprintf(errmsg, errmsg_sz, "bad quantile '%.*s' (expected 0..1)", (int)n, p);
+            return 0;
+        }
+        if (!add_column(out, AGG_QUANTILE, field, q, errmsg, errmsg_sz))
+            return 0;
+        if (!comma)
+            return 1;
+        p = comma + 1;
+    }
+}
+
+/**
+ * @brief Parses a --bucket width: seconds, or a number with s, m, h or d.
+ *
+ * @return 1 on success, 0 on a malformed or non-positive width.
+ */
+int aggspec_parse_bucket(const char *spec, AggSpec *out, char *errmsg, size_t errmsg_sz)
+{
+    char *endp;
+    long n = strtol(spec, &endp, 10);
+    long unit = 0;
+    switch (*endp)
+    {
+    case '\0':
+    case 's':
+        unit = 1;
+        break;
+    case 'm':
+        unit = 60;
+        break;
+    case 'h':
+        unit = 3600;
+        break;
+    case 'd':
+        unit = 86400;
+        break;
+    }
+    if (endp == spec || n < 1 || !unit || (*endp && endp[1]) || n > 3650L * 86400 / unit)
+    {
+        snprintf(errmsg, errmsg_sz, "expected a duration such as 30s, 1m, 1h or 1d: %s", spec);
+        return 0;
+    }
+    out->bucket = n * unit;
+    return 1;
+}
+
+// Numeric value of an aggregated field; 0 when the entry has none (request time not logged)
+static int field_value(LogEntry *e, LogField f, double *v)
+{
+    if (f == LF_STATUS)
+    {
+        *v = (double)e->status;
+        return 1;
+    }
+    logentry_load(e, LF_BIT(f));
+    if (f == LF_REQUEST_TIME)
+    {
+        *v = e->request_time;
+        return e->request_time >= 0;
+    }
+    *v = (double)e->bytes;
+    return 1;
+}
+
+// Histograms count integers: request times go in as microseconds
+static uint64_t hist_value(LogField f, double v)
+{
+    if (v < 0)
+        return 0;
+    return f == LF_REQUEST_TIME ? (uint64_t)(v * 1e6 + 0.5) : (uint64_t)v;
+}
+
+static double hist_unit(LogField f)
+{
+    return f == LF_REQUEST_TIME ? 1e-6 : 1.0;
+}
+
+static void init_cells(const Agg *a, AggCell *c)
+{
+    const AggSpec *spec = a->spec;
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        c[j].v = spec->cols[j].fn == AGG_MIN ? INFINITY : spec->cols[j].fn == AGG_MAX ? -INFINITY : 0.0;
+        c[j].n = 0;
+        c[j].h = spec->cols[j].fn == AGG_QUANTILE && a->hist[j] == j ? hdr_new() : NULL;
+        c[j].d = spec->cols[j].fn == AGG_DISTINCT ? hll_new() : NULL;
+    }
+}
+
+// Rebuilds the slot array at twice the size
+static void grow_slots(Agg *a)
+{
+    size_t n = a->nslots * 2;
+    uint32_t *slots = (uint32_t *)calloc(n, sizeof(uint32_t));
+    if (!slots)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t r = 0; r < a->nrows; r++)
+    {
+        size_t i = (size_t)a->rows[r].hash & (n - 1);
+        while (slots[i])
+            i = (i + 1) & (n - 1);
+        slots[i] = (uint32_t)(r + 1);
+    }
+    free(a->slots);
+    a->slots = slots;
+    a->nslots = n;
+}
+
+// Returns the row for a key, creating (and interning) it on first sight
+static size_t find_or_add(Agg *a, const char *key, size_t klen, uint64_t hash)
+{
+    size_t mask = a->nslots - 1, i = (size_t)hash & mask;
+    while (a->slots[i])
+    {
+        const AggRow *row = &a->rows[a->slots[i] - 1];
+        if (row->hash == hash && row->klen == klen && memcmp(a->keys + row->koff, key, klen) == 0)
+            return a->slots[i] - 1;
+        i = (i + 1) & mask;
+    }
+
+    if (a->nrows == a->rowcap)
+    {
+        a->rowcap = a->rowcap ? a->rowcap * 2 : 64;
+        a->rows = (AggRow *)xrealloc(a->rows, a->rowcap * sizeof(AggRow));
+        a->cells = (AggCell *)xrealloc(a->cells, a->rowcap * (size_t)a->spec->ncols * sizeof(AggCell));
+    }
+    if (a->keys_len + klen > a->keys_cap)
+    {
+        while (a->keys_len + klen > a->keys_cap)
+            a->keys_cap = a->keys_cap ? a->keys_cap * 2 : 4096;
+        a->keys = (char *)xrealloc(a->keys, a->keys_cap);
+    }
+    memcpy(a->keys + a->keys_len, key, klen);
+
+    size_t r = a->nrows++;
+    a->rows[r].hash = hash;
+    a->rows[r].koff = a->keys_len;
+    a->rows[r].klen = klen;
+    a->rows[r].n = 0;
+    a->keys_len += klen;
+    init_cells(a, a->cells + r * (size_t)a->spec->ncols);
+
+    // keep the load factor at or below 3/4
+    if (a->nrows * 4 > a->nslots * 3)
+        grow_slots(a);
+    else
+        a->slots[i] = (uint32_t)(r + 1);
+    return r;
+}
+
+/**
+ * @brief Creates an empty aggregation table.
+ *
+ * @param spec  Grouping and columns; must outlive the table.
+ */
+Agg *agg_new(const AggSpec *spec)
+{
+    Agg *a = (Agg *)calloc(1, sizeof(Agg));
+    if (!a)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    a->spec = spec;
+    if (spec->top)
+    {
+        a->top = topk_new((size_t)spec->top_counters);
+        return a;
+    }
+    // quantile columns on the same field share one histogram
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        a->hist[j] = j;
+        for (int i = 0; i < j; i++)
+            if (spec->cols[i].fn == AGG_QUANTILE && spec->cols[j].fn == AGG_QUANTILE &&
+                spec->cols[i].field == spec->cols[j].field)
+            {
+                a->hist[j] = i;
+                break;
+            }
+    }
+    a->nslots = AGG_MIN_SLOTS;
+    a->slots = (uint32_t *)calloc(a->nslots, sizeof(uint32_t));
+    a->kbuf_cap = 1024;
+    a->kbuf = (char *)malloc(a->kbuf_cap);
+    a->keys_cap = 4096;
+    a->keys = (char *)malloc(a->keys_cap);
+    if (!a->slots || !a->kbuf || !a->keys)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    // without a grouping there is always exactly one row, even if nothing matched
+    if (spec->nkeys == 0)
+        find_or_add(a, "", 0, lf_hash64("", 0));
+    return a;
+}
+
+static void key_reserve(Agg *a, size_t need)
+{
+    if (need <= a->kbuf_cap)
+        return;
+    while (need > a->kbuf_cap)
+        a->kbuf_cap *= 2;
+    a->kbuf = (char *)xrealloc(a->kbuf, a->kbuf_cap);
+}
+
+// Start of the --bucket interval holding t
+static long long bucket_start(long long t, long bucket)
+{
+    long long r = t % bucket;
+    return t - (r < 0 ? r + bucket : r);
+}
+
+static long long decode_num(const char *p)
+{
+    uint64_t x = 0;
+    for (int b = 0; b < AGG_NUM_LEN; b++)
+        x = (x << 8) | (unsigned char)p[b];
+    return (long long)x;
+}
+
+// Bucket start stored first in a --bucket key; 0 if the timestamp did not decode
+static int key_bucket(const char *key, long long *start)
+{
+    uint32_t n;
+    memcpy(&n, key, 4);
+    if (n != AGG_NUM_LEN)
+        return 0;
+    *start = decode_num(key + 4) ^ (long long)((uint64_t)1 << 63);
+    return 1;
+}
+
+// Encodes an entry's group-by values into a->kbuf; returns the key length
+static size_t build_key(Agg *a, LogEntry *e)
+{
+    size_t len = 0;
+    for (int k = 0; k < a->spec->nkeys; k++)
+    {
+        LogField f = a->spec->keys[k];
+        time_t t;
+        if (f == LF_TIMESTAMP && a->spec->bucket && !logentry_epoch(e, &t))
+        {
+            uint32_t n = 0;
+            key_reserve(a, len + 4);
+            memcpy(a->kbuf + len, &n, 4);
+            len += 4;
+        }
+        else if (f == LF_STATUS || f == LF_BYTES || (f == LF_TIMESTAMP && a->spec->bucket))
+        {
+            double d;
+            uint64_t v;
+            if (f == LF_TIMESTAMP)
+                v = (uint64_t)bucket_start((long long)t, a->spec->bucket) ^ ((uint64_t)1 << 63);
+            else
+            {
+                field_value(e, f, &d);
+                v = (uint64_t)(long long)d;
+            }
+            uint32_t n = AGG_NUM_LEN;
+            key_reserve(a, len + 4 + AGG_NUM_LEN);
+            memcpy(a->kbuf + len, &n, 4);
+            for (int b = 0; b < AGG_NUM_LEN; b++)
+                a->kbuf[len + 4 + b] = (char)(v >> (56 - 8 * b));
+            len += 4 + AGG_NUM_LEN;
+        }
+        else
+        {
+            LogSlice s = logentry_field(e, f);
+            uint32_t n = (uint32_t)s.len;
+            key_reserve(a, len + 4 + s.len);
+            memcpy(a->kbuf + len, &n, 4);
+            memcpy(a->kbuf + len + 4, s.p, s.len);
+            len += 4 + s.len;
+        }
+    }
+    return len;
+}
+
+// Hash of a field's value for distinct(); numbers are hashed as their decimal text
+static uint64_t field_hash(LogEntry *e, LogField f)
+{
+    if (f == LF_STATUS || f == LF_BYTES)
+    {
+        char num[24];
+        double d;
+        field_value(e, f, &d);
+        int n = snprintf(num, sizeof(num), "%lld", (long long)d);
+        return lf_hash64(num, (size_t)n);
+    }
+    LogSlice s = logentry_field(e, f);
+    return lf_hash64(s.p, s.len);
+}
+
+/**
+ * @brief Folds one matching entry into its group.
+ *
+ * Only the group-by fields and the aggregated fields are loaded.
+ */
+void agg_add(Agg *a, LogEntry *e)
+{
+    const AggSpec *spec = a->spec;
+    size_t r;
+    a->added++;
+    if (a->top)
+    {
+        LogSlice s = logentry_field(e, spec->top_by);
+        topk_add(a->top, s.p, s.len);
+        return;
+    }
+    if (spec->nkeys == 0)
+        r = 0;
+    else
+    {
+        size_t klen = build_key(a, e);
+        r = find_or_add(a, a->kbuf, klen, lf_hash64(a->kbuf, klen));
+    }
+
+    a->rows[r].n++;
+    AggCell *c = a->cells + r * (size_t)spec->ncols;
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        double v;
+        if (spec->cols[j].fn == AGG_DISTINCT)
+        {
+            hll_add(c[j].d, field_hash(e, spec->cols[j].field));
+            c[j].n++;
+            continue;
+        }
+        if (spec->cols[j].fn == AGG_COUNT || !field_value(e, spec->cols[j].field, &v))
+            continue;
+        c[j].n++;
+        switch (spec->cols[j].fn)
+        {
+        case AGG_MIN:
+            if (v < c[j].v)
+                c[j].v = v;
+            break;
+        case AGG_MAX:
+            if (v > c[j].v)
+                c[j].v = v;
+            break;
+        case AGG_QUANTILE:
+            if (c[j].h)
+                hdr_add(c[j].h, hist_value(spec->cols[j].field, v));
+            break;
+        default:
+            c[j].v += v;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Number of entries added so far, including those merged in.
+ */
+long long agg_added(const Agg *a)
+{
+    return a->added;
+}
+
+/**
+ * @brief Adds every group of src into dst (same spec). src is unchanged.
+ */
+void agg_merge(Agg *dst, const Agg *src)
+{
+    const AggSpec *spec = dst->spec;
+    dst->added += src->added;
+    if (dst->top)
+    {
+        topk_merge(dst->top, src->top);
+        return;
+    }
+    for (size_t r = 0; r < src->nrows; r++)
+    {
+        const AggRow *sr = &src->rows[r];
+        size_t d = find_or_add(dst, src->keys + sr->koff, sr->klen, sr->hash);
+        const AggCell *sc = src->cells + r * (size_t)spec->ncols;
+        AggCell *dc = dst->cells + d * (size_t)spec->ncols;
+        dst->rows[d].n += sr->n;
+        for (int j = 0; j < spec->ncols; j++)
+        {
+            dc[j].n += sc[j].n;
+            switch (spec->cols[j].fn)
+            {
+            case AGG_MIN:
+                if (sc[j].v < dc[j].v)
+                    dc[j].v = sc[j].v;
+                break;
+            case AGG_MAX:
+                if (sc[j].v > dc[j].v)
+                    dc[j].v = sc[j].v;
+                break;
+            case AGG_QUANTILE:
+                if (dc[j].h)
+                    hdr_merge(dc[j].h, sc[j].h);
+                break;
+            case AGG_DISTINCT:
+                hll_merge(dc[j].d, sc[j].d);
+                break;
+            default:
+                dc[j].v += sc[j].v;
+                break;
+            }
+        }
+    }
+}
+
+// Moves row r of src into dst, handing over its histograms and counters
+static void move_row(Agg *dst, Agg *src, size_t r)
+{
+    int ncols = src->spec->ncols;
+    const AggRow *sr = &src->rows[r];
+    size_t d = find_or_add(dst, src->keys + sr->koff, sr->klen, sr->hash);
+    AggCell *sc = src->cells + r * (size_t)ncols;
+    AggCell *dc = dst->cells + d * (size_t)ncols;
+    for (int j = 0; j < ncols; j++)
+    {
+        hdr_free(dc[j].h);
+        hll_free(dc[j].d);
+        dc[j] = sc[j];
+        sc[j].h = NULL;
+        sc[j].d = NULL;
+    }
+    dst->rows[d].n = sr->n;
+}
+
+/**
+ * @brief With --bucket, moves the time buckets that have ended into a new table.
+ *
+ * A bucket has ended once its end is at or before `now`. The newest bucket
+ * stays while keep_newest is set, as lines for it may still be arriving.
+ * Rows for entries whose timestamp did not decode always move.
+ *
+ * @return The moved rows, or NULL if no bucket has ended.
+ */
+Agg *agg_take_closed(Agg *a, time_t now, int keep_newest)
+{
+    const AggSpec *spec = a->spec;
+    if (!spec->bucket || a->top)
+        return NULL;
+
+    // keys[0] holds the bucket start
+    long long newest = 0;
+    int seen = 0;
+    for (size_t r = 0; r < a->nrows; r++)
+    {
+        long long start;
+        if (key_bucket(a->keys + a->rows[r].koff, &start) && (!seen || start > newest))
+        {
+            newest = start;
+            seen = 1;
+        }
+    }
+    unsigned char *closed = (unsigned char *)malloc(a->nrows + 1);
+    size_t nclosed = 0;
+    if (!closed)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t r = 0; r < a->nrows; r++)
+    {
+        long long start;
+        closed[r] = !key_bucket(a->keys + a->rows[r].koff, &start) ||
+                    (start + spec->bucket <= (long long)now && !(keep_newest && start == newest));
+        nclosed += closed[r];
+    }
+    if (!nclosed)
+    {
+        free(closed);
+        return NULL;
+    }
+
+    Agg *done = agg_new(spec), *keep = agg_new(spec);
+    for (size_t r = 0; r < a->nrows; r++)
+        move_row(closed[r] ? done : keep, a, r);
+    free(closed);
+
+    // keep the open buckets in a
+    keep->added = a->added;
+    Agg old = *a;
+    *a = *keep;
+    *keep = old;
+    agg_free(keep);
+    return done;
+}
+
+// What a saved table was built from; loading it under another spec is refused
+typedef struct
+{
+    int32_t nkeys, ncols, top, top_by;
+    int64_t bucket, top_counters;
+    int32_t keys[LF_COUNT];
+    struct
+    {
+        int32_t fn, field;
+        double q;
+    } cols[AGG_MAX_COLUMNS];
+} AggSig;
+
+static void agg_sig(const AggSpec *spec, AggSig *s)
+{
+    memset(s, 0, sizeof(*s)); // padding too: signatures are compared bytewise
+    s->nkeys = spec->nkeys;
+    s->ncols = spec->ncols;
+    s->top = spec->top;
+    s->top_by = spec->top_by;
+    s->bucket = spec->bucket;
+    s->top_counters = spec->top_counters;
+    for (int k = 0; k < spec->nkeys; k++)
+        s->keys[k] = spec->keys[k];
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        s->cols[j].fn = spec->cols[j].fn;
+        s->cols[j].field = spec->cols[j].field;
+        s->cols[j].q = spec->cols[j].q;
+    }
+}
+
+/**
+ * @brief Writes the table for agg_load() (host byte order), e.g. to resume --tail.
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+int agg_save(const Agg *a, FILE *fp)
+{
+    const AggSpec *spec = a->spec;
+    AggSig sig;
+    agg_sig(spec, &sig);
+    int64_t head[2] = {a->added, a->top ? 0 : (int64_t)a->nrows};
+    int ok = fwrite(&sig, sizeof(sig), 1, fp) == 1 && fwrite(head, sizeof(head), 1, fp) == 1;
+    if (a->top)
+        return ok && topk_save(a->top, fp);
+    for (size_t r = 0; r < a->nrows && ok; r++)
+    {
+        const AggRow *row = &a->rows[r];
+        int64_t rh[2] = {(int64_t)row->klen, row->n};
+        ok = fwrite(rh, sizeof(rh), 1, fp) == 1 && fwrite(a->keys + row->koff, 1, row->klen, fp) == row->klen;
+        const AggCell *c = a->cells + r * (size_t)spec->ncols;
+        for (int j = 0; j < spec->ncols && ok; j++)
+        {
+            ok = fwrite(&c[j].v, sizeof(c[j].v), 1, fp) == 1 && fwrite(&c[j].n, sizeof(c[j].n), 1, fp) == 1;
+            if (ok && c[j].h)
+                ok = hdr_save(c[j].h, fp);
+            if (ok && c[j].d)
+                ok = hll_save(c[j].d, fp);
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Reads a table written by agg_save() under the same spec.
+ *
+ * @return The table, or NULL if it was saved for other groups/columns or is damaged.
+ */
+Agg *agg_load(const AggSpec *spec, FILE *fp)
+{
+    AggSig want, got;
+    int64_t head[2];
+    agg_sig(spec, &want);
+    if (fread(&got, sizeof(got), 1, fp) != 1 || memcmp(&want, &got, sizeof(want)) != 0 ||
+        fread(head, sizeof(head), 1, fp) != 1 || head[1] < 0)
+        return NULL;
+
+    Agg *a = agg_new(spec);
+    int ok = 1;
+    a->added = head[0];
+    if (a->top)
+        ok = topk_load(a->top, fp);
+    for (int64_t i = 0; i < head[1] && ok; i++)
+    {
+        int64_t rh[2];
+        ok = fread(rh, sizeof(rh), 1, fp) == 1 && rh[0] >= 0 && rh[0] <= (1 << 24);
+        if (!ok)
+            break;
+        size_t klen = (size_t)rh[0];
+        key_reserve(a, klen);
+        if (fread(a->kbuf, 1, klen, fp) != klen)
+        {
+            ok = 0;
+            break;
+        }
+        size_t r = find_or_add(a, a->kbuf, klen, lf_hash64(a->kbuf, klen));
+        a->rows[r].n = rh[1];
+        AggCell *c = a->cells + r * (size_t)spec->ncols;
+        for (int j = 0; j < spec->ncols && ok; j++)
+        {
+            ok = fread(&c[j].v, sizeof(c[j].v), 1, fp) == 1 && fread(&c[j].n, sizeof(c[j].n), 1, fp) == 1;
+            if (ok && c[j].h)
+                ok = hdr_load(c[j].h, fp);
+            if (ok && c[j].d)
+                ok = hll_load(c[j].d, fp);
+        }
+    }
+    if (!ok)
+    {
+        agg_free(a);
+        return NULL;
+    }
+    return a;
+}
+
+/**
+ * @brief Prints a one-line note on the table to stderr.
+ *
+ * For --top this states the error bound: no count is more than
+ * matches/counters above the true count.
+ */
+void agg_summary(const Agg *a, FILE *err)
+{
+    if (a->top)
+    {
+        long long n = topk_total(a->top);
+        size_t m = topk_capacity(a->top);
+        fprintf(err, "[top] %lld matches, %zu counters: counts are at most %lld too high (see error)\n",
+                n, m, n / (long long)m);
+    }
+    else if (a->spec->nkeys)
+        fprintf(err, "[agg] %zu groups\n", a->nrows);
+}
+
+void agg_free(Agg *a)
+{
+    if (!a)
+        return;
+    topk_free(a->top);
+    for (size_t i = 0; i < a->nrows * (size_t)a->spec->ncols; i++)
+    {
+        hdr_free(a->cells[i].h);
+        hll_free(a->cells[i].d);
+    }
+    free(a->rows);
+    free(a->cells);
+    free(a->slots);
+    free(a->keys);
+    free(a->kbuf);
+    free(a);
+}
+
+/* ---------- output ---------- */
+
+typedef struct
+{
+    const char *key;
+    size_t len;
+    size_t row;
+} SortRef;
+
+// Bytewise, one group-by value at a time (a shorter value sorts first)
+static int cmp_keys(const void *pa, const void *pb)
+{
+    const SortRef *a = (const SortRef *)pa, *b = (const SortRef *)pb;
+    size_t i = 0, j = 0;
+    while (i < a->len && j < b->len)
+    {
+        uint32_t na, nb;
+        memcpy(&na, a->key + i, 4);
+        memcpy(&nb, b->key + j, 4);
+        int c = memcmp(a->key + i + 4, b->key + j + 4, na < nb ? na : nb);
+        if (c)
+            return c;
+        if (na != nb)
+            return na < nb ? -1 : 1;
+        i += 4 + na;
+        j += 4 + nb;
+    }
+    return (i < a->len) - (j < b->len);
+}
+
+// One decoded group-by value: text, or a number for status/bytes
+typedef struct
+{
+    LogSlice s;
+    int numeric;
+    long long num;
+    char text[32]; // a --bucket start, as ISO 8601 UTC
+} KeyValue;
+
+static size_t next_value(const AggSpec *spec, int k, const char *key, size_t pos, KeyValue *v)
+{
+    uint32_t n;
+    memcpy(&n, key + pos, 4);
+    v->s.p = key + pos + 4;
+    v->s.len = n;
+    v->numeric = spec->keys[k] == LF_STATUS || spec->keys[k] == LF_BYTES;
+    v->num = v->numeric ? decode_num(v->s.p) : 0;
+    long long start;
+    if (spec->keys[k] == LF_TIMESTAMP && spec->bucket && key_bucket(key + pos, &start))
+    {
+        time_t t = (time_t)start;
+        struct tm tm;
+#ifdef _WIN32
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        v->s.p = v->text;
+        v->s.len = strftime(v->text, sizeof(v->text), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    }
+    return pos + 4 + n;
+}
+
+// Formats one aggregate; returns 0 when it has no value (min/max/avg of nothing)
+static int format_cell(const Agg *a, size_t r, int j, char *buf, size_t bufsz)
+{
+    const AggSpec *spec = a->spec;
+    const AggCell *c = a->cells + r * (size_t)spec->ncols;
+    double v;
+    switch (spec->cols[j].fn)
+    {
+    case AGG_COUNT:
+        snprintf(buf, bufsz, "%lld", a->rows[r].n);
+        return 1;
+    case AGG_AVG:
+        v = c[j].n ? c[j].v / (double)c[j].n : NAN;
+        break;
+    case AGG_DISTINCT:
+        snprintf(buf, bufsz, "%.0f", hll_estimate(c[j].d));
+        return 1;
+    case AGG_QUANTILE:
+    {
+        const Hdr *h = c[a->hist[j]].h;
+        LogField f = spec->cols[j].field;
+        v = hdr_count(h) ? (double)hdr_quantile(h, spec->cols[j].q) * hist_unit(f) : NAN;
+        break;
+    }
+    default:
+        v = c[j].n ? c[j].v : NAN;
+        break;
+    }
+    if (!isfinite(v))
+    {
+        buf[0] = '\0';
+        return 0;
+    }
+    if (v > -9e15 && v < 9e15 && v == (double)(long long)v)
+        snprintf(buf, bufsz, "%.0f", v);
+    else
+        snprintf(buf, bufsz, "%.3f", v);
+    return 1;
+}
+
+static void column_name(const AggSpec *spec, int j, char *buf, size_t bufsz)
+{
+    if (spec->cols[j].fn == AGG_COUNT)
+        snprintf(buf, bufsz, "count");
+    else if (spec->cols[j].fn == AGG_QUANTILE)
+        snprintf(buf, bufsz, "p%g(%s)", spec->cols[j].q * 100, logfield_name(spec->cols[j].field));
+    else
+        snprintf(buf, bufsz, "%s(%s)", fn_names[spec->cols[j].fn], logfield_name(spec->cols[j].field));
+}
+
+static void pad(OutBuf *out, size_t n)
+{
+    while (n--)
+        outbuf_putc(out, ' ');
+}
+
+static void write_text(const Agg *a, const SortRef *order, OutBuf *out)
+{
+    const AggSpec *spec = a->spec;
+    int ncol = spec->nkeys + spec->ncols;
+    size_t *width = (size_t *)calloc((size_t)ncol, sizeof(size_t));
+    char buf[64];
+    KeyValue v;
+    if (!width)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (int k = 0; k < spec->nkeys; k++)
+        width[k] = strlen(logfield_name(spec->keys[k]));
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        column_name(spec, j, buf, sizeof(buf));
+        width[spec->nkeys + j] = strlen(buf);
+    }
+    for (size_t i = 0; i < a->nrows; i++)
+    {
+        size_t pos = 0;
+        for (int k = 0; k < spec->nkeys; k++)
+        {
+            pos = next_value(spec, k, order[i].key, pos, &v);
+            size_t w = v.numeric ? (size_t)snprintf(buf, sizeof(buf), "%lld", v.num) : v.s.len ? v.s.len : 1;
+            if (w > width[k])
+                width[k] = w;
+        }
+        for (int j = 0; j < spec->ncols; j++)
+        {
+            size_t w = format_cell(a, order[i].row, j, buf, sizeof(buf)) ? strlen(buf) : 1;
+            if (w > width[spec->nkeys + j])
+                width[spec->nkeys + j] = w;
+        }
+    }
+
+    // group values left-aligned, aggregates right-aligned
+    for (int c = 0; c < ncol; c++)
+    {
+        const char *name = buf;
+        if (c < spec->nkeys)
+            name = logfield_name(spec->keys[c]);
+        else
+            column_name(spec, c - spec->nkeys, buf, sizeof(buf));
+        if (c)
+            outbuf_puts(out, "  ");
+        if (c >= spec->nkeys)
+            pad(out, width[c] - strlen(name));
+        outbuf_puts(out, name);
+        if (c < spec->nkeys && c + 1 < ncol)
+            pad(out, width[c] - strlen(name));
+    }
+    outbuf_putc(out, '\n');
+
+    for (size_t i = 0; i < a->nrows; i++)
+    {
+        size_t pos = 0;
+        for (int k = 0; k < spec->nkeys; k++)
+        {
+            size_t w;
+            pos = next_value(spec, k, order[i].key, pos, &v);
+            if (k)
+                outbuf_puts(out, "  ");
+            if (v.numeric)
+            {
+                w = (size_t)snprintf(buf, sizeof(buf), "%lld", v.num);
+                outbuf_write(out, buf, w);
+            }
+            else if (v.s.len)
+            {
+                outbuf_write(out, v.s.p, v.s.len);
+                w = v.s.len;
+            }
+            else
+            {
+                outbuf_putc(out, '-');
+                w = 1;
+            }
+            if (k + 1 < ncol)
+                pad(out, width[k] - w);
+        }
+        for (int j = 0; j < spec->ncols; j++)
+        {
+            if (!format_cell(a, order[i].row, j, buf, sizeof(buf)))
+                strcpy(buf, "-");
+            if (spec->nkeys + j)
+                outbuf_puts(out, "  ");
+            pad(out, width[spec->nkeys + j] - strlen(buf));
+            outbuf_puts(out, buf);
+        }
+        outbuf_putc(out, '\n');
+    }
+    free(width);
+}
+
+static void write_json(const Agg *a, const SortRef *order, OutBuf *out)
+{
+    const AggSpec *spec = a->spec;
+    char name[64], buf[64];
+    KeyValue v;
+
+    outbuf_puts(out, "[\n");
+    for (size_t i = 0; i < a->nrows; i++)
+    {
+        size_t pos = 0;
+        outbuf_puts(out, "  {");
+        for (int k = 0; k < spec->nkeys; k++)
+        {
+            pos = next_value(spec, k, order[i].key, pos, &v);
+            if (k)
+                outbuf_puts(out, ", ");
+            outbuf_putc(out, '"');
+            outbuf_puts(out, logfield_name(spec->keys[k]));
+            outbuf_puts(out, "\": ");
+            if (v.numeric)
+                outbuf_i64(out, v.num);
+            else
+            {
+                outbuf_putc(out, '"');
+                outbuf_json(out, v.s);
+                outbuf_putc(out, '"');
+            }
+        }
+        for (int j = 0; j < spec->ncols; j++)
+        {
+            column_name(spec, j, name, sizeof(name));
+            if (spec->nkeys + j)
+                outbuf_puts(out, ", ");
+            outbuf_putc(out, '"');
+            outbuf_puts(out, name);
+            outbuf_puts(out, "\": ");
+            outbuf_puts(out, format_cell(a, order[i].row, j, buf, sizeof(buf)) ? buf : "null");
+        }
+        outbuf_puts(out, i + 1 < a->nrows ? "},\n" : "}\n");
+    }
+    outbuf_puts(out, "]\n");
+}
+
+static void write_csv(const Agg *a, const SortRef *order, OutBuf *out)
+{
+    const AggSpec *spec = a->spec;
+    char buf[64];
+    KeyValue v;
+
+    for (int k = 0; k < spec->nkeys; k++)
+    {
+        if (k)
+            outbuf_putc(out, ',');
+        outbuf_puts(out, logfield_name(spec->keys[k]));
+    }
+    for (int j = 0; j < spec->ncols; j++)
+    {
+        column_name(spec, j, buf, sizeof(buf));
+        if (spec->nkeys + j)
+            outbuf_putc(out, ',');
+        outbuf_puts(out, buf);
+    }
+    outbuf_putc(out, '\n');
+
+    for (size_t i = 0; i < a->nrows; i++)
+    {
+        size_t pos = 0;
+        for (int k = 0; k < spec->nkeys; k++)
+        {
+            pos = next_value(spec, k, order[i].key, pos, &v);
+            if (k)
+                outbuf_putc(out, ',');
+            if (v.numeric)
+                outbuf_i64(out, v.num);
+            else
+                outbuf_csv(out, v.s);
+        }
+        for (int j = 0; j < spec->ncols; j++)
+        {
+            if (spec->nkeys + j)
+                outbuf_putc(out, ',');
+            if (format_cell(a, order[i].row, j, buf, sizeof(buf)))
+                outbuf_puts(out, buf);
+        }
+        outbuf_putc(out, '\n');
+    }
+}
+
+// --top: value, count and error, most frequent first
+static void write_top(const Agg *a, OutputFormat format, OutBuf *out)
+{
+    const char *name = logfield_name(a->spec->top_by);
+    size_t k = (size_t)a->spec->top;
+    TopKItem *items = (TopKItem *)malloc(k * sizeof(TopKItem));
+    if (!items)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    k = topk_list(a->top, items, k);
+
+    if (format == FORMAT_JSON)
+    {
+        outbuf_puts(out, "[\n");
+        for (size_t i = 0; i < k; i++)
+        {
+            LogSlice s = {items[i].key, items[i].len};
+            outbuf_puts(out, "  {\"");
+            outbuf_puts(out, name);
+            outbuf_puts(out, "\": \"");
+            outbuf_json(out, s);
+            outbuf_puts(out, "\", \"count\": ");
+            outbuf_i64(out, items[i].count);
+            outbuf_puts(out, ", \"error\": ");
+            outbuf_i64(out, items[i].err);
+            outbuf_puts(out, i + 1 < k ? "},\n" : "}\n");
+        }
+        outbuf_puts(out, "]\n");
+    }
+    else if (format == FORMAT_CSV)
+    {
+        outbuf_puts(out, name);
+        outbuf_puts(out, ",count,error\n");
+        for (size_t i = 0; i < k; i++)
+        {
+            LogSlice s = {items[i].key, items[i].len};
+            outbuf_csv(out, s);
+            outbuf_putc(out, ',');
+            outbuf_i64(out, items[i].count);
+            outbuf_putc(out, ',');
+            outbuf_i64(out, items[i].err);
+            outbuf_putc(out, '\n');
+        }
+    }
+    else
+    {
+        char buf[32];
+        size_t w = strlen(name), wc = 5, we = 5, n;
+        for (size_t i = 0; i < k; i++)
+        {
+            if (items[i].len > w)
+                w = items[i].len;
+            if ((size_t)snprintf(buf, sizeof(buf), "%lld", items[i].count) > wc)
+                wc = strlen(buf);
+            if ((size_t)snprintf(buf, sizeof(buf), "%lld", items[i].err) > we)
+                we = strlen(buf);
+        }
+        outbuf_puts(out, name);
+        pad(out, w - strlen(name));
+        outbuf_puts(out, "  ");
+        pad(out, wc - 5);
+        outbuf_puts(out, "count  ");
+        pad(out, we - 5);
+        outbuf_puts(out, "error\n");
+        for (size_t i = 0; i < k; i++)
+        {
+            if (items[i].len)
+                outbuf_write(out, items[i].key, items[i].len);
+            else
+                outbuf_putc(out, '-');
+            pad(out, w - (items[i].len ? items[i].len : 1));
+            outbuf_puts(out, "  ");
+            n = (size_t)snprintf(buf, sizeof(buf), "%lld", items[i].count);
+            pad(out, wc - n);
+            outbuf_write(out, buf, n);
+            outbuf_puts(out, "  ");
+            n = (size_t)snprintf(buf, sizeof(buf), "%lld", items[i].err);
+            pad(out, we - n);
+            outbuf_write(out, buf, n);
+            outbuf_putc(out, '\n');
+        }
+    }
+    free(items);
+}
+
+/**
+ * @brief Prints the table, one row per group sorted by group key.
+ *
+ * Text output is a header line and aligned columns; JSON is an array of
+ * objects keyed by field and column name ("count", "sum(bytes)"); CSV has
+ * a header row. Aggregates without a value (min/max/avg of no entries) are
+ * printed as "-", null or an empty CSV field. For --top, the K most frequent
+ * values are printed instead, largest count first, with each count's error.
+ */
+void agg_write(const Agg *a, OutputFormat format, FILE *out)
+{
+    OutBuf ob;
+    outbuf_init(&ob, out);
+    if (a->top)
+    {
+        write_top(a, format, &ob);
+        outbuf_free(&ob);
+        return;
+    }
+
+    SortRef *order = (SortRef *)malloc((a->nrows ? a->nrows : 1) * sizeof(SortRef));
+    if (!order)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t r = 0; r < a->nrows; r++)
+    {
+        order[r].key = a->keys + a->rows[r].koff;
+        order[r].len = a->rows[r].klen;
+        order[r].row = r;
+    }
+    qsort(order, a->nrows, sizeof(SortRef), cmp_keys);
+
+    switch (format)
+    {
+    case FORMAT_JSON:
+        write_json(a, order, &ob);
+        break;
+    case FORMAT_CSV:
+        write_csv(a, order, &ob);
+        break;
+    default:
+        write_text(a, order, &ob);
+        break;
+    }
+    free(order);
+    outbuf_free(&ob);
+}
@@ -5,7 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "cli.h"
+#include "formatter.h"
+#include "timeseek.h"
+#include "agg.h"
 
 /**
  * @brief Parses a string argument to determine the output format.
@@ -26,6 +30,32 @@ static OutputFormat parseFormatArg(const char *arg)
     return FORMAT_TEXT;
 }
 
+/**
+ * @brief Parses a worker count for --threads / --jobs.
+ *
+ * Accepts 1..1024; 0 means one per online CPU. Exits on invalid input.
+ *
+ * @param flag The option name, for the error message.
+ * @param arg  The count argument.
+ * @return int The resolved worker count (>= 1).
+ */
+static int parseCountArg(const char *flag, const char *arg)
+{
+    char *endp = NULL;
+    long n = strtol(arg, &endp, 10);
+    if (endp == arg || *endp || n < 0 || n > 1024)
+    {
+        fprintf(stderr, "%s: invalid count '%s'\n", flag, arg);
+        exit(1);
+    }
+    if (n == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? cpus : 1;
+    }
+    return (int)n;
+}
+
 /**
  * @brief Adds an input path to the CLIOptions structure, dynamically resizing the inputs array as needed.
  *
@@ -67,14 +97,37 @@ static void print_usage(void)
 {
     fprintf(stderr,
             "Usage: logfire [--log FILE | --log -]... [--search TERM] [--query EXPR]\n"
-            "               [--format text|json|csv] [--output FILE]\n"
-            "               [--strict] [--ci] [--tail|-f] [--from-start]\n"
+            "               [--format text|json|csv] [--fields F1,F2,...] [--output FILE]\n"
+            "               [--strict] [--ci] [--tail|-f] [--from-start] [--state-file FILE]\n"
+            "               [--threads N] [--unordered] [--jobs N] [--interleave]\n"
+            "               [--no-seek] [--seek-slack SECONDS] [--no-index]\n"
+            "               [--group-by F1,F2,...] [--agg count,sum(bytes),...] [--stats]\n"
+            "               [--quantiles FIELD:Q1,Q2,...] [--distinct FIELD] [--bucket 1m]\n"
+            "               [--top K [--by FIELD] [--top-counters N]] [--interval SECONDS]\n"
             "               [--help]\n"
+            "       logfire index build FILE... [--block-lines N]\n"
+            "       logfire convert --to lfc FILE... [--output OUT] [--block-rows N]\n"
             "\n"
             "Examples:\n"
-            "  gunzip -c access.log.1.gz | logfire --log - --format json > out.json\n"
+            "  logfire --log access.log.1.gz --format json > out.json\n"
             "  logfire --log access.log --log access.log.1 --query \"status>=500 ip:10.*\" --format csv\n"
-            "  logfire --log access.log --tail -f --query \"method:POST url:*login*\" --format json\n");
+            "  logfire --jobs 8 --format json access.log access.log.[0-9]* > all.json\n"
+            "  logfire --jobs 8 --format json --output all.json.zst access.log access.log.[0-9]*\n"
+            "  logfire --log access.log --query \"status>=500\" --fields ip,status,url\n"
+            "  logfire --log access.log --query \"url~^/api/v[0-9]+/ status~^5\" --ci\n"
+            "  logfire --log access.log --query \"(status>=500 OR status=429) AND NOT ip:10.*\"\n"
+            "  logfire --log access.log --query \"ip IN @blocklist.txt OR ip IN 10.0.0.0/8\"\n"
+            "  logfire --log access.log --group-by status,method --agg count,sum(bytes) --threads 0\n"
+            "  logfire --log access.log --group-by url --quantiles request_time:0.5,0.99\n"
+            "  logfire --log access.log --query \"bytes>1000000\" --fields ip,url,bytes\n"
+            "  logfire --log access.log --query \"url=/login\" --distinct ip --bucket 1m\n"
+            "  logfire --log access.log --top 20 --by ip --query \"status>=500\"\n"
+            "  logfire --log access.log --tail -f --top 10 --by url --interval 30\n"
+            "  logfire index build access.log && logfire --log access.log --query \"ip:10.0.0.7\"\n"
+            "  logfire convert --to lfc access.log && logfire --log access.log.lfc --group-by status\n"
+            "  logfire --log access.log --tail -f --query \"method:POST url:*login*\" --format json\n"
+            "  logfire --tail --log '/var/log/nginx/*.access.log' --query \"status>=500\"\n"
+            "  logfire --tail --log access.log --group-by status --state-file /var/lib/logfire/access.state\n");
 }
 
 /**
@@ -85,11 +138,40 @@ static void print_usage(void)
  *   --search <term>   : Keyword search (simple contains across fields).
  *   --query  <expr>   : Field-based query (status, ip, method, url, timestamp, etc.).
  *   --format <type>   : text | json | csv (default: text).
- *   --output <file>   : Write to file (otherwise stdout).
+ *   --fields <list>   : Output projection, e.g. ip,status,url. Fields that are
+ *                       neither printed nor queried are never parsed.
+ *   --output <file>   : Write to file (otherwise stdout); .gz/.zst names are compressed.
  *   --strict          : Warn/print malformed lines to stderr.
  *   --ci              : Case-insensitive matching.
- *   --tail, -f        : Follow file (tail -f). Use with a single --log file.
+ *   --tail, -f        : Follow files and glob patterns (tail -F), including ones created later.
  *   --from-start      : With --tail, start at beginning (default: end).
+ *   --state-file <f>  : With --tail, checkpoint read offsets and the aggregate there and resume from them.
+ *   --threads <n>     : Scan inputs with N worker threads (0 = one per CPU); stdin, pipes
+ *                       and --tail run as a reader/workers/writer pipeline.
+ *   --unordered       : With --threads, write results as chunks finish instead of in
+ *                       file order.
+ *   --jobs <n>        : Process up to N inputs concurrently (0 = one per CPU).
+ *   --interleave      : With --jobs, write results as they arrive instead of grouped
+ *                       per input in argument order.
+ *   --no-seek         : Don't binary-search time-ordered files for the query's
+ *                       timestamp window; always scan everything.
+ *   --seek-slack <s>  : Out-of-order tolerance for that search (default 60 s).
+ *   --no-index        : Don't use <file>.lfidx sidecar indexes to skip blocks.
+ *   --group-by <list> : Print one row per distinct combination of these fields
+ *                       instead of the matching entries.
+ *   --agg <list>      : Aggregates per group: count, sum/min/max/avg/p99(bytes|status|
+ *                       request_time) (default: count).
+ *   --quantiles <f:qs>: Add quantile columns, e.g. request_time:0.5,0.99 (repeatable).
+ *   --distinct <field>: Add an approximate distinct count (HyperLogLog) of the field.
+ *   --bucket <width>  : Group by time bucket (30s, 1m, 1h, 1d) ahead of --group-by.
+ *   --stats           : Aggregate with count,sum(bytes),avg(bytes),max(bytes) unless
+ *                       --agg is given; without --group-by, over all matches.
+ *   --top <k>         : Print the K most frequent values of the --by field (default ip),
+ *                       counted in bounded memory with a Space-Saving summary.
+ *   --by <field>      : Field for --top (ip, url, userAgent, ...).
+ *   --top-counters <n>: Counters --top keeps (default max(10000, 100*K)); counts are at
+ *                       most matches/N too high.
+ *   --interval <s>    : With --tail, print the aggregate every S seconds (default 10).
  *   --help, -h        : Show usage.
  *   --                : Treat remaining args as filenames.
  *
@@ -108,7 +190,18 @@ CLIOptions parseCLI(int argc, char *argv[])
         .case_insensitive = 0,
         .tail = 0,
         .from_start = 0,
+        .has_fields = 0,
+        .threads = 1,
+        .unordered = 0,
+        .jobs = 1,
+        .interleave = 0,
+        .no_seek = 0,
+        .seek_slack = TIMESEEK_DEFAULT_SLACK,
+        .no_index = 0,
+        .aggregate = 0,
+        .interval = 10,
     };
+    int stats = 0, by = 0, agg_cols = 0;
 
     int cap = 0;
 
@@ -158,6 +251,21 @@ CLIOptions parseCLI(int argc, char *argv[])
             }
             opts.format = parseFormatArg(argv[++i]);
         }
+        else if (strcmp(a, "--fields") == 0)
+        {
+            char ferr[128];
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--fields requires a comma-separated field list\n");
+                exit(1);
+            }
+            if (!fieldset_parse(argv[++i], &opts.fields, ferr, sizeof(ferr)))
+            {
+                fprintf(stderr, "--fields: %s\n", ferr);
+                exit(1);
+            }
+            opts.has_fields = 1;
+        }
         else if (strcmp(a, "--output") == 0)
         {
             if (i + 1 >= argc)
@@ -167,6 +275,15 @@ CLIOptions parseCLI(int argc, char *argv[])
             }
             opts.outputFile = argv[++i];
         }
+        else if (strcmp(a, "--state-file") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--state-file requires a filename\n");
+                exit(1);
+            }
+            opts.state_file = argv[++i];
+        }
         else if (strcmp(a, "--strict") == 0)
         {
             opts.strict = 1;
@@ -183,6 +300,130 @@ CLIOptions parseCLI(int argc, char *argv[])
         {
             opts.from_start = 1;
         }
+        else if (strcmp(a, "--threads") == 0 || strcmp(a, "--jobs") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "%s requires a count (0 = one per CPU)\n", a);
+                exit(1);
+            }
+            int n = parseCountArg(a, argv[++i]);
+            if (strcmp(a, "--threads") == 0)
+                opts.threads = n;
+            else
+                opts.jobs = n;
+        }
+        else if (strcmp(a, "--unordered") == 0)
+        {
+            opts.unordered = 1;
+        }
+        else if (strcmp(a, "--interleave") == 0)
+        {
+            opts.interleave = 1;
+        }
+        else if (strcmp(a, "--no-seek") == 0)
+        {
+            opts.no_seek = 1;
+        }
+        else if (strcmp(a, "--no-index") == 0)
+        {
+            opts.no_index = 1;
+        }
+        else if (strcmp(a, "--group-by") == 0 || strcmp(a, "--agg") == 0 ||
+                 strcmp(a, "--quantiles") == 0 || strcmp(a, "--distinct") == 0 ||
+                 strcmp(a, "--bucket") == 0)
+        {
+            char aerr[128];
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "%s requires a comma-separated list\n", a);
+                exit(1);
+            }
+            int ok;
+            if (strcmp(a, "--group-by") == 0)
+                ok = aggspec_parse_keys(argv[++i], &opts.agg, aerr, sizeof(aerr));
+            else if (strcmp(a, "--agg") == 0)
+                ok = agg_cols = aggspec_parse_columns(argv[++i], &opts.agg, aerr, sizeof(aerr));
+            else if (strcmp(a, "--quantiles") == 0)
+                ok = aggspec_parse_quantiles(argv[++i], &opts.agg, aerr, sizeof(aerr));
+            else if (strcmp(a, "--bucket") == 0)
+                ok = aggspec_parse_bucket(argv[++i], &opts.agg, aerr, sizeof(aerr));
+            else
+            {
+                char col[64];
+                snprintf(col, sizeof(col), "distinct(%s)", argv[++i]);
+                ok = aggspec_parse_columns(col, &opts.agg, aerr, sizeof(aerr));
+            }
+            if (!ok)
+            {
+                fprintf(stderr, "%s: %s\n", a, aerr);
+                exit(1);
+            }
+            opts.aggregate = 1;
+        }
+        else if (strcmp(a, "--top") == 0 || strcmp(a, "--top-counters") == 0 ||
+                 strcmp(a, "--interval") == 0)
+        {
+            char *endp = NULL;
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "%s requires a number\n", a);
+                exit(1);
+            }
+            long n = strtol(argv[++i], &endp, 10);
+            if (endp == argv[i] || *endp || n < 1 || n > 100000000)
+            {
+                fprintf(stderr, "%s: invalid value '%s'\n", a, argv[i]);
+                exit(1);
+            }
+            if (strcmp(a, "--top") == 0)
+            {
+                opts.agg.top = (int)n;
+                opts.aggregate = 1;
+            }
+            else if (strcmp(a, "--top-counters") == 0)
+                opts.agg.top_counters = n;
+            else
+                opts.interval = (int)n;
+        }
+        else if (strcmp(a, "--by") == 0)
+        {
+            char ferr[128];
+            FieldSet fs;
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--by requires a field name\n");
+                exit(1);
+            }
+            if (!fieldset_parse(argv[++i], &fs, ferr, sizeof(ferr)) || fs.count != 1 ||
+                fs.list[0] == LF_STATUS || fs.list[0] == LF_BYTES || fs.list[0] == LF_REQUEST_TIME)
+            {
+                fprintf(stderr, "--by: expected one text field (ip, url, userAgent, ...): %s\n", argv[i]);
+                exit(1);
+            }
+            opts.agg.top_by = fs.list[0];
+            by = 1;
+        }
+        else if (strcmp(a, "--stats") == 0)
+        {
+            opts.aggregate = 1;
+            stats = 1;
+        }
+        else if (strcmp(a, "--seek-slack") == 0)
+        {
+            char *endp = NULL;
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--seek-slack requires a number of seconds\n");
+                exit(1);
+            }
+            opts.seek_slack = strtol(argv[++i], &endp, 10);
+            if (endp == argv[i] || *endp || opts.seek_slack < 0)
+            {
+                fprintf(stderr, "--seek-slack: invalid value '%s'\n", argv[i]);
+                exit(1);
+            }
+        }
         else if (strcmp(a, "--help") == 0 || strcmp(a, "-h") == 0)
         {
             print_usage();
@@ -208,6 +449,56 @@ CLIOptions parseCLI(int argc, char *argv[])
         exit(1);
     }
 
+    if (opts.agg.top)
+    {
+        if (opts.agg.nkeys || opts.agg.ncols || opts.agg.bucket || stats)
+        {
+            fprintf(stderr, "--top cannot be combined with --group-by, --agg, --quantiles, --distinct, "
+                            "--bucket or --stats\n");
+            exit(1);
+        }
+        if (!by)
+            opts.agg.top_by = LF_IP;
+        if (opts.agg.top_counters == 0)
+            opts.agg.top_counters = opts.agg.top * 100L > 10000 ? opts.agg.top * 100L : 10000;
+        if (opts.agg.top_counters < opts.agg.top)
+            opts.agg.top_counters = opts.agg.top;
+    }
+    else if (by)
+    {
+        fprintf(stderr, "--by is only used with --top\n");
+        exit(1);
+    }
+    else if (opts.aggregate && !agg_cols)
+    {
+        // default columns go first, then any --quantiles
+        char aerr[128];
+        AggSpec q = opts.agg;
+        opts.agg.ncols = 0;
+        aggspec_parse_columns(stats ? "count,sum(bytes),avg(bytes),max(bytes)" : "count", &opts.agg,
+                              aerr, sizeof(aerr));
+        for (int j = 0; j < q.ncols && opts.agg.ncols < AGG_MAX_COLUMNS; j++)
+            opts.agg.cols[opts.agg.ncols++] = q.cols[j];
+    }
+    if (opts.agg.bucket)
+    {
+        // the time bucket is the first group key
+        int k = 0;
+        while (k < opts.agg.nkeys && opts.agg.keys[k] != LF_TIMESTAMP)
+            k++;
+        if (k == opts.agg.nkeys)
+            opts.agg.nkeys++;
+        for (; k > 0; k--)
+            opts.agg.keys[k] = opts.agg.keys[k - 1];
+        opts.agg.keys[0] = LF_TIMESTAMP;
+    }
+
+    if (opts.state_file && !opts.tail)
+    {
+        fprintf(stderr, "--state-file is only used with --tail\n");
+        exit(1);
+    }
+
     // If both --search and --query are provided, prefer --query but warn
     if (opts.searchTerm && opts.query)
     {
@@ -0,0 +1,713 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decomp.h"
+
+#define DECOMP_PIECE (1u << 20)           // output is handed over in pieces of this size
+#define DECOMP_QUEUE_CAP (16u << 20)      // decoded bytes a segment may queue before its worker waits
+#define DECOMP_SEGMENT_MIN (8u << 20)     // compressed bytes per parallel segment, at least
+#define DECOMP_SEGMENTS_PER_THREAD 4      // load-balancing granularity
+#define DECOMP_WINDOW_PER_THREAD 2        // segments decoded ahead of the reader, per worker
+#define DECOMP_PROBE (1u << 20)           // how far past a cut point to look for a gzip member
+#define DECOMP_TRIAL (64u << 10)          // compressed bytes inflated to check a member header
+#define DECOMP_INBUF (256u << 10)         // read size for streamed input
+
+typedef struct Piece
+{
+    struct Piece *next;
+    size_t len;
+    char data[];
+} Piece;
+
+enum
+{
+    SEG_PENDING,
+    SEG_RUNNING,
+    SEG_DONE
+};
+
+/*
+ * A segment decodes the members/frames that start in [start, end) and
+ * records where the last one ended. Its output queues up until the reader
+ * gets to it.
+ */
+typedef struct
+{
+    size_t start, end;
+    size_t stop;
+    Piece *head, *tail;
+    size_t queued;
+    int state;
+    int cancel;  // the reader restarted it from another offset
+    int error;   // corrupt or truncated data
+    int garbage; // stopped at bytes that are not another member
+} Segment;
+
+struct Decomp
+{
+    DecompKind kind;
+    const unsigned char *map; // mapped input (owned), or NULL
+    size_t len;
+    FILE *fp; // streamed input, and the bytes already read from it
+    unsigned char *head;
+    size_t head_len;
+
+    int threads;
+    Segment *segs;
+    int nsegs;
+    int cur;    // segment being read
+    int window; // segments that may be decoded ahead of cur
+    Piece *piece; // piece being read
+    size_t piece_pos;
+    pthread_t *tids;
+    int started;
+    int closing;
+    int done; // end of input or an error was reported
+
+    pthread_mutex_t mu;
+    pthread_cond_t cv_data;  // output queued or a segment finished
+    pthread_cond_t cv_space; // the reader consumed output or moved on
+};
+
+/**
+ * @brief Recognises gzip (1f 8b) and zstd (28 b5 2f fd) magic numbers.
+ */
+DecompKind decomp_detect(const void *p, size_t n)
+{
+    const unsigned char *b = (const unsigned char *)p;
+    if (n >= 3 && b[0] == 0x1f && b[1] == 0x8b && b[2] == 8)
+        return DECOMP_GZIP;
+    if (n >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd)
+        return DECOMP_ZSTD;
+    return DECOMP_NONE;
+}
+
+static Decomp *decomp_new(DecompKind kind)
+{
+    Decomp *d = (Decomp *)calloc(1, sizeof(Decomp));
+    if (!d)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    d->kind = kind;
+    d->threads = 1;
+    pthread_mutex_init(&d->mu, NULL);
+    pthread_cond_init(&d->cv_data, NULL);
+    pthread_cond_init(&d->cv_space, NULL);
+    return d;
+}
+
+/**
+ * @brief Decodes a mapped file; the mapping is unmapped by decomp_close().
+ */
+Decomp *decomp_open_map(DecompKind kind, const void *map, size_t len)
+{
+    Decomp *d = decomp_new(kind);
+    d->map = (const unsigned char *)map;
+    d->len = len;
+    return d;
+}
+
+/**
+ * @brief Decodes a stream whose first n bytes (head) have already been read.
+ */
+Decomp *decomp_open_stream(DecompKind kind, FILE *fp, const void *head, size_t n)
+{
+    Decomp *d = decomp_new(kind);
+    d->fp = fp;
+    d->head = (unsigned char *)malloc(n ? n : 1);
+    if (!d->head)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(d->head, head, n);
+    d->head_len = n;
+    return d;
+}
+
+/**
+ * @brief Sets the number of decoder threads; call before the first read.
+ */
+void decomp_set_threads(Decomp *d, int threads)
+{
+    d->threads = threads > 0 ? threads : 1;
+}
+
+/* --- input --------------------------------------------------------------- */
+
+typedef struct
+{
+    Decomp *d;
+    const unsigned char *p; // bytes not yet passed to the decoder
+    size_t n;
+    size_t at;    // input offset of p
+    unsigned char *buf;
+    int head_done;
+} Input;
+
+static void input_init(Input *in, Decomp *d, size_t start, size_t end)
+{
+    memset(in, 0, sizeof(*in));
+    in->d = d;
+    in->at = start;
+    if (d->map)
+    {
+        in->p = d->map + start;
+        in->n = (end < d->len ? end : d->len) - start;
+    }
+}
+
+// Streamed input: the next read; 0 at the end of the stream
+static int input_more(Input *in)
+{
+    Decomp *d = in->d;
+    if (d->map)
+        return 0;
+    in->at += in->n;
+    in->n = 0;
+    if (!in->head_done)
+    {
+        in->head_done = 1;
+        in->p = d->head;
+        in->n = d->head_len;
+        if (in->n)
+            return 1;
+    }
+    if (!in->buf && !(in->buf = (unsigned char *)malloc(DECOMP_INBUF)))
+    {
+        perror("malloc");
+        exit(1);
+    }
+    in->p = in->buf;
+    in->n = fread(in->buf, 1, DECOMP_INBUF, d->fp);
+    return in->n > 0;
+}
+
+/* --- output -------------------------------------------------------------- */
+
+static Piece *piece_new(void)
+{
+    Piece *p = (Piece *)malloc(sizeof(Piece) + DECOMP_PIECE);
+    if (!p)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    p->next = NULL;
+    p->len = 0;
+    return p;
+}
+
+static void free_pieces(Segment *s)
+{
+    while (s->head)
+    {
+        Piece *p = s->head;
+        s->head = p->next;
+        free(p);
+    }
+    s->tail = NULL;
+    s->queued = 0;
+}
+
+// Queues a piece; 0 if the segment was restarted or the reader is closing
+static int push_piece(Decomp *d, Segment *s, Piece *p)
+{
+    pthread_mutex_lock(&d->mu);
+    while (s->queued >= DECOMP_QUEUE_CAP && !s->cancel && !d->closing)
+        pthread_cond_wait(&d->cv_space, &d->mu);
+    if (s->cancel || d->closing)
+    {
+        pthread_mutex_unlock(&d->mu);
+        free(p);
+        return 0;
+    }
+    if (s->tail)
+        s->tail->next = p;
+    else
+        s->head = p;
+    s->tail = p;
+    s->queued += p->len;
+    pthread_cond_broadcast(&d->cv_data);
+    pthread_mutex_unlock(&d->mu);
+    return 1;
+}
+
+/* --- decoders ------------------------------------------------------------ */
+
+// Decodes the gzip members that start in the segment; returns 0 if it was cancelled
+static int decode_gzip(Decomp *d, Segment *s, size_t start)
+{
+    z_stream zs;
+    Input in;
+    Piece *p = piece_new();
+    int first = 1, ret = Z_OK;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+    {
+        free(p);
+        s->error = 1;
+        return 1;
+    }
+    input_init(&in, d, start, d->len);
+    zs.next_in = (Bytef *)in.p;
+    zs.avail_in = (uInt)(in.n < UINT32_MAX ? in.n : UINT32_MAX);
+
+    size_t member = start;
+    while (member < s->end)
+    {
+        if (zs.avail_in == 0)
+        {
+            if (!input_more(&in))
+                break; // ends after a whole member
+            zs.next_in = (Bytef *)in.p;
+            zs.avail_in = (uInt)in.n;
+        }
+        inflateReset(&zs);
+        size_t produced = 0;
+        for (;;)
+        {
+            if (zs.avail_in == 0)
+            {
+                if (!input_more(&in))
+                    break; // truncated member
+                zs.next_in = (Bytef *)in.p;
+                zs.avail_in = (uInt)in.n;
+            }
+            if (p->len == DECOMP_PIECE)
+            {
+                if (!push_piece(d, s, p))
+                {
+                    inflateEnd(&zs);
+                    free(in.buf);
+                    return 0;
+                }
+                p = piece_new();
+            }
+            const Bytef *before = zs.next_in;
+            zs.next_out = (Bytef *)p->data + p->len;
+            zs.avail_out = (uInt)(DECOMP_PIECE - p->len);
+            ret = inflate(&zs, Z_NO_FLUSH);
+            size_t got = DECOMP_PIECE - p->len - zs.avail_out;
+            p->len += got;
+            produced += got;
+            // mapped input larger than 4 GiB is fed 4 GiB at a time
+            if (d->map && zs.avail_in == 0 && (size_t)(zs.next_in - d->map) < d->len)
+            {
+                size_t left = d->len - (size_t)(zs.next_in - d->map);
+                zs.avail_in = (uInt)(left < UINT32_MAX ? left : UINT32_MAX);
+            }
+            if (ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR))
+                break;
+            if (ret == Z_BUF_ERROR && zs.next_in == before && got == 0 && zs.avail_in != 0)
+                break; // no progress although there is room and input
+        }
+        if (ret != Z_STREAM_END)
+        {
+            if (!first && produced == 0 && ret == Z_DATA_ERROR)
+                s->garbage = 1; // like gzip, ignore what follows the last member
+            else
+            {
+                fprintf(stderr, "[warn] gzip: %s\n", ret == Z_DATA_ERROR && zs.msg ? zs.msg : "unexpected end of input");
+                s->error = 1;
+            }
+            break;
+        }
+        first = 0;
+        member = d->map ? (size_t)(zs.next_in - d->map) : in.at + (in.n - zs.avail_in);
+    }
+    if (!d->map && ferror(d->fp) && !s->error)
+    {
+        fprintf(stderr, "[warn] gzip: read error\n");
+        s->error = 1;
+    }
+    s->stop = member;
+    inflateEnd(&zs);
+    free(in.buf);
+    if (p->len == 0)
+    {
+        free(p);
+        return 1;
+    }
+    return push_piece(d, s, p);
+}
+
+#ifdef HAVE_ZSTD
+// Decodes the segment's zstd frames (exact boundaries); returns 0 if it was cancelled
+static int decode_zstd(Decomp *d, Segment *s, size_t start)
+{
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    Input in;
+    Piece *p = piece_new();
+    size_t hint = 0;
+    int full = 0;
+
+    if (!ds)
+    {
+        free(p);
+        s->error = 1;
+        return 1;
+    }
+    ZSTD_initDStream(ds);
+    input_init(&in, d, start, s->end);
+    ZSTD_inBuffer zin = {in.p, in.n, 0};
+    for (;;)
+    {
+        if (zin.pos == zin.size && !full)
+        {
+            if (!input_more(&in))
+                break;
+            zin.src = in.p;
+            zin.size = in.n;
+            zin.pos = 0;
+        }
+        if (p->len == DECOMP_PIECE)
+        {
+            if (!push_piece(d, s, p))
+            {
+                ZSTD_freeDStream(ds);
+                free(in.buf);
+                return 0;
+            }
+            p = piece_new();
+        }
+        ZSTD_outBuffer zout = {p->data + p->len, DECOMP_PIECE - p->len, 0};
+        size_t used = zin.pos;
+        size_t r = ZSTD_decompressStream(ds, &zout, &zin);
+        if (ZSTD_isError(r))
+        {
+            fprintf(stderr, "[warn] zstd: %s\n", ZSTD_getErrorName(r));
+            s->error = 1;
+            break;
+        }
+        if (zout.pos || zin.pos != used) // a call that only checks for more after a frame ended says nothing
+            hint = r;
+        p->len += zout.pos;
+        full = zout.pos == zout.size; // more may be buffered in the decoder
+    }
+    if (!s->error && hint != 0)
+    {
+        fprintf(stderr, "[warn] zstd: unexpected end of input\n");
+        s->error = 1;
+    }
+    s->stop = s->end;
+    ZSTD_freeDStream(ds);
+    free(in.buf);
+    if (p->len == 0)
+    {
+        free(p);
+        return 1;
+    }
+    return push_piece(d, s, p);
+}
+#endif
+
+/* --- segments ------------------------------------------------------------ */
+
+// A gzip member header that inflates cleanly for a while
+static int plausible_member(const unsigned char *p, size_t n)
+{
+    unsigned char out[16384];
+    z_stream zs;
+    int ret;
+
+    if (n < 18 || decomp_detect(p, n) != DECOMP_GZIP || (p[3] & 0xe0))
+        return 0;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return 0;
+    zs.next_in = (Bytef *)p;
+    zs.avail_in = (uInt)(n < DECOMP_TRIAL ? n : DECOMP_TRIAL);
+    do
+    {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = inflate(&zs, Z_NO_FLUSH);
+    } while (ret == Z_OK && zs.avail_in > 0);
+    inflateEnd(&zs);
+    return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
+}
+
+static size_t find_member(const unsigned char *map, size_t from, size_t to, size_t len)
+{
+    for (size_t i = from; i < to;)
+    {
+        const unsigned char *q = (const unsigned char *)memchr(map + i, 0x1f, to - i);
+        if (!q)
+            break;
+        i = (size_t)(q - map);
+        if (plausible_member(q, len - i))
+            return i;
+        i++;
+    }
+    return 0;
+}
+
+static void add_segment(Decomp *d, size_t start, size_t end, int *cap)
+{
+    if (d->nsegs == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        d->segs = (Segment *)realloc(d->segs, (size_t)*cap * sizeof(Segment));
+        if (!d->segs)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    Segment *s = &d->segs[d->nsegs++];
+    memset(s, 0, sizeof(*s));
+    s->start = start;
+    s->end = end;
+}
+
+static void plan_segments(Decomp *d)
+{
+    int cap = 0;
+    size_t prev = 0;
+    if (!d->map)
+    {
+        add_segment(d, 0, (size_t)-1, &cap);
+        return;
+    }
+    size_t target = d->len / ((size_t)d->threads * DECOMP_SEGMENTS_PER_THREAD);
+    if (target < DECOMP_SEGMENT_MIN)
+        target = DECOMP_SEGMENT_MIN;
+    if (d->threads > 1 && d->kind == DECOMP_GZIP)
+    {
+        for (size_t at = target; at < d->len; at += target)
+        {
+            size_t to = d->len - at > DECOMP_PROBE ? at + DECOMP_PROBE : d->len;
+            size_t cut = find_member(d->map, at, to, d->len);
+            if (cut > prev)
+            {
+                add_segment(d, prev, cut, &cap);
+                prev = cut;
+            }
+        }
+    }
+#ifdef HAVE_ZSTD
+    else if (d->threads > 1 && d->kind == DECOMP_ZSTD)
+    {
+        size_t at = 0;
+        while (at < d->len)
+        {
+            size_t n = ZSTD_findFrameCompressedSize(d->map + at, d->len - at);
+            if (ZSTD_isError(n))
+                break; // the last segment reports it
+            at += n;
+            if (at - prev >= target && at < d->len)
+            {
+                add_segment(d, prev, at, &cap);
+                prev = at;
+            }
+        }
+    }
+#endif
+    add_segment(d, prev, d->len, &cap);
+}
+
+static void *decode_worker(void *arg)
+{
+    Decomp *d = (Decomp *)arg;
+
+    pthread_mutex_lock(&d->mu);
+    for (;;)
+    {
+        Segment *s = NULL;
+        while (!d->closing)
+        {
+            for (int i = d->cur; i < d->nsegs && i < d->cur + d->window && !s; i++)
+                if (d->segs[i].state == SEG_PENDING)
+                    s = &d->segs[i];
+            if (s)
+                break;
+            pthread_cond_wait(&d->cv_space, &d->mu);
+        }
+        if (d->closing)
+            break;
+        s->state = SEG_RUNNING;
+        s->error = s->garbage = 0;
+        size_t start = s->start; // the reader may move it while this runs
+        pthread_mutex_unlock(&d->mu);
+
+        int kept = 1;
+#ifdef HAVE_ZSTD
+        if (d->kind == DECOMP_ZSTD)
+            kept = decode_zstd(d, s, start);
+        else
+#endif
+            kept = decode_gzip(d, s, start);
+
+        pthread_mutex_lock(&d->mu);
+        if (s->cancel || !kept)
+        {
+            free_pieces(s);
+            s->cancel = 0;
+            s->state = SEG_PENDING; // the reader moved its start; decode it again
+        }
+        else
+            s->state = SEG_DONE;
+        pthread_cond_broadcast(&d->cv_data);
+        pthread_cond_broadcast(&d->cv_space);
+    }
+    pthread_mutex_unlock(&d->mu);
+    return NULL;
+}
+
+static int start_workers(Decomp *d)
+{
+#ifndef HAVE_ZSTD
+    if (d->kind == DECOMP_ZSTD)
+    {
+        fprintf(stderr, "[warn] zstd input needs a logfire built with libzstd (HAVE_ZSTD)\n");
+        return 0;
+    }
+#endif
+    plan_segments(d);
+    int n = d->threads < d->nsegs ? d->threads : d->nsegs;
+    d->window = n * DECOMP_WINDOW_PER_THREAD;
+    d->tids = (pthread_t *)malloc((size_t)n * sizeof(pthread_t));
+    if (!d->tids)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (pthread_create(&d->tids[i], NULL, decode_worker, d) != 0)
+            break;
+        d->started++;
+    }
+    if (d->started == 0)
+    {
+        fprintf(stderr, "[warn] could not start a decompression thread\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads up to cap bytes of decompressed data.
+ *
+ * The first call plans the segments and starts the decoder threads.
+ *
+ * @return Bytes read, 0 at the end of the data, -1 on corrupt or truncated
+ *         input (reported on stderr) or a missing decoder.
+ */
+ssize_t decomp_read(Decomp *d, char *buf, size_t cap)
+{
+    if (d->done)
+        return d->done < 0 ? -1 : 0;
+    if (!d->tids && !start_workers(d))
+    {
+        d->done = -1;
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (d->piece)
+        {
+            size_t n = d->piece->len - d->piece_pos;
+            if (n > cap)
+                n = cap;
+            memcpy(buf, d->piece->data + d->piece_pos, n);
+            d->piece_pos += n;
+            if (d->piece_pos == d->piece->len)
+            {
+                free(d->piece);
+                d->piece = NULL;
+            }
+            return (ssize_t)n;
+        }
+
+        pthread_mutex_lock(&d->mu);
+        Segment *s = &d->segs[d->cur];
+        while (!s->head && s->state != SEG_DONE)
+            pthread_cond_wait(&d->cv_data, &d->mu);
+        if (s->head)
+        {
+            d->piece = s->head;
+            d->piece_pos = 0;
+            s->head = s->head->next;
+            if (!s->head)
+                s->tail = NULL;
+            s->queued -= d->piece->len;
+            pthread_cond_broadcast(&d->cv_space);
+            pthread_mutex_unlock(&d->mu);
+            continue;
+        }
+        if (s->error)
+        {
+            d->done = -1;
+            pthread_mutex_unlock(&d->mu);
+            return -1;
+        }
+        if (s->garbage || d->cur + 1 == d->nsegs)
+        {
+            if (s->garbage)
+                fprintf(stderr, "[warn] gzip: trailing garbage ignored\n");
+            d->done = 1;
+            pthread_mutex_unlock(&d->mu);
+            return 0;
+        }
+
+        Segment *next = &d->segs[d->cur + 1];
+        if (next->start != s->stop)
+        {
+            // the cut was not a member boundary: decode the next segment from where this one ended
+            free_pieces(next);
+            next->start = s->stop;
+            if (next->state == SEG_RUNNING)
+                next->cancel = 1;
+            else
+                next->state = SEG_PENDING;
+        }
+        d->cur++;
+        pthread_cond_broadcast(&d->cv_space);
+        pthread_mutex_unlock(&d->mu);
+    }
+}
+
+/**
+ * @brief Stops the decoder threads and releases everything, including the mapping.
+ */
+void decomp_close(Decomp *d)
+{
+    if (!d)
+        return;
+    pthread_mutex_lock(&d->mu);
+    d->closing = 1;
+    pthread_cond_broadcast(&d->cv_space);
+    pthread_mutex_unlock(&d->mu);
+    for (int i = 0; i < d->started; i++)
+        pthread_join(d->tids[i], NULL);
+
+    for (int i = 0; i < d->nsegs; i++)
+        free_pieces(&d->segs[i]);
+    free(d->segs);
+    free(d->piece);
+    free(d->tids);
+    free(d->head);
+    if (d->map)
+        munmap((void *)d->map, d->len);
+    pthread_mutex_destroy(&d->mu);
+    pthread_cond_destroy(&d->cv_data);
+    pthread_cond_destroy(&d->cv_space);
+    free(d);
+}
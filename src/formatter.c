@@ -4,84 +4,217 @@
  */
 #include <stdio.h>
 #include "formatter.h"
+#include "parser.h"
 
 #include <string.h>
+#include <strings.h>
 
-void escapeJSONString(const char *input, char *output, size_t outSize)
+// Output names, indexed by LogField
+static const char *field_names[LF_COUNT] = {
+    "timestamp", "ip", "method", "url", "protocol", "status", "bytes", "referrer", "userAgent",
+    "requestTime"};
+
+// Other accepted spellings, as --query and --agg write them
+static const struct
+{
+    const char *name;
+    LogField field;
+} field_aliases[] = {{"request_time", LF_REQUEST_TIME}, {"user_agent", LF_USERAGENT}};
+
+const char *logfield_name(LogField f)
+{
+    return (f >= 0 && f < LF_COUNT) ? field_names[f] : "?";
+}
+
+/**
+ * @brief Fills a FieldSet with the classic output columns.
+ *
+ * timestamp, ip, method, url, status, userAgent - the layout logfire has
+ * always printed when no --fields projection is given.
+ */
+void fieldset_default(FieldSet *out)
 {
-    size_t outIndex = 0;
+    static const LogField def[] = {LF_TIMESTAMP, LF_IP, LF_METHOD, LF_URL, LF_STATUS, LF_USERAGENT};
+    out->count = 0;
+    out->mask = 0;
+    for (size_t i = 0; i < sizeof(def) / sizeof(def[0]); i++)
+    {
+        out->list[out->count++] = def[i];
+        out->mask |= LF_BIT(def[i]);
+    }
+}
 
-    for (size_t i = 0; input[i] != '\0' && outIndex < outSize - 1; i++)
+/**
+ * @brief Parses a comma-separated --fields list ("ip,status,url").
+ *
+ * Names are matched case-insensitively against the output field names,
+ * and also accept the snake_case spellings request_time and user_agent.
+ * Order is preserved; duplicates are ignored.
+ *
+ * @return 1 on success, 0 on an unknown or empty field list.
+ */
+int fieldset_parse(const char *spec, FieldSet *out, char *errmsg, size_t errmsg_sz)
+{
+    out->count = 0;
+    out->mask = 0;
+
+    const char *p = spec;
+    while (*p)
     {
-        if (outIndex >= outSize - 2)
-            break; // Leave space for null-terminator
+        const char *comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        while (n && (*p == ' '))
+            p++, n--;
+        while (n && p[n - 1] == ' ')
+            n--;
 
-        switch (input[i])
+        if (n)
         {
-        case '\"':
-            if (outIndex < outSize - 2)
-            {
-                output[outIndex++] = '\\';
-                output[outIndex++] = '\"';
-            }
-            break;
-        case '\\':
-            if (outIndex < outSize - 2)
+            int f;
+            for (f = 0; f < LF_COUNT; f++)
+                if (strlen(field_names[f]) == n && strncasecmp(field_names[f], p, n) == 0)
+                    break;
+            for (size_t k = 0; f == LF_COUNT && k < sizeof(field_aliases) / sizeof(field_aliases[0]); k++)
+                if (strlen(field_aliases[k].name) == n && strncasecmp(field_aliases[k].name, p, n) == 0)
+                    f = field_aliases[k].field;
+            if (f == LF_COUNT)
             {
-                output[outIndex++] = '\\';
-                output[outIndex++] = '\\';
+                snprintf(errmsg, errmsg_sz, "unknown field: %.*s", (int)n, p);
+                return 0;
             }
-            break;
-        case '\n':
-            if (outIndex < outSize - 2)
+            if (!(out->mask & LF_BIT(f)))
             {
-                output[outIndex++] = '\\';
-                output[outIndex++] = 'n';
+                out->list[out->count++] = (LogField)f;
+                out->mask |= LF_BIT(f);
             }
-            break;
-        case '\t':
-            if (outIndex < outSize - 2)
-            {
-                output[outIndex++] = '\\';
-                output[outIndex++] = 't';
-            }
-            break;
-        default:
-            output[outIndex++] = input[i];
-            break;
         }
+        if (!comma)
+            break;
+        p = comma + 1;
     }
-
-    output[outIndex] = '\0';
+    if (out->count == 0)
+    {
+        snprintf(errmsg, errmsg_sz, "empty field list");
+        return 0;
+    }
+    return 1;
 }
 
-void printLogText(LogEntry *entry, FILE *out)
+// Prints status/bytes/request time as numbers; returns 0 for string fields
+static int writeNumeric(LogEntry *entry, LogField f, const char *none, OutBuf *out)
 {
-    fprintf(out, "[%s] %s %s %s -> %d\n",
-           entry->timestamp, entry->ip, entry->method, entry->url, entry->status);
+    if (f == LF_REQUEST_TIME)
+    {
+        logentry_load(entry, LF_BIT(LF_REQUEST_TIME));
+        if (entry->request_time < 0)
+            outbuf_puts(out, none); // not logged
+        else
+            outbuf_fixed3(out, entry->request_time);
+        return 1;
+    }
+    if (f == LF_STATUS)
+    {
+        outbuf_i64(out, entry->status);
+        return 1;
+    }
+    if (f == LF_BYTES)
+    {
+        logentry_load(entry, LF_BIT(LF_BYTES));
+        outbuf_i64(out, entry->bytes);
+        return 1;
+    }
+    return 0;
 }
 
-void printLogJSON(LogEntry *entry, FILE *out)
+/**
+ * @brief Prints one entry as a single text line (no trailing newline).
+ *
+ * The classic "[timestamp] ip method url -> status" layout is used unless a
+ * --fields projection is in effect, in which case the selected values are
+ * printed space-separated in the requested order.
+ */
+void printLogText(LogEntry *entry, const FieldSet *fields, OutBuf *out)
 {
-    char escapedTimestamp[128] = {0};
-    char escapedIP[128] = {0};
-    char escapedMethod[32] = {0};
-    char escapedURL[2048] = {0};
-    char escapedUserAgent[2048] = {0};
-
-    escapeJSONString(entry->timestamp, escapedTimestamp, sizeof(escapedTimestamp));
-    escapeJSONString(entry->ip, escapedIP, sizeof(escapedIP));
-    escapeJSONString(entry->method, escapedMethod, sizeof(escapedMethod));
-    escapeJSONString(entry->url, escapedURL, sizeof(escapedURL));
-    escapeJSONString(entry->userAgent, escapedUserAgent, sizeof(escapedUserAgent));
-
-    fprintf(out, "  {\"timestamp\": \"%s\", \"ip\": \"%s\", \"method\": \"%s\", \"url\": \"%s\", \"status\": %d, \"userAgent\": \"%s\"}",
-           escapedTimestamp, escapedIP, escapedMethod, escapedURL, entry->status, escapedUserAgent);
+    if (!fields)
+    {
+        outbuf_putc(out, '[');
+        outbuf_write(out, entry->timestamp.p, entry->timestamp.len);
+        outbuf_write(out, "] ", 2);
+        outbuf_write(out, entry->ip.p, entry->ip.len);
+        outbuf_putc(out, ' ');
+        outbuf_write(out, entry->method.p, entry->method.len);
+        outbuf_putc(out, ' ');
+        outbuf_write(out, entry->url.p, entry->url.len);
+        outbuf_write(out, " -> ", 4);
+        outbuf_i64(out, entry->status);
+        return;
+    }
+    for (int i = 0; i < fields->count; i++)
+    {
+        if (i)
+            outbuf_putc(out, ' ');
+        if (!writeNumeric(entry, fields->list[i], "-", out))
+        {
+            LogSlice s = logentry_field(entry, fields->list[i]);
+            outbuf_write(out, s.p, s.len);
+        }
+    }
 }
 
-void printLogCSV(LogEntry *entry, FILE *out)
+/**
+ * @brief Prints one entry as a JSON object (no trailing separator).
+ *
+ * Only the projected fields are touched, so fields that are not printed
+ * are never located in the source line. Strings are escaped straight into
+ * the output buffer.
+ */
+void printLogJSON(LogEntry *entry, const FieldSet *fields, OutBuf *out)
 {
-    fprintf(out, "\"%s\",\"%s\",\"%s\",\"%s\",%d,\"%s\"\n",
-           entry->timestamp, entry->ip, entry->method, entry->url, entry->status, entry->userAgent);
+    FieldSet def;
+    if (!fields)
+    {
+        fieldset_default(&def);
+        fields = &def;
+    }
+    outbuf_write(out, "  {", 3);
+    for (int i = 0; i < fields->count; i++)
+    {
+        LogField f = fields->list[i];
+        if (i)
+            outbuf_write(out, ", ", 2);
+        outbuf_putc(out, '"');
+        outbuf_puts(out, field_names[f]);
+        outbuf_write(out, "\": ", 3);
+        if (!writeNumeric(entry, f, "null", out))
+        {
+            outbuf_putc(out, '"');
+            outbuf_json(out, logentry_field(entry, f));
+            outbuf_putc(out, '"');
+        }
+    }
+    outbuf_putc(out, '}');
 }
 
+/**
+ * @brief Prints one entry as a CSV row (no trailing newline).
+ *
+ * Text fields are always quoted, with embedded quotes doubled (RFC 4180);
+ * numbers are bare.
+ */
+void printLogCSV(LogEntry *entry, const FieldSet *fields, OutBuf *out)
+{
+    FieldSet def;
+    if (!fields)
+    {
+        fieldset_default(&def);
+        fields = &def;
+    }
+    for (int i = 0; i < fields->count; i++)
+    {
+        LogField f = fields->list[i];
+        if (i)
+            outbuf_putc(out, ',');
+        if (!writeNumeric(entry, f, "", out))
+            outbuf_csv(out, logentry_field(entry, f));
+    }
+}
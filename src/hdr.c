@@ -0,0 +1,180 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "hdr.h"
+
+#define HDR_SUB_BITS 7
+#define HDR_SUB (1u << HDR_SUB_BITS) // buckets per block
+#define HDR_BLOCKS (64 - HDR_SUB_BITS + 1)
+
+/*
+ * Block 0 holds the values 0..127 exactly. Block b >= 1 holds
+ * [128 << (b-1), 256 << (b-1)) in 128 buckets of width 1 << (b-1).
+ */
+struct Hdr
+{
+    uint64_t *block[HDR_BLOCKS]; // HDR_SUB counts each, NULL until used
+    uint64_t n;
+    uint64_t min, max;
+};
+
+Hdr *hdr_new(void)
+{
+    Hdr *h = (Hdr *)calloc(1, sizeof(Hdr));
+    if (!h)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    h->min = UINT64_MAX;
+    return h;
+}
+
+void hdr_free(Hdr *h)
+{
+    if (!h)
+        return;
+    for (int b = 0; b < HDR_BLOCKS; b++)
+        free(h->block[b]);
+    free(h);
+}
+
+static uint64_t *use_block(Hdr *h, int b)
+{
+    if (!h->block[b] && !(h->block[b] = (uint64_t *)calloc(HDR_SUB, sizeof(uint64_t))))
+    {
+        perror("calloc");
+        exit(1);
+    }
+    return h->block[b];
+}
+
+void hdr_add(Hdr *h, uint64_t v)
+{
+    int b = 0;
+    unsigned sub = (unsigned)v;
+    if (v >= HDR_SUB)
+    {
+        int e = 63 - __builtin_clzll(v); // HDR_SUB_BITS..63
+        b = e - HDR_SUB_BITS + 1;
+        sub = (unsigned)(v >> (b - 1)) - HDR_SUB;
+    }
+    use_block(h, b)[sub]++;
+    h->n++;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+void hdr_merge(Hdr *dst, const Hdr *src)
+{
+    for (int b = 0; b < HDR_BLOCKS; b++)
+    {
+        if (!src->block[b])
+            continue;
+        uint64_t *d = use_block(dst, b);
+        for (unsigned i = 0; i < HDR_SUB; i++)
+            d[i] += src->block[b][i];
+    }
+    dst->n += src->n;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/**
+ * @brief Writes the histogram (host byte order) for hdr_load().
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+int hdr_save(const Hdr *h, FILE *fp)
+{
+    uint64_t used = 0;
+    for (int b = 0; b < HDR_BLOCKS; b++)
+        if (h->block[b])
+            used |= (uint64_t)1 << b;
+    uint64_t head[4] = {h->n, h->min, h->max, used};
+    int ok = fwrite(head, sizeof(head), 1, fp) == 1;
+    for (int b = 0; b < HDR_BLOCKS && ok; b++)
+        if (h->block[b])
+            ok = fwrite(h->block[b], sizeof(uint64_t), HDR_SUB, fp) == HDR_SUB;
+    return ok;
+}
+
+/**
+ * @brief Adds a histogram written by hdr_save() into h.
+ *
+ * @return 1 on success, 0 on a short read.
+ */
+int hdr_load(Hdr *h, FILE *fp)
+{
+    uint64_t head[4], counts[HDR_SUB];
+    if (fread(head, sizeof(head), 1, fp) != 1)
+        return 0;
+    for (int b = 0; b < HDR_BLOCKS; b++)
+    {
+        if (!(head[3] >> b & 1))
+            continue;
+        if (fread(counts, sizeof(uint64_t), HDR_SUB, fp) != HDR_SUB)
+            return 0;
+        uint64_t *d = use_block(h, b);
+        for (unsigned i = 0; i < HDR_SUB; i++)
+            d[i] += counts[i];
+    }
+    h->n += head[0];
+    if (head[1] < h->min)
+        h->min = head[1];
+    if (head[2] > h->max)
+        h->max = head[2];
+    return 1;
+}
+
+uint64_t hdr_count(const Hdr *h)
+{
+    return h->n;
+}
+
+/**
+ * @brief Value at quantile q (0..1): the middle of the bucket holding the
+ *        ceil(q * count)-th smallest value, clamped to the observed range.
+ *        The first and last ranks are exact (min and max).
+ *
+ * @return 0 for an empty histogram.
+ */
+uint64_t hdr_quantile(const Hdr *h, double q)
+{
+    if (h->n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->n);
+    if ((double)rank < q * (double)h->n)
+        rank++;
+    if (rank < 1)
+        rank = 1;
+    if (rank >= h->n)
+        return h->max;
+    if (rank == 1)
+        return h->min;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HDR_BLOCKS; b++)
+    {
+        if (!h->block[b])
+            continue;
+        for (unsigned i = 0; i < HDR_SUB; i++)
+        {
+            seen += h->block[b][i];
+            if (seen < rank)
+                continue;
+            uint64_t lo = b == 0 ? i : (uint64_t)(HDR_SUB + i) << (b - 1);
+            uint64_t width = b == 0 ? 1 : (uint64_t)1 << (b - 1);
+            uint64_t v = lo + (width - 1) / 2;
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
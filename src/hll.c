@@ -0,0 +1,314 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hll.h"
+
+#define HLL_P 14 // dense: 2^14 registers
+#define HLL_M (1u << HLL_P)
+#define HLL_SP 25 // sparse: 25-bit indices
+#define HLL_SPARSE_MAX (HLL_M / 4) // sparse entries before switching to registers (16 KiB either way)
+#define HLL_PENDING 256            // unsorted sparse entries before they are merged in
+
+/*
+ * A sparse entry is (index << 6) | rank for the top 25 hash bits and the
+ * rank (leading zeros + 1) of the remaining 39. Sorting entries orders
+ * them by index, then rank.
+ */
+struct Hll
+{
+    uint8_t *reg;    // HLL_M registers once dense, else NULL
+    uint32_t *list;  // sparse: sorted entries, then up to HLL_PENDING unsorted ones
+    size_t nsorted, n, cap;
+};
+
+static void *xmalloc(size_t n)
+{
+    void *p = malloc(n ? n : 1);
+    if (!p)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+Hll *hll_new(void)
+{
+    Hll *h = (Hll *)calloc(1, sizeof(Hll));
+    if (!h)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    return h;
+}
+
+void hll_free(Hll *h)
+{
+    if (!h)
+        return;
+    free(h->reg);
+    free(h->list);
+    free(h);
+}
+
+// Leading zeros of the bits below the top p, plus one; capped at 64 - p + 1
+static unsigned hash_rank(uint64_t hash, int p)
+{
+    uint64_t w = hash << p;
+    unsigned r = w ? (unsigned)__builtin_clzll(w) + 1 : 65;
+    return r > 64u - p + 1 ? 64u - p + 1 : r;
+}
+
+static void set_reg(uint8_t *reg, uint32_t idx, unsigned rank)
+{
+    if (rank > reg[idx])
+        reg[idx] = (uint8_t)rank;
+}
+
+// Folds a sparse entry into dense registers
+static void entry_to_reg(uint8_t *reg, uint32_t e)
+{
+    uint32_t idx = e >> 6;
+    uint32_t low = idx & ((1u << (HLL_SP - HLL_P)) - 1); // index bits the dense form ranks
+    unsigned rank = low ? (unsigned)__builtin_clz(low) - (32 - (HLL_SP - HLL_P)) + 1
+                        : (HLL_SP - HLL_P) + (e & 63);
+    set_reg(reg, idx >> (HLL_SP - HLL_P), rank);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts entries and keeps the highest rank per index; returns the new count
+static size_t sort_unique(uint32_t *e, size_t n)
+{
+    size_t out = 0;
+    qsort(e, n, sizeof(uint32_t), cmp_u32);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (out && (e[out - 1] >> 6) == (e[i] >> 6))
+            out--; // same index, higher or equal rank
+        e[out++] = e[i];
+    }
+    return out;
+}
+
+static void to_dense(Hll *h)
+{
+    h->reg = (uint8_t *)calloc(HLL_M, 1);
+    if (!h->reg)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < h->n; i++)
+        entry_to_reg(h->reg, h->list[i]);
+    free(h->list);
+    h->list = NULL;
+    h->n = h->nsorted = h->cap = 0;
+}
+
+static void compact(Hll *h)
+{
+    h->n = h->nsorted = sort_unique(h->list, h->n);
+    if (h->n > HLL_SPARSE_MAX)
+        to_dense(h);
+}
+
+static void reserve(Hll *h, size_t need)
+{
+    if (need <= h->cap)
+        return;
+    size_t cap = h->cap ? h->cap : 16;
+    while (cap < need)
+        cap *= 2;
+    uint32_t *l = (uint32_t *)realloc(h->list, cap * sizeof(uint32_t));
+    if (!l)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    h->list = l;
+    h->cap = cap;
+}
+
+/**
+ * @brief Counts one value, given as a 64-bit hash of its bytes.
+ */
+void hll_add(Hll *h, uint64_t hash)
+{
+    if (h->reg)
+    {
+        set_reg(h->reg, (uint32_t)(hash >> (64 - HLL_P)), hash_rank(hash, HLL_P));
+        return;
+    }
+    reserve(h, h->n + 1);
+    h->list[h->n++] = (uint32_t)(hash >> (64 - HLL_SP)) << 6 | hash_rank(hash, HLL_SP);
+    if (h->n - h->nsorted >= HLL_PENDING)
+        compact(h);
+}
+
+/**
+ * @brief Folds src into dst. src is unchanged.
+ */
+void hll_merge(Hll *dst, const Hll *src)
+{
+    if (!src->reg && !dst->reg)
+    {
+        reserve(dst, dst->n + src->n);
+        memcpy(dst->list + dst->n, src->list, src->n * sizeof(uint32_t));
+        dst->n += src->n;
+        compact(dst);
+        return;
+    }
+    if (!dst->reg)
+        to_dense(dst);
+    if (src->reg)
+    {
+        for (uint32_t i = 0; i < HLL_M; i++)
+            set_reg(dst->reg, i, src->reg[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < src->n; i++)
+            entry_to_reg(dst->reg, src->list[i]);
+    }
+}
+
+/**
+ * @brief Writes the counter (host byte order) for hll_load().
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+int hll_save(const Hll *h, FILE *fp)
+{
+    uint64_t head[2] = {h->reg ? 1 : 0, h->reg ? HLL_M : h->n};
+    if (fwrite(head, sizeof(head), 1, fp) != 1)
+        return 0;
+    if (h->reg)
+        return fwrite(h->reg, 1, HLL_M, fp) == HLL_M;
+    return fwrite(h->list, sizeof(uint32_t), h->n, fp) == h->n;
+}
+
+/**
+ * @brief Folds a counter written by hll_save() into h.
+ *
+ * @return 1 on success, 0 on a short read or a malformed record.
+ */
+int hll_load(Hll *h, FILE *fp)
+{
+    uint64_t head[2];
+    if (fread(head, sizeof(head), 1, fp) != 1)
+        return 0;
+    if (head[0])
+    {
+        uint8_t *reg = (uint8_t *)xmalloc(HLL_M);
+        if (head[1] != HLL_M || fread(reg, 1, HLL_M, fp) != HLL_M)
+        {
+            free(reg);
+            return 0;
+        }
+        if (!h->reg)
+            to_dense(h);
+        for (uint32_t i = 0; i < HLL_M; i++)
+            set_reg(h->reg, i, reg[i]);
+        free(reg);
+        return 1;
+    }
+    if (head[1] > HLL_SPARSE_MAX + HLL_PENDING)
+        return 0;
+    size_t n = (size_t)head[1];
+    if (h->reg)
+    {
+        uint32_t e;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (fread(&e, sizeof(e), 1, fp) != 1)
+                return 0;
+            entry_to_reg(h->reg, e);
+        }
+        return 1;
+    }
+    reserve(h, h->n + n);
+    if (fread(h->list + h->n, sizeof(uint32_t), n, fp) != n)
+        return 0;
+    h->n += n;
+    compact(h);
+    return 1;
+}
+
+static double sigma(double x)
+{
+    if (x == 1.0)
+        return INFINITY;
+    double y = 1.0, z = x, zp;
+    do
+    {
+        x *= x;
+        zp = z;
+        z += x * y;
+        y += y;
+    } while (z != zp);
+    return z;
+}
+
+static double tau(double x)
+{
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+    double y = 1.0, z = 1.0 - x, zp;
+    do
+    {
+        x = sqrt(x);
+        zp = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != zp);
+    return z / 3.0;
+}
+
+/*
+ * Ertl, "New cardinality estimation algorithms for HyperLogLog sketches"
+ * (2017): c[k] is the number of registers holding k, for m registers that
+ * rank the remaining q hash bits.
+ */
+static double ertl_estimate(const uint64_t *c, double m, int q)
+{
+    double z = m * tau(1.0 - (double)c[q + 1] / m);
+    for (int k = q; k >= 1; k--)
+        z = 0.5 * (z + (double)c[k]);
+    z += m * sigma((double)c[0] / m);
+    return 0.5 / log(2.0) * m * m / z;
+}
+
+/**
+ * @brief Estimated number of distinct values added.
+ */
+double hll_estimate(const Hll *h)
+{
+    uint64_t c[66] = {0};
+    if (h->reg)
+    {
+        for (uint32_t i = 0; i < HLL_M; i++)
+            c[h->reg[i]]++;
+        return ertl_estimate(c, (double)HLL_M, 64 - HLL_P);
+    }
+
+    // sparse: the pending entries may repeat indices, so rank a sorted copy
+    uint32_t *e = (uint32_t *)xmalloc(h->n * sizeof(uint32_t));
+    memcpy(e, h->list, h->n * sizeof(uint32_t));
+    size_t n = sort_unique(e, h->n);
+    for (size_t i = 0; i < n; i++)
+        c[e[i] & 63]++;
+    free(e);
+    c[0] = ((uint64_t)1 << HLL_SP) - n;
+    return ertl_estimate(c, (double)(1u << HLL_SP), 64 - HLL_SP);
+}
@@ -0,0 +1,537 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "hash.h"
+#include "linesrc.h"
+#include "parser.h"
+
+#define INDEX_MAGIC "LFIDX01"
+#define INDEX_VERSION 1
+#define INDEX_TAIL_BYTES 4096 // hashed to recognise the indexed prefix after growth
+#define INDEX_MAX_BLOCK_LINES (1u << 24)
+
+// Method bitmap: one bit per well-known method, INDEX_M_OTHER for the rest
+static const char *const index_methods[] = {
+    "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH", "CONNECT", "TRACE"};
+#define INDEX_NMETHODS (int)(sizeof(index_methods) / sizeof(index_methods[0]))
+#define INDEX_M_OTHER (1u << INDEX_NMETHODS)
+
+static unsigned method_bit(LogSlice m)
+{
+    for (int i = 0; i < INDEX_NMETHODS; i++)
+        if (strlen(index_methods[i]) == m.len && memcmp(index_methods[i], m.p, m.len) == 0)
+            return 1u << i;
+    return INDEX_M_OTHER;
+}
+
+// IPs go into the Bloom filter lowercased, so one filter serves --ci and exact terms
+static uint64_t ip_hash(const char *p, size_t n)
+{
+    char buf[PARSE_MAX_IP];
+    if (n > sizeof(buf))
+        n = sizeof(buf);
+    for (size_t i = 0; i < n; i++)
+        buf[i] = (p[i] >= 'A' && p[i] <= 'Z') ? (char)(p[i] + 32) : p[i];
+    return lf_hash64(buf, n);
+}
+
+// k probe positions by double hashing the two halves of one 64-bit hash
+static unsigned bloom_pos(uint64_t h, int i)
+{
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1u;
+    return (h1 + (uint32_t)i * h2) % INDEX_BLOOM_BITS;
+}
+
+static void bloom_add(IndexBlock *b, uint64_t h)
+{
+    for (int i = 0; i < INDEX_BLOOM_HASHES; i++)
+    {
+        unsigned bit = bloom_pos(h, i);
+        b->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int bloom_test(const IndexBlock *b, uint64_t h)
+{
+    for (int i = 0; i < INDEX_BLOOM_HASHES; i++)
+    {
+        unsigned bit = bloom_pos(h, i);
+        if (!(b->bloom[bit / 64] & (1ULL << (bit % 64))))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Starts an empty block summary at byte offset.
+ */
+void index_block_init(IndexBlock *b, uint64_t offset)
+{
+    memset(b, 0, sizeof(*b));
+    b->offset = b->end = offset;
+    b->t_min = INT64_MAX;
+    b->t_max = INT64_MIN;
+}
+
+/**
+ * @brief Counts one parsed line into a block summary.
+ *
+ * Also used by the columnar format (lfc.h) for its per-block zone maps.
+ */
+void index_block_add(IndexBlock *b, LogEntry *e)
+{
+    time_t t;
+
+    b->lines++;
+    unsigned st = (e->status >= 0 && e->status < INDEX_STATUS_BITS - 1) ? (unsigned)e->status
+                                                                         : INDEX_STATUS_BITS - 1;
+    b->status[st / 64] |= 1ULL << (st % 64);
+    b->methods |= method_bit(e->method);
+    bloom_add(b, ip_hash(e->ip.p, e->ip.len));
+    if (logentry_epoch(e, &t))
+    {
+        if ((int64_t)t < b->t_min)
+            b->t_min = (int64_t)t;
+        if ((int64_t)t > b->t_max)
+            b->t_max = (int64_t)t;
+    }
+}
+
+static void block_add(IndexBlock *b, const char *line, size_t len)
+{
+    LogEntry e;
+    char perr[8];
+
+    if (!parse_apache_or_nginx(line, len, &e, perr, sizeof(perr)))
+    {
+        b->lines++;
+        b->failed++;
+        return;
+    }
+    index_block_add(b, &e);
+}
+
+static uint64_t tail_hash(const char *data, uint64_t indexed)
+{
+    uint64_t from = indexed > INDEX_TAIL_BYTES ? indexed - INDEX_TAIL_BYTES : 0;
+    return lf_hash64(data + from, (size_t)(indexed - from));
+}
+
+static char *sidecar_path(const char *path)
+{
+    size_t n = strlen(path);
+    char *s = (char *)malloc(n + sizeof(INDEX_SUFFIX) + 4);
+    if (s)
+    {
+        memcpy(s, path, n);
+        memcpy(s + n, INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+    }
+    return s;
+}
+
+/*
+ * Reads <path>.lfidx and checks that it describes a prefix of this file:
+ * same device and inode, and either the same size and mtime or a larger
+ * file whose bytes just before the indexed end still hash the same.
+ * Returns 1 if usable, 0 if there is no index, -1 if it is stale or corrupt.
+ */
+static int index_read(const char *path, const struct stat *st, const char *data, size_t len,
+                      LogIndex *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+    char *ipath = sidecar_path(path);
+    if (!ipath)
+        return 0;
+    FILE *f = fopen(ipath, "rb");
+    free(ipath);
+    if (!f)
+        return 0;
+
+    int rc = -1;
+    IndexHeader *h = &idx->hdr;
+    if (fread(h, sizeof(*h), 1, f) != 1 || memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != INDEX_VERSION || h->nblocks > (uint64_t)len + 1)
+        goto done;
+    idx->blocks = (IndexBlock *)malloc((size_t)(h->nblocks ? h->nblocks : 1) * sizeof(IndexBlock));
+    if (!idx->blocks || fread(idx->blocks, sizeof(IndexBlock), (size_t)h->nblocks, f) != h->nblocks)
+        goto done;
+
+    if (h->dev != (uint64_t)st->st_dev || h->ino != (uint64_t)st->st_ino || h->indexed > len)
+        goto done;
+    if (h->file_size == (uint64_t)len && h->mtime == (int64_t)st->st_mtime)
+        rc = 1;
+    else if ((uint64_t)len > h->file_size && tail_hash(data, h->indexed) == h->tail_hash)
+        rc = 1; // appended to since the index was written
+    else
+        goto done;
+
+    // blocks must tile [0, indexed) in order
+    uint64_t at = 0;
+    for (uint64_t i = 0; i < h->nblocks && rc == 1; i++)
+    {
+        if (idx->blocks[i].offset != at || idx->blocks[i].end < at)
+            rc = -1;
+        at = idx->blocks[i].end;
+    }
+    if (at != h->indexed)
+        rc = -1;
+
+done:
+    fclose(f);
+    if (rc != 1)
+        index_free(idx);
+    return rc;
+}
+
+/**
+ * @brief Loads and validates the sidecar index of a mapped log file.
+ *
+ * @param path  Log file path; the index is read from path + ".lfidx".
+ * @param fd    Descriptor of the open log (for inode, size and mtime).
+ * @param data, len  The log's mapping.
+ * @param idx   Receives the index; release with index_free().
+ * @return      1 if the index covers a prefix of the file, 0 if there is none,
+ *              -1 if it exists but is stale or unreadable.
+ */
+int index_load(const char *path, int fd, const char *data, size_t len, LogIndex *idx)
+{
+    struct stat st;
+    memset(idx, 0, sizeof(*idx));
+    if (fstat(fd, &st) != 0)
+        return 0;
+    return index_read(path, &st, data, len, idx);
+}
+
+void index_free(LogIndex *idx)
+{
+    free(idx->blocks);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/**
+ * @brief Builds or extends <path>.lfidx.
+ *
+ * If a valid index exists and the file has only grown, its complete blocks are
+ * kept and indexing resumes where they end. Only newline-terminated lines are
+ * indexed; a partially written last line is left for the next run. The index
+ * is written to a temporary file and renamed into place.
+ *
+ * @param path         Log file to index.
+ * @param block_lines  Lines per block (0 = INDEX_DEFAULT_BLOCK_LINES).
+ * @return             1 on success, 0 on error (reported on stderr).
+ */
+int index_build(const char *path, unsigned block_lines)
+{
+    if (block_lines == 0)
+        block_lines = INDEX_DEFAULT_BLOCK_LINES;
+
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return 0;
+    }
+    struct stat st;
+    LineSource src;
+    if (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "[%s] index: not a regular file\n", path);
+        fclose(in);
+        return 0;
+    }
+    if (!linesrc_open(&src, in))
+    {
+        perror("linesrc_open");
+        fclose(in);
+        return 0;
+    }
+    if (!src.map && st.st_size > 0)
+    {
+        fprintf(stderr, "[%s] index: cannot map file\n", path);
+        linesrc_close(&src);
+        fclose(in);
+        return 0;
+    }
+
+    // resume after the complete blocks of a still-valid index
+    LogIndex old;
+    uint64_t kept = 0, start = 0;
+    if (src.map && index_read(path, &st, src.map, src.map_len, &old) == 1)
+    {
+        if (old.hdr.block_lines == block_lines)
+        {
+            while (kept < old.hdr.nblocks && old.blocks[kept].lines == block_lines)
+                kept++;
+            start = kept ? old.blocks[kept - 1].end : 0;
+        }
+    }
+    else
+        memset(&old, 0, sizeof(old));
+
+    size_t cap = (size_t)kept + 16, n = (size_t)kept;
+    IndexBlock *blocks = (IndexBlock *)malloc(cap * sizeof(IndexBlock));
+    if (!blocks)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    if (kept)
+        memcpy(blocks, old.blocks, (size_t)kept * sizeof(IndexBlock));
+    index_free(&old);
+
+    IndexBlock cur;
+    index_block_init(&cur, start);
+    if (src.map)
+    {
+        const char *line;
+        size_t len;
+        linesrc_range(&src, (size_t)start, src.map_len);
+        while (linesrc_next(&src, &line, &len) > 0)
+        {
+            size_t off = (size_t)(line - src.map);
+            if (off + len >= src.map_len)
+                break; // no newline yet: the writer may still be on this line
+            block_add(&cur, line, len);
+            cur.end = off + len + 1;
+            if (cur.lines == block_lines)
+            {
+                if (n == cap)
+                {
+                    cap *= 2;
+                    IndexBlock *nb = (IndexBlock *)realloc(blocks, cap * sizeof(IndexBlock));
+                    if (!nb)
+                    {
+                        perror("realloc");
+                        exit(1);
+                    }
+                    blocks = nb;
+                }
+                blocks[n++] = cur;
+                index_block_init(&cur, cur.end);
+            }
+        }
+    }
+    if (cur.lines > 0)
+    {
+        if (n == cap)
+        {
+            IndexBlock *nb = (IndexBlock *)realloc(blocks, (cap + 1) * sizeof(IndexBlock));
+            if (!nb)
+            {
+                perror("realloc");
+                exit(1);
+            }
+            blocks = nb;
+        }
+        blocks[n++] = cur;
+    }
+
+    IndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.version = INDEX_VERSION;
+    h.block_lines = block_lines;
+    h.dev = (uint64_t)st.st_dev;
+    h.ino = (uint64_t)st.st_ino;
+    h.file_size = (uint64_t)st.st_size;
+    h.mtime = (int64_t)st.st_mtime;
+    h.indexed = n ? blocks[n - 1].end : 0;
+    h.tail_hash = src.map ? tail_hash(src.map, h.indexed) : 0;
+    h.nblocks = n;
+
+    char *ipath = sidecar_path(path);
+    char *tmp = ipath ? (char *)malloc(strlen(ipath) + 5) : NULL;
+    if (!tmp)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(tmp, "%s.tmp", ipath);
+
+    int ok = 0;
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+        perror(tmp);
+    else
+    {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(blocks, sizeof(IndexBlock), n, f) == n;
+        ok = (fclose(f) == 0) && ok;
+        if (ok && rename(tmp, ipath) != 0)
+        {
+            perror(ipath);
+            ok = 0;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "[%s] index: write failed: %s\n", path, strerror(errno));
+            remove(tmp);
+        }
+    }
+    if (ok)
+        fprintf(stderr, "[%s] index: %zu blocks of %u lines (%zu reused), %llu of %lld bytes\n",
+                path, n, block_lines, (size_t)kept, (unsigned long long)h.indexed, (long long)st.st_size);
+
+    free(tmp);
+    free(ipath);
+    free(blocks);
+    linesrc_close(&src);
+    fclose(in);
+    return ok;
+}
+
+static int has_wildcard(const char *s)
+{
+    return strchr(s, '*') || strchr(s, '?');
+}
+
+// Whether a term can rule out a block from its summary
+static int term_prunable(const QueryTerm *t)
+{
+    switch (t->field)
+    {
+    case QF_TIMESTAMP:
+        return t->has_t && t->op != QOP_NE;
+    case QF_STATUS:
+        return 1;
+    case QF_METHOD:
+        return t->op == QOP_EQ || t->op == QOP_CONTAINS || t->op == QOP_REGEX || t->op == QOP_IN;
+    case QF_IP:
+        return (t->op == QOP_EQ || t->op == QOP_CONTAINS) && !has_wildcard(t->value);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Returns 1 if the query has any term the block summaries can test.
+ */
+int index_queryable(const Query *q)
+{
+    for (int i = 0; i < q->nand; i++)
+        if (term_prunable(&q->terms[i]))
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief Tests a block summary against the top-level AND terms of a query.
+ *
+ * @return 0 if no line in the block can match, 1 if it has to be scanned.
+ */
+int index_block_may_match(const IndexBlock *b, const Query *q)
+{
+    if (q->count > 0 && b->lines == b->failed)
+        return 0; // every term needs a parsed line
+    for (int i = 0; i < q->nand; i++)
+    {
+        const QueryTerm *t = &q->terms[i];
+        if (!term_prunable(t))
+            continue;
+        int ok = 0;
+        switch (t->field)
+        {
+        case QF_TIMESTAMP:
+        {
+            int64_t v = (int64_t)t->value_t;
+            if (b->t_min > b->t_max)
+                return 0; // no decodable timestamps at all
+            switch (t->op)
+            {
+            case QOP_GT:
+                ok = b->t_max > v;
+                break;
+            case QOP_GTE:
+                ok = b->t_max >= v;
+                break;
+            case QOP_LT:
+                ok = b->t_min < v;
+                break;
+            case QOP_LTE:
+                ok = b->t_min <= v;
+                break;
+            default: // EQ, CONTAINS
+                ok = b->t_min <= v && v <= b->t_max;
+                break;
+            }
+        }
+        break;
+        case QF_STATUS:
+            ok = (b->status[(INDEX_STATUS_BITS - 1) / 64] >> ((INDEX_STATUS_BITS - 1) % 64)) & 1;
+            for (int s = 0; s < INDEX_STATUS_BITS - 1 && !ok; s++)
+                if ((b->status[s / 64] >> (s % 64)) & 1)
+                    ok = query_status_match(t, s);
+            break;
+        case QF_METHOD:
+            ok = (b->methods & INDEX_M_OTHER) != 0;
+            for (int m = 0; m < INDEX_NMETHODS && !ok; m++)
+                if (b->methods & (1u << m))
+                    ok = query_text_match(t, index_methods[m], strlen(index_methods[m]));
+            break;
+        case QF_IP:
+            ok = bloom_test(b, ip_hash(t->value, strlen(t->value)));
+            break;
+        default:
+            ok = 1;
+            break;
+        }
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Entry point for `logfire index build FILE... [--block-lines N]`.
+ *
+ * @return Process exit status.
+ */
+int index_main(int argc, char *argv[])
+{
+    unsigned block_lines = INDEX_DEFAULT_BLOCK_LINES;
+    int nfiles = 0, failed = 0;
+
+    if (argc < 2 || strcmp(argv[1], "build") != 0)
+    {
+        fprintf(stderr, "Usage: logfire index build FILE... [--block-lines N]\n");
+        return 1;
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--block-lines") == 0)
+        {
+            char *endp = NULL;
+            long n = i + 1 < argc ? strtol(argv[++i], &endp, 10) : 0;
+            if (!endp || *endp || n < 1 || n > (long)INDEX_MAX_BLOCK_LINES)
+            {
+                fprintf(stderr, "--block-lines: invalid value '%s'\n", i < argc ? argv[i] : "");
+                return 1;
+            }
+            block_lines = (unsigned)n;
+        }
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--block-lines") == 0)
+        {
+            i++;
+            continue;
+        }
+        nfiles++;
+        if (!index_build(argv[i], block_lines))
+            failed++;
+    }
+    if (nfiles == 0)
+    {
+        fprintf(stderr, "Usage: logfire index build FILE... [--block-lines N]\n");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
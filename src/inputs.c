@@ -0,0 +1,431 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "logfire.h"
+#include "linesrc.h"
+#include "lfc.h"
+
+/*
+ * Batch processing of all --log inputs.
+ *
+ * With --jobs 1 (the default) inputs are scanned one after another. With
+ * --jobs N, up to N inputs are scanned concurrently, each by one worker
+ * thread. Workers format matches into blocks of whole entries and queue
+ * them on their input; the calling thread is the only writer. It drains
+ * the inputs either grouped in argument order (default) or in whatever
+ * order blocks arrive (--interleave). In grouped mode, a worker that is
+ * not on the input currently being written stops once QUEUE_CAP bytes are
+ * queued, so memory stays bounded however far ahead it is.
+ *
+ * Either way all inputs share one JSON array, every input gets its own
+ * summary line and a combined total follows. When aggregating, each worker
+ * keeps a private table for the inputs it scans and merges it into the
+ * combined one when it is done; nothing is queued for the writer.
+ */
+
+#define BLOCK_BYTES (256u << 10) // hand a block to the writer at this size
+#define QUEUE_CAP (64u << 20)    // per-input backlog while waiting its turn
+
+typedef struct Block
+{
+    struct Block *next;
+    char *out, *err;
+    size_t out_len, err_len;
+} Block;
+
+typedef struct
+{
+    const char *path;
+    Block *head, *tail;
+    size_t queued; // bytes in head..tail
+    ScanStats st;
+    double secs;
+    int missing; // could not be opened; no summary
+    int done;
+    int reported;
+} InputJob;
+
+typedef struct
+{
+    const ScanPlan *plan;
+    Agg *agg; // merge target for the workers' tables, or NULL
+    InputJob *jobs;
+    int njobs;
+    int next;    // next input to hand to a worker
+    int current; // grouped mode: input being written
+    int grouped;
+    pthread_mutex_t mu;
+    pthread_cond_t cv_ready; // a block was queued or an input finished
+    pthread_cond_t cv_space; // the writer drained a queue or moved on
+} InputPool;
+
+// Opens a fresh output block (a memory buffer for matches, a memory stream for warnings)
+static void block_open(const ScanPlan *plan, Block *b, OutBuf *out, FILE **err)
+{
+    memset(b, 0, sizeof(*b));
+    outbuf_init(out, NULL);
+    *err = plan->opt->strict ? open_memstream(&b->err, &b->err_len) : stderr;
+    if (!*err)
+    {
+        perror("open_memstream");
+        exit(1);
+    }
+}
+
+// Closes the current block and queues it, waiting if the input is over its cap
+static void block_push(InputPool *pool, InputJob *job, Block *cur, OutBuf *out, FILE *err)
+{
+    if (err != stderr)
+        fclose(err);
+    cur->out = out->buf; // the block takes over the buffer
+    cur->out_len = out->len;
+    out->buf = NULL;
+    if (cur->out_len == 0 && cur->err_len == 0)
+    {
+        free(cur->out);
+        free(cur->err);
+        return;
+    }
+
+    Block *b = (Block *)malloc(sizeof(Block));
+    if (!b)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    *b = *cur;
+
+    pthread_mutex_lock(&pool->mu);
+    while (pool->grouped && job != &pool->jobs[pool->current] && job->queued >= QUEUE_CAP)
+        pthread_cond_wait(&pool->cv_space, &pool->mu);
+    if (job->tail)
+        job->tail->next = b;
+    else
+        job->head = b;
+    job->tail = b;
+    job->queued += b->out_len + b->err_len;
+    pthread_cond_broadcast(&pool->cv_ready);
+    pthread_mutex_unlock(&pool->mu);
+}
+
+// Columnar input: output is handed over after each block of rows
+static void scan_lfc(InputPool *pool, InputJob *job, FILE *in)
+{
+    const ScanPlan *plan = pool->plan;
+    double t0 = now_sec();
+    LfcReader *r = lfc_open(plan, in, job->path, &job->st);
+    if (!r)
+        return;
+
+    Block cur;
+    OutBuf out;
+    FILE *err;
+    int first_json = 1;
+
+    block_open(plan, &cur, &out, &err);
+    while (lfc_next(r, &out, &first_json, &job->st) > 0)
+    {
+        if (out.len >= BLOCK_BYTES)
+        {
+            block_push(pool, job, &cur, &out, err);
+            block_open(plan, &cur, &out, &err);
+            first_json = 1;
+        }
+    }
+    block_push(pool, job, &cur, &out, err);
+    job->secs = now_sec() - t0;
+    lfc_close(r);
+}
+
+static void scan_input(InputPool *pool, InputJob *job)
+{
+    const ScanPlan *plan = pool->plan;
+    FILE *in = stdin;
+    if (strcmp(job->path, "-") != 0 && !(in = fopen(job->path, "rb")))
+    {
+        perror(job->path);
+        job->missing = 1;
+        return;
+    }
+    if (lfc_detect(in))
+    {
+        scan_lfc(pool, job, in);
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    LineSource src;
+    if (!linesrc_open(&src, in))
+    {
+        perror("linesrc_open");
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+    scan_prune(plan, &src, job->path, &job->st);
+
+    double t0 = now_sec();
+    Block cur;
+    OutBuf out;
+    FILE *err;
+    int first_json = 1, rc;
+    const char *blk;
+    size_t len;
+
+    // output is checked after each input block (about 1 MiB of lines)
+    block_open(plan, &cur, &out, &err);
+    while ((rc = linesrc_next_block(&src, &blk, &len)) > 0)
+    {
+        scan_block(plan, blk, len, job->path, &out, err, &first_json, &job->st);
+        if (out.len >= BLOCK_BYTES)
+        {
+            block_push(pool, job, &cur, &out, err);
+            block_open(plan, &cur, &out, &err);
+            first_json = 1; // each block is an independent JSON fragment
+        }
+    }
+    if (rc < 0)
+        fprintf(stderr, "[warn] read error (%s)\n", job->path);
+    block_push(pool, job, &cur, &out, err);
+
+    job->st.bytes = src.bytes;
+    job->secs = now_sec() - t0;
+    linesrc_close(&src);
+    if (in != stdin)
+        fclose(in);
+}
+
+static void *input_worker(void *arg)
+{
+    InputPool *pool = (InputPool *)arg;
+    Agg *part = pool->agg ? agg_new(pool->plan->agg) : NULL;
+
+    pthread_mutex_lock(&pool->mu);
+    while (pool->next < pool->njobs)
+    {
+        InputJob *job = &pool->jobs[pool->next++];
+        pthread_mutex_unlock(&pool->mu);
+
+        job->st.agg = part;
+        scan_input(pool, job);
+
+        pthread_mutex_lock(&pool->mu);
+        job->done = 1;
+        pthread_cond_broadcast(&pool->cv_ready);
+    }
+    if (part)
+        agg_merge(pool->agg, part);
+    pthread_mutex_unlock(&pool->mu);
+    agg_free(part);
+    return NULL;
+}
+
+static void add_stats(ScanStats *sum, const ScanStats *st)
+{
+    sum->total += st->total;
+    sum->parsed += st->parsed;
+    sum->failed += st->failed;
+    sum->skipped += st->skipped;
+    sum->bytes += st->bytes;
+}
+
+// Writer side of the pool; runs on the calling thread
+static void drain_pool(InputPool *pool, OutBuf *out, int *first_json, ScanStats *sum)
+{
+    int format_json = pool->plan->opt->format == FORMAT_JSON;
+    int remaining = pool->njobs;
+
+    pthread_mutex_lock(&pool->mu);
+    while (remaining > 0)
+    {
+        InputJob *job = NULL;
+        if (pool->grouped)
+        {
+            job = &pool->jobs[pool->current];
+            if (!job->head && !job->done)
+                job = NULL;
+        }
+        else
+        {
+            for (int i = 0; i < pool->next && !job; i++)
+                if (!pool->jobs[i].reported && (pool->jobs[i].head || pool->jobs[i].done))
+                    job = &pool->jobs[i];
+        }
+        if (!job)
+        {
+            pthread_cond_wait(&pool->cv_ready, &pool->mu);
+            continue;
+        }
+
+        Block *b = job->head;
+        if (b)
+        {
+            job->head = b->next;
+            if (!job->head)
+                job->tail = NULL;
+            job->queued -= b->out_len + b->err_len;
+            pthread_cond_broadcast(&pool->cv_space);
+            pthread_mutex_unlock(&pool->mu);
+
+            if (b->err_len)
+                fwrite(b->err, 1, b->err_len, stderr);
+            if (b->out_len)
+            {
+                if (format_json && !*first_json)
+                    outbuf_putc(out, ',');
+                outbuf_write(out, b->out, b->out_len);
+                *first_json = 0;
+            }
+            free(b->out);
+            free(b->err);
+            free(b);
+
+            pthread_mutex_lock(&pool->mu);
+            continue;
+        }
+
+        // input finished and fully written
+        job->reported = 1;
+        remaining--;
+        if (pool->grouped && pool->current + 1 < pool->njobs)
+        {
+            pool->current++;
+            pthread_cond_broadcast(&pool->cv_space);
+        }
+        pthread_mutex_unlock(&pool->mu);
+        outbuf_flush(out);
+        if (!job->missing)
+            scan_summary(job->path, &job->st, job->secs);
+        add_stats(sum, &job->st);
+        pthread_mutex_lock(&pool->mu);
+    }
+    pthread_mutex_unlock(&pool->mu);
+}
+
+/**
+ * @brief Processes every --log input into one output stream.
+ *
+ * Inputs are scanned sequentially, or concurrently with --jobs N. JSON
+ * output is a single array across all inputs. Each input gets a summary
+ * line, and a combined total is printed when there is more than one input.
+ * With --group-by/--agg, one table covering all inputs is printed instead of
+ * the matching entries.
+ *
+ * @param opt  Parsed command-line options (inputs, format, filters, ...).
+ * @param out  Output stream.
+ */
+void process_inputs(const CLIOptions *opt, FILE *out)
+{
+    ScanPlan plan;
+    ScanStats sum;
+    OutBuf ob;
+    int first_json = 1;
+
+    scan_plan_init(&plan, opt);
+    memset(&sum, 0, sizeof(sum));
+    if (plan.agg)
+        sum.agg = agg_new(plan.agg);
+    double t0 = now_sec();
+
+    outbuf_init(&ob, out);
+    if (opt->format == FORMAT_JSON && !sum.agg)
+        outbuf_putc(&ob, '[');
+
+    int nworkers = opt->jobs < opt->input_count ? opt->jobs : opt->input_count;
+    if (nworkers <= 1)
+    {
+        for (int i = 0; i < opt->input_count; i++)
+        {
+            const char *path = opt->inputs[i];
+            FILE *in = stdin;
+            if (strcmp(path, "-") != 0 && !(in = fopen(path, "rb")))
+            {
+                perror(path);
+                continue;
+            }
+            ScanStats st;
+            memset(&st, 0, sizeof(st));
+            st.agg = sum.agg;
+            double t1 = now_sec();
+            scan_stream(&plan, in, path, &ob, &first_json, &st);
+            if (in != stdin)
+                fclose(in);
+            outbuf_flush(&ob);
+            scan_summary(path, &st, now_sec() - t1);
+            add_stats(&sum, &st);
+        }
+    }
+    else
+    {
+        InputPool pool;
+        memset(&pool, 0, sizeof(pool));
+        pool.plan = &plan;
+        pool.agg = sum.agg;
+        pool.njobs = opt->input_count;
+        pool.grouped = !opt->interleave;
+        pool.jobs = (InputJob *)calloc((size_t)pool.njobs, sizeof(InputJob));
+        pthread_t *tids = (pthread_t *)malloc((size_t)nworkers * sizeof(pthread_t));
+        if (!pool.jobs || !tids)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        for (int i = 0; i < pool.njobs; i++)
+            pool.jobs[i].path = opt->inputs[i];
+        pthread_mutex_init(&pool.mu, NULL);
+        pthread_cond_init(&pool.cv_ready, NULL);
+        pthread_cond_init(&pool.cv_space, NULL);
+
+        int started = 0;
+        for (int i = 0; i < nworkers; i++)
+        {
+            if (pthread_create(&tids[i], NULL, input_worker, &pool) != 0)
+                break;
+            started++;
+        }
+        if (started == 0)
+        {
+            fprintf(stderr, "[warn] could not start worker threads; scanning sequentially\n");
+            pool.grouped = 0; // nothing to wait for: the single worker runs to completion
+            input_worker(&pool);
+        }
+
+        drain_pool(&pool, &ob, &first_json, &sum);
+
+        for (int i = 0; i < started; i++)
+            pthread_join(tids[i], NULL);
+        pthread_mutex_destroy(&pool.mu);
+        pthread_cond_destroy(&pool.cv_ready);
+        pthread_cond_destroy(&pool.cv_space);
+        free(tids);
+        free(pool.jobs);
+    }
+
+    if (!sum.agg && opt->format == FORMAT_JSON)
+        outbuf_write(&ob, "]\n", 2);
+    outbuf_free(&ob);
+    if (sum.agg)
+    {
+        agg_write(sum.agg, opt->format, out);
+        agg_summary(sum.agg, stderr);
+        agg_free(sum.agg);
+    }
+
+    if (opt->input_count > 1)
+    {
+        double secs = now_sec() - t0;
+        char skipped[48] = "";
+        if (sum.skipped)
+            snprintf(skipped, sizeof(skipped), " skipped=%lld", sum.skipped);
+        fprintf(stderr, "[total] files=%d total=%lld parsed=%lld failed=%lld%s bytes=%llu (%.1f MB/s)\n",
+                opt->input_count, sum.total, sum.parsed, sum.failed, skipped, sum.bytes,
+                secs > 0 ? (double)sum.bytes / secs / 1e6 : 0.0);
+    }
+    scan_plan_free(&plan);
+}
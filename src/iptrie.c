@@ -0,0 +1,454 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "iptrie.h"
+
+typedef struct
+{
+    unsigned char addr[16];
+    int len; // prefix length in bits
+} IpPrefix;
+
+typedef struct
+{
+    uint64_t leaf[4];  // bytes covered by a prefix that ends here
+    uint64_t child[4]; // bytes that continue in a child node
+    uint32_t base;     // index of the first child
+} IpNode;
+
+typedef struct
+{
+    IpPrefix *list; // collected by iptrie_add(), released by iptrie_build()
+    size_t count, cap;
+    IpNode *nodes;
+    size_t nnodes, nodecap;
+    int root; // -1: empty
+} IpFamily;
+
+struct IpTrie
+{
+    IpFamily fam[2]; // [0] IPv4, [1] IPv6
+    size_t prefixes;
+};
+
+/* --- address parsing ----------------------------------------------------- */
+
+static int parse_v4(const char *s, size_t n, unsigned char out[4])
+{
+    size_t i = 0;
+    for (int part = 0; part < 4; part++)
+    {
+        unsigned v = 0;
+        size_t start = i;
+        while (i < n && s[i] >= '0' && s[i] <= '9' && i - start < 3)
+            v = v * 10 + (unsigned)(s[i++] - '0');
+        if (i == start || v > 255)
+            return 0;
+        out[part] = (unsigned char)v;
+        if (part < 3)
+        {
+            if (i >= n || s[i] != '.')
+                return 0;
+            i++;
+        }
+    }
+    return i == n;
+}
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// RFC 4291 text form, including "::" and a trailing dotted IPv4 part
+static int parse_v6(const char *s, size_t n, unsigned char out[16])
+{
+    unsigned char tmp[16];
+    int ngroups = 0, gap = -1;
+    size_t i = 0;
+
+    if (n >= 2 && s[0] == ':' && s[1] == ':')
+    {
+        gap = 0;
+        i = 2;
+    }
+    while (i < n)
+    {
+        size_t start = i;
+        unsigned v = 0;
+        while (i < n && hexval(s[i]) >= 0 && i - start < 4)
+            v = v * 16 + (unsigned)hexval(s[i++]);
+        if (i < n && s[i] == '.')
+        {
+            // dotted IPv4 tail takes the last two groups
+            if (ngroups > 6 || !parse_v4(s + start, n - start, tmp + ngroups * 2))
+                return 0;
+            ngroups += 2;
+            i = n;
+            break;
+        }
+        if (i == start || ngroups >= 8)
+            return 0;
+        tmp[ngroups * 2] = (unsigned char)(v >> 8);
+        tmp[ngroups * 2 + 1] = (unsigned char)v;
+        ngroups++;
+        if (i == n)
+            break;
+        if (s[i] != ':')
+            return 0;
+        i++;
+        if (i < n && s[i] == ':')
+        {
+            if (gap >= 0)
+                return 0; // only one "::"
+            gap = ngroups;
+            i++;
+        }
+        else if (i == n)
+            return 0; // trailing single ':'
+    }
+    if (gap < 0)
+    {
+        if (ngroups != 8)
+            return 0;
+        memcpy(out, tmp, 16);
+        return 1;
+    }
+    if (ngroups > 7)
+        return 0;
+    memset(out, 0, 16);
+    memcpy(out, tmp, (size_t)gap * 2);
+    memcpy(out + 16 - (ngroups - gap) * 2, tmp + gap * 2, (size_t)(ngroups - gap) * 2);
+    return 1;
+}
+
+static const unsigned char v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+/**
+ * @brief Parses an IPv4 or IPv6 address.
+ *
+ * @param addr  Receives the address: 4 bytes for IPv4 (also for IPv4-mapped
+ *              IPv6), 16 bytes for IPv6.
+ * @param v6    Set to 1 for IPv6, 0 for IPv4.
+ * @return      1 if s[0..n) is an address, 0 otherwise.
+ */
+int ip_parse(const char *s, size_t n, unsigned char addr[16], int *v6)
+{
+    if (memchr(s, ':', n))
+    {
+        if (!parse_v6(s, n, addr))
+            return 0;
+        if (memcmp(addr, v4_mapped, 12) == 0)
+        {
+            memmove(addr, addr + 12, 4);
+            *v6 = 0;
+        }
+        else
+            *v6 = 1;
+        return 1;
+    }
+    *v6 = 0;
+    return parse_v4(s, n, addr);
+}
+
+/* --- building ------------------------------------------------------------ */
+
+/**
+ * @brief Creates an empty set; fill it with iptrie_add()/iptrie_load(),
+ *        then call iptrie_build() before any lookup.
+ */
+IpTrie *iptrie_new(void)
+{
+    IpTrie *t = (IpTrie *)calloc(1, sizeof(IpTrie));
+    if (t)
+        t->fam[0].root = t->fam[1].root = -1;
+    return t;
+}
+
+/**
+ * @brief Adds "addr" or "addr/len".
+ *
+ * @return 1 on success, 0 if the text is not an address or CIDR (or on
+ *         allocation failure).
+ */
+int iptrie_add(IpTrie *t, const char *s, size_t n)
+{
+    const char *slash = (const char *)memchr(s, '/', n);
+    size_t alen = slash ? (size_t)(slash - s) : n;
+    IpPrefix p;
+    int v6;
+    memset(&p, 0, sizeof(p));
+    if (!ip_parse(s, alen, p.addr, &v6))
+        return 0;
+    int max = v6 ? 128 : 32;
+    p.len = max;
+    if (slash)
+    {
+        size_t i = alen + 1;
+        int len = 0;
+        if (i == n || n - i > 3)
+            return 0;
+        for (; i < n; i++)
+        {
+            if (s[i] < '0' || s[i] > '9')
+                return 0;
+            len = len * 10 + (s[i] - '0');
+        }
+        if (!v6 && memchr(s, ':', alen))
+            len -= 96; // ::ffff:a.b.c.d/n counts the mapped prefix
+        if (len < 0 || len > max)
+            return 0;
+        p.len = len;
+    }
+
+    IpFamily *f = &t->fam[v6];
+    if (f->count == f->cap)
+    {
+        size_t ncap = f->cap ? f->cap * 2 : 64;
+        IpPrefix *nl = (IpPrefix *)realloc(f->list, ncap * sizeof(IpPrefix));
+        if (!nl)
+            return 0;
+        f->list = nl;
+        f->cap = ncap;
+    }
+    f->list[f->count++] = p;
+    t->prefixes++;
+    return 1;
+}
+
+/**
+ * @brief Adds every address/CIDR in a file, one per line.
+ *
+ * Blank lines and text after '#' are ignored.
+ *
+ * @return 1 on success; 0 with a message in err otherwise.
+ */
+int iptrie_load(IpTrie *t, const char *path, char *err, size_t errsz)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        snprintf(err, errsz, "%s: cannot open", path);
+        return 0;
+    }
+    char line[256];
+    long lineno = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char *p = line, *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        else if (!strchr(line, '\n') && !feof(fp))
+        {
+            snprintf(err, errsz, "%s:%ld: line too long", path, lineno);
+            fclose(fp);
+            return 0;
+        }
+        while (*p == ' ' || *p == '\t')
+            p++;
+        size_t n = strcspn(p, " \t\r\n");
+        if (n == 0)
+            continue;
+        if (p[n + strspn(p + n, " \t\r\n")] != '\0' || !iptrie_add(t, p, n))
+        {
+            snprintf(err, errsz, "%s:%ld: bad address: %.*s", path, lineno, (int)n, p);
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+static int cmp_prefix(const void *a, const void *b)
+{
+    const IpPrefix *x = (const IpPrefix *)a, *y = (const IpPrefix *)b;
+    int c = memcmp(x->addr, y->addr, 16);
+    return c ? c : x->len - y->len;
+}
+
+static void bit_set(uint64_t *bm, unsigned b)
+{
+    bm[b >> 6] |= 1ULL << (b & 63);
+}
+
+static int bit_test(const uint64_t *bm, unsigned b)
+{
+    return (int)((bm[b >> 6] >> (b & 63)) & 1);
+}
+
+// Children before byte b: the index of b's child among its siblings
+static unsigned rank(const uint64_t *bm, unsigned b)
+{
+    unsigned r = 0, w = b >> 6;
+    for (unsigned i = 0; i < w; i++)
+        r += (unsigned)__builtin_popcountll(bm[i]);
+    return r + (unsigned)__builtin_popcountll(bm[w] & ((1ULL << (b & 63)) - 1));
+}
+
+static int reserve_nodes(IpFamily *f, size_t n)
+{
+    if (f->nnodes + n > f->nodecap)
+    {
+        size_t ncap = f->nodecap ? f->nodecap : 64;
+        while (ncap < f->nnodes + n)
+            ncap *= 2;
+        IpNode *nn = (IpNode *)realloc(f->nodes, ncap * sizeof(IpNode));
+        if (!nn)
+            return 0;
+        f->nodes = nn;
+        f->nodecap = ncap;
+    }
+    return 1;
+}
+
+/*
+ * Fills node `at` for byte `depth` from the sorted prefixes p[0..n), which
+ * share their first `depth` bytes. Prefixes ending within this byte set
+ * leaf bits for the byte range they cover; longer ones go to the child of
+ * their byte unless that byte is already covered.
+ */
+static int build_node(IpFamily *f, size_t at, const IpPrefix *p, size_t n, int depth)
+{
+    IpNode nd;
+    memset(&nd, 0, sizeof(nd));
+    for (size_t i = 0; i < n; i++)
+    {
+        int bits = p[i].len - depth * 8;
+        if (bits > 8)
+            continue;
+        unsigned b = p[i].addr[depth];
+        unsigned span = bits <= 0 ? 256u : 1u << (8 - bits);
+        unsigned lo = bits <= 0 ? 0 : b & ~(span - 1);
+        for (unsigned k = lo; k < lo + span; k++)
+            bit_set(nd.leaf, k);
+    }
+    size_t nchild = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned b = p[i].addr[depth];
+        if (p[i].len - depth * 8 > 8 && !bit_test(nd.leaf, b) && !bit_test(nd.child, b))
+        {
+            bit_set(nd.child, b);
+            nchild++;
+        }
+    }
+    if (!reserve_nodes(f, nchild))
+        return 0;
+    nd.base = (uint32_t)f->nnodes;
+    f->nnodes += nchild;
+    f->nodes[at] = nd;
+
+    // p is sorted, so the prefixes of each child byte are contiguous
+    size_t i = 0;
+    while (i < n)
+    {
+        unsigned b = p[i].addr[depth];
+        size_t j = i;
+        while (j < n && p[j].addr[depth] == b)
+            j++;
+        if (bit_test(nd.child, b))
+        {
+            // skip the short prefixes, which only set leaf bits here
+            size_t k = i;
+            while (k < j && p[k].len - depth * 8 <= 8)
+                k++;
+            if (!build_node(f, nd.base + rank(nd.child, b), p + k, j - k, depth + 1))
+                return 0;
+        }
+        i = j;
+    }
+    return 1;
+}
+
+/**
+ * @brief Compiles the added prefixes into the lookup trie.
+ *
+ * @return 1 on success, 0 when out of memory.
+ */
+int iptrie_build(IpTrie *t)
+{
+    for (int v = 0; v < 2; v++)
+    {
+        IpFamily *f = &t->fam[v];
+        free(f->nodes);
+        f->nodes = NULL;
+        f->nnodes = f->nodecap = 0;
+        f->root = -1;
+        if (f->count == 0)
+            continue;
+        // clear host bits, so sorting groups every prefix under its node
+        for (size_t i = 0; i < f->count; i++)
+            for (int b = f->list[i].len; b < 128; b++)
+                f->list[i].addr[b >> 3] &= (unsigned char)~(0x80u >> (b & 7));
+        qsort(f->list, f->count, sizeof(IpPrefix), cmp_prefix);
+        if (!reserve_nodes(f, 1))
+            return 0;
+        f->nnodes = 1;
+        f->root = 0;
+        if (!build_node(f, 0, f->list, f->count, 0))
+            return 0;
+        free(f->list);
+        f->list = NULL;
+        f->count = f->cap = 0;
+    }
+    return 1;
+}
+
+/* --- lookup -------------------------------------------------------------- */
+
+/**
+ * @brief Returns 1 if a prefix in the set covers the address.
+ *
+ * @param addr, v6  As filled in by ip_parse().
+ */
+int iptrie_contains(const IpTrie *t, const unsigned char *addr, int v6)
+{
+    const IpFamily *f = &t->fam[v6 ? 1 : 0];
+    int bytes = v6 ? 16 : 4;
+    if (f->root < 0)
+        return 0;
+    const IpNode *nd = &f->nodes[f->root];
+    for (int d = 0; d < bytes; d++)
+    {
+        unsigned b = addr[d];
+        if (bit_test(nd->leaf, b))
+            return 1;
+        if (!bit_test(nd->child, b))
+            return 0;
+        nd = &f->nodes[nd->base + rank(nd->child, b)];
+    }
+    return 0;
+}
+
+/**
+ * @brief Number of prefixes added (before deduplication).
+ */
+size_t iptrie_count(const IpTrie *t)
+{
+    return t->prefixes;
+}
+
+void iptrie_free(IpTrie *t)
+{
+    if (!t)
+        return;
+    for (int v = 0; v < 2; v++)
+    {
+        free(t->fam[v].list);
+        free(t->fam[v].nodes);
+    }
+    free(t);
+}
@@ -0,0 +1,1122 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "lfc.h"
+#include "hash.h"
+#include "iptrie.h"
+#include "linesrc.h"
+#include "parser.h"
+
+#define LFC_MAGIC "LFCOL01"
+#define LFC_VERSION 1
+#define LFC_MAX_BLOCK_ROWS (1u << 24)
+#define LFC_MAX_BLOCK_BYTES (256u << 20) // a block is closed early past this much column data
+#define LFC_LEVEL 6                      // deflate level
+#define LFC_MIN_SAVING 4                 // keep a chunk compressed only if that saves 1/4 of it
+
+enum
+{
+    K_PLAIN, // per-row values only
+    K_DICT,  // varint count, that many (varint length, bytes) values, then a varint code per row
+    K_STRING // varint size of the lengths, a varint length per row, then the bytes
+};
+
+static const unsigned char col_kind[LFC_NCOLS] = {
+    [LFC_C_ZONE] = K_DICT,       [LFC_C_TSTEXT] = K_STRING,  [LFC_C_METHOD] = K_DICT,
+    [LFC_C_URL] = K_STRING,      [LFC_C_PROTOCOL] = K_DICT,  [LFC_C_STATUS] = K_DICT,
+    [LFC_C_REFERRER] = K_STRING, [LFC_C_USERAGENT] = K_STRING};
+
+static const char month_names[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static void *xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n ? n : 1);
+    if (!p)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void put_varint(OutBuf *b, uint64_t v)
+{
+    outbuf_grow(b, 10);
+    unsigned char *o = (unsigned char *)b->buf + b->len;
+    while (v >= 0x80)
+    {
+        *o++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *o++ = (unsigned char)v;
+    b->len = (size_t)((char *)o - b->buf);
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* --- timestamps and addresses -------------------------------------------- */
+
+// " +hhmm" / " -hhmm" (or nothing) to seconds east of UTC
+static int zone_offset(const char *s, size_t n, int64_t *off)
+{
+    *off = 0;
+    if (n == 0)
+        return 1;
+    if (n != 6 || s[0] != ' ' || (s[1] != '+' && s[1] != '-'))
+        return 0;
+    for (int i = 2; i < 6; i++)
+        if (s[i] < '0' || s[i] > '9')
+            return 0;
+    *off = ((s[2] - '0') * 10 + (s[3] - '0')) * 3600 + ((s[4] - '0') * 10 + (s[5] - '0')) * 60;
+    if (s[1] == '-')
+        *off = -*off;
+    return 1;
+}
+
+static void put2(char *o, int v)
+{
+    o[0] = (char)('0' + v / 10);
+    o[1] = (char)('0' + v % 10);
+}
+
+// Local time t as "dd/Mon/yyyy:HH:MM:SS" (20 bytes); 0 outside years 0..9999
+static int format_time(int64_t t, char *o)
+{
+    int64_t z = (t >= 0 ? t : t - 86399) / 86400, secs = t - z * 86400;
+    // civil_from_days: inverse of the parser's days_from_civil()
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    int64_t y = yoe + era * 400 + (m <= 2);
+    if (y < 0 || y > 9999)
+        return 0;
+
+    put2(o, d);
+    o[2] = '/';
+    memcpy(o + 3, month_names[m - 1], 3);
+    o[6] = '/';
+    put2(o + 7, (int)(y / 100));
+    put2(o + 9, (int)(y % 100));
+    o[11] = ':';
+    put2(o + 12, (int)(secs / 3600));
+    o[14] = ':';
+    put2(o + 15, (int)(secs / 60 % 60));
+    o[17] = ':';
+    put2(o + 18, (int)(secs % 60));
+    return 1;
+}
+
+// Text form of a parsed address (dotted quad, or inet_ntop for IPv6)
+static size_t format_ip(const unsigned char *addr, int v6, char *o, size_t cap)
+{
+    if (v6)
+        return inet_ntop(AF_INET6, addr, o, (socklen_t)cap) ? strlen(o) : 0;
+    char *p = o;
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned v = addr[i];
+        if (i)
+            *p++ = '.';
+        if (v >= 100)
+            *p++ = (char)('0' + v / 100);
+        if (v >= 10)
+            *p++ = (char)('0' + v / 10 % 10);
+        *p++ = (char)('0' + v % 10);
+    }
+    return (size_t)(p - o);
+}
+
+/* --- writer -------------------------------------------------------------- */
+
+// Per-block dictionary of distinct values, in first-seen order
+typedef struct
+{
+    OutBuf heap;     // values back to back
+    size_t *off;     // value i is heap[off[i], off[i + 1])
+    uint64_t *hash;
+    uint32_t n, cap;
+    uint32_t *slots; // value index + 1, 0 = empty
+    uint32_t nslots; // power of two, more than twice n
+} Dict;
+
+static void dict_init(Dict *d)
+{
+    memset(d, 0, sizeof(*d));
+    outbuf_init(&d->heap, NULL);
+    d->nslots = 64;
+    d->slots = (uint32_t *)calloc(d->nslots, sizeof(uint32_t));
+    d->off = (size_t *)xrealloc(NULL, sizeof(size_t));
+    if (!d->slots)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    d->off[0] = 0;
+}
+
+static void dict_reset(Dict *d)
+{
+    memset(d->slots, 0, d->nslots * sizeof(uint32_t));
+    d->n = 0;
+    d->heap.len = 0;
+}
+
+static void dict_free(Dict *d)
+{
+    outbuf_free(&d->heap);
+    free(d->off);
+    free(d->hash);
+    free(d->slots);
+}
+
+static void dict_insert_slot(Dict *d, uint32_t code)
+{
+    uint32_t mask = d->nslots - 1, i = (uint32_t)d->hash[code] & mask;
+    while (d->slots[i])
+        i = (i + 1) & mask;
+    d->slots[i] = code + 1;
+}
+
+static uint32_t dict_code(Dict *d, const char *p, size_t n)
+{
+    uint64_t h = lf_hash64(p, n);
+    uint32_t mask = d->nslots - 1, i = (uint32_t)h & mask;
+    for (; d->slots[i]; i = (i + 1) & mask)
+    {
+        uint32_t c = d->slots[i] - 1;
+        if (d->hash[c] == h && d->off[c + 1] - d->off[c] == n && memcmp(d->heap.buf + d->off[c], p, n) == 0)
+            return c;
+    }
+
+    if (d->n == d->cap)
+    {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->off = (size_t *)xrealloc(d->off, (d->cap + 1) * sizeof(size_t));
+        d->hash = (uint64_t *)xrealloc(d->hash, d->cap * sizeof(uint64_t));
+    }
+    uint32_t c = d->n++;
+    d->hash[c] = h;
+    outbuf_write(&d->heap, p, n);
+    d->off[c + 1] = d->heap.len;
+    if (2 * d->n >= d->nslots)
+    {
+        free(d->slots);
+        d->nslots *= 2;
+        d->slots = (uint32_t *)calloc(d->nslots, sizeof(uint32_t));
+        if (!d->slots)
+        {
+            perror("calloc");
+            exit(1);
+        }
+        for (uint32_t k = 0; k < d->n; k++)
+            dict_insert_slot(d, k);
+    }
+    else
+        dict_insert_slot(d, c);
+    return c;
+}
+
+typedef struct
+{
+    FILE *f;
+    const char *path;
+    uint64_t pos; // file offset of the next chunk
+    LfcBlock *dir;
+    size_t ndir, cap;
+    LfcBlock cur;
+    OutBuf col[LFC_NCOLS];  // per-row data (dictionary codes for K_DICT)
+    OutBuf lens[LFC_NCOLS]; // K_STRING: value lengths
+    Dict dict[LFC_NCOLS];   // K_DICT: the values
+    OutBuf pack;            // a column's chunk before compression
+    unsigned char *z;
+    size_t zcap;
+    int64_t prev_epoch;
+    int ok;
+} Writer;
+
+static void put_string(Writer *w, int c, const char *p, size_t n)
+{
+    put_varint(&w->lens[c], n);
+    outbuf_write(&w->col[c], p, n);
+}
+
+static void put_dict(Writer *w, int c, const char *p, size_t n)
+{
+    put_varint(&w->col[c], dict_code(&w->dict[c], p, n));
+}
+
+static void write_bytes(Writer *w, const void *p, size_t n)
+{
+    if (w->ok && n && fwrite(p, 1, n, w->f) != n)
+        w->ok = 0;
+    w->pos += n;
+}
+
+static size_t block_bytes(const Writer *w)
+{
+    size_t n = 0;
+    for (int c = 0; c < LFC_NCOLS; c++)
+        n += w->col[c].len + w->lens[c].len + w->dict[c].heap.len;
+    return n;
+}
+
+static void writer_flush(Writer *w)
+{
+    if (w->cur.rows == 0)
+        return;
+    for (int c = 0; c < LFC_NCOLS; c++)
+    {
+        const char *data = w->col[c].buf;
+        size_t n = w->col[c].len;
+        if (col_kind[c] != K_PLAIN)
+        {
+            OutBuf *pk = &w->pack;
+            pk->len = 0;
+            if (col_kind[c] == K_DICT)
+            {
+                const Dict *d = &w->dict[c];
+                put_varint(pk, d->n);
+                for (uint32_t i = 0; i < d->n; i++)
+                {
+                    put_varint(pk, d->off[i + 1] - d->off[i]);
+                    outbuf_write(pk, d->heap.buf + d->off[i], d->off[i + 1] - d->off[i]);
+                }
+                dict_reset(&w->dict[c]);
+            }
+            else
+            {
+                put_varint(pk, w->lens[c].len);
+                outbuf_write(pk, w->lens[c].buf, w->lens[c].len);
+                w->lens[c].len = 0;
+            }
+            outbuf_write(pk, data, n);
+            data = pk->buf;
+            n = pk->len;
+        }
+
+        uLongf zn = compressBound((uLong)n);
+        if (zn > w->zcap)
+        {
+            w->zcap = zn;
+            w->z = (unsigned char *)xrealloc(w->z, w->zcap);
+        }
+        LfcChunk *k = &w->cur.col[c];
+        k->offset = w->pos;
+        k->raw_size = (uint32_t)n;
+        if (n && compress2(w->z, &zn, (const Bytef *)data, (uLong)n, LFC_LEVEL) == Z_OK &&
+            zn < n - n / LFC_MIN_SAVING)
+        {
+            k->size = (uint32_t)zn;
+            write_bytes(w, w->z, zn);
+        }
+        else
+        {
+            k->size = (uint32_t)n; // stored as is
+            write_bytes(w, data, n);
+        }
+        w->col[c].len = 0;
+    }
+
+    if (w->ndir == w->cap)
+    {
+        w->cap = w->cap ? w->cap * 2 : 16;
+        w->dir = (LfcBlock *)xrealloc(w->dir, w->cap * sizeof(LfcBlock));
+    }
+    w->dir[w->ndir++] = w->cur;
+    index_block_init(&w->cur.zone, w->cur.zone.end);
+    w->cur.rows = 0;
+    w->prev_epoch = 0;
+}
+
+static void writer_add(Writer *w, LogEntry *e, uint64_t end)
+{
+    char ts[32], zone[8], ip[64];
+    unsigned char addr[16];
+    time_t t;
+    int64_t off;
+    int v6;
+
+    // timestamp: epoch delta + zone, with the text only if rebuilding would change it
+    int have_t = logentry_epoch(e, &t);
+    LogSlice s = e->timestamp;
+    if (have_t && (s.len == 20 || s.len == 26) && zone_offset(s.p + 20, s.len - 20, &off) &&
+        format_time((int64_t)t + off, ts) && memcmp(ts, s.p, 20) == 0)
+    {
+        zone[0] = 'c';
+        memcpy(zone + 1, s.p + 20, s.len - 20);
+        put_dict(w, LFC_C_ZONE, zone, s.len - 19);
+        put_string(w, LFC_C_TSTEXT, "", 0);
+    }
+    else
+    {
+        put_dict(w, LFC_C_ZONE, have_t ? "r" : "x", 1);
+        put_string(w, LFC_C_TSTEXT, s.p, s.len);
+    }
+    if (have_t)
+    {
+        put_varint(&w->col[LFC_C_EPOCH], zigzag((int64_t)t - w->prev_epoch));
+        w->prev_epoch = (int64_t)t;
+    }
+    else
+        put_varint(&w->col[LFC_C_EPOCH], 0);
+
+    // ip: address bytes when they print back as the same text
+    OutBuf *b = &w->col[LFC_C_IP];
+    if (ip_parse(e->ip.p, e->ip.len, addr, &v6) && format_ip(addr, v6, ip, sizeof(ip)) == e->ip.len &&
+        memcmp(ip, e->ip.p, e->ip.len) == 0)
+    {
+        outbuf_putc(b, v6 ? 6 : 4);
+        outbuf_write(b, addr, v6 ? 16 : 4);
+    }
+    else
+    {
+        outbuf_putc(b, 0);
+        put_varint(b, e->ip.len);
+        outbuf_write(b, e->ip.p, e->ip.len);
+    }
+
+    int32_t status = (int32_t)e->status;
+    put_dict(w, LFC_C_METHOD, e->method.p, e->method.len);
+    put_string(w, LFC_C_URL, e->url.p, e->url.len);
+    put_dict(w, LFC_C_PROTOCOL, e->protocol.p, e->protocol.len);
+    put_dict(w, LFC_C_STATUS, (const char *)&status, sizeof(status));
+    put_varint(&w->col[LFC_C_BYTES], zigzag((int64_t)e->bytes));
+    put_string(w, LFC_C_REFERRER, e->referrer.p, e->referrer.len);
+    put_string(w, LFC_C_USERAGENT, e->userAgent.p, e->userAgent.len);
+    outbuf_write(&w->col[LFC_C_REQUEST_TIME], &e->request_time, sizeof(double));
+
+    index_block_add(&w->cur.zone, e);
+    w->cur.zone.end = end;
+    w->cur.rows++;
+}
+
+/**
+ * @brief Converts a log file (or "-" for stdin) to the columnar format.
+ *
+ * The file is written to dest + ".tmp" and renamed into place.
+ *
+ * @param path        Log to convert.
+ * @param dest        Output file.
+ * @param block_rows  Rows per block (0 = LFC_DEFAULT_BLOCK_ROWS).
+ * @return            1 on success, 0 on error (reported on stderr).
+ */
+int lfc_convert(const char *path, const char *dest, unsigned block_rows)
+{
+    if (block_rows == 0)
+        block_rows = LFC_DEFAULT_BLOCK_ROWS;
+
+    FILE *in = stdin;
+    if (strcmp(path, "-") != 0 && !(in = fopen(path, "rb")))
+    {
+        perror(path);
+        return 0;
+    }
+    LineSource src;
+    if (!linesrc_open(&src, in))
+    {
+        perror("linesrc_open");
+        if (in != stdin)
+            fclose(in);
+        return 0;
+    }
+
+    char *tmp = (char *)xrealloc(NULL, strlen(dest) + 5);
+    sprintf(tmp, "%s.tmp", dest);
+
+    Writer w;
+    memset(&w, 0, sizeof(w));
+    w.path = path;
+    w.ok = 1;
+    if (!(w.f = fopen(tmp, "wb")))
+    {
+        perror(tmp);
+        free(tmp);
+        linesrc_close(&src);
+        if (in != stdin)
+            fclose(in);
+        return 0;
+    }
+    for (int c = 0; c < LFC_NCOLS; c++)
+    {
+        outbuf_init(&w.col[c], NULL);
+        outbuf_init(&w.lens[c], NULL);
+        dict_init(&w.dict[c]);
+    }
+    outbuf_init(&w.pack, NULL);
+    index_block_init(&w.cur.zone, 0);
+
+    LfcHeader h;
+    memset(&h, 0, sizeof(h));
+    write_bytes(&w, &h, sizeof(h)); // rewritten at the end
+
+    const char *line;
+    size_t len;
+    int rc;
+    char perr[8];
+    while ((rc = linesrc_next(&src, &line, &len)) > 0)
+    {
+        LogEntry e;
+        if (!parse_apache_or_nginx(line, len, &e, perr, sizeof(perr)))
+        {
+            h.failed++;
+            continue;
+        }
+        logentry_load(&e, LF_LAZY);
+        writer_add(&w, &e, src.bytes);
+        h.rows++;
+        if (w.cur.rows == block_rows || block_bytes(&w) >= LFC_MAX_BLOCK_BYTES)
+            writer_flush(&w);
+    }
+    if (rc < 0)
+    {
+        fprintf(stderr, "[%s] convert: read error\n", path);
+        w.ok = 0;
+    }
+    writer_flush(&w);
+
+    static const char pad[8];
+    write_bytes(&w, pad, (size_t)(-w.pos & 7)); // the directory is read in place
+    memcpy(h.magic, LFC_MAGIC, sizeof(h.magic));
+    h.version = LFC_VERSION;
+    h.ncols = LFC_NCOLS;
+    h.block_rows = block_rows;
+    h.nblocks = w.ndir;
+    h.dir_offset = w.pos;
+    write_bytes(&w, w.dir, w.ndir * sizeof(LfcBlock));
+    if (w.ok && (fseeko(w.f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w.f) != 1))
+        w.ok = 0;
+    w.ok = (fclose(w.f) == 0) && w.ok;
+    if (w.ok && rename(tmp, dest) != 0)
+    {
+        perror(dest);
+        w.ok = 0;
+    }
+    if (!w.ok)
+    {
+        fprintf(stderr, "[%s] convert: write failed: %s\n", path, strerror(errno));
+        remove(tmp);
+    }
+    else
+        fprintf(stderr, "[%s] convert: %llu rows in %zu blocks (%llu unparsable), %llu -> %llu bytes\n",
+                path, (unsigned long long)h.rows, w.ndir, (unsigned long long)h.failed, src.bytes,
+                (unsigned long long)w.pos);
+
+    for (int c = 0; c < LFC_NCOLS; c++)
+    {
+        outbuf_free(&w.col[c]);
+        outbuf_free(&w.lens[c]);
+        dict_free(&w.dict[c]);
+    }
+    outbuf_free(&w.pack);
+    free(w.z);
+    free(w.dir);
+    free(tmp);
+    linesrc_close(&src);
+    if (in != stdin)
+        fclose(in);
+    return w.ok;
+}
+
+/* --- reader -------------------------------------------------------------- */
+
+typedef struct
+{
+    const unsigned char *p, *end;
+} Cursor;
+
+static int get_varint(Cursor *c, uint64_t *v)
+{
+    uint64_t x = 0;
+    for (int shift = 0; c->p < c->end && shift < 64; shift += 7)
+    {
+        unsigned char b = *c->p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int get_bytes(Cursor *c, size_t n, const unsigned char **p)
+{
+    if ((size_t)(c->end - c->p) < n)
+        return 0;
+    *p = c->p;
+    c->p += n;
+    return 1;
+}
+
+struct LfcReader
+{
+    const ScanPlan *plan;
+    const char *label;
+    const unsigned char *map;
+    size_t len;
+    const LfcHeader *hdr;
+    const LfcBlock *dir;
+    uint64_t next; // next block to visit
+    unsigned cols; // bit per LfcColumn that has to be decoded
+
+    unsigned char *buf[LFC_NCOLS]; // inflated chunks
+    size_t cap[LFC_NCOLS];
+    Cursor cur[LFC_NCOLS];  // per-row data
+    Cursor heap[LFC_NCOLS]; // K_STRING: the bytes
+    LogSlice *dict[LFC_NCOLS];
+    uint32_t ndict[LFC_NCOLS], dcap[LFC_NCOLS];
+    int *status;  // decoded LFC_C_STATUS values
+    int64_t *off; // LFC_C_ZONE: seconds east of UTC
+    uint32_t vcap;
+
+    char ts[32]; // last rebuilt timestamp text
+    int64_t ts_epoch;
+    uint32_t ts_zone;
+    int ts_valid;
+    char ip[64];
+};
+
+/**
+ * @brief Returns 1 if the stream is a seekable file that starts like a .lfc file.
+ *
+ * Reads the magic with pread(), so the stream position is left alone.
+ */
+int lfc_detect(FILE *in)
+{
+    char magic[8];
+    return pread(fileno(in), magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+           memcmp(magic, LFC_MAGIC, sizeof(magic)) == 0;
+}
+
+static unsigned field_columns(unsigned fields)
+{
+    unsigned cols = 0;
+    if (fields & LF_BIT(LF_TIMESTAMP))
+        cols |= 1u << LFC_C_EPOCH | 1u << LFC_C_ZONE | 1u << LFC_C_TSTEXT;
+    if (fields & LF_BIT(LF_IP))
+        cols |= 1u << LFC_C_IP;
+    if (fields & LF_BIT(LF_METHOD))
+        cols |= 1u << LFC_C_METHOD;
+    if (fields & LF_BIT(LF_URL))
+        cols |= 1u << LFC_C_URL;
+    if (fields & LF_BIT(LF_PROTOCOL))
+        cols |= 1u << LFC_C_PROTOCOL;
+    if (fields & LF_BIT(LF_STATUS))
+        cols |= 1u << LFC_C_STATUS;
+    if (fields & LF_BIT(LF_BYTES))
+        cols |= 1u << LFC_C_BYTES;
+    if (fields & LF_BIT(LF_REFERRER))
+        cols |= 1u << LFC_C_REFERRER;
+    if (fields & LF_BIT(LF_USERAGENT))
+        cols |= 1u << LFC_C_USERAGENT;
+    if (fields & LF_BIT(LF_REQUEST_TIME))
+        cols |= 1u << LFC_C_REQUEST_TIME;
+    return cols;
+}
+
+// LF_BIT() mask of the fields the filter, the output or the aggregation read
+static unsigned plan_fields(const ScanPlan *plan)
+{
+    unsigned f = 0;
+    if (plan->use_q)
+        f |= query_fields(&plan->q);
+    if (plan->keyword) // see matches()
+        f |= LF_BIT(LF_METHOD) | LF_BIT(LF_URL) | LF_BIT(LF_TIMESTAMP) | LF_BIT(LF_IP) | LF_BIT(LF_USERAGENT);
+    if (plan->agg)
+    {
+        const AggSpec *a = plan->agg;
+        for (int i = 0; i < a->nkeys; i++)
+            f |= LF_BIT(a->keys[i]);
+        for (int i = 0; i < a->ncols; i++)
+            if (a->cols[i].fn != AGG_COUNT)
+                f |= LF_BIT(a->cols[i].field);
+        if (a->top)
+            f |= LF_BIT(a->top_by);
+        if (a->bucket)
+            f |= LF_BIT(LF_TIMESTAMP);
+    }
+    else if (plan->fields)
+        f |= plan->fields->mask;
+    else if (plan->opt->format == FORMAT_TEXT)
+        f |= LF_DEFAULT_OUTPUT & ~LF_BIT(LF_USERAGENT); // "[timestamp] ip method url -> status"
+    else
+        f |= LF_DEFAULT_OUTPUT;
+    return f;
+}
+
+/**
+ * @brief Maps a .lfc file for scanning with lfc_next().
+ *
+ * Lines that failed to parse during the conversion are added to st's
+ * total and failed counts.
+ *
+ * @return The reader, or NULL if the file is unreadable or corrupt (reported on stderr).
+ */
+LfcReader *lfc_open(const ScanPlan *plan, FILE *in, const char *label, ScanStats *st)
+{
+    struct stat sb;
+    label = label ? label : "-";
+    if (fstat(fileno(in), &sb) != 0 || sb.st_size < (off_t)sizeof(LfcHeader))
+    {
+        fprintf(stderr, "[%s] not a valid .lfc file\n", label);
+        return NULL;
+    }
+    size_t len = (size_t)sb.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+    if (map == MAP_FAILED)
+    {
+        perror(label);
+        return NULL;
+    }
+
+    const LfcHeader *h = (const LfcHeader *)map;
+    if (memcmp(h->magic, LFC_MAGIC, sizeof(h->magic)) != 0 || h->version != LFC_VERSION ||
+        h->ncols != LFC_NCOLS || h->dir_offset % 8 != 0 || h->dir_offset > len ||
+        h->nblocks > (len - h->dir_offset) / sizeof(LfcBlock))
+    {
+        fprintf(stderr, "[%s] not a valid .lfc file (or written by another version)\n", label);
+        munmap(map, len);
+        return NULL;
+    }
+
+    LfcReader *r = (LfcReader *)calloc(1, sizeof(LfcReader));
+    if (!r)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    r->plan = plan;
+    r->label = label;
+    r->map = (const unsigned char *)map;
+    r->len = len;
+    r->hdr = h;
+    r->dir = (const LfcBlock *)(r->map + h->dir_offset);
+    r->cols = field_columns(plan_fields(plan));
+    st->total += (long long)h->failed;
+    st->failed += (long long)h->failed;
+    return r;
+}
+
+void lfc_close(LfcReader *r)
+{
+    if (!r)
+        return;
+    for (int c = 0; c < LFC_NCOLS; c++)
+    {
+        free(r->buf[c]);
+        free(r->dict[c]);
+    }
+    free(r->status);
+    free(r->off);
+    munmap((void *)r->map, r->len);
+    free(r);
+}
+
+// Points the column's cursor at its decoded chunk, inflating it if needed
+static int load_chunk(LfcReader *r, const LfcBlock *b, int c, ScanStats *st)
+{
+    const LfcChunk *k = &b->col[c];
+    if (k->offset > r->len || k->size > r->len - k->offset)
+        return 0;
+    const unsigned char *p = r->map + k->offset;
+    st->bytes += k->size;
+    if (k->size != k->raw_size)
+    {
+        if (r->cap[c] < k->raw_size)
+        {
+            r->cap[c] = k->raw_size;
+            r->buf[c] = (unsigned char *)xrealloc(r->buf[c], r->cap[c]);
+        }
+        uLongf n = k->raw_size;
+        if (uncompress(r->buf[c], &n, p, k->size) != Z_OK || n != k->raw_size)
+            return 0;
+        p = r->buf[c];
+    }
+    r->cur[c].p = p;
+    r->cur[c].end = p + k->raw_size;
+
+    if (col_kind[c] == K_DICT)
+    {
+        uint64_t n, vlen;
+        const unsigned char *v;
+        if (!get_varint(&r->cur[c], &n) || n > (uint64_t)(r->cur[c].end - r->cur[c].p))
+            return 0;
+        if (n > r->dcap[c])
+        {
+            r->dcap[c] = (uint32_t)n;
+            r->dict[c] = (LogSlice *)xrealloc(r->dict[c], n * sizeof(LogSlice));
+        }
+        for (uint64_t i = 0; i < n; i++)
+        {
+            if (!get_varint(&r->cur[c], &vlen) || !get_bytes(&r->cur[c], (size_t)vlen, &v))
+                return 0;
+            r->dict[c][i].p = (const char *)v;
+            r->dict[c][i].len = (size_t)vlen;
+        }
+        r->ndict[c] = (uint32_t)n;
+    }
+    else if (col_kind[c] == K_STRING)
+    {
+        uint64_t n;
+        const unsigned char *lens;
+        if (!get_varint(&r->cur[c], &n) || !get_bytes(&r->cur[c], (size_t)n, &lens))
+            return 0;
+        r->heap[c] = r->cur[c];
+        r->cur[c].p = lens;
+        r->cur[c].end = lens + n;
+    }
+    return 1;
+}
+
+// Decodes the values of the status and zone dictionaries once per block
+static int load_values(LfcReader *r)
+{
+    uint32_t n = 0;
+    if (r->cols & (1u << LFC_C_STATUS))
+        n = r->ndict[LFC_C_STATUS];
+    if ((r->cols & (1u << LFC_C_ZONE)) && r->ndict[LFC_C_ZONE] > n)
+        n = r->ndict[LFC_C_ZONE];
+    if (n > r->vcap)
+    {
+        r->vcap = n;
+        r->status = (int *)xrealloc(r->status, n * sizeof(int));
+        r->off = (int64_t *)xrealloc(r->off, n * sizeof(int64_t));
+    }
+    if (r->cols & (1u << LFC_C_STATUS))
+        for (uint32_t i = 0; i < r->ndict[LFC_C_STATUS]; i++)
+        {
+            int32_t v;
+            if (r->dict[LFC_C_STATUS][i].len != sizeof(v))
+                return 0;
+            memcpy(&v, r->dict[LFC_C_STATUS][i].p, sizeof(v));
+            r->status[i] = v;
+        }
+    if (r->cols & (1u << LFC_C_ZONE))
+        for (uint32_t i = 0; i < r->ndict[LFC_C_ZONE]; i++)
+        {
+            LogSlice z = r->dict[LFC_C_ZONE][i];
+            if (z.len == 0 || (z.p[0] == 'c' && !zone_offset(z.p + 1, z.len - 1, &r->off[i])))
+                return 0;
+        }
+    r->ts_valid = 0;
+    return 1;
+}
+
+static int get_code(LfcReader *r, int c, uint32_t *code)
+{
+    uint64_t v;
+    if (!get_varint(&r->cur[c], &v) || v >= r->ndict[c])
+        return 0;
+    *code = (uint32_t)v;
+    return 1;
+}
+
+static int get_string(LfcReader *r, int c, LogSlice *s)
+{
+    uint64_t n;
+    const unsigned char *p;
+    if (!get_varint(&r->cur[c], &n) || !get_bytes(&r->heap[c], (size_t)n, &p))
+        return 0;
+    s->p = (const char *)p;
+    s->len = (size_t)n;
+    return 1;
+}
+
+// Timestamp columns into e; the text comes from the zone dictionary or verbatim
+static int get_time(LfcReader *r, LogEntry *e, int64_t *epoch)
+{
+    uint64_t d;
+    uint32_t z;
+    LogSlice text;
+    if (!get_varint(&r->cur[LFC_C_EPOCH], &d) || !get_code(r, LFC_C_ZONE, &z) ||
+        !get_string(r, LFC_C_TSTEXT, &text))
+        return 0;
+    *epoch += unzigzag(d);
+
+    LogSlice zone = r->dict[LFC_C_ZONE][z];
+    if (zone.p[0] != 'x')
+    {
+        e->epoch = (time_t)*epoch;
+        e->loaded |= LE_EPOCH_OK;
+    }
+    if (zone.p[0] != 'c')
+    {
+        e->timestamp = text;
+        return 1;
+    }
+    if (!r->ts_valid || r->ts_epoch != *epoch || r->ts_zone != z)
+    {
+        if (zone.len > 7 || !format_time(*epoch + r->off[z], r->ts))
+            return 0;
+        memcpy(r->ts + 20, zone.p + 1, zone.len - 1);
+        r->ts_epoch = *epoch;
+        r->ts_zone = z;
+        r->ts_valid = 1;
+    }
+    e->timestamp.p = r->ts;
+    e->timestamp.len = 20 + zone.len - 1;
+    return 1;
+}
+
+static int get_ip(LfcReader *r, LogEntry *e)
+{
+    Cursor *c = &r->cur[LFC_C_IP];
+    const unsigned char *p;
+    uint64_t n;
+    if (c->p == c->end)
+        return 0;
+    unsigned char kind = *c->p++;
+    if (kind == 0)
+    {
+        if (!get_varint(c, &n) || !get_bytes(c, (size_t)n, &p))
+            return 0;
+        e->ip.p = (const char *)p;
+        e->ip.len = (size_t)n;
+        return 1; // logentry_addr() parses it like any other text
+    }
+    if ((kind != 4 && kind != 6) || !get_bytes(c, kind == 6 ? 16 : 4, &p))
+        return 0;
+    memcpy(e->addr, p, kind == 6 ? 16 : 4);
+    e->addr_v6 = kind == 6;
+    e->loaded |= LE_ADDR | LE_ADDR_OK;
+    e->ip.p = r->ip;
+    e->ip.len = format_ip(p, kind == 6, r->ip, sizeof(r->ip));
+    return 1;
+}
+
+static int get_row(LfcReader *r, LogEntry *e, int64_t *epoch)
+{
+    unsigned cols = r->cols;
+    uint32_t code;
+    uint64_t v;
+    const unsigned char *p;
+
+    if ((cols & (1u << LFC_C_EPOCH)) && !get_time(r, e, epoch))
+        return 0;
+    if ((cols & (1u << LFC_C_IP)) && !get_ip(r, e))
+        return 0;
+    if (cols & (1u << LFC_C_METHOD))
+    {
+        if (!get_code(r, LFC_C_METHOD, &code))
+            return 0;
+        e->method = r->dict[LFC_C_METHOD][code];
+    }
+    if ((cols & (1u << LFC_C_URL)) && !get_string(r, LFC_C_URL, &e->url))
+        return 0;
+    if (cols & (1u << LFC_C_PROTOCOL))
+    {
+        if (!get_code(r, LFC_C_PROTOCOL, &code))
+            return 0;
+        e->protocol = r->dict[LFC_C_PROTOCOL][code];
+    }
+    if (cols & (1u << LFC_C_STATUS))
+    {
+        if (!get_code(r, LFC_C_STATUS, &code))
+            return 0;
+        e->status = r->status[code];
+    }
+    if (cols & (1u << LFC_C_BYTES))
+    {
+        if (!get_varint(&r->cur[LFC_C_BYTES], &v))
+            return 0;
+        e->bytes = (long long)unzigzag(v);
+    }
+    if ((cols & (1u << LFC_C_REFERRER)) && !get_string(r, LFC_C_REFERRER, &e->referrer))
+        return 0;
+    if ((cols & (1u << LFC_C_USERAGENT)) && !get_string(r, LFC_C_USERAGENT, &e->userAgent))
+        return 0;
+    if (cols & (1u << LFC_C_REQUEST_TIME))
+    {
+        if (!get_bytes(&r->cur[LFC_C_REQUEST_TIME], sizeof(double), &p))
+            return 0;
+        memcpy(&e->request_time, p, sizeof(double));
+    }
+    return 1;
+}
+
+// Decodes one block and runs its rows through the filter and output/aggregation
+static int scan_rows(LfcReader *r, const LfcBlock *b, OutBuf *out, int *first_json, ScanStats *st)
+{
+    for (int c = 0; c < LFC_NCOLS; c++)
+        if ((r->cols & (1u << c)) && !load_chunk(r, b, c, st))
+            return 0;
+    if (!load_values(r))
+        return 0;
+
+    // every field counts as located; columns that were not decoded are never read
+    static const char empty[1] = "";
+    LogEntry blank;
+    memset(&blank, 0, sizeof(blank));
+    blank.line = blank.rest = empty;
+    blank.timestamp.p = blank.ip.p = blank.method.p = blank.url.p = blank.protocol.p = empty;
+    blank.referrer.p = blank.userAgent.p = empty;
+    blank.request_time = -1.0;
+    blank.loaded = LF_ALL | LE_EPOCH;
+
+    int64_t epoch = 0;
+    for (uint32_t i = 0; i < b->rows; i++)
+    {
+        LogEntry e = blank;
+        if (!get_row(r, &e, &epoch))
+            return 0;
+        st->total++;
+        st->parsed++;
+        if (scan_filter(r->plan, &e))
+        {
+            if (st->agg)
+                agg_add(st->agg, &e);
+            else
+                scan_emit(r->plan, &e, out, first_json);
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Scans the next block that the query's terms do not rule out.
+ *
+ * Rows in blocks skipped through their zone maps are never decoded; they
+ * count towards total and skipped.
+ *
+ * @return 1 after a block, 0 when there are no more, -1 on a corrupt block.
+ */
+int lfc_next(LfcReader *r, OutBuf *out, int *first_json, ScanStats *st)
+{
+    const ScanPlan *plan = r->plan;
+    while (r->next < r->hdr->nblocks)
+    {
+        const LfcBlock *b = &r->dir[r->next++];
+        if (plan->use_q && !index_block_may_match(&b->zone, &plan->q))
+        {
+            st->total += b->rows;
+            st->skipped += b->rows;
+            continue;
+        }
+        if (!scan_rows(r, b, out, first_json, st))
+        {
+            fprintf(stderr, "[%s] block %llu of the .lfc file is corrupt\n", r->label,
+                    (unsigned long long)(r->next - 1));
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Scans a whole .lfc file, like scan_stream() does a log.
+ *
+ * @return 1 on success, 0 if the file could not be read.
+ */
+int lfc_scan(const ScanPlan *plan, FILE *in, const char *label, OutBuf *out,
+             int *first_json, ScanStats *st)
+{
+    LfcReader *r = lfc_open(plan, in, label, st);
+    if (!r)
+        return 0;
+    int rc;
+    while ((rc = lfc_next(r, out, first_json, st)) > 0)
+        ;
+    lfc_close(r);
+    return rc == 0;
+}
+
+/**
+ * @brief Entry point for `logfire convert --to lfc FILE... [--output OUT] [--block-rows N]`.
+ *
+ * Each FILE is written to FILE.lfc unless --output names the destination
+ * (one input only; required for stdin, "-").
+ *
+ * @return Process exit status.
+ */
+int lfc_main(int argc, char *argv[])
+{
+    static const char usage[] = "Usage: logfire convert --to lfc FILE... [--output OUT] [--block-rows N]\n";
+    const char *to = NULL, *dest = NULL;
+    unsigned block_rows = LFC_DEFAULT_BLOCK_ROWS;
+    int nfiles = 0, failed = 0;
+    char **files = (char **)xrealloc(NULL, (size_t)argc * sizeof(char *));
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--to") == 0 && i + 1 < argc)
+            to = argv[++i];
+        else if ((strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0) && i + 1 < argc)
+            dest = argv[++i];
+        else if (strcmp(argv[i], "--block-rows") == 0)
+        {
+            char *endp = NULL;
+            long n = i + 1 < argc ? strtol(argv[++i], &endp, 10) : 0;
+            if (!endp || *endp || n < 1 || n > (long)LFC_MAX_BLOCK_ROWS)
+            {
+                fprintf(stderr, "--block-rows: invalid value '%s'\n", i < argc ? argv[i] : "");
+                free(files);
+                return 1;
+            }
+            block_rows = (unsigned)n;
+        }
+        else
+            files[nfiles++] = argv[i];
+    }
+    if (!to || strcmp(to, "lfc") != 0 || nfiles == 0)
+    {
+        if (to && strcmp(to, "lfc") != 0)
+            fprintf(stderr, "convert: unknown format '%s' (supported: lfc)\n", to);
+        fprintf(stderr, "%s", usage);
+        free(files);
+        return 1;
+    }
+    if (dest && nfiles > 1)
+    {
+        fprintf(stderr, "convert: --output takes a single input\n");
+        free(files);
+        return 1;
+    }
+
+    for (int i = 0; i < nfiles; i++)
+    {
+        if (dest)
+        {
+            failed += !lfc_convert(files[i], dest, block_rows);
+            continue;
+        }
+        if (strcmp(files[i], "-") == 0)
+        {
+            fprintf(stderr, "convert: stdin needs --output\n");
+            failed++;
+            continue;
+        }
+        char *path = (char *)xrealloc(NULL, strlen(files[i]) + sizeof(LFC_SUFFIX));
+        sprintf(path, "%s%s", files[i], LFC_SUFFIX);
+        failed += !lfc_convert(files[i], path, block_rows);
+        free(path);
+    }
+    free(files);
+    return failed ? 1 : 0;
+}
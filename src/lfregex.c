@@ -0,0 +1,1150 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lfregex.h"
+
+#define LFRE_MAX_INSTS 20000          // compiled program size limit
+#define LFRE_MAX_REPEAT 1000          // {m,n} bounds
+#define LFRE_CACHE_BYTES (1u << 20)   // per-thread DFA cache budget
+
+/* --- parse tree ---------------------------------------------------------- */
+
+enum
+{
+    N_SET,   // one byte from sets[set]
+    N_EMPTY, // matches the empty string
+    N_BOL,
+    N_EOL,
+    N_CAT,
+    N_ALT,
+    N_REPEAT // a{min,max}; max < 0 means unbounded
+};
+
+typedef struct
+{
+    int type;
+    int set;
+    int a, b; // child node indices
+    int min, max;
+} Node;
+
+typedef struct
+{
+    uint64_t bits[4];
+} ByteSet;
+
+/* --- program ------------------------------------------------------------- */
+
+enum
+{
+    OP_BYTE,  // consume a byte in sets[set], continue at x
+    OP_SPLIT, // continue at x and y
+    OP_JMP,
+    OP_BOL, // only at the start of the subject
+    OP_EOL, // only at the end of the subject
+    OP_MATCH
+};
+
+typedef struct
+{
+    unsigned char op;
+    int x, y;
+    int set;
+} Inst;
+
+struct DCache;
+
+struct LfRegex
+{
+    int ci;
+    Node *nodes;
+    int nnodes, root;
+    ByteSet *sets;
+    int nsets;
+    Inst *prog;
+    int ninst;
+    int start;
+    unsigned char cls[256]; // byte -> equivalence class
+    unsigned char rep[256]; // class -> representative byte
+    int nclasses;
+    int keyed;         // key and mu are initialized
+    pthread_key_t key; // this thread's DFA cache
+    pthread_mutex_t mu;
+    struct DCache *caches; // every thread's cache, freed with the regex
+};
+
+/* --- parser -------------------------------------------------------------- */
+
+typedef struct
+{
+    LfRegex *re;
+    const char *p;
+    char *err;
+    size_t errsz;
+    int failed;
+    int nodecap, setcap;
+    int depth;
+} Parser;
+
+static int fail(Parser *ps, const char *msg)
+{
+    if (!ps->failed)
+        snprintf(ps->err, ps->errsz, "regex: %s", msg);
+    ps->failed = 1;
+    return -1;
+}
+
+static int new_node(Parser *ps, int type)
+{
+    LfRegex *re = ps->re;
+    if (re->nnodes == ps->nodecap)
+    {
+        int ncap = ps->nodecap ? ps->nodecap * 2 : 64;
+        Node *nn = (Node *)realloc(re->nodes, (size_t)ncap * sizeof(Node));
+        if (!nn)
+            return fail(ps, "out of memory");
+        re->nodes = nn;
+        ps->nodecap = ncap;
+    }
+    Node *n = &re->nodes[re->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->a = n->b = -1;
+    return re->nnodes++;
+}
+
+static int new_set(Parser *ps, const ByteSet *s)
+{
+    LfRegex *re = ps->re;
+    if (re->nsets == ps->setcap)
+    {
+        int ncap = ps->setcap ? ps->setcap * 2 : 16;
+        ByteSet *ns = (ByteSet *)realloc(re->sets, (size_t)ncap * sizeof(ByteSet));
+        if (!ns)
+            return fail(ps, "out of memory");
+        re->sets = ns;
+        ps->setcap = ncap;
+    }
+    re->sets[re->nsets] = *s;
+    return re->nsets++;
+}
+
+static void set_add(ByteSet *s, unsigned c)
+{
+    s->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int set_has(const ByteSet *s, unsigned c)
+{
+    return (int)((s->bits[c >> 6] >> (c & 63)) & 1);
+}
+
+static void set_range(ByteSet *s, unsigned lo, unsigned hi)
+{
+    for (unsigned c = lo; c <= hi; c++)
+        set_add(s, c);
+}
+
+// With --ci every letter in a set brings its other case along
+static void set_fold(ByteSet *s)
+{
+    for (unsigned c = 'a'; c <= 'z'; c++)
+        if (set_has(s, c) || set_has(s, c - 32))
+        {
+            set_add(s, c);
+            set_add(s, c - 32);
+        }
+}
+
+static int set_node(Parser *ps, ByteSet *s)
+{
+    if (ps->re->ci)
+        set_fold(s);
+    int set = new_set(ps, s);
+    int n = set < 0 ? -1 : new_node(ps, N_SET);
+    if (n >= 0)
+        ps->re->nodes[n].set = set;
+    return n;
+}
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Escape after '\'. Adds a class (\d \w \s, negated forms) or a single byte
+ * to s. Returns the byte, 256 for a class, or -1 on error.
+ */
+static int parse_escape(Parser *ps, ByteSet *s)
+{
+    char c = *ps->p++;
+    ByteSet t;
+    memset(&t, 0, sizeof(t));
+    switch (c)
+    {
+    case '\0':
+        ps->p--;
+        return fail(ps, "trailing backslash");
+    case 'd':
+    case 'D':
+        set_range(&t, '0', '9');
+        break;
+    case 'w':
+    case 'W':
+        set_range(&t, '0', '9');
+        set_range(&t, 'a', 'z');
+        set_range(&t, 'A', 'Z');
+        set_add(&t, '_');
+        break;
+    case 's':
+    case 'S':
+        set_add(&t, ' ');
+        set_range(&t, '\t', '\r');
+        break;
+    case 'n':
+        set_add(s, '\n');
+        return '\n';
+    case 't':
+        set_add(s, '\t');
+        return '\t';
+    case 'r':
+        set_add(s, '\r');
+        return '\r';
+    case 'f':
+        set_add(s, '\f');
+        return '\f';
+    case 'v':
+        set_add(s, '\v');
+        return '\v';
+    case 'x':
+    {
+        int h = hexval(ps->p[0]), l = h < 0 ? -1 : hexval(ps->p[1]);
+        if (l < 0)
+            return fail(ps, "bad \\x escape");
+        ps->p += 2;
+        set_add(s, (unsigned)(h * 16 + l));
+        return h * 16 + l;
+    }
+    case 'b':
+    case 'B':
+        return fail(ps, "\\b and \\B are not supported");
+    default:
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            return fail(ps, "unknown escape");
+        set_add(s, (unsigned char)c);
+        return (unsigned char)c;
+    }
+    if (c >= 'A' && c <= 'Z') // \D \W \S
+        for (int i = 0; i < 4; i++)
+            t.bits[i] = ~t.bits[i];
+    for (int i = 0; i < 4; i++)
+        s->bits[i] |= t.bits[i];
+    return 256;
+}
+
+static int parse_class(Parser *ps)
+{
+    ByteSet s;
+    int neg = 0, first = 1;
+    memset(&s, 0, sizeof(s));
+    if (*ps->p == '^')
+    {
+        neg = 1;
+        ps->p++;
+    }
+    while (*ps->p && (first || *ps->p != ']'))
+    {
+        int lo;
+        first = 0;
+        if (*ps->p == '\\')
+        {
+            ps->p++;
+            if ((lo = parse_escape(ps, &s)) < 0)
+                return -1;
+        }
+        else
+        {
+            lo = (unsigned char)*ps->p++;
+            set_add(&s, (unsigned)lo);
+        }
+        if (lo < 256 && ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']')
+        {
+            ps->p++;
+            int hi;
+            if (*ps->p == '\\')
+            {
+                ByteSet tmp;
+                memset(&tmp, 0, sizeof(tmp));
+                ps->p++;
+                if ((hi = parse_escape(ps, &tmp)) < 0)
+                    return -1;
+                if (hi == 256)
+                    return fail(ps, "bad class range");
+            }
+            else
+                hi = (unsigned char)*ps->p++;
+            if (hi < lo)
+                return fail(ps, "bad class range");
+            set_range(&s, (unsigned)lo, (unsigned)hi);
+        }
+    }
+    if (*ps->p != ']')
+        return fail(ps, "missing ]");
+    ps->p++;
+    if (ps->re->ci)
+        set_fold(&s); // before negating, so [^a] excludes 'A' too
+    if (neg)
+        for (int i = 0; i < 4; i++)
+            s.bits[i] = ~s.bits[i];
+    int set = new_set(ps, &s);
+    int n = set < 0 ? -1 : new_node(ps, N_SET);
+    if (n >= 0)
+        ps->re->nodes[n].set = set;
+    return n;
+}
+
+static int parse_alt(Parser *ps);
+
+// {m}, {m,}, {m,n}; returns 0 (and consumes nothing) if this is not a count
+static int parse_count(Parser *ps, int *min, int *max)
+{
+    const char *p = ps->p + 1;
+    long m = 0, n;
+    if (*p < '0' || *p > '9')
+        return 0;
+    while (*p >= '0' && *p <= '9' && m <= LFRE_MAX_REPEAT)
+        m = m * 10 + (*p++ - '0');
+    n = m;
+    if (*p == ',')
+    {
+        p++;
+        if (*p == '}')
+            n = -1;
+        else
+        {
+            if (*p < '0' || *p > '9')
+                return 0;
+            n = 0;
+            while (*p >= '0' && *p <= '9' && n <= LFRE_MAX_REPEAT)
+                n = n * 10 + (*p++ - '0');
+        }
+    }
+    if (*p != '}')
+        return 0;
+    if (m > LFRE_MAX_REPEAT || n > LFRE_MAX_REPEAT)
+        return fail(ps, "repeat count too large"), 0;
+    if (n >= 0 && n < m)
+        return fail(ps, "bad repeat range"), 0;
+    ps->p = p + 1;
+    *min = (int)m;
+    *max = (int)n;
+    return 1;
+}
+
+static int parse_atom(Parser *ps)
+{
+    char c = *ps->p;
+    ByteSet s;
+    memset(&s, 0, sizeof(s));
+    switch (c)
+    {
+    case '(':
+    {
+        ps->p++;
+        if (ps->p[0] == '?' && ps->p[1] == ':')
+            ps->p += 2;
+        if (++ps->depth > 200)
+            return fail(ps, "nested too deeply");
+        int n = parse_alt(ps);
+        ps->depth--;
+        if (n < 0)
+            return -1;
+        if (*ps->p != ')')
+            return fail(ps, "missing )");
+        ps->p++;
+        return n;
+    }
+    case '[':
+        ps->p++;
+        return parse_class(ps);
+    case '.':
+        ps->p++;
+        for (int i = 0; i < 4; i++)
+            s.bits[i] = ~0ULL;
+        return set_node(ps, &s);
+    case '^':
+        ps->p++;
+        return new_node(ps, N_BOL);
+    case '$':
+        ps->p++;
+        return new_node(ps, N_EOL);
+    case '\\':
+        ps->p++;
+        if (parse_escape(ps, &s) < 0)
+            return -1;
+        return set_node(ps, &s);
+    case '*':
+    case '+':
+    case '?':
+        return fail(ps, "nothing to repeat");
+    default:
+        ps->p++;
+        set_add(&s, (unsigned char)c);
+        return set_node(ps, &s);
+    }
+}
+
+static int make_repeat(Parser *ps, int a, int min, int max)
+{
+    int n = new_node(ps, N_REPEAT);
+    if (n >= 0)
+    {
+        Node *r = &ps->re->nodes[n];
+        r->a = a;
+        r->min = min;
+        r->max = max;
+    }
+    return n;
+}
+
+static int parse_repeat(Parser *ps)
+{
+    int n = parse_atom(ps);
+    while (n >= 0)
+    {
+        int min, max;
+        char c = *ps->p;
+        if (c == '*')
+            min = 0, max = -1;
+        else if (c == '+')
+            min = 1, max = -1;
+        else if (c == '?')
+            min = 0, max = 1;
+        else if (c == '{' && parse_count(ps, &min, &max))
+            ps->p--; // parse_count consumed the braces; undo the ++ below
+        else
+            break;
+        if (ps->failed)
+            return -1;
+        ps->p++;
+        if (*ps->p == '?') // lazy: same set of matching subjects
+            ps->p++;
+        n = make_repeat(ps, n, min, max);
+    }
+    return ps->failed ? -1 : n;
+}
+
+static int parse_cat(Parser *ps)
+{
+    int left = -1;
+    while (*ps->p && *ps->p != '|' && *ps->p != ')')
+    {
+        int n = parse_repeat(ps);
+        if (n < 0)
+            return -1;
+        if (left < 0)
+            left = n;
+        else
+        {
+            int c = new_node(ps, N_CAT);
+            if (c < 0)
+                return -1;
+            ps->re->nodes[c].a = left;
+            ps->re->nodes[c].b = n;
+            left = c;
+        }
+    }
+    return left >= 0 ? left : new_node(ps, N_EMPTY);
+}
+
+static int parse_alt(Parser *ps)
+{
+    int left = parse_cat(ps);
+    while (left >= 0 && *ps->p == '|')
+    {
+        ps->p++;
+        int right = parse_cat(ps);
+        if (right < 0)
+            return -1;
+        int n = new_node(ps, N_ALT);
+        if (n < 0)
+            return -1;
+        ps->re->nodes[n].a = left;
+        ps->re->nodes[n].b = right;
+        left = n;
+    }
+    return left;
+}
+
+/* --- compiler ------------------------------------------------------------ */
+
+static int emit(LfRegex *re, int *cap, unsigned char op, int x, int y, int set)
+{
+    if (re->ninst >= LFRE_MAX_INSTS)
+        return -1;
+    if (re->ninst == *cap)
+    {
+        int ncap = *cap ? *cap * 2 : 64;
+        Inst *np = (Inst *)realloc(re->prog, (size_t)ncap * sizeof(Inst));
+        if (!np)
+            return -1;
+        re->prog = np;
+        *cap = ncap;
+    }
+    Inst *i = &re->prog[re->ninst];
+    i->op = op;
+    i->x = x;
+    i->y = y;
+    i->set = set;
+    return re->ninst++;
+}
+
+// Emits node n so that it falls through to the next instruction
+static int compile_node(LfRegex *re, int *cap, int n)
+{
+    const Node *nd = &re->nodes[n];
+    int pc, l1;
+    switch (nd->type)
+    {
+    case N_SET:
+        pc = emit(re, cap, OP_BYTE, 0, 0, nd->set);
+        if (pc < 0)
+            return -1;
+        re->prog[pc].x = pc + 1;
+        return 0;
+    case N_EMPTY:
+        return 0;
+    case N_BOL:
+    case N_EOL:
+        pc = emit(re, cap, nd->type == N_BOL ? OP_BOL : OP_EOL, 0, 0, 0);
+        if (pc < 0)
+            return -1;
+        re->prog[pc].x = pc + 1;
+        return 0;
+    case N_CAT:
+        return compile_node(re, cap, nd->a) < 0 ? -1 : compile_node(re, cap, nd->b);
+    case N_ALT:
+    {
+        int split = emit(re, cap, OP_SPLIT, 0, 0, 0);
+        if (split < 0 || compile_node(re, cap, nd->a) < 0)
+            return -1;
+        int jmp = emit(re, cap, OP_JMP, 0, 0, 0);
+        if (jmp < 0)
+            return -1;
+        re->prog[split].x = split + 1;
+        re->prog[split].y = re->ninst;
+        if (compile_node(re, cap, nd->b) < 0)
+            return -1;
+        re->prog[jmp].x = re->ninst;
+        return 0;
+    }
+    case N_REPEAT:
+    {
+        int a = nd->a, min = nd->min, max = nd->max;
+        for (int i = 0; i < min; i++)
+            if (compile_node(re, cap, a) < 0)
+                return -1;
+        if (max < 0)
+        {
+            // L1: split L2, L3; L2: a; jmp L1; L3:
+            l1 = emit(re, cap, OP_SPLIT, 0, 0, 0);
+            if (l1 < 0 || compile_node(re, cap, a) < 0)
+                return -1;
+            if (emit(re, cap, OP_JMP, l1, 0, 0) < 0)
+                return -1;
+            re->prog[l1].x = l1 + 1;
+            re->prog[l1].y = re->ninst;
+            return 0;
+        }
+        for (int i = min; i < max; i++)
+        {
+            // split L1, L2; L1: a; L2:  (a?a?... matches the same as a{0,k})
+            l1 = emit(re, cap, OP_SPLIT, 0, 0, 0);
+            if (l1 < 0 || compile_node(re, cap, a) < 0)
+                return -1;
+            re->prog[l1].x = l1 + 1;
+            re->prog[l1].y = re->ninst;
+        }
+        return 0;
+    }
+    }
+    return -1;
+}
+
+// Partitions bytes into classes no set distinguishes; DFA rows are per class
+static void compute_classes(LfRegex *re)
+{
+    int remap[512];
+    memset(re->cls, 0, sizeof(re->cls));
+    re->nclasses = 1;
+    for (int s = 0; s < re->nsets; s++)
+    {
+        int n = 0;
+        for (int i = 0; i < 512; i++)
+            remap[i] = -1;
+        for (int c = 0; c < 256; c++)
+        {
+            int key = re->cls[c] * 2 + set_has(&re->sets[s], (unsigned)c);
+            if (remap[key] < 0)
+                remap[key] = n++;
+            re->cls[c] = (unsigned char)remap[key];
+        }
+        re->nclasses = n;
+    }
+    for (int c = 255; c >= 0; c--)
+        re->rep[re->cls[c]] = (unsigned char)c;
+}
+
+/* --- lazy DFA ------------------------------------------------------------ */
+
+#define D_UNKNOWN ((DState *)0)
+
+typedef struct DState
+{
+    struct DState *hnext; // hash chain
+    uint32_t hash;
+    int bol;        // built for position 0 (^ may still apply)
+    int accept;     // contains MATCH: the subject matches
+    int end_accept; // -1 unknown, else whether $ at the end leads to MATCH
+    int dead;       // no thread left and nothing restarts (anchored pattern)
+    int n;
+    int *pcs;                // sorted OP_BYTE / OP_EOL / OP_MATCH pcs
+    struct DState *next[1];  // per byte class, D_UNKNOWN until computed
+} DState;
+
+typedef struct DCache
+{
+    const LfRegex *re;
+    struct DCache *link_next, *link_prev;
+    DState **table;
+    size_t tsize;
+    DState **all;
+    size_t nall, capall;
+    size_t bytes;
+    DState *start;
+    // work space for closures, sized by the program
+    int *mark;
+    int gen;
+    int *stack; // a pc is pushed at most twice per closure
+    int *list;
+    int nlist;
+} DCache;
+
+static void cache_clear(DCache *c)
+{
+    for (size_t i = 0; i < c->nall; i++)
+        free(c->all[i]);
+    c->nall = 0;
+    memset(c->table, 0, c->tsize * sizeof(DState *));
+    c->bytes = 0;
+    c->start = NULL;
+}
+
+static void cache_destroy(DCache *c)
+{
+    if (!c)
+        return;
+    cache_clear(c);
+    free(c->all);
+    free(c->table);
+    free(c->mark);
+    free(c->stack);
+    free(c->list);
+    free(c);
+}
+
+// Thread exit: unlink this thread's cache from the regex and free it
+static void cache_release(void *arg)
+{
+    DCache *c = (DCache *)arg;
+    LfRegex *re = (LfRegex *)c->re;
+    pthread_mutex_lock(&re->mu);
+    if (c->link_prev)
+        c->link_prev->link_next = c->link_next;
+    else
+        re->caches = c->link_next;
+    if (c->link_next)
+        c->link_next->link_prev = c->link_prev;
+    pthread_mutex_unlock(&re->mu);
+    cache_destroy(c);
+}
+
+static DCache *cache_get(const LfRegex *cre)
+{
+    LfRegex *re = (LfRegex *)cre;
+    DCache *c = (DCache *)pthread_getspecific(re->key);
+    if (c)
+        return c;
+    c = (DCache *)calloc(1, sizeof(DCache));
+    if (!c)
+        return NULL;
+    c->re = re;
+    c->tsize = 1024;
+    c->table = (DState **)calloc(c->tsize, sizeof(DState *));
+    c->mark = (int *)calloc((size_t)re->ninst + 1, sizeof(int));
+    c->stack = (int *)malloc(2 * ((size_t)re->ninst + 1) * sizeof(int));
+    c->list = (int *)malloc(((size_t)re->ninst + 1) * sizeof(int));
+    if (!c->table || !c->mark || !c->stack || !c->list)
+    {
+        cache_destroy(c);
+        return NULL;
+    }
+    pthread_mutex_lock(&re->mu);
+    c->link_next = re->caches;
+    if (re->caches)
+        re->caches->link_prev = c;
+    re->caches = c;
+    pthread_mutex_unlock(&re->mu);
+    pthread_setspecific(re->key, c);
+    return c;
+}
+
+// Adds pc and everything reachable from it without consuming a byte
+static void closure(DCache *c, int pc, int bol, int eol)
+{
+    const Inst *prog = c->re->prog;
+    int sp = 0;
+    c->stack[sp++] = pc;
+    while (sp > 0)
+    {
+        pc = c->stack[--sp];
+        if (c->mark[pc] == c->gen)
+            continue;
+        c->mark[pc] = c->gen;
+        const Inst *in = &prog[pc];
+        switch (in->op)
+        {
+        case OP_JMP:
+            c->stack[sp++] = in->x;
+            break;
+        case OP_SPLIT:
+            c->stack[sp++] = in->y;
+            c->stack[sp++] = in->x;
+            break;
+        case OP_BOL:
+            if (bol)
+                c->stack[sp++] = in->x;
+            break;
+        case OP_EOL:
+            if (eol)
+                c->stack[sp++] = in->x;
+            else
+                c->list[c->nlist++] = pc; // may still hold at the end
+            break;
+        default: // OP_BYTE, OP_MATCH
+            c->list[c->nlist++] = pc;
+            break;
+        }
+    }
+}
+
+static void begin_set(DCache *c)
+{
+    if (++c->gen == 0) // wrapped: reset the marks
+    {
+        memset(c->mark, 0, ((size_t)c->re->ninst + 1) * sizeof(int));
+        c->gen = 1;
+    }
+    c->nlist = 0;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Finds or creates the DFA state for c->list; NULL when out of memory
+static DState *intern(DCache *c, int bol)
+{
+    const LfRegex *re = c->re;
+    qsort(c->list, (size_t)c->nlist, sizeof(int), cmp_int);
+    uint32_t h = 2166136261u ^ (uint32_t)bol;
+    for (int i = 0; i < c->nlist; i++)
+        h = (h ^ (uint32_t)c->list[i]) * 16777619u;
+    size_t slot = h & (c->tsize - 1);
+    for (DState *d = c->table[slot]; d; d = d->hnext)
+        if (d->hash == h && d->bol == bol && d->n == c->nlist &&
+            memcmp(d->pcs, c->list, (size_t)c->nlist * sizeof(int)) == 0)
+            return d;
+
+    size_t sz = sizeof(DState) + (size_t)(re->nclasses - 1) * sizeof(DState *) +
+                (size_t)c->nlist * sizeof(int);
+    if (c->nall == c->capall)
+    {
+        size_t ncap = c->capall ? c->capall * 2 : 64;
+        DState **na = (DState **)realloc(c->all, ncap * sizeof(DState *));
+        if (!na)
+            return NULL;
+        c->all = na;
+        c->capall = ncap;
+    }
+    DState *d = (DState *)calloc(1, sz);
+    if (!d)
+        return NULL;
+    d->pcs = (int *)((char *)d + sizeof(DState) + (size_t)(re->nclasses - 1) * sizeof(DState *));
+    memcpy(d->pcs, c->list, (size_t)c->nlist * sizeof(int));
+    d->n = c->nlist;
+    d->hash = h;
+    d->bol = bol;
+    d->end_accept = -1;
+    for (int i = 0; i < d->n; i++)
+        if (re->prog[d->pcs[i]].op == OP_MATCH)
+            d->accept = 1;
+    d->hnext = c->table[slot];
+    c->table[slot] = d;
+    c->all[c->nall++] = d;
+    c->bytes += sz;
+    return d;
+}
+
+// The state before any input: the program's start, with ^ satisfied
+static DState *start_state(DCache *c)
+{
+    if (!c->start)
+    {
+        begin_set(c);
+        closure(c, c->re->start, 1, 0);
+        c->start = intern(c, 1);
+    }
+    return c->start;
+}
+
+/*
+ * Next state after one byte of class cls: every thread that can consume
+ * it, plus a fresh thread from the start (the pattern may begin anywhere).
+ * Flushes the cache first if it is over budget; the caller must then not
+ * use any other DState pointer it holds.
+ */
+static DState *step(DCache *c, DState *d, int cls)
+{
+    const LfRegex *re = c->re;
+    unsigned char byte = re->rep[cls];
+
+    if (c->bytes > LFRE_CACHE_BYTES)
+    {
+        // keep d's thread list across the flush
+        int n = d->n;
+        memcpy(c->stack, d->pcs, (size_t)n * sizeof(int));
+        begin_set(c);
+        memcpy(c->list, c->stack, (size_t)n * sizeof(int));
+        c->nlist = n;
+        int bol = d->bol;
+        cache_clear(c);
+        d = intern(c, bol);
+        if (!d)
+            return NULL;
+    }
+
+    begin_set(c);
+    for (int i = 0; i < d->n; i++)
+    {
+        const Inst *in = &re->prog[d->pcs[i]];
+        if (in->op == OP_BYTE && set_has(&re->sets[in->set], byte))
+            closure(c, in->x, 0, 0);
+    }
+    closure(c, re->start, 0, 0);
+    DState *nx = intern(c, 0);
+    if (!nx)
+        return NULL;
+    nx->dead = nx->n == 0;
+    d->next[cls] = nx;
+    return nx;
+}
+
+static int end_accepts(DCache *c, DState *d)
+{
+    if (d->end_accept < 0)
+    {
+        begin_set(c);
+        for (int i = 0; i < d->n; i++)
+            if (c->re->prog[d->pcs[i]].op == OP_EOL)
+                closure(c, d->pcs[i], d->bol, 1);
+        int ok = 0;
+        for (int i = 0; i < c->nlist; i++)
+            if (c->re->prog[c->list[i]].op == OP_MATCH)
+                ok = 1;
+        d->end_accept = ok;
+    }
+    return d->end_accept;
+}
+
+/* --- simulation fallback ------------------------------------------------- */
+
+// Used only if a DFA cache cannot be allocated: same automaton, no caching
+static int nfa_match(const LfRegex *re, const char *s, size_t n)
+{
+    DCache tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.re = re;
+    size_t w = (size_t)re->ninst + 1;
+    int *buf = (int *)calloc(5 * w, sizeof(int));
+    if (!buf)
+        return 0;
+    tmp.mark = buf;
+    tmp.stack = buf + w;
+    tmp.list = buf + 3 * w;
+    int *cur = buf + 4 * w, ncur = 0;
+    int ok = 0;
+
+    begin_set(&tmp);
+    closure(&tmp, re->start, 1, 0);
+    for (size_t i = 0;; i++)
+    {
+        ncur = tmp.nlist;
+        memcpy(cur, tmp.list, (size_t)ncur * sizeof(int));
+        for (int k = 0; k < ncur; k++)
+            if (re->prog[cur[k]].op == OP_MATCH)
+                ok = 1;
+        if (ok || i == n)
+            break;
+        begin_set(&tmp);
+        for (int k = 0; k < ncur; k++)
+        {
+            const Inst *in = &re->prog[cur[k]];
+            if (in->op == OP_BYTE && set_has(&re->sets[in->set], (unsigned char)s[i]))
+                closure(&tmp, in->x, 0, 0);
+        }
+        closure(&tmp, re->start, 0, 0);
+    }
+    if (!ok)
+    {
+        begin_set(&tmp);
+        for (int k = 0; k < ncur; k++)
+            if (re->prog[cur[k]].op == OP_EOL)
+                closure(&tmp, cur[k], n == 0, 1);
+        for (int k = 0; k < tmp.nlist; k++)
+            if (re->prog[tmp.list[k]].op == OP_MATCH)
+                ok = 1;
+    }
+    free(buf);
+    return ok;
+}
+
+/* --- public -------------------------------------------------------------- */
+
+/**
+ * @brief Compiles a pattern.
+ *
+ * @param pattern  NUL-terminated regular expression.
+ * @param ci       Match ASCII letters case-insensitively.
+ * @param err      Receives a message on failure.
+ * @return         The compiled regex (free with lfre_free()), or NULL.
+ */
+LfRegex *lfre_compile(const char *pattern, int ci, char *err, size_t errsz)
+{
+    LfRegex *re = (LfRegex *)calloc(1, sizeof(LfRegex));
+    if (!re)
+    {
+        snprintf(err, errsz, "regex: out of memory");
+        return NULL;
+    }
+    re->ci = ci;
+
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.re = re;
+    ps.p = pattern;
+    ps.err = err;
+    ps.errsz = errsz;
+    re->root = parse_alt(&ps);
+    if (re->root >= 0 && *ps.p == ')')
+        fail(&ps, "unmatched )");
+    if (ps.failed || re->root < 0)
+    {
+        fail(&ps, "syntax error");
+        lfre_free(re);
+        return NULL;
+    }
+
+    int cap = 0;
+    if (compile_node(re, &cap, re->root) < 0 || emit(re, &cap, OP_MATCH, 0, 0, 0) < 0)
+    {
+        snprintf(err, errsz, "regex: pattern too large");
+        lfre_free(re);
+        return NULL;
+    }
+    re->start = 0;
+    compute_classes(re);
+    if (pthread_key_create(&re->key, cache_release) != 0)
+    {
+        snprintf(err, errsz, "regex: out of thread keys");
+        lfre_free(re);
+        return NULL;
+    }
+    pthread_mutex_init(&re->mu, NULL);
+    re->keyed = 1;
+    return re;
+}
+
+/**
+ * @brief Returns 1 if the regex matches anywhere in s[0..n).
+ *
+ * Safe to call from several threads at once; each thread keeps its own
+ * DFA cache. Runs in time linear in n.
+ */
+int lfre_match(const LfRegex *re, const char *s, size_t n)
+{
+    DCache *c = cache_get(re);
+    if (!c)
+        return nfa_match(re, s, n);
+    DState *d = start_state(c);
+    if (!d)
+        return nfa_match(re, s, n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (d->accept)
+            return 1;
+        if (d->dead)
+            return 0;
+        int cls = re->cls[(unsigned char)s[i]];
+        DState *nx = d->next[cls];
+        if (nx == D_UNKNOWN && !(nx = step(c, d, cls)))
+            return nfa_match(re, s, n);
+        d = nx;
+    }
+    return d->accept || end_accepts(c, d);
+}
+
+// Required-literal scan over a concatenation, flattened left to right
+typedef struct
+{
+    const LfRegex *re;
+    char run[256], best[256];
+    size_t nrun, nbest;
+} LitScan;
+
+// The byte a set stands for when it is a single character (or a letter under --ci)
+static int literal_byte(const LfRegex *re, const ByteSet *s)
+{
+    int found = -1, count = 0;
+    for (int c = 0; c < 256; c++)
+        if (set_has(s, (unsigned)c))
+        {
+            count++;
+            found = c;
+        }
+    if (count == 1)
+        return found;
+    if (re->ci && count == 2 && found >= 'a' && found <= 'z' && set_has(s, (unsigned)found - 32))
+        return found;
+    return -1;
+}
+
+static void lit_flush(LitScan *ls)
+{
+    if (ls->nrun > ls->nbest)
+    {
+        memcpy(ls->best, ls->run, ls->nrun);
+        ls->nbest = ls->nrun;
+    }
+    ls->nrun = 0;
+}
+
+static void lit_walk(LitScan *ls, int n)
+{
+    const Node *nd = &ls->re->nodes[n];
+    switch (nd->type)
+    {
+    case N_SET:
+    {
+        int b = literal_byte(ls->re, &ls->re->sets[nd->set]);
+        if (b < 0)
+            lit_flush(ls);
+        else if (ls->nrun < sizeof(ls->run))
+            ls->run[ls->nrun++] = (char)b;
+        break;
+    }
+    case N_EMPTY:
+    case N_BOL:
+    case N_EOL:
+        break; // zero width: neighbours stay adjacent
+    case N_CAT:
+        lit_walk(ls, nd->a);
+        lit_walk(ls, nd->b);
+        break;
+    case N_REPEAT:
+        if (nd->min == 0)
+            lit_flush(ls);
+        else if (nd->min == 1 && nd->max == 1)
+            lit_walk(ls, nd->a);
+        else if (ls->re->nodes[nd->a].type == N_SET)
+        {
+            // x{m,n}: m copies in a row, and the last one touches what follows
+            for (int i = 0; i < nd->min; i++)
+                lit_walk(ls, nd->a);
+            if (nd->max != nd->min)
+            {
+                lit_flush(ls);
+                lit_walk(ls, nd->a);
+            }
+        }
+        else
+        {
+            // only the first copy is known to touch what precedes
+            lit_walk(ls, nd->a);
+            lit_flush(ls);
+        }
+        break;
+    default: // N_ALT: no single literal is required
+        lit_flush(ls);
+        break;
+    }
+}
+
+/**
+ * @brief Longest literal every match must contain, for substring prefiltering.
+ *
+ * @param ci  Set to 1 if the literal is lowercased and must be matched
+ *            case-insensitively.
+ * @return    Literal length (copied to buf, NUL-terminated), or 0.
+ */
+size_t lfre_required_literal(const LfRegex *re, char *buf, size_t bufsz, int *ci)
+{
+    LitScan ls;
+    memset(&ls, 0, sizeof(ls));
+    ls.re = re;
+    lit_walk(&ls, re->root);
+    lit_flush(&ls);
+    size_t n = ls.nbest < bufsz ? ls.nbest : bufsz - 1;
+    memcpy(buf, ls.best, n);
+    buf[n] = '\0';
+    *ci = re->ci;
+    return n;
+}
+
+void lfre_free(LfRegex *re)
+{
+    if (!re)
+        return;
+    if (re->keyed)
+    {
+        // threads still holding a cache are gone or idle; free them all
+        pthread_key_delete(re->key);
+        while (re->caches)
+        {
+            DCache *c = re->caches;
+            re->caches = c->link_next;
+            cache_destroy(c);
+        }
+        pthread_mutex_destroy(&re->mu);
+    }
+    free(re->prog);
+    free(re->nodes);
+    free(re->sets);
+    free(re);
+}
@@ -0,0 +1,310 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include "linesrc.h"
+#include "decomp.h"
+
+#define LINESRC_BLOCK (1u << 20) // 1 MiB read blocks in buffered mode
+
+/**
+ * @brief Attaches a line source to an already opened stream.
+ *
+ * Regular, non-empty files are mapped read-only and scanned in place. For
+ * everything else (stdin, pipes, or a failed mmap) a single block buffer is
+ * allocated and refilled with fread() as lines are consumed. Compressed
+ * input, mapped or read, is refilled from a decoder instead.
+ *
+ * @param ls  LineSource to initialize.
+ * @param fp  Open input stream; must not have been read from yet.
+ * @return    1 on success, 0 on allocation failure.
+ */
+int linesrc_open(LineSource *ls, FILE *fp)
+{
+    memset(ls, 0, sizeof(*ls));
+    ls->fp = fp;
+
+#ifndef _WIN32
+    struct stat st;
+    int fd = fileno(fp);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+#ifdef MADV_SEQUENTIAL
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+            DecompKind kind = decomp_detect(p, (size_t)st.st_size);
+            if (kind == DECOMP_NONE)
+            {
+                ls->map = (const char *)p;
+                ls->map_len = (size_t)st.st_size;
+                ls->limit = ls->map_len;
+                return 1;
+            }
+            ls->z = decomp_open_map(kind, p, (size_t)st.st_size); // owns the mapping now
+            ls->probed = 1;
+        }
+        // fall through to buffered reads
+    }
+#endif
+
+    ls->cap = LINESRC_BLOCK;
+    ls->buf = (char *)malloc(ls->cap);
+    if (!ls->buf)
+        return 0;
+    return 1;
+}
+
+// Buffered mode: make room and pull the next block in behind the pending bytes
+static int linesrc_fill(LineSource *ls)
+{
+    if (ls->start > 0)
+    {
+        memmove(ls->buf, ls->buf + ls->start, ls->end - ls->start);
+        ls->end -= ls->start;
+        ls->start = 0;
+    }
+    if (ls->end == ls->cap)
+    {
+        // a single line longer than the buffer: grow it
+        size_t ncap = ls->cap * 2;
+        char *nbuf = (char *)realloc(ls->buf, ncap);
+        if (!nbuf)
+            return -1;
+        ls->buf = nbuf;
+        ls->cap = ncap;
+    }
+    size_t n;
+    if (ls->z)
+    {
+        ssize_t r = decomp_read(ls->z, ls->buf + ls->end, ls->cap - ls->end);
+        if (r < 0)
+            return -1;
+        n = (size_t)r;
+    }
+    else
+    {
+        n = fread(ls->buf + ls->end, 1, ls->cap - ls->end, ls->fp);
+        if (n == 0 && ferror(ls->fp))
+            return -1;
+        if (!ls->probed)
+        {
+            ls->probed = 1;
+            DecompKind kind = decomp_detect(ls->buf, n);
+            if (kind != DECOMP_NONE)
+            {
+                // hand what was read to the decoder, then read decoded data instead
+                ls->z = decomp_open_stream(kind, ls->fp, ls->buf, n);
+                decomp_set_threads(ls->z, ls->threads);
+                return linesrc_fill(ls);
+            }
+        }
+    }
+    ls->end += n;
+    if (n == 0)
+        ls->eof = 1;
+    return (int)(n > 0);
+}
+
+/**
+ * @brief Returns the next line as a span into the mapping or block buffer.
+ *
+ * @param ls    LineSource to read from.
+ * @param line  Receives a pointer to the first byte of the line.
+ * @param len   Receives the line length, excluding the newline.
+ * @return      1 if a line was returned, 0 at end of input, -1 on error.
+ */
+int linesrc_next(LineSource *ls, const char **line, size_t *len)
+{
+    if (ls->map)
+    {
+        while (ls->pos >= ls->limit)
+        {
+            if (ls->next_range >= ls->nranges)
+                return 0;
+            ls->pos = ls->ranges[2 * ls->next_range];
+            ls->limit = ls->ranges[2 * ls->next_range + 1];
+            ls->next_range++;
+        }
+        const char *s = ls->map + ls->pos;
+        size_t left = ls->limit - ls->pos;
+        const char *nl = (const char *)memchr(s, '\n', left);
+        size_t n = nl ? (size_t)(nl - s) : left;
+        *line = s;
+        *len = n;
+        ls->pos += nl ? n + 1 : n;
+        ls->bytes += nl ? n + 1 : n;
+        return 1;
+    }
+
+    size_t scan_from = ls->start;
+    for (;;)
+    {
+        const char *s = ls->buf + ls->start;
+        const char *nl = (const char *)memchr(ls->buf + scan_from, '\n', ls->end - scan_from);
+        if (nl)
+        {
+            size_t n = (size_t)(nl - s);
+            *line = s;
+            *len = n;
+            ls->start += n + 1;
+            ls->bytes += n + 1;
+            return 1;
+        }
+        if (ls->eof)
+        {
+            if (ls->start == ls->end)
+                return 0;
+            // trailing line without a newline
+            *line = s;
+            *len = ls->end - ls->start;
+            ls->bytes += *len;
+            ls->start = ls->end;
+            return 1;
+        }
+        size_t pending = ls->end - ls->start;
+        if (linesrc_fill(ls) < 0)
+            return -1;
+        scan_from = ls->start + pending; // don't rescan bytes without '\n'
+    }
+}
+
+/**
+ * @brief Returns the next run of whole lines as one span.
+ *
+ * Lets callers search a block of input at once instead of line by line.
+ * The span ends just after a '\n', or at the end of input for a last line
+ * without one, and holds about one read block (a single longer line is
+ * returned whole). It stays valid until the next call.
+ *
+ * @param ls   LineSource to read from.
+ * @param blk  Receives a pointer to the first byte of the span.
+ * @param len  Receives the span length, including newlines.
+ * @return     1 if a span was returned, 0 at end of input, -1 on error.
+ */
+int linesrc_next_block(LineSource *ls, const char **blk, size_t *len)
+{
+    if (ls->map)
+    {
+        while (ls->pos >= ls->limit)
+        {
+            if (ls->next_range >= ls->nranges)
+                return 0;
+            ls->pos = ls->ranges[2 * ls->next_range];
+            ls->limit = ls->ranges[2 * ls->next_range + 1];
+            ls->next_range++;
+        }
+        const char *s = ls->map + ls->pos;
+        size_t left = ls->limit - ls->pos, n = left;
+        if (left > LINESRC_BLOCK)
+        {
+            const char *nl = (const char *)memchr(s + LINESRC_BLOCK - 1, '\n', left - (LINESRC_BLOCK - 1));
+            n = nl ? (size_t)(nl - s) + 1 : left;
+        }
+        *blk = s;
+        *len = n;
+        ls->pos += n;
+        ls->bytes += n;
+        return 1;
+    }
+
+    for (;;)
+    {
+        // everything up to the last newline in the buffer
+        size_t n = ls->end - ls->start;
+        while (n > 0 && ls->buf[ls->start + n - 1] != '\n')
+            n--;
+        if (n == 0 && ls->eof)
+            n = ls->end - ls->start; // trailing line without a newline
+        if (n > 0)
+        {
+            *blk = ls->buf + ls->start;
+            *len = n;
+            ls->start += n;
+            ls->bytes += n;
+            return 1;
+        }
+        if (ls->eof)
+            return 0;
+        if (linesrc_fill(ls) < 0)
+            return -1;
+    }
+}
+
+/**
+ * @brief Restricts a mapped source to the byte range [start, end).
+ *
+ * Both offsets must be line starts (or the end of the file). Has no effect
+ * in buffered mode, which cannot seek.
+ */
+void linesrc_range(LineSource *ls, size_t start, size_t end)
+{
+    if (!ls->map)
+        return;
+    if (end > ls->map_len)
+        end = ls->map_len;
+    ls->pos = start < end ? start : end;
+    ls->limit = end;
+    ls->nranges = ls->next_range = 0;
+}
+
+/**
+ * @brief Restricts a mapped source to a list of byte ranges, read in order.
+ *
+ * @param ranges  n pairs of [start, end) line-aligned offsets, ascending and
+ *                non-overlapping. Copied; the caller keeps ownership.
+ * @return        1 on success, 0 on allocation failure (source unchanged).
+ */
+int linesrc_ranges(LineSource *ls, const size_t *ranges, size_t n)
+{
+    if (!ls->map)
+        return 1;
+    size_t *copy = (size_t *)malloc((n ? n : 1) * 2 * sizeof(size_t));
+    if (!copy)
+        return 0;
+    for (size_t i = 0; i < 2 * n; i++)
+        copy[i] = ranges[i] < ls->map_len ? ranges[i] : ls->map_len;
+    free(ls->ranges);
+    ls->ranges = copy;
+    ls->nranges = n;
+    ls->next_range = 0;
+    ls->pos = ls->limit = 0; // first linesrc_next() moves to ranges[0]
+    return 1;
+}
+
+/**
+ * @brief Sets how many threads decode compressed input (default 1).
+ *
+ * Call before the first line is read. Has no effect on uncompressed input.
+ */
+void linesrc_set_threads(LineSource *ls, int threads)
+{
+    ls->threads = threads;
+    if (ls->z)
+        decomp_set_threads(ls->z, threads);
+}
+
+/**
+ * @brief Releases the mapping or block buffer. Does not close the stream.
+ */
+void linesrc_close(LineSource *ls)
+{
+#ifndef _WIN32
+    if (ls->map)
+        munmap((void *)ls->map, ls->map_len);
+#endif
+    decomp_close(ls->z);
+    free(ls->buf);
+    free(ls->ranges);
+    memset(ls, 0, sizeof(*ls));
+}
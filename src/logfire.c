@@ -5,11 +5,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include "cli.h"
+#include "linesrc.h"
 #include "parser.h"
 #include "query.h"
 #include "formatter.h"
 #include "jsonout.h"
+#include "logfire.h"
+#include "pipeline.h"
+#include "timeseek.h"
+#include "index.h"
+#include "lfc.h"
+#include "strsearch.h"
 
 /**
  * read_line_dyn - Reads a line of arbitrary length from the given file pointer.
@@ -68,117 +76,480 @@ char *read_line_dyn(FILE *fp)
     return buf;
 }
 
+// Monotonic wall clock in seconds, for throughput reporting
+double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+#define PREFILTER_MIN_LITERAL 2
+
 /**
- * @brief Processes a stream of log lines, parses them, and outputs in the specified format.
+ * @brief Prepares the per-run filter and output settings shared by batch and tail mode.
  *
- * Reads lines from the input stream, attempts to parse each as an Apache or Nginx log entry,
- * and writes the output in JSON, CSV, or plain text format to the output stream. Optionally
- * filters entries by a search term and supports case-insensitive matching. Handles parse
- * failures according to the strictness option and prints a summary to stderr.
+ * Parses --query once. If it does not parse, the raw expression is used as a
+ * keyword instead (the historical behavior); otherwise --search supplies the
+ * keyword, if any. Outside --strict, literals of which every match must contain
+ * one (a single one unless the query has OR) are picked for the raw-line
+ * prefilter in scan_block().
  *
- * @param in        Input file stream to read log lines from.
- * @param label     Optional label for the input source, used in warnings and summary.
- * @param opt       Pointer to CLIOptions struct specifying output format, search term, and options.
- * @param out       Output file stream to write formatted log entries.
+ * @param plan  ScanPlan to fill in.
+ * @param opt   Parsed command-line options.
  */
-void process_stream(FILE *in, const char *label, const CLIOptions *opt, FILE *out)
+void scan_plan_init(ScanPlan *plan, const CLIOptions *opt)
 {
-    long long total = 0, parsed = 0, failed = 0;
-    int opened_json = 0, first_json = 1;
-
-    /* ---- Parse field-based query once (if provided) ---- */
-    Query q;
-    int use_q = 0;
     char qerr[128] = {0};
 
+    memset(plan, 0, sizeof(*plan));
+    plan->opt = opt;
+    plan->fields = opt->has_fields ? &opt->fields : NULL;
+    plan->agg = opt->aggregate ? &opt->agg : NULL;
+
     if (opt->query && *opt->query)
     {
-        if (!query_parse(opt->query, opt->case_insensitive, &q, qerr, sizeof(qerr)))
+        if (query_parse(opt->query, opt->case_insensitive, &plan->q, qerr, sizeof(qerr)))
         {
-            fprintf(stderr, "query parse error: %s\n", qerr);
-            // You can choose to return early, or just fall back to keyword search:
-            // return;
+            plan->use_q = 1;
+            plan->has_window = !opt->no_seek && query_time_bounds(&plan->q, &plan->t_lo, &plan->t_hi);
         }
         else
         {
-            use_q = 1;
+            fprintf(stderr, "query parse error: %s\n", qerr);
+            plan->keyword = opt->query;
         }
     }
-
-    /* JSON array opening (batch mode) */
-    if (opt->format == FORMAT_JSON)
+    else if (opt->searchTerm && *opt->searchTerm)
     {
-        fprintf(out, "[");
-        opened_json = 1;
+        plan->keyword = opt->searchTerm;
     }
 
-    for (;;)
+    // --strict reports every unparsable line, so it has to parse them all
+    if (!opt->strict)
     {
-        char *line = read_line_dyn(in);
-        if (!line)
-            break;
-        total++;
+        if (plan->use_q)
+            plan->nlits = query_required_literals(&plan->q, plan->lits);
+        else if (plan->keyword)
+        {
+            QueryLiteral *l = &plan->lits[0];
+            size_t n = strlen(plan->keyword);
+            l->len = n < sizeof(l->s) ? n : sizeof(l->s) - 1;
+            memcpy(l->s, plan->keyword, l->len);
+            l->ci = opt->case_insensitive;
+            plan->nlits = 1;
+        }
+        for (int i = 0; i < plan->nlits; i++)
+            if (plan->lits[i].len < PREFILTER_MIN_LITERAL)
+                plan->nlits = 0; // would hit nearly every line
+    }
+}
 
-        LogEntry e;
-        char perr[256] = {0};
+/**
+ * @brief Releases what scan_plan_init() allocated (the compiled query).
+ */
+void scan_plan_free(ScanPlan *plan)
+{
+    if (plan->use_q)
+        query_free(&plan->q);
+}
 
-        if (parse_apache_or_nginx(line, &e, perr, sizeof(perr)))
+/**
+ * @brief Applies the query or keyword filter to a parsed entry.
+ *
+ * @return 1 if the entry should be output, 0 otherwise.
+ */
+int scan_filter(const ScanPlan *plan, LogEntry *e)
+{
+    if (plan->use_q)
+        return query_match(e, &plan->q);
+    if (plan->keyword)
+        return matches(e, plan->keyword, plan->opt->case_insensitive);
+    return 1; // no filters -> print all
+}
+
+/**
+ * @brief Writes one matching entry in the selected output format.
+ *
+ * @param first_json  Batch JSON array state (comma placement). Pass NULL for
+ *                    newline-delimited JSON, as used by tail mode.
+ */
+void scan_emit(const ScanPlan *plan, LogEntry *e, OutBuf *out, int *first_json)
+{
+    switch (plan->opt->format)
+    {
+    case FORMAT_JSON:
+        if (first_json)
+        {
+            if (!*first_json)
+                outbuf_putc(out, ',');
+            *first_json = 0;
+            printLogJSON(e, plan->fields, out);
+        }
+        else
         {
-            int ok = 1;
+            printLogJSON(e, plan->fields, out);
+            outbuf_putc(out, '\n');
+        }
+        break;
+    case FORMAT_CSV:
+        printLogCSV(e, plan->fields, out);
+        outbuf_putc(out, '\n');
+        break;
+    default:
+        printLogText(e, plan->fields, out);
+        outbuf_putc(out, '\n');
+        break;
+    }
+}
 
-            if (use_q)
-            {
-                ok = query_match(&e, &q);
-            }
-            else if (opt->query && *opt->query)
-            {
-                ok = matches(&e, opt->query, opt->case_insensitive);
-            }
+/**
+ * @brief Parses, filters and emits one line, updating the stream counters.
+ *
+ * This is the whole per-line pipeline, shared by the sequential loop and the
+ * parallel chunk workers (which pass per-chunk memory buffers for out/err).
+ *
+ * @param plan        Filter/output settings.
+ * @param line, len   The raw line (no newline).
+ * @param label       Input name for --strict warnings.
+ * @param out         Output writer for matching entries.
+ * @param err         Destination for --strict warnings.
+ * @param first_json  Batch JSON comma state (see scan_emit()).
+ * @param st          Counters to update; matches go to st->agg instead of out when set.
+ */
+void scan_line(const ScanPlan *plan, const char *line, size_t len, const char *label,
+               OutBuf *out, FILE *err, int *first_json, ScanStats *st)
+{
+    LogEntry e;
+    char perr[256] = {0};
+
+    st->total++;
+    if (parse_apache_or_nginx(line, len, &e, perr, sizeof(perr)))
+    {
+        if (scan_filter(plan, &e))
+        {
+            if (st->agg)
+                agg_add(st->agg, &e);
             else
-            {
-                ok = 1; // no filters -> print all
-            }
+                scan_emit(plan, &e, out, first_json);
+        }
+        st->parsed++;
+    }
+    else
+    {
+        st->failed++;
+        if (plan->opt->strict)
+        {
+            fprintf(err, "[warn] parse failed (%s): %s\n",
+                    label ? label : "-", perr[0] ? perr : "unknown");
+            fprintf(err, "  >> %.*s\n", (int)len, line);
+        }
+    }
+}
 
-            if (ok)
-            {
-                if (opt->format == FORMAT_JSON)
-                {
-                    if (!first_json)
-                        fprintf(out, ",");
-                    printLogJSON(&e, out); // your signature: (LogEntry*, FILE*)
-                    first_json = 0;
-                }
-                else if (opt->format == FORMAT_CSV)
-                {
-                    printLogCSV(&e, out);
-                    fputc('\n', out);
-                }
-                else
-                {
-                    printLogText(&e, out);
-                    fputc('\n', out);
-                }
-            }
-            parsed++;
+// Time seek: bisect a time-ordered file for the query's timestamp window
+static void scan_seek(const ScanPlan *plan, LineSource *src, const char *label)
+{
+    size_t start, end;
+    if (!time_seek_range(src->map, src->map_len, plan->t_lo, plan->t_hi,
+                         plan->opt->seek_slack, &start, &end))
+    {
+        fprintf(stderr, "[%s] not in time order; scanning the whole file\n", label);
+        return;
+    }
+    linesrc_range(src, start, end);
+    fprintf(stderr, "[%s] time seek: bytes %zu..%zu of %zu\n", label, start, end, src->map_len);
+}
+
+/*
+ * Sidecar index: visit only the blocks whose summaries can satisfy the query,
+ * plus whatever was appended after the indexed prefix. Lines in skipped
+ * blocks are never read; they count towards total and skipped, like the
+ * lines the literal prefilter passes over. Returns 0 if there is no usable
+ * index.
+ */
+static int scan_index(const ScanPlan *plan, LineSource *src, const char *label, ScanStats *st)
+{
+    LogIndex idx;
+    int rc = index_load(label, fileno(src->fp), src->map, src->map_len, &idx);
+    if (rc < 0)
+        fprintf(stderr, "[%s] index is out of date; run 'logfire index build %s'\n", label, label);
+    if (rc <= 0)
+        return 0;
+
+    size_t *ranges = (size_t *)malloc((size_t)(idx.hdr.nblocks + 1) * 2 * sizeof(size_t));
+    if (!ranges)
+    {
+        index_free(&idx);
+        return 0;
+    }
+    long long skipped = 0;
+    size_t n = 0, kept = 0;
+    for (uint64_t i = 0; i < idx.hdr.nblocks; i++)
+    {
+        const IndexBlock *b = &idx.blocks[i];
+        if (!index_block_may_match(b, &plan->q))
+        {
+            skipped += b->lines;
+            continue;
         }
+        kept++;
+        if (n > 0 && ranges[2 * n - 1] == b->offset)
+            ranges[2 * n - 1] = b->end; // adjacent: extend the previous range
         else
         {
-            failed++;
-            if (opt->strict)
-            {
-                fprintf(stderr, "[warn] parse failed (%s): %s\n",
-                        label ? label : "-", perr[0] ? perr : "unknown");
-                fprintf(stderr, "  >> %s\n", line);
-            }
+            ranges[2 * n] = b->offset;
+            ranges[2 * n + 1] = b->end;
+            n++;
         }
+    }
+    if (idx.hdr.indexed < src->map_len)
+    {
+        ranges[2 * n] = idx.hdr.indexed;
+        ranges[2 * n + 1] = src->map_len;
+        n++;
+    }
+    if (!linesrc_ranges(src, ranges, n))
+    {
+        free(ranges);
+        index_free(&idx);
+        return 0;
+    }
+    st->total += skipped;
+    st->skipped += skipped;
+    fprintf(stderr, "[%s] index: scanning %zu of %llu blocks (+%zu unindexed bytes)\n", label, kept,
+            (unsigned long long)idx.hdr.nblocks, src->map_len - (size_t)idx.hdr.indexed);
+    free(ranges);
+    index_free(&idx);
+    return 1;
+}
+
+// Lines in [p, end): newlines, plus a final line without one
+static long long count_lines(const char *p, const char *end)
+{
+    const unsigned long long ones7 = 0x7F7F7F7F7F7F7F7FULL, nl = 0x0A0A0A0A0A0A0A0AULL;
+    long long n = 0;
+    const char *s = p;
+    // 8 bytes at a time: the high bit of each byte that equals '\n'
+    for (; end - s >= 8; s += 8)
+    {
+        unsigned long long w;
+        memcpy(&w, s, 8);
+        w ^= nl;
+        n += __builtin_popcountll(~(((w & ones7) + ones7) | w | ones7));
+    }
+    for (; s < end; s++)
+        n += *s == '\n';
+    return n + (end > p && end[-1] != '\n');
+}
+
+// Next occurrence of l in [p, end), or end
+static const char *find_literal(const QueryLiteral *l, const char *p, const char *end)
+{
+    const char *hit = l->ci ? lf_memmem_ci(p, (size_t)(end - p), l->s, l->len)
+                            : lf_memmem(p, (size_t)(end - p), l->s, l->len);
+    return hit ? hit : end;
+}
+
+/**
+ * @brief Runs scan_line() over a span of whole lines, skipping hopeless ones.
+ *
+ * With prefilter literals the span is searched for them as a whole, and only
+ * the lines one occurs in are parsed and filtered. The lines in between are
+ * counted (as skipped) but never parsed. With several literals (an OR query)
+ * each one's next occurrence is remembered, so every literal is searched for
+ * once per span rather than once per line.
+ *
+ * @param p, n  Span of complete lines (see linesrc_next_block()).
+ */
+void scan_block(const ScanPlan *plan, const char *p, size_t n, const char *label,
+                OutBuf *out, FILE *err, int *first_json, ScanStats *st)
+{
+    const char *end = p + n;
+
+    if (plan->nlits == 0)
+    {
+        while (p < end)
+        {
+            const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+            size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+            scan_line(plan, p, len, label, out, err, first_json, st);
+            p += len + 1;
+        }
+        return;
+    }
+
+    const char *next[QUERY_MAX_LITERALS];
+    for (int i = 0; i < plan->nlits; i++)
+        next[i] = find_literal(&plan->lits[i], p, end);
+    while (p < end)
+    {
+        const char *hit = end;
+        for (int i = 0; i < plan->nlits; i++)
+        {
+            if (next[i] < p) // inside a line already scanned
+                next[i] = find_literal(&plan->lits[i], p, end);
+            if (next[i] < hit)
+                hit = next[i];
+        }
+        const char *ls = hit;
+        if (hit < end)
+            while (ls > p && ls[-1] != '\n')
+                ls--;
+        long long skip = count_lines(p, ls); // to the end: includes a last line without '\n'
+        st->total += skip;
+        st->skipped += skip;
+        if (hit == end)
+            break;
+
+        const char *nl = (const char *)memchr(hit, '\n', (size_t)(end - hit));
+        size_t len = nl ? (size_t)(nl - ls) : (size_t)(end - ls);
+        scan_line(plan, ls, len, label, out, err, first_json, st);
+        p = ls + len + 1;
+    }
+}
+
+/**
+ * @brief Narrows a mapped input to the parts that can hold matching lines.
+ *
+ * Uses the sidecar index (see index_build()) when the query has terms its
+ * block summaries can test; otherwise, when the query bounds the timestamp
+ * and the file is time-ordered, binary search finds the first and last
+ * candidate lines. Pipes and queries neither can use are left alone.
+ *
+ * @param st  Counters; lines in blocks skipped through the index are added to total and skipped.
+ */
+void scan_prune(const ScanPlan *plan, LineSource *src, const char *label, ScanStats *st)
+{
+    if (!plan->use_q || !src->map)
+        return;
+    label = label ? label : "-";
+    if (!plan->opt->no_index && strcmp(label, "-") != 0 && index_queryable(&plan->q) &&
+        scan_index(plan, src, label, st))
+        return;
+    if (plan->has_window)
+        scan_seek(plan, src, label);
+}
+
+/**
+ * @brief Scans one input stream, without JSON brackets or a summary line.
+ *
+ * Lines come from a LineSource, so regular files are scanned in place through mmap and
+ * pipes are read in large blocks; no memory is allocated per line. Each block goes through
+ * scan_block(), which parses only the lines the prefilter lets through. Entries are views
+ * into the line, and fields that neither the filter nor the output touch are never located.
+ * With --threads, a mapped file is split into newline-aligned chunks and scanned by
+ * scan_parallel() instead, and anything else (stdin, pipes, compressed input) is read
+ * here and parsed by scan_pipeline()'s workers. Columnar .lfc files go to lfc_scan().
+ *
+ * @param plan        Filter/output settings.
+ * @param in          Input stream.
+ * @param label       Input name for warnings.
+ * @param out         Output writer.
+ * @param first_json  JSON comma state, shared by all inputs written into one array.
+ * @param st          Counters (including bytes read) to add to.
+ * @return            1 on success, 0 on a read or setup error.
+ */
+int scan_stream(const ScanPlan *plan, FILE *in, const char *label, OutBuf *out,
+                int *first_json, ScanStats *st)
+{
+    if (lfc_detect(in))
+        return lfc_scan(plan, in, label, out, first_json, st);
 
-        free(line);
+    LineSource src;
+    if (!linesrc_open(&src, in))
+    {
+        perror("linesrc_open");
+        return 0;
     }
+    linesrc_set_threads(&src, plan->opt->threads); // compressed input: parallel decoding
+
+    scan_prune(plan, &src, label, st);
 
-    if (opened_json)
-        fprintf(out, "]\n");
+    int rc = 0;
+    if (plan->opt->threads > 1 && src.map)
+    {
+        scan_parallel(plan, &src, label, out, first_json, st);
+    }
+    else if (plan->opt->threads > 1)
+    {
+        rc = scan_pipeline(plan, &src, label, out, first_json, st);
+    }
+    else
+    {
+        const char *blk;
+        size_t n;
+        while ((rc = linesrc_next_block(&src, &blk, &n)) > 0)
+            scan_block(plan, blk, n, label, out, stderr, first_json, st);
+    }
+    if (rc < 0)
+        fprintf(stderr, "[warn] read error (%s)\n", label ? label : "-");
 
+    st->bytes += src.bytes; // 0 after scan_parallel(), which counts its own
+    linesrc_close(&src);
+    return rc >= 0;
+}
+
+/**
+ * @brief Prints the per-input summary line to stderr.
+ */
+void scan_summary(const char *label, const ScanStats *st, double secs)
+{
     // Summary to stderr keeps stdout clean for pipes/redirection
-    fprintf(stderr, "[%s] total=%lld parsed=%lld failed=%lld\n",
-            label ? label : "-", total, parsed, failed);
-}
\ No newline at end of file
+    char skipped[48] = "";
+    if (st->skipped)
+        snprintf(skipped, sizeof(skipped), " skipped=%lld", st->skipped);
+    fprintf(stderr, "[%s] total=%lld parsed=%lld failed=%lld%s bytes=%llu (%.1f MB/s)\n",
+            label ? label : "-", st->total, st->parsed, st->failed, skipped, st->bytes,
+            secs > 0 ? (double)st->bytes / secs / 1e6 : 0.0);
+}
+
+/**
+ * @brief Processes a stream of log lines, parses them, and outputs in the specified format.
+ *
+ * Reads lines from the input stream, attempts to parse each as an Apache or Nginx log entry,
+ * and writes the output in JSON, CSV, or plain text format to the output stream. Optionally
+ * filters entries by a search term and supports case-insensitive matching. Handles parse
+ * failures according to the strictness option and prints a summary (including throughput)
+ * to stderr. JSON output is a complete array; use process_inputs() to put several inputs
+ * into one array. With --group-by/--agg, the aggregated table is printed instead.
+ *
+ * @param in        Input file stream to read log lines from.
+ * @param label     Optional label for the input source, used in warnings and summary.
+ * @param opt       Pointer to CLIOptions struct specifying output format, search term, and options.
+ * @param out       Output file stream to write formatted log entries.
+ */
+void process_stream(FILE *in, const char *label, const CLIOptions *opt, FILE *out)
+{
+    ScanStats st;
+    OutBuf ob;
+    int first_json = 1;
+
+    ScanPlan plan;
+    scan_plan_init(&plan, opt);
+    memset(&st, 0, sizeof(st));
+    if (plan.agg)
+        st.agg = agg_new(plan.agg);
+
+    double t0 = now_sec();
+
+    /* JSON array opening (batch mode) */
+    outbuf_init(&ob, out);
+    if (opt->format == FORMAT_JSON && !st.agg)
+        outbuf_putc(&ob, '[');
+
+    scan_stream(&plan, in, label, &ob, &first_json, &st);
+
+    if (!st.agg && opt->format == FORMAT_JSON)
+        outbuf_write(&ob, "]\n", 2);
+    outbuf_free(&ob);
+    if (st.agg)
+    {
+        agg_write(st.agg, opt->format, out);
+        agg_summary(st.agg, stderr);
+        agg_free(st.agg);
+    }
+
+    scan_summary(label, &st, now_sec() - t0);
+    scan_plan_free(&plan);
+}
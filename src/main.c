@@ -6,48 +6,61 @@
 #include <stdlib.h>
 #include <string.h>
 #include "cli.h"
-
-// Prototypes from your other modules
-void process_stream(FILE *in, const char *label, const CLIOptions *opt, FILE *out);
-void tail_file(const char *path, int from_start, const CLIOptions *opt, FILE *out);
+#include "logfire.h"
+#include "index.h"
+#include "lfc.h"
+#include "tail.h"
+#include "zout.h"
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "index") == 0)
+        return index_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "convert") == 0)
+        return lfc_main(argc - 1, argv + 1);
+
     CLIOptions opts = parseCLI(argc, argv);
 
     FILE *out = stdout;
     if (opts.outputFile)
     {
+        ZoutKind zk = zout_kind(opts.outputFile);
+        if (!zout_supported(zk))
+        {
+            fprintf(stderr, "Error: %s: zstd output needs a logfire built with libzstd (HAVE_ZSTD).\n",
+                    opts.outputFile);
+            return 1;
+        }
+        if (zk != ZOUT_NONE && opts.tail)
+        {
+            fprintf(stderr, "Error: --tail cannot write compressed output; pipe it to a compressor instead.\n");
+            return 1;
+        }
         out = fopen(opts.outputFile, "w");
         if (!out)
         {
             perror("open output");
             return 1;
         }
+        if (zk != ZOUT_NONE)
+            out = zout_open(out, zk, opts.threads > opts.jobs ? opts.threads : opts.jobs);
     }
     
     if (opts.tail)
     {
-        
-        if (opts.input_count != 1)
-        {
-            fprintf(stderr, "Error: --tail expects exactly one --log FILE (not multiple, not stdin).\n");
-            if (out != stdout)
-                fclose(out);
-            free((void *)opts.inputs);
-            return 1;
-        }
-        const char *path = opts.inputs[0];
-        if (strcmp(path, "-") == 0)
+        for (int i = 0; i < opts.input_count; i++)
         {
-            fprintf(stderr, "Error: --tail cannot follow stdin. Provide a file path with --log.\n");
-            if (out != stdout)
-                fclose(out);
-            free((void *)opts.inputs);
-            return 1;
+            if (strcmp(opts.inputs[i], "-") == 0)
+            {
+                fprintf(stderr, "Error: --tail cannot follow stdin. Provide file paths or patterns with --log.\n");
+                if (out != stdout)
+                    fclose(out);
+                free((void *)opts.inputs);
+                return 1;
+            }
         }
-        // Tail mode: stream indefinitely; recommend NDJSON for JSON output in tail_file
-        tail_file(path, opts.from_start, &opts, out);
+        // Tail mode: stream indefinitely; JSON output is NDJSON
+        tail_files(opts.inputs, opts.input_count, opts.from_start, &opts, out);
 
         if (out != stdout)
             fclose(out);
@@ -55,25 +68,7 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    for (int i = 0; i < opts.input_count; i++)
-    {
-        const char *path = opts.inputs[i];
-        if (strcmp(path, "-") == 0)
-        {
-            process_stream(stdin, "-", &opts, out);
-        }
-        else
-        {
-            FILE *fp = fopen(path, "rb");
-            if (!fp)
-            {
-                perror(path);
-                continue;
-            }
-            process_stream(fp, path, &opts, out);
-            fclose(fp);
-        }
-    }
+    process_inputs(&opts, out);
 
     if (out != stdout)
         fclose(out);
@@ -0,0 +1,305 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "outbuf.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define OUTBUF_FILE_SIZE (1u << 20) // flushed when full
+#define OUTBUF_MEM_SIZE (64u << 10) // initial size; doubles as needed
+
+/**
+ * @brief Starts a writer on fp, or an in-memory buffer when fp is NULL.
+ */
+void outbuf_init(OutBuf *b, FILE *fp)
+{
+    b->fp = fp;
+    b->fd = fp ? fileno(fp) : -1;
+    b->len = 0;
+    b->cap = fp ? OUTBUF_FILE_SIZE : OUTBUF_MEM_SIZE;
+    b->buf = (char *)malloc(b->cap);
+    if (!b->buf)
+    {
+        perror("malloc");
+        exit(1);
+    }
+}
+
+// Writes every byte of iov[0..cnt), retrying short writes and interrupts
+static void write_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t w = writev(fd, iov, cnt);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        while (cnt > 0 && (size_t)w >= iov->iov_len)
+        {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+// Sends the buffered bytes and then p[0..n) to the destination
+static void emit(OutBuf *b, const void *p, size_t n)
+{
+    fflush(b->fp); // anything printed through stdio comes first
+    if (b->fd < 0)
+    {
+        fwrite(b->buf, 1, b->len, b->fp);
+        if (n)
+            fwrite(p, 1, n, b->fp);
+    }
+    else
+    {
+        struct iovec iov[2];
+        iov[0].iov_base = b->buf;
+        iov[0].iov_len = b->len;
+        iov[1].iov_base = (void *)p;
+        iov[1].iov_len = n;
+        write_all(b->fd, iov, 2);
+    }
+    b->len = 0;
+}
+
+void outbuf_flush(OutBuf *b)
+{
+    if (b->fp && b->len)
+        emit(b, NULL, 0);
+}
+
+/**
+ * @brief Flushes (or, for a memory buffer, frees) the writer.
+ */
+void outbuf_free(OutBuf *b)
+{
+    outbuf_flush(b);
+    free(b->buf);
+    b->buf = NULL;
+    b->len = b->cap = 0;
+}
+
+/**
+ * @brief Makes room for at least need more bytes.
+ *
+ * Writers on a FILE flush first and only grow for a single oversized item.
+ */
+void outbuf_grow(OutBuf *b, size_t need)
+{
+    if (b->cap - b->len >= need)
+        return;
+    outbuf_flush(b);
+    if (b->cap - b->len >= need)
+        return;
+    size_t cap = b->cap ? b->cap : OUTBUF_MEM_SIZE;
+    while (cap - b->len < need)
+        cap *= 2;
+    char *p = (char *)realloc(b->buf, cap);
+    if (!p)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    b->buf = p;
+    b->cap = cap;
+}
+
+void outbuf_write(OutBuf *b, const void *p, size_t n)
+{
+    if (b->cap - b->len < n)
+    {
+        if (b->fp && n >= b->cap / 2)
+        {
+            emit(b, p, n); // big block: skip the copy
+            return;
+        }
+        outbuf_grow(b, n);
+    }
+    memcpy(b->buf + b->len, p, n);
+    b->len += n;
+}
+
+/**
+ * @brief Appends a signed integer in decimal.
+ */
+void outbuf_i64(OutBuf *b, long long v)
+{
+    char tmp[24];
+    char *end = tmp + sizeof(tmp), *p = end;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do
+    {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    outbuf_write(b, p, (size_t)(end - p));
+}
+
+/**
+ * @brief Appends a number with three decimals, as printf("%.3f") would.
+ */
+void outbuf_fixed3(OutBuf *b, double v)
+{
+    if (!(v > -9e15 && v < 9e15))
+    {
+        char tmp[400];
+        int n = snprintf(tmp, sizeof(tmp), "%.3f", v);
+        outbuf_write(b, tmp, (size_t)n);
+        return;
+    }
+    long long m = (long long)(v * 1000.0 + (v < 0 ? -0.5 : 0.5));
+    char frac[4];
+    if (m < 0)
+    {
+        outbuf_putc(b, '-');
+        m = -m;
+    }
+    outbuf_i64(b, m / 1000);
+    frac[0] = '.';
+    frac[1] = (char)('0' + m / 100 % 10);
+    frac[2] = (char)('0' + m / 10 % 10);
+    frac[3] = (char)('0' + m % 10);
+    outbuf_write(b, frac, 4);
+}
+
+/**
+ * @brief Length of the prefix of p that JSON strings can hold as is.
+ *
+ * Stops at the first quote, backslash or control character (below 0x20).
+ */
+size_t json_clean_prefix(const char *p, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\'), ctl = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        // v <= 0x1f (unsigned) exactly when min(v, 0x1f) == v
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        unsigned char c = (unsigned char)p[i];
+        if (c < 0x20 || c == '"' || c == '\\')
+            break;
+    }
+    return i;
+}
+
+/**
+ * @brief Writes the JSON escape for c into esc (up to 6 bytes).
+ *
+ * @return Number of bytes written.
+ */
+size_t json_escape_char(unsigned char c, char *esc)
+{
+    static const char hex[] = "0123456789abcdef";
+    char short_form = 0;
+    switch (c)
+    {
+    case '"':
+        short_form = '"';
+        break;
+    case '\\':
+        short_form = '\\';
+        break;
+    case '\b':
+        short_form = 'b';
+        break;
+    case '\f':
+        short_form = 'f';
+        break;
+    case '\n':
+        short_form = 'n';
+        break;
+    case '\r':
+        short_form = 'r';
+        break;
+    case '\t':
+        short_form = 't';
+        break;
+    }
+    esc[0] = '\\';
+    if (short_form)
+    {
+        esc[1] = short_form;
+        return 2;
+    }
+    memcpy(esc + 1, "u00", 3);
+    esc[4] = hex[c >> 4];
+    esc[5] = hex[c & 15];
+    return 6;
+}
+
+/**
+ * @brief Appends a slice as JSON string contents (without the quotes).
+ */
+void outbuf_json(OutBuf *b, LogSlice s)
+{
+    const char *p = s.p, *end = s.p + s.len;
+    outbuf_grow(b, s.len * 6); // worst case: every byte becomes \u00XX
+    char *o = b->buf + b->len;
+    while (p < end)
+    {
+        size_t run = json_clean_prefix(p, (size_t)(end - p));
+        memcpy(o, p, run);
+        o += run;
+        p += run;
+        if (p == end)
+            break;
+        o += json_escape_char((unsigned char)*p++, o);
+    }
+    b->len = (size_t)(o - b->buf);
+}
+
+/**
+ * @brief Appends a slice as a quoted CSV field (RFC 4180: quotes are doubled).
+ */
+void outbuf_csv(OutBuf *b, LogSlice s)
+{
+    const char *p = s.p, *end = s.p + s.len;
+    outbuf_grow(b, s.len * 2 + 2);
+    char *o = b->buf + b->len;
+    *o++ = '"';
+    while (p < end)
+    {
+        const char *q = (const char *)memchr(p, '"', (size_t)(end - p));
+        size_t run = q ? (size_t)(q + 1 - p) : (size_t)(end - p);
+        memcpy(o, p, run); // up to and including the quote, which is then doubled
+        o += run;
+        p += run;
+        if (q)
+            *o++ = '"';
+    }
+    *o++ = '"';
+    b->len = (size_t)(o - b->buf);
+}
@@ -0,0 +1,260 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "logfire.h"
+
+/*
+ * Parallel scan of one mapped file (--threads N).
+ *
+ * The mapping is cut into newline-aligned chunks. Worker threads claim
+ * chunks in file order, run the normal per-line pipeline over them and
+ * format matches into a per-chunk memory buffer. The calling thread acts
+ * as the writer: it flushes finished chunks either strictly in chunk order
+ * (default) or as soon as they complete (--unordered). Workers never run
+ * more than a fixed window of chunks ahead of the writer, which bounds the
+ * memory held in unflushed output.
+ *
+ * When aggregating, each worker folds its chunks into a private table and
+ * merges it into the caller's once it runs out of chunks.
+ */
+
+#define CHUNK_MIN (1u << 20)   // never split finer than 1 MiB
+#define CHUNKS_PER_THREAD 8    // load-balancing granularity
+#define WINDOW_PER_THREAD 4    // unflushed chunks allowed per worker
+
+typedef struct
+{
+    const char *begin, *end;
+    OutBuf out;      // formatted matches
+    char *err;       // --strict warnings
+    size_t err_len;
+    ScanStats st;
+    int done;
+    int flushed;
+} Chunk;
+
+typedef struct
+{
+    const ScanPlan *plan;
+    const char *label;
+    Agg *agg; // merge target for the workers' tables, or NULL
+    Chunk *chunks;
+    int nchunks;
+    int next;     // next chunk to hand out
+    int consumed; // chunks flushed by the writer
+    int window;
+    pthread_mutex_t mu;
+    pthread_cond_t cv_done;  // a chunk finished
+    pthread_cond_t cv_space; // the writer freed window space
+} ParallelScan;
+
+static void scan_chunk(const ParallelScan *ps, Chunk *c)
+{
+    int first_json = 1;
+    FILE *err = ps->plan->opt->strict ? open_memstream(&c->err, &c->err_len) : NULL;
+    if (ps->plan->opt->strict && !err)
+    {
+        perror("open_memstream");
+        exit(1);
+    }
+    if (!ps->agg)
+        outbuf_init(&c->out, NULL);
+
+    scan_block(ps->plan, c->begin, (size_t)(c->end - c->begin), ps->label, &c->out,
+               err ? err : stderr, &first_json, &c->st);
+
+    if (err)
+        fclose(err);
+}
+
+static void *scan_worker(void *arg)
+{
+    ParallelScan *ps = (ParallelScan *)arg;
+    Agg *part = ps->agg ? agg_new(ps->plan->agg) : NULL;
+
+    pthread_mutex_lock(&ps->mu);
+    for (;;)
+    {
+        while (ps->next < ps->nchunks && ps->next - ps->consumed >= ps->window)
+            pthread_cond_wait(&ps->cv_space, &ps->mu);
+        if (ps->next >= ps->nchunks)
+            break;
+        Chunk *c = &ps->chunks[ps->next++];
+        pthread_mutex_unlock(&ps->mu);
+
+        c->st.agg = part;
+        scan_chunk(ps, c);
+
+        pthread_mutex_lock(&ps->mu);
+        c->done = 1;
+        pthread_cond_broadcast(&ps->cv_done);
+    }
+    if (part)
+        agg_merge(ps->agg, part);
+    pthread_mutex_unlock(&ps->mu);
+    agg_free(part);
+    return NULL;
+}
+
+// Writes one finished chunk; called by the writer without the lock held
+static void flush_chunk(const ParallelScan *ps, Chunk *c, OutBuf *out, int *first_json, ScanStats *st)
+{
+    if (c->err_len)
+        fwrite(c->err, 1, c->err_len, stderr);
+    if (c->out.len)
+    {
+        // chunks are formatted as independent JSON fragments; join them
+        if (ps->plan->opt->format == FORMAT_JSON && !*first_json)
+            outbuf_putc(out, ',');
+        outbuf_write(out, c->out.buf, c->out.len);
+        *first_json = 0;
+    }
+    st->total += c->st.total;
+    st->parsed += c->st.parsed;
+    st->failed += c->st.failed;
+    st->skipped += c->st.skipped;
+    outbuf_free(&c->out);
+    free(c->err);
+    c->err = NULL;
+}
+
+// Cuts [p, end) into newline-aligned chunks of about target bytes
+static void add_chunks(ParallelScan *ps, const char *p, const char *end, size_t target)
+{
+    while (p < end)
+    {
+        const char *cut = (size_t)(end - p) > target ? p + target : end;
+        if (cut < end)
+        {
+            const char *nl = (const char *)memchr(cut, '\n', (size_t)(end - cut));
+            cut = nl ? nl + 1 : end;
+        }
+        ps->chunks[ps->nchunks].begin = p;
+        ps->chunks[ps->nchunks].end = cut;
+        ps->nchunks++;
+        p = cut;
+    }
+}
+
+/**
+ * @brief Scans a mapped file on --threads worker threads.
+ *
+ * Covers what is left of the source's current range plus any further ranges
+ * set with linesrc_ranges(); the source itself is not advanced.
+ * Output is byte-for-byte what the sequential loop produces unless
+ * --unordered is given, in which case chunks are written as they finish.
+ * Line counters are accumulated per chunk and summed, so they are exact.
+ * With st->agg set, matches are aggregated into it instead of written.
+ *
+ * @param plan   Filter/output settings (read-only, shared by all workers).
+ * @param src    Mapped line source.
+ * @param label  Input name for --strict warnings.
+ * @param out    Output writer; only the calling thread writes to it.
+ * @param first_json  JSON comma state shared with whatever was written before.
+ * @param st     Counters to add this file's totals to (including bytes).
+ */
+void scan_parallel(const ScanPlan *plan, const LineSource *src, const char *label,
+                   OutBuf *out, int *first_json, ScanStats *st)
+{
+    int nthreads = plan->opt->threads;
+    size_t total = src->limit - src->pos;
+    for (size_t r = src->next_range; r < src->nranges; r++)
+        total += src->ranges[2 * r + 1] - src->ranges[2 * r];
+    size_t target = total / ((size_t)nthreads * CHUNKS_PER_THREAD);
+    if (target < CHUNK_MIN)
+        target = CHUNK_MIN;
+
+    ParallelScan ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.plan = plan;
+    ps.label = label;
+    ps.agg = st->agg;
+    ps.window = nthreads * WINDOW_PER_THREAD;
+    ps.chunks = (Chunk *)calloc(total / target + 2 + (src->nranges - src->next_range), sizeof(Chunk));
+    if (!ps.chunks)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    add_chunks(&ps, src->map + src->pos, src->map + src->limit, target);
+    for (size_t r = src->next_range; r < src->nranges; r++)
+        add_chunks(&ps, src->map + src->ranges[2 * r], src->map + src->ranges[2 * r + 1], target);
+    st->bytes += total;
+
+    pthread_mutex_init(&ps.mu, NULL);
+    pthread_cond_init(&ps.cv_done, NULL);
+    pthread_cond_init(&ps.cv_space, NULL);
+
+    if (nthreads > ps.nchunks)
+        nthreads = ps.nchunks;
+    pthread_t *tids = (pthread_t *)malloc((size_t)(nthreads > 0 ? nthreads : 1) * sizeof(pthread_t));
+    if (!tids)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    int started = 0;
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, scan_worker, &ps) != 0)
+            break;
+        started++;
+    }
+    if (started == 0 && ps.nchunks > 0)
+    {
+        // no threads available: behave like one worker on this thread
+        fprintf(stderr, "[warn] could not start worker threads; scanning sequentially\n");
+        ps.window = ps.nchunks;
+        scan_worker(&ps);
+    }
+
+    int ordered = !plan->opt->unordered;
+    int low = 0; // lowest chunk not yet flushed
+    pthread_mutex_lock(&ps.mu);
+    while (ps.consumed < ps.nchunks)
+    {
+        Chunk *ready = NULL;
+        if (ordered)
+        {
+            if (ps.chunks[ps.consumed].done)
+                ready = &ps.chunks[ps.consumed];
+        }
+        else
+        {
+            while (low < ps.nchunks && ps.chunks[low].flushed)
+                low++;
+            for (int i = low; i < ps.next && !ready; i++)
+                if (ps.chunks[i].done && !ps.chunks[i].flushed)
+                    ready = &ps.chunks[i];
+        }
+        if (!ready)
+        {
+            pthread_cond_wait(&ps.cv_done, &ps.mu);
+            continue;
+        }
+        ready->flushed = 1;
+        pthread_mutex_unlock(&ps.mu);
+
+        flush_chunk(&ps, ready, out, first_json, st);
+
+        pthread_mutex_lock(&ps.mu);
+        ps.consumed++;
+        pthread_cond_broadcast(&ps.cv_space);
+    }
+    pthread_mutex_unlock(&ps.mu);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    free(tids);
+    free(ps.chunks);
+    pthread_mutex_destroy(&ps.mu);
+    pthread_cond_destroy(&ps.cv_done);
+    pthread_cond_destroy(&ps.cv_space);
+}
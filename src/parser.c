@@ -7,46 +7,479 @@
 #include <string.h>
 #include "logfire.h"
 #include "parser.h"
+#include "iptrie.h"
+
+static int parse_fail(char *errmsg, size_t errmsg_sz, const char *why)
+{
+    if (errmsg && errmsg_sz)
+        snprintf(errmsg, errmsg_sz, "%s", why);
+    return 0;
+}
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static const char *find_ws(const char *p, const char *end)
+{
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    return p;
+}
+
+// Find the closing quote of a quoted field, skipping backslash escapes (\")
+static const char *find_quote(const char *p, const char *end)
+{
+    while (p < end)
+    {
+        const char *q = (const char *)memchr(p, '"', (size_t)(end - p));
+        if (!q)
+            return NULL;
+        const char *b = q;
+        while (b > p && b[-1] == '\\')
+            b--;
+        if (((q - b) & 1) == 0)
+            return q;
+        p = q + 1;
+    }
+    return NULL;
+}
+
+#if defined(_MSC_VER)
+#define LF_THREAD_LOCAL __declspec(thread)
+#else
+#define LF_THREAD_LOCAL __thread
+#endif
+
+static int month_index(const char *m)
+{
+    // "Jan".."Dec", matched exactly as Apache/Nginx write them
+    switch (m[0])
+    {
+    case 'J':
+        if (m[1] == 'a' && m[2] == 'n')
+            return 0;
+        if (m[1] == 'u' && m[2] == 'n')
+            return 5;
+        if (m[1] == 'u' && m[2] == 'l')
+            return 6;
+        break;
+    case 'F':
+        return (m[1] == 'e' && m[2] == 'b') ? 1 : -1;
+    case 'M':
+        if (m[1] == 'a' && m[2] == 'r')
+            return 2;
+        if (m[1] == 'a' && m[2] == 'y')
+            return 4;
+        break;
+    case 'A':
+        if (m[1] == 'p' && m[2] == 'r')
+            return 3;
+        if (m[1] == 'u' && m[2] == 'g')
+            return 7;
+        break;
+    case 'S':
+        return (m[1] == 'e' && m[2] == 'p') ? 8 : -1;
+    case 'O':
+        return (m[1] == 'c' && m[2] == 't') ? 9 : -1;
+    case 'N':
+        return (m[1] == 'o' && m[2] == 'v') ? 10 : -1;
+    case 'D':
+        return (m[1] == 'e' && m[2] == 'c') ? 11 : -1;
+    }
+    return -1;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (month 1..12)
+static long long days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = (int)(y - era * 400);
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int digits(const char *p, int n, int *out)
+{
+    int v = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return 0;
+        v = v * 10 + (p[i] - '0');
+    }
+    *out = v;
+    return 1;
+}
+
+/**
+ * @brief Decodes an Apache/Nginx timestamp ("10/Oct/2000:13:55:36 -0700").
+ *
+ * Fixed-layout decoder, no strptime/mktime and no dependency on the local
+ * time zone. The "+zzzz" offset is optional; without it UTC is assumed.
+ *
+ * @param s    Timestamp text (need not be null-terminated).
+ * @param n    Its length: 20 without a zone, 26 with one.
+ * @param out  Receives seconds since the Unix epoch (UTC).
+ * @return     1 on success, 0 if the text is not in that format.
+ */
+int parse_apache_time(const char *s, size_t n, time_t *out)
+{
+    int d, y, hh, mm, ss, mon;
+    if (n != 20 && n != 26)
+        return 0;
+    if (s[2] != '/' || s[6] != '/' || s[11] != ':' || s[14] != ':' || s[17] != ':')
+        return 0;
+    if (!digits(s, 2, &d) || !digits(s + 7, 4, &y) || !digits(s + 12, 2, &hh) ||
+        !digits(s + 15, 2, &mm) || !digits(s + 18, 2, &ss))
+        return 0;
+    if ((mon = month_index(s + 3)) < 0 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60)
+        return 0;
+
+    long long off = 0;
+    if (n == 26)
+    {
+        int zh, zm;
+        if (s[20] != ' ' || (s[21] != '+' && s[21] != '-') ||
+            !digits(s + 22, 2, &zh) || !digits(s + 24, 2, &zm))
+            return 0;
+        off = (long long)zh * 3600 + zm * 60;
+        if (s[21] == '-')
+            off = -off;
+    }
+
+    *out = (time_t)(days_from_civil(y, mon + 1, d) * 86400 + hh * 3600 + mm * 60 + ss - off);
+    return 1;
+}
+
+/*
+ * Consecutive log lines almost always fall in the same minute, so remember
+ * the epoch of the last "dd/Mon/yyyy:HH:MM" + zone seen on this thread and
+ * only add the seconds when the next timestamp shares it.
+ */
+typedef struct
+{
+    char prefix[17]; // dd/Mon/yyyy:HH:MM
+    char zone[6];    // " +zzzz" or empty
+    size_t n;
+    time_t minute; // epoch at :00 of that minute
+    int valid;
+} MinuteCache;
+
+static LF_THREAD_LOCAL MinuteCache minute_cache;
+
+static int decode_time_cached(const char *s, size_t n, time_t *out)
+{
+    MinuteCache *c = &minute_cache;
+    int ss;
+    if (c->valid && n == c->n && memcmp(s, c->prefix, 17) == 0 &&
+        memcmp(s + 20, c->zone, n - 20) == 0 && s[17] == ':' && digits(s + 18, 2, &ss) && ss <= 60)
+    {
+        *out = c->minute + ss;
+        return 1;
+    }
+    if (!parse_apache_time(s, n, out))
+        return 0;
+    memcpy(c->prefix, s, 17);
+    memcpy(c->zone, s + 20, n - 20);
+    c->n = n;
+    c->minute = *out - ((s[18] - '0') * 10 + (s[19] - '0'));
+    c->valid = 1;
+    return 1;
+}
+
+/**
+ * @brief Returns the entry's timestamp as seconds since the epoch (UTC).
+ *
+ * Decoded on first use and cached in the entry (e->epoch).
+ *
+ * @return 1 with *out set, or 0 if the timestamp is not in Apache format.
+ */
+int logentry_epoch(LogEntry *e, time_t *out)
+{
+    if (!(e->loaded & LE_EPOCH))
+    {
+        e->loaded |= LE_EPOCH;
+        if (decode_time_cached(e->timestamp.p, e->timestamp.len, &e->epoch))
+            e->loaded |= LE_EPOCH_OK;
+    }
+    *out = e->epoch;
+    return (e->loaded & LE_EPOCH_OK) != 0;
+}
+
+/**
+ * @brief Parses the client IP into e->addr / e->addr_v6 on first use.
+ *
+ * @return 1 if the IP field is an IPv4 or IPv6 address, 0 otherwise.
+ */
+int logentry_addr(LogEntry *e)
+{
+    if (!(e->loaded & LE_ADDR))
+    {
+        e->loaded |= LE_ADDR;
+        if (ip_parse(e->ip.p, e->ip.len, e->addr, &e->addr_v6))
+            e->loaded |= LE_ADDR_OK;
+    }
+    return (e->loaded & LE_ADDR_OK) != 0;
+}
+
+// Whether p starts with whitespace, a three-digit number and whitespace or the end of the line
+static int status_follows(const char *p, const char *end)
+{
+    if (p >= end || (*p != ' ' && *p != '\t'))
+        return 0;
+    p = skip_ws(p, end);
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9' && digits < 4)
+        p++, digits++;
+    return digits == 3 && (p == end || *p == ' ' || *p == '\t');
+}
+
+/*
+ * Closing quote of the request. Servers log a '"' inside the URL unescaped,
+ * so the first quote ends it only if the status code follows; otherwise the
+ * first later quote that is followed by one does. Without such a quote the
+ * first one is used and the line is judged on that.
+ */
+static const char *find_request_end(const char *p, const char *end)
+{
+    const char *first = find_quote(p, end), *q = first;
+    while (q && !status_follows(q + 1, end))
+        q = find_quote(q + 1, end);
+    return q ? q : first;
+}
+
+static LogSlice slice(const char *p, size_t n)
+{
+    LogSlice s = {p, n};
+    return s;
+}
 
 /**
  * @brief Parses a single log line in Apache or Nginx combined log format.
  *
- * This function attempts to extract key fields from a log line, including IP address,
- * timestamp, HTTP method, URL, protocol, status code, and User-Agent. The referrer
- * field is ignored. The extracted values are stored in the provided LogEntry struct.
+ * Single pass over the line: each field boundary is located with a short
+ * scan or memchr and recorded as a slice into the line; nothing is copied.
+ * Only the fields that decide whether a line is valid are located here
+ * (IP, timestamp, method, URL, protocol, status). Bytes, referrer and
+ * User-Agent are located on first use by logentry_load().
+ *
+ * Validation mirrors the former sscanf format: IP, timestamp, method,
+ * URL, protocol and status are required, and an over-long IP, timestamp,
+ * method or protocol rejects the line.
  *
- * @param line      The input log line as a null-terminated string.
- * @param out       Pointer to a LogEntry struct to be filled with parsed data.
+ * @param line      The input log line (need not be null-terminated). Must
+ *                  stay valid for as long as the entry is used.
+ * @param len       Length of the line in bytes, excluding any newline.
+ * @param out       Pointer to a LogEntry view to be filled in.
  * @param errmsg    Buffer to receive an error message if parsing fails (can be NULL).
  * @param errmsg_sz Size of the errmsg buffer.
  * @return          1 if parsing was successful and required fields were found, 0 otherwise.
  */
-int parse_apache_or_nginx(const char *line, LogEntry *out, char *errmsg, size_t errmsg_sz)
+int parse_apache_or_nginx(const char *line, size_t len, LogEntry *out, char *errmsg, size_t errmsg_sz)
 {
-    memset(out, 0, sizeof(*out)); // Reset out
+    // Example line: 83.149.9.216 - - [17/May/2015:10:05:03 +0000] "GET /path HTTP/1.1" 200 123 "-" "UA..."
+    const char *p = line, *end = line + len, *tok, *q;
+    size_t n;
 
-    char ip[64] = {0}, timebuf[64] = {0}, method[16] = {0}, url[1024] = {0}, proto[32] = {0}, ua[1024] = {0}; // Example line: 83.149.9.216 - - [17/May/2015:10:05:03 +0000] "GET /path HTTP/1.1" 200 123 "-" "UA..."
-    int status = 0;
+    if (end > p && end[-1] == '\r') // CRLF files
+        end--;
 
-    // NOTE: Some servers put the referrer in quotes before the User-Agent; the pattern above skips it with %*[^\" ].
-    // This parser will continue to ignore the referrer and only extract the User-Agent.
-    int matched = sscanf(line,
-                         "%63s - - [%63[^]]] \"%15s %1023s %31[^\"]\" %d %*s %*[^\" ] \"%1023[^\"]\"",
-                         ip, timebuf, method, url, proto, &status, ua); // we use scansets to grab inside [] and ""
+    out->line = line;
+    out->len = (size_t)(end - line);
+    out->bytes = 0;
+    out->request_time = -1.0;
+    out->referrer = slice(end, 0);
+    out->userAgent = slice(end, 0);
+    out->epoch = 0;
+    out->loaded = 0;
 
-    if (matched < 6)
-    { // be lenient; require at least ip,time,method,url,proto,status
-        if (errmsg && errmsg_sz)
-            snprintf(errmsg, errmsg_sz, "sscanf matched %d fields", matched);
-        return 0;
+    /* client address */
+    p = skip_ws(p, end);
+    tok = p;
+    p = find_ws(p, end);
+    n = (size_t)(p - tok);
+    if (n == 0)
+        return parse_fail(errmsg, errmsg_sz, "missing client address");
+    if (n >= PARSE_MAX_IP)
+        return parse_fail(errmsg, errmsg_sz, "client address too long");
+    out->ip = slice(tok, n);
+
+    /* ident and authuser (usually "-") */
+    for (int k = 0; k < 2; k++)
+    {
+        p = skip_ws(p, end);
+        tok = p;
+        p = find_ws(p, end);
+        if (p == tok)
+            return parse_fail(errmsg, errmsg_sz, "missing ident/user");
     }
 
-    strncpy(out->ip, ip, sizeof(out->ip) - 1);
-    strncpy(out->timestamp, timebuf, sizeof(out->timestamp) - 1);
-    strncpy(out->method, method, sizeof(out->method) - 1);
-    strncpy(out->url, url, sizeof(out->url) - 1);
-    out->status = status;
-    strncpy(out->userAgent, ua, sizeof(out->userAgent) - 1);  
+    /* [timestamp] */
+    p = skip_ws(p, end);
+    if (p >= end || *p != '[')
+        return parse_fail(errmsg, errmsg_sz, "expected '[' before timestamp");
+    tok = ++p;
+    q = (const char *)memchr(p, ']', (size_t)(end - p));
+    if (!q)
+        return parse_fail(errmsg, errmsg_sz, "unterminated timestamp");
+    n = (size_t)(q - tok);
+    if (n == 0 || n >= PARSE_MAX_TIMESTAMP)
+        return parse_fail(errmsg, errmsg_sz, "bad timestamp length");
+    out->timestamp = slice(tok, n);
+    p = q + 1;
 
+    /* "METHOD URL PROTOCOL" */
+    p = skip_ws(p, end);
+    if (p >= end || *p != '"')
+        return parse_fail(errmsg, errmsg_sz, "expected quoted request");
+    p++;
+    const char *rq_end = find_request_end(p, end);
+    if (!rq_end)
+        return parse_fail(errmsg, errmsg_sz, "unterminated request");
+
+    tok = p;
+    p = find_ws(p, rq_end);
+    n = (size_t)(p - tok);
+    if (n == 0 || n >= PARSE_MAX_METHOD)
+        return parse_fail(errmsg, errmsg_sz, "bad request method");
+    out->method = slice(tok, n);
+
+    p = skip_ws(p, rq_end);
+    tok = p;
+    p = find_ws(p, rq_end);
+    n = (size_t)(p - tok);
+    if (n == 0)
+        return parse_fail(errmsg, errmsg_sz, "missing request URL");
+    out->url = slice(tok, n);
+
+    p = skip_ws(p, rq_end);
+    q = rq_end;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t'))
+        q--;
+    n = (size_t)(q - p);
+    if (n == 0 || n >= PARSE_MAX_PROTOCOL)
+        return parse_fail(errmsg, errmsg_sz, "bad request protocol");
+    out->protocol = slice(p, n);
+    p = rq_end + 1;
+
+    /* status */
+    p = skip_ws(p, end);
+    int status = 0, neg = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = (*p++ == '-');
+    tok = p;
+    while (p < end && *p >= '0' && *p <= '9' && p - tok < 9)
+        status = status * 10 + (*p++ - '0');
+    if (p == tok)
+        return parse_fail(errmsg, errmsg_sz, "missing status");
+    out->status = neg ? -status : status;
+    out->rest = find_ws(p, end);
+
+    out->loaded = LF_ALL & ~LF_LAZY;
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Locates the optional trailing fields of a parsed entry on demand.
+ *
+ * Bytes, referrer, User-Agent and the request time come after the status
+ * code and are usually not needed by a query or a projected output, so the
+ * parser leaves them alone until a caller asks for them. Asking again is free.
+ * The request time is the first field after the User-Agent, if it is a
+ * number of seconds (nginx's $request_time), optionally as key=value.
+ *
+ * @param e       Entry previously filled by parse_apache_or_nginx().
+ * @param fields  LF_BIT() mask of the fields the caller is about to read.
+ */
+void logentry_load(LogEntry *e, unsigned fields)
+{
+    if (!(fields & LF_LAZY & ~e->loaded))
+        return;
+    e->loaded |= LF_LAZY;
+
+    const char *end = e->line + e->len, *p, *tok, *q;
+
+    /* response bytes ("-" when no body was sent) */
+    p = skip_ws(e->rest, end);
+    tok = p;
+    p = find_ws(p, end);
+    if (p == tok)
+        return;
+    long long bytes = 0;
+    for (const char *d = tok; d < p && *d >= '0' && *d <= '9'; d++)
+        bytes = bytes * 10 + (*d - '0');
+    e->bytes = bytes;
+
+    /* "referrer" "user-agent" */
+    p = skip_ws(p, end);
+    if (p >= end || *p != '"' || !(q = find_quote(p + 1, end)))
+        return;
+    e->referrer = slice(p + 1, (size_t)(q - p - 1));
+    p = skip_ws(q + 1, end);
+    if (p >= end || *p != '"' || !(q = find_quote(p + 1, end)))
+        return;
+    e->userAgent = slice(p + 1, (size_t)(q - p - 1));
+
+    /* nginx $request_time ("0.123", or "rt=0.123" / "request_time=0.123") */
+    p = skip_ws(q + 1, end);
+    tok = p;
+    p = find_ws(p, end);
+    for (const char *eq = tok; eq < p; eq++)
+        if (*eq == '=')
+            tok = eq + 1;
+    if (tok < p && *tok == '"' && p[-1] == '"' && p - tok >= 2)
+        tok++, p--;
+    double secs = 0, scale = 0;
+    const char *d = tok;
+    for (; d < p; d++)
+    {
+        if (*d >= '0' && *d <= '9')
+        {
+            if (scale)
+                secs += (*d - '0') * (scale /= 10);
+            else
+                secs = secs * 10 + (*d - '0');
+        }
+        else if (*d == '.' && !scale)
+            scale = 1;
+        else
+            break;
+    }
+    if (d == p && d > tok && !(scale && d - tok == 1))
+        e->request_time = secs;
+}
+
+/**
+ * @brief Returns the raw text of a string field, loading it if needed.
+ *
+ * Numeric fields (status, bytes, request time) have no slice and yield an empty one.
+ */
+LogSlice logentry_field(LogEntry *e, LogField f)
+{
+    logentry_load(e, LF_BIT(f));
+    switch (f)
+    {
+    case LF_TIMESTAMP:
+        return e->timestamp;
+    case LF_IP:
+        return e->ip;
+    case LF_METHOD:
+        return e->method;
+    case LF_URL:
+        return e->url;
+    case LF_PROTOCOL:
+        return e->protocol;
+    case LF_REFERRER:
+        return e->referrer;
+    case LF_USERAGENT:
+        return e->userAgent;
+    default:
+        return slice(e->line, 0);
+    }
+}
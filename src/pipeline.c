@@ -0,0 +1,465 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include "pipeline.h"
+
+/*
+ * Batches move through the ring as FREE -> FILLED (reader) -> DONE
+ * (worker) -> FREE (writer). Sequence numbers decide the slot (seq % size)
+ * and the order batches are claimed and written in. All state changes take
+ * one mutex; a batch holds about a read block (1 MiB from stdin), so that
+ * costs a few lock round trips per megabyte.
+ */
+
+#define PIPE_SLOTS_PER_WORKER 4 // batches in the ring per worker
+
+enum
+{
+    SLOT_FREE,
+    SLOT_FILLED,
+    SLOT_DONE
+};
+
+typedef struct
+{
+    char *in; // lines to scan
+    size_t in_len, in_cap;
+    char *label; // copy of the input name, or NULL
+    size_t label_cap;
+    OutBuf out; // formatted matches
+    char *err;  // --strict warnings
+    size_t err_len;
+    ScanStats st;
+    int state;
+} Batch;
+
+typedef struct
+{
+    struct Pipeline *p;
+    int id;
+} WorkerArg;
+
+struct Pipeline
+{
+    const ScanPlan *plan;
+    OutBuf *out;
+    int *first_json; // NULL for NDJSON (--tail)
+    ScanStats *st;
+    Batch *ring;
+    int nslots;
+    long long submitted, claimed, written; // sequence numbers
+    int ndone;                             // batches parsed but not yet written
+    int writer_busy;                       // the writer is using out without the lock
+    int stop;
+
+    Agg **parts; // each worker's private table, or NULL
+    WorkerArg *args;
+    pthread_t *tids;
+    int nworkers, started;
+    pthread_t writer;
+    int sequential; // no threads: pipeline_submit() scans directly
+
+    // queue depths, sampled as batches enter each queue
+    long long parse_depth_sum, write_depth_sum;
+    int parse_depth_max, write_depth_max;
+    long long reader_waits; // reader blocked on a full ring (backpressure)
+    long long writer_waits; // writer waited for the next batch to be parsed
+
+    pthread_mutex_t mu;
+    pthread_cond_t cv_work; // a batch was submitted, or stop
+    pthread_cond_t cv_done; // a batch was parsed, or stop
+    pthread_cond_t cv_free; // the writer freed a slot or went idle
+};
+
+static void *xmalloc(size_t n)
+{
+    void *p = malloc(n ? n : 1);
+    if (!p)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void scan_batch(const Pipeline *p, Batch *b, Agg *part)
+{
+    int first_json = 1;
+    FILE *err = p->plan->opt->strict ? open_memstream(&b->err, &b->err_len) : NULL;
+    if (p->plan->opt->strict && !err)
+    {
+        perror("open_memstream");
+        exit(1);
+    }
+    memset(&b->st, 0, sizeof(b->st));
+    b->st.agg = part;
+    b->out.len = 0;
+
+    scan_block(p->plan, b->in, b->in_len, b->label, &b->out, err ? err : stderr,
+               p->first_json ? &first_json : NULL, &b->st);
+
+    if (err)
+        fclose(err);
+}
+
+static void *parse_worker(void *arg)
+{
+    WorkerArg *wa = (WorkerArg *)arg;
+    Pipeline *p = wa->p;
+
+    pthread_mutex_lock(&p->mu);
+    for (;;)
+    {
+        while (p->claimed == p->submitted && !p->stop)
+            pthread_cond_wait(&p->cv_work, &p->mu);
+        if (p->claimed == p->submitted)
+            break;
+        Batch *b = &p->ring[p->claimed++ % p->nslots];
+        Agg *part = p->parts ? p->parts[wa->id] : NULL;
+        pthread_mutex_unlock(&p->mu);
+
+        scan_batch(p, b, part);
+
+        pthread_mutex_lock(&p->mu);
+        b->state = SLOT_DONE;
+        p->ndone++;
+        pthread_cond_broadcast(&p->cv_done);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
+
+// Writes one parsed batch; called by the writer without the lock held
+static void flush_batch(Pipeline *p, Batch *b)
+{
+    if (b->err_len)
+        fwrite(b->err, 1, b->err_len, stderr);
+    if (b->out.len)
+    {
+        // batches are formatted as independent JSON fragments; join them
+        if (p->first_json && p->plan->opt->format == FORMAT_JSON && !*p->first_json)
+            outbuf_putc(p->out, ',');
+        outbuf_write(p->out, b->out.buf, b->out.len);
+        if (p->first_json)
+            *p->first_json = 0;
+    }
+    p->st->total += b->st.total;
+    p->st->parsed += b->st.parsed;
+    p->st->failed += b->st.failed;
+    p->st->skipped += b->st.skipped;
+    free(b->err);
+    b->err = NULL;
+    b->err_len = 0;
+}
+
+// The next batch to write, or NULL; called with mu held
+static Batch *next_ready(Pipeline *p)
+{
+    if (!p->plan->opt->unordered)
+    {
+        Batch *b = &p->ring[p->written % p->nslots];
+        return p->written < p->submitted && b->state == SLOT_DONE ? b : NULL;
+    }
+    for (int i = 0; i < p->nslots; i++)
+        if (p->ring[i].state == SLOT_DONE)
+            return &p->ring[i];
+    return NULL;
+}
+
+static void *write_worker(void *arg)
+{
+    Pipeline *p = (Pipeline *)arg;
+
+    pthread_mutex_lock(&p->mu);
+    for (;;)
+    {
+        Batch *b = next_ready(p);
+        if (!b)
+        {
+            if (p->out->fp && p->out->len)
+            {
+                // caught up: show what matched so far
+                p->writer_busy = 1;
+                pthread_mutex_unlock(&p->mu);
+                outbuf_flush(p->out);
+                pthread_mutex_lock(&p->mu);
+                p->writer_busy = 0;
+                pthread_cond_broadcast(&p->cv_free);
+                continue;
+            }
+            if (p->stop && p->written == p->submitted)
+                break;
+            if (p->written < p->submitted)
+                p->writer_waits++;
+            pthread_cond_wait(&p->cv_done, &p->mu);
+            continue;
+        }
+        p->ndone--; // the rest wait behind this one
+        p->write_depth_sum += p->ndone;
+        if (p->ndone > p->write_depth_max)
+            p->write_depth_max = p->ndone;
+        p->writer_busy = 1;
+        pthread_mutex_unlock(&p->mu);
+
+        flush_batch(p, b);
+
+        pthread_mutex_lock(&p->mu);
+        b->state = SLOT_FREE;
+        p->written++;
+        p->writer_busy = 0;
+        pthread_cond_broadcast(&p->cv_free);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
+
+/**
+ * @brief Starts the worker and writer threads.
+ *
+ * Falls back to scanning on the calling thread (with a warning) when no
+ * threads can be started.
+ *
+ * @param plan        Filter/output settings (read-only, shared by all workers).
+ * @param workers     Parse/filter worker threads.
+ * @param out         Output writer; owned by the writer thread until pipeline_close().
+ * @param first_json  JSON comma state, or NULL to write NDJSON.
+ * @param st          Counters to add to; st->agg, when set, receives the workers' tables.
+ */
+Pipeline *pipeline_open(const ScanPlan *plan, int workers, OutBuf *out, int *first_json, ScanStats *st)
+{
+    Pipeline *p = (Pipeline *)calloc(1, sizeof(Pipeline));
+    if (!p)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    if (workers < 1)
+        workers = 1;
+    p->plan = plan;
+    p->out = out;
+    p->first_json = first_json;
+    p->st = st;
+    p->nworkers = workers;
+    p->nslots = workers * PIPE_SLOTS_PER_WORKER;
+    p->ring = (Batch *)calloc((size_t)p->nslots, sizeof(Batch));
+    if (!p->ring)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    if (!st->agg)
+        for (int i = 0; i < p->nslots; i++)
+            outbuf_init(&p->ring[i].out, NULL);
+    else
+    {
+        p->parts = (Agg **)xmalloc((size_t)workers * sizeof(Agg *));
+        for (int i = 0; i < workers; i++)
+            p->parts[i] = agg_new(plan->agg);
+    }
+    p->args = (WorkerArg *)xmalloc((size_t)workers * sizeof(WorkerArg));
+    p->tids = (pthread_t *)xmalloc((size_t)workers * sizeof(pthread_t));
+    pthread_mutex_init(&p->mu, NULL);
+    pthread_cond_init(&p->cv_work, NULL);
+    pthread_cond_init(&p->cv_done, NULL);
+    pthread_cond_init(&p->cv_free, NULL);
+
+    // signals stay with the caller (--tail waits for SIGINT/SIGTERM)
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&p->writer, NULL, write_worker, p) == 0)
+    {
+        for (int i = 0; i < workers; i++)
+        {
+            p->args[i].p = p;
+            p->args[i].id = i;
+            if (pthread_create(&p->tids[i], NULL, parse_worker, &p->args[i]) != 0)
+                break;
+            p->started++;
+        }
+        if (p->started == 0)
+        {
+            pthread_mutex_lock(&p->mu);
+            p->stop = 1;
+            pthread_cond_broadcast(&p->cv_done);
+            pthread_mutex_unlock(&p->mu);
+            pthread_join(p->writer, NULL);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (p->started == 0)
+    {
+        fprintf(stderr, "[warn] could not start worker threads; scanning sequentially\n");
+        p->sequential = 1;
+    }
+    return p;
+}
+
+/**
+ * @brief Queues n bytes of whole lines (the last one may lack its '\n').
+ *
+ * The bytes and the label are copied. Blocks while every slot of the ring
+ * is taken.
+ */
+void pipeline_submit(Pipeline *p, const char *data, size_t n, const char *label)
+{
+    if (p->sequential)
+    {
+        scan_block(p->plan, data, n, label, p->out, stderr, p->first_json, p->st);
+        return;
+    }
+
+    pthread_mutex_lock(&p->mu);
+    Batch *b = &p->ring[p->submitted % p->nslots];
+    if (b->state != SLOT_FREE)
+    {
+        p->reader_waits++;
+        while (b->state != SLOT_FREE)
+            pthread_cond_wait(&p->cv_free, &p->mu);
+    }
+    pthread_mutex_unlock(&p->mu);
+
+    // the slot is the reader's until it is marked FILLED
+    if (b->in_cap < n)
+    {
+        free(b->in);
+        b->in_cap = n;
+        b->in = (char *)xmalloc(b->in_cap);
+    }
+    memcpy(b->in, data, n);
+    b->in_len = n;
+    if (label)
+    {
+        size_t len = strlen(label) + 1;
+        if (b->label_cap < len)
+        {
+            free(b->label);
+            b->label_cap = len;
+            b->label = (char *)xmalloc(len);
+        }
+        memcpy(b->label, label, len);
+    }
+    else
+    {
+        free(b->label);
+        b->label = NULL;
+        b->label_cap = 0;
+    }
+
+    pthread_mutex_lock(&p->mu);
+    int depth = (int)(p->submitted - p->claimed);
+    p->parse_depth_sum += depth;
+    if (depth > p->parse_depth_max)
+        p->parse_depth_max = depth;
+    b->state = SLOT_FILLED;
+    p->submitted++;
+    pthread_cond_signal(&p->cv_work);
+    pthread_mutex_unlock(&p->mu);
+}
+
+// Folds the workers' tables into the caller's; called with every batch written
+static void merge_parts(Pipeline *p, int renew)
+{
+    if (!p->parts)
+        return;
+    for (int i = 0; i < p->started; i++)
+    {
+        agg_merge(p->st->agg, p->parts[i]);
+        agg_free(p->parts[i]);
+        p->parts[i] = renew ? agg_new(p->plan->agg) : NULL;
+    }
+}
+
+/**
+ * @brief Waits until everything submitted is written and flushed.
+ *
+ * Afterwards the output, counters and aggregate passed to pipeline_open()
+ * are complete and the caller may use them until its next pipeline_submit().
+ */
+void pipeline_sync(Pipeline *p)
+{
+    if (p->sequential)
+        return;
+    pthread_mutex_lock(&p->mu);
+    while (p->written < p->submitted || p->writer_busy || (p->out->fp && p->out->len))
+        pthread_cond_wait(&p->cv_free, &p->mu);
+    merge_parts(p, 1);
+    pthread_mutex_unlock(&p->mu);
+}
+
+/**
+ * @brief Finishes everything submitted, stops the threads and frees the pipeline.
+ *
+ * Prints the queue statistics to stderr when anything went through the threads.
+ */
+void pipeline_close(Pipeline *p)
+{
+    if (!p->sequential)
+    {
+        pthread_mutex_lock(&p->mu);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->cv_work);
+        pthread_cond_broadcast(&p->cv_done);
+        pthread_mutex_unlock(&p->mu);
+        for (int i = 0; i < p->started; i++)
+            pthread_join(p->tids[i], NULL);
+        pthread_join(p->writer, NULL);
+        merge_parts(p, 0);
+
+        if (p->submitted)
+            fprintf(stderr,
+                    "[pipeline] %d workers, %lld batches: parse queue avg %.1f max %d, "
+                    "write queue avg %.1f max %d (of %d slots); reader blocked %lld times, "
+                    "writer waited %lld times\n",
+                    p->started, p->submitted, (double)p->parse_depth_sum / (double)p->submitted,
+                    p->parse_depth_max, (double)p->write_depth_sum / (double)p->submitted,
+                    p->write_depth_max, p->nslots, p->reader_waits, p->writer_waits);
+    }
+    pthread_mutex_destroy(&p->mu);
+    pthread_cond_destroy(&p->cv_work);
+    pthread_cond_destroy(&p->cv_done);
+    pthread_cond_destroy(&p->cv_free);
+
+    if (p->parts)
+        for (int i = p->started; i < p->nworkers; i++)
+            agg_free(p->parts[i]); // tables of workers that never started
+    for (int i = 0; i < p->nslots; i++)
+    {
+        free(p->ring[i].in);
+        free(p->ring[i].label);
+        if (!p->st->agg)
+            outbuf_free(&p->ring[i].out);
+    }
+    free(p->ring);
+    free(p->parts);
+    free(p->args);
+    free(p->tids);
+    free(p);
+}
+
+/**
+ * @brief Scans a stream that is read in blocks (stdin, pipes) with --threads workers.
+ *
+ * The calling thread reads; see pipeline.h. Output is byte-for-byte what the
+ * sequential loop produces unless --unordered is given.
+ *
+ * @return  The last linesrc_next_block() result: 0 at end of input, -1 on a read error.
+ */
+int scan_pipeline(const ScanPlan *plan, LineSource *src, const char *label, OutBuf *out,
+                  int *first_json, ScanStats *st)
+{
+    Pipeline *p = pipeline_open(plan, plan->opt->threads, out, first_json, st);
+    const char *blk;
+    size_t n;
+    int rc;
+    while ((rc = linesrc_next_block(src, &blk, &n)) > 0)
+        pipeline_submit(p, blk, n, label);
+    pipeline_close(p);
+    return rc;
+}
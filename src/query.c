@@ -7,8 +7,14 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <time.h>
+#include <limits.h>
 #include "query.h"
 #include "logstore.h"
+#include "parser.h"
+#include "strsearch.h"
+#include "lfregex.h"
+#include "hash.h"
+#include "iptrie.h"
 
 static int icasecmp(char a, char b)
 {
@@ -29,33 +35,450 @@ static int str_eq_ci(const char *a, const char *b)
     return *a == 0 && *b == 0;
 }
 
-// simple wildcard match (* ?), case-insensitive optional
-static int wildcard_match(const char *s, const char *pat, int ci)
+/*
+ * Compiled term matchers.
+ *
+ * query_parse() classifies every string pattern once: no wildcards is an
+ * exact compare, a single literal with leading and/or trailing '*' is a
+ * prefix, suffix or substring test, and anything else becomes a glob split
+ * into its '*'-separated segments. With --ci the pattern is lowercased at
+ * compile time and only the subject is folded while matching.
+ *
+ * A glob is matched by placing each segment at its leftmost possible
+ * position after the previous one (first and last segment anchored unless
+ * the pattern starts/ends with '*'), which is exact for '*' globs and never
+ * backtracks. Unanchored segments up to 64 bytes are found with a
+ * bit-parallel Shift-And scan, so matching is linear in the subject.
+ */
+
+#define GLOB_SHIFT_AND_MAX 64
+
+typedef struct
+{
+    const char *p; // segment bytes ('?' matches any byte), lowercased when ci
+    size_t len;
+    unsigned long long *mask; // Shift-And table (256 entries), or NULL
+} GlobSeg;
+
+struct QueryGlob
+{
+    char *pat; // storage for the segments
+    GlobSeg *segs;
+    int nsegs;
+    int has_star;
+    int anchor_start, anchor_end;
+};
+
+// ASCII lowercase without a locale lookup
+static inline unsigned char fold(unsigned char c)
+{
+    return (unsigned char)(c + (((unsigned)(c - 'A') < 26u) << 5));
+}
+
+// Compares n subject bytes against a (pre-folded when ci) literal
+static int lit_eq(const char *s, const char *lit, size_t n, int ci)
+{
+    if (!ci)
+        return memcmp(s, lit, n) == 0;
+    for (size_t i = 0; i < n; i++)
+        if (fold((unsigned char)s[i]) != (unsigned char)lit[i])
+            return 0;
+    return 1;
+}
+
+// Leftmost occurrence of a literal in s[0..n), or NULL
+static const char *lit_find(const char *s, size_t n, const char *lit, size_t m, int ci)
 {
-    const char *star = NULL, *ss = NULL;
-    while (*s)
+    return ci ? lf_memmem_ci(s, n, lit, m) : lf_memmem(s, n, lit, m);
+}
+
+static int seg_at(const GlobSeg *g, const char *s, int ci)
+{
+    for (size_t i = 0; i < g->len; i++)
+    {
+        unsigned char c = ci ? fold((unsigned char)s[i]) : (unsigned char)s[i];
+        if (g->p[i] != '?' && (unsigned char)g->p[i] != c)
+            return 0;
+    }
+    return 1;
+}
+
+// Leftmost placement of a segment in s[0..n), or NULL
+static const char *seg_find(const GlobSeg *g, const char *s, size_t n, int ci)
+{
+    if (n < g->len)
+        return NULL;
+    if (g->mask)
     {
-        if (*pat == '*')
+        unsigned long long d = 0, hit = 1ULL << (g->len - 1);
+        for (size_t i = 0; i < n; i++)
         {
-            star = ++pat;
-            ss = s;
+            d = ((d << 1) | 1ULL) & g->mask[(unsigned char)s[i]];
+            if (d & hit)
+                return s + i + 1 - g->len;
         }
-        else if (*pat == '?' || (!ci && *pat == *s) || (ci && !icasecmp(*pat, *s)))
+        return NULL;
+    }
+    for (size_t i = 0; i + g->len <= n; i++)
+        if (seg_at(g, s + i, ci))
+            return s + i;
+    return NULL;
+}
+
+static int glob_match(const QueryGlob *g, const char *s, size_t n, int ci)
+{
+    int first = 0, last = g->nsegs;
+    size_t pos = 0, end = n;
+
+    if (!g->has_star)
+        return n == g->segs[0].len && seg_at(&g->segs[0], s, ci);
+    if (g->anchor_start)
+    {
+        if (g->segs[0].len > n || !seg_at(&g->segs[0], s, ci))
+            return 0;
+        pos = g->segs[0].len;
+        first = 1;
+    }
+    if (g->anchor_end && last > first)
+    {
+        const GlobSeg *sg = &g->segs[last - 1];
+        if (sg->len > end - pos || !seg_at(sg, s + n - sg->len, ci))
+            return 0;
+        end = n - sg->len;
+        last--;
+    }
+    for (int i = first; i < last; i++)
+    {
+        const char *at = seg_find(&g->segs[i], s + pos, end - pos, ci);
+        if (!at)
+            return 0;
+        pos = (size_t)(at - s) + g->segs[i].len;
+    }
+    return 1;
+}
+
+static void glob_free(QueryGlob *g)
+{
+    if (!g)
+        return;
+    for (int i = 0; i < g->nsegs; i++)
+        free(g->segs[i].mask);
+    free(g->segs);
+    free(g->pat);
+    free(g);
+}
+
+// Builds a glob over pat (takes ownership); returns NULL on allocation failure
+static QueryGlob *glob_compile(char *pat, int ci)
+{
+    size_t n = strlen(pat);
+    QueryGlob *g = (QueryGlob *)calloc(1, sizeof(QueryGlob));
+    if (!g || !(g->segs = (GlobSeg *)calloc(n / 2 + 2, sizeof(GlobSeg))))
+    {
+        free(g);
+        free(pat);
+        return NULL;
+    }
+    g->pat = pat;
+    g->has_star = strchr(pat, '*') != NULL;
+    g->anchor_start = pat[0] != '*';
+    g->anchor_end = n == 0 || pat[n - 1] != '*';
+
+    for (char *p = pat; *p;)
+    {
+        char *star = strchr(p, '*');
+        size_t len = star ? (size_t)(star - p) : strlen(p);
+        if (len > 0)
         {
-            pat++;
-            s++;
+            g->segs[g->nsegs].p = p;
+            g->segs[g->nsegs].len = len;
+            g->nsegs++;
         }
-        else if (star)
+        p += len;
+        while (*p == '*')
+            p++;
+    }
+    if (g->nsegs == 0) // "" (only reachable without a star)
+    {
+        g->segs[0].p = pat;
+        g->nsegs = 1;
+    }
+
+    for (int i = 0; i < g->nsegs; i++)
+    {
+        GlobSeg *sg = &g->segs[i];
+        int anchored = (i == 0 && g->anchor_start) || (i == g->nsegs - 1 && g->anchor_end);
+        if (anchored || sg->len > GLOB_SHIFT_AND_MAX)
+            continue;
+        sg->mask = (unsigned long long *)calloc(256, sizeof(unsigned long long));
+        if (!sg->mask)
+            continue; // falls back to the direct scan
+        for (size_t j = 0; j < sg->len; j++)
         {
-            pat = star;
-            s = ++ss;
+            unsigned long long bit = 1ULL << j;
+            unsigned char c = (unsigned char)sg->p[j];
+            if (c == '?')
+            {
+                for (int k = 0; k < 256; k++)
+                    sg->mask[k] |= bit;
+                continue;
+            }
+            sg->mask[c] |= bit;
+            if (ci && c >= 'a' && c <= 'z')
+                sg->mask[c - 32] |= bit;
         }
-        else
+    }
+    return g;
+}
+
+// Classifies a string pattern and compiles it into m
+static int compile_text(QueryMatch *m, const char *val, int ci)
+{
+    size_t n = strlen(val);
+    char *pat = (char *)malloc(n + 1);
+    if (!pat)
+        return 0;
+    for (size_t i = 0; i <= n; i++)
+        pat[i] = ci ? (char)fold((unsigned char)val[i]) : val[i];
+    m->ci = ci;
+
+    size_t lead = 0, trail = 0;
+    while (pat[lead] == '*')
+        lead++;
+    if (lead == n && n > 0)
+    {
+        free(pat);
+        m->kind = QM_ANY;
+        return 1;
+    }
+    while (trail < n - lead && pat[n - 1 - trail] == '*')
+        trail++;
+    size_t core = n - lead - trail;
+    if (!memchr(pat + lead, '*', core) && !memchr(pat + lead, '?', core))
+    {
+        memmove(pat, pat + lead, core);
+        pat[core] = '\0';
+        m->lit = pat;
+        m->lit_len = core;
+        m->kind = lead ? (trail ? QM_CONTAINS : QM_SUFFIX) : (trail ? QM_PREFIX : QM_EXACT);
+        return 1;
+    }
+    m->kind = QM_GLOB;
+    m->glob = glob_compile(pat, ci);
+    return m->glob != NULL;
+}
+
+// Decimal digits of v into buf (at least 12 bytes); returns the length
+static size_t fmt_int(char *buf, int v)
+{
+    char tmp[12];
+    size_t n = 0, len = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    do
+        tmp[n++] = (char)('0' + u % 10);
+    while ((u /= 10) != 0);
+    if (v < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = tmp[--n];
+    return len;
+}
+
+/*
+ * IN lists: members are hashed into an open-addressing table (load <= 1/2),
+ * so a lookup costs one hash of the field plus about one compare however
+ * long the list is. With --ci members are stored lowercased and the field
+ * is folded before hashing.
+ */
+#define QUERY_SET_MAX_ITEM 1024
+
+typedef struct
+{
+    uint64_t h;
+    size_t off, len; // len == SIZE_MAX: empty slot
+} SetSlot;
+
+struct QuerySet
+{
+    char *data; // members, back to back
+    SetSlot *slots;
+    size_t mask;
+    size_t min_len, max_len;
+};
+
+static void set_free(QuerySet *s)
+{
+    if (!s)
+        return;
+    free(s->data);
+    free(s->slots);
+    free(s);
+}
+
+static int set_contains(const QuerySet *s, const char *p, size_t n, int ci)
+{
+    char buf[QUERY_SET_MAX_ITEM];
+    if (n < s->min_len || n > s->max_len)
+        return 0;
+    if (ci)
+    {
+        for (size_t i = 0; i < n; i++)
+            buf[i] = (char)fold((unsigned char)p[i]);
+        p = buf;
+    }
+    uint64_t h = lf_hash64(p, n);
+    for (size_t i = (size_t)h & s->mask;; i = (i + 1) & s->mask)
+    {
+        const SetSlot *sl = &s->slots[i];
+        if (sl->len == SIZE_MAX)
+            return 0;
+        if (sl->h == h && sl->len == n && memcmp(s->data + sl->off, p, n) == 0)
+            return 1;
+    }
+}
+
+/*
+ * Builds a set from nitems NUL-separated members in items. Duplicates are
+ * dropped. Returns NULL when out of memory.
+ */
+static QuerySet *set_build(const char *items, size_t size, int nitems, int ci)
+{
+    QuerySet *s = (QuerySet *)calloc(1, sizeof(QuerySet));
+    if (!s)
+        return NULL;
+    size_t cap = 4;
+    while (cap < (size_t)nitems * 2)
+        cap *= 2;
+    s->data = (char *)malloc(size ? size : 1);
+    s->slots = (SetSlot *)malloc(cap * sizeof(SetSlot));
+    if (!s->data || !s->slots)
+    {
+        set_free(s);
+        return NULL;
+    }
+    for (size_t i = 0; i < cap; i++)
+        s->slots[i].len = SIZE_MAX;
+    s->mask = cap - 1;
+    s->min_len = SIZE_MAX;
+
+    size_t used = 0;
+    for (const char *p = items; p < items + size; p += strlen(p) + 1)
+    {
+        size_t n = strlen(p);
+        char *dst = s->data + used;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = ci ? (char)fold((unsigned char)p[i]) : p[i];
+        uint64_t h = lf_hash64(dst, n);
+        size_t i = (size_t)h & s->mask;
+        for (; s->slots[i].len != SIZE_MAX; i = (i + 1) & s->mask)
+            if (s->slots[i].h == h && s->slots[i].len == n && memcmp(s->data + s->slots[i].off, dst, n) == 0)
+                break;
+        if (s->slots[i].len != SIZE_MAX)
+            continue; // duplicate
+        s->slots[i] = (SetSlot){h, used, n};
+        used += n;
+        if (n < s->min_len)
+            s->min_len = n;
+        if (n > s->max_len)
+            s->max_len = n;
+    }
+    return s;
+}
+
+static int text_match(const QueryMatch *m, const char *s, size_t n)
+{
+    switch (m->kind)
+    {
+    case QM_ANY:
+        return 1;
+    case QM_EXACT:
+        return n == m->lit_len && lit_eq(s, m->lit, n, m->ci);
+    case QM_PREFIX:
+        return n >= m->lit_len && lit_eq(s, m->lit, m->lit_len, m->ci);
+    case QM_SUFFIX:
+        return n >= m->lit_len && lit_eq(s + n - m->lit_len, m->lit, m->lit_len, m->ci);
+    case QM_CONTAINS:
+        return lit_find(s, n, m->lit, m->lit_len, m->ci) != NULL;
+    case QM_GLOB:
+        return glob_match(m->glob, s, n, m->ci);
+    case QM_REGEX:
+        return lfre_match(m->re, s, n);
+    case QM_SET:
+        return set_contains(m->set, s, n, m->ci);
+    case QM_CIDR:
+    {
+        unsigned char addr[16];
+        int v6;
+        return ip_parse(s, n, addr, &v6) && iptrie_contains(m->trie, addr, v6);
+    }
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Numeric glob on the status code, e.g. "5*" or "40?": a digit prefix,
+ * some '?' and an optional trailing '*'. Decimal strings have no leading
+ * zeros, so every matching length L is one integer range. Other shapes
+ * return 0 and are matched as text.
+ */
+static int compile_status_ranges(QueryMatch *m, const char *val)
+{
+    size_t d = 0, q = 0, n = strlen(val);
+    while (d < n && isdigit((unsigned char)val[d]))
+        d++;
+    while (d + q < n && val[d + q] == '?')
+        q++;
+    int star = d + q < n;
+    for (size_t i = d + q; i < n; i++)
+        if (val[i] != '*')
             return 0;
+    if (d + q == 0 || d > 10)
+        return 0;
+
+    long long prefix = 0;
+    for (size_t i = 0; i < d; i++)
+        prefix = prefix * 10 + (val[i] - '0');
+
+    m->ranges = (QueryRange *)calloc(11, sizeof(QueryRange));
+    if (!m->ranges)
+        return 0;
+    m->kind = QM_RANGES;
+    if (d > 0 && val[0] == '0')
+    {
+        // only "0" itself starts with a zero
+        if (d == 1 && q == 0)
+            m->ranges[m->nranges++] = (QueryRange){0, 0};
+        return 1;
+    }
+    long long scale = 1;
+    for (size_t i = 0; i < q; i++)
+        scale *= 10;
+    for (size_t len = d + q; len <= (star ? 10 : d + q) && len <= 10; len++)
+    {
+        QueryRange r;
+        if (d > 0)
+            r = (QueryRange){prefix * scale, (prefix + 1) * scale - 1};
+        else
+            r = (QueryRange){len == 1 ? 0 : scale / 10, scale - 1};
+        if (m->nranges > 0 && m->ranges[m->nranges - 1].hi + 1 == r.lo)
+            m->ranges[m->nranges - 1].hi = r.hi;
+        else
+            m->ranges[m->nranges++] = r;
+        scale *= 10;
     }
-    while (*pat == '*')
-        pat++;
-    return *pat == 0;
+    return 1;
+}
+
+static void match_free(QueryMatch *m)
+{
+    free(m->lit);
+    glob_free(m->glob);
+    free(m->ranges);
+    lfre_free(m->re);
+    set_free(m->set);
+    iptrie_free(m->trie);
+    memset(m, 0, sizeof(*m));
 }
 
 // parse ISO 8601 "YYYY-MM-DDTHH:MM:SS" (assume UTC)
@@ -121,170 +544,1048 @@ static int map_field(const char *name, QueryField *out)
         *out = QF_TIMESTAMP;
         return 1;
     }
-    if (str_eq_ci(name, "useragent"))
+    if (str_eq_ci(name, "useragent") || str_eq_ci(name, "user_agent"))
     {
         *out = QF_USERAGENT;
         return 1;
     }
+    if (str_eq_ci(name, "bytes"))
+    {
+        *out = QF_BYTES;
+        return 1;
+    }
+    if (str_eq_ci(name, "request_time") || str_eq_ci(name, "requesttime"))
+    {
+        *out = QF_REQUEST_TIME;
+        return 1;
+    }
     return 0;
 }
 
-// detect operator and split "field<op>value"
-static int split_token(char *tok, char *field, char *op, char *val)
+#define QUERY_OP_CHARS "!:=<>~"
+
+// detect operator and split "field<op>value"; the first operator character
+// ends the field name, so values (regexes especially) may contain any of them
+static int split_token(char *tok, char *field, size_t fieldsz, char *op, char *val, size_t valsz)
+{
+    size_t L = strcspn(tok, QUERY_OP_CHARS);
+    if (!tok[L] || L >= fieldsz)
+        return 0;
+    size_t olen = 1;
+    if ((tok[L] == '>' || tok[L] == '<' || tok[L] == '!') && tok[L + 1] == '=')
+        olen = 2;
+    if (strlen(tok + L + olen) >= valsz)
+        return 0;
+    memcpy(field, tok, L);
+    field[L] = 0;
+    memcpy(op, tok + L, olen);
+    op[olen] = 0;
+    strcpy(val, tok + L + olen);
+    return 1;
+}
+
+static int compile_term(QueryTerm *t, int ci, char *errmsg, size_t errmsg_sz)
 {
-    // try two-char ops first
-    const char *ops2[] = {">=", "<=", "!=", NULL};
-    for (int i = 0; ops2[i]; i++)
+    if (t->field == QF_BYTES || t->field == QF_REQUEST_TIME)
     {
-        char *p = strstr(tok, ops2[i]);
-        if (p)
-        {
-            strncpy(field, tok, p - tok);
-            field[p - tok] = 0;
-            strcpy(op, ops2[i]);
-            strcpy(val, p + 2);
-            return 1;
-        }
+        t->m.kind = QM_CMP;
+        return 1;
     }
-    // one-char ops
-    const char *ops1 = ":=><";
-    for (const char *q = tok; *q; q++)
+    if (t->op == QOP_REGEX)
     {
-        if (strchr(ops1, *q))
+        t->m.re = lfre_compile(t->value, t->field == QF_STATUS ? 0 : ci, errmsg, errmsg_sz);
+        t->m.kind = QM_REGEX;
+        t->m.ci = t->field == QF_STATUS ? 0 : ci;
+        return t->m.re != NULL;
+    }
+    if (t->field == QF_STATUS)
+    {
+        if (t->op != QOP_CONTAINS)
         {
-            size_t L = (size_t)(q - tok);
-            strncpy(field, tok, L);
-            field[L] = 0;
-            op[0] = *q;
-            op[1] = 0;
-            strcpy(val, q + 1);
+            t->m.kind = QM_CMP;
             return 1;
         }
+        if (compile_status_ranges(&t->m, t->value))
+            return 1;
+        match_free(&t->m);
+        if (compile_text(&t->m, t->value, 1))
+            return 1;
     }
+    else if (t->field == QF_TIMESTAMP && t->has_t)
+    {
+        t->m.kind = QM_CMP;
+        return 1;
+    }
+    else if (compile_text(&t->m, t->value, ci))
+        return 1;
+    snprintf(errmsg, errmsg_sz, "out of memory");
     return 0;
 }
 
-// tokenize by spaces, honoring quotes
-static int next_token(const char **p, char *buf, size_t bufsz)
+/*
+ * Rough per-line cost of a term: what it takes to reach the field (status
+ * is already an int, the User-Agent may still have to be located) plus what
+ * the matcher does with it. "!=" terms rarely reject, so they go last among
+ * otherwise equal terms.
+ */
+static int term_cost(const QueryTerm *t)
+{
+    static const int field_cost[] = {
+        [QF_STATUS] = 0, [QF_METHOD] = 1, [QF_IP] = 2,
+        [QF_TIMESTAMP] = 3, [QF_URL] = 4, [QF_BYTES] = 6, [QF_USERAGENT] = 8,
+        [QF_REQUEST_TIME] = 9};
+    int cost = field_cost[t->field] * 16;
+    switch (t->m.kind)
+    {
+    case QM_PREFIX:
+    case QM_SUFFIX:
+        cost += 1;
+        break;
+    case QM_CONTAINS:
+        cost += 4;
+        break;
+    case QM_GLOB:
+        cost += 8;
+        break;
+    case QM_REGEX:
+        cost += 12;
+        break;
+    case QM_SET:
+        cost += 2;
+        break;
+    case QM_CIDR:
+        cost += 3;
+        break;
+    default:
+        break;
+    }
+    if (t->m.ci && t->m.kind != QM_CMP && t->m.kind != QM_RANGES)
+        cost += 1;
+    if (t->op == QOP_NE)
+        cost += 2;
+    return cost;
+}
+
+/*
+ * Expression tokens. A word runs to the next unquoted space and loses its
+ * quotes. Until a word has an operator character, '(' and ')' end it, so
+ * "NOT(" and "IN(" split; in a term's value parentheses have to balance,
+ * so "url~(a|b)" keeps its group while "status=429)" gives up the ')'.
+ */
+enum
+{
+    TOK_ERROR = -1,
+    TOK_END,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_WORD
+};
+
+#define QUERY_MAX_DEPTH 64
+
+enum
+{
+    QN_TERM,
+    QN_NOT,
+    QN_AND,
+    QN_OR
+};
+
+// Expression tree node; operands of AND/OR are binary here, flattened on emit
+typedef struct
+{
+    int kind;
+    int term; // QN_TERM
+    int a, b; // operands
+} QNode;
+
+typedef struct
 {
-    const char *s = *p;
+    const char *p; // cursor into the expression
+    Query *q;
+    int ci;
+    char *err;
+    size_t errsz;
+    int depth;
+    char tok[2048]; // last word read by lex()
+    int quoted;     // it had quotes, so it is never a keyword
+    QNode *nodes;
+    int nnodes, nodecap;
+    int codecap;
+} QParser;
+
+static int qerror(QParser *ps, const char *msg, const char *arg)
+{
+    if (arg)
+        snprintf(ps->err, ps->errsz, "%s: %s", msg, arg);
+    else
+        snprintf(ps->err, ps->errsz, "%s", msg);
+    return -1;
+}
+
+static int lex(QParser *ps)
+{
+    const char *s = ps->p;
     while (*s && isspace((unsigned char)*s))
         s++;
+    ps->quoted = 0;
+    ps->tok[0] = 0;
     if (!*s)
     {
-        *p = s;
-        return 0;
+        ps->p = s;
+        return TOK_END;
+    }
+    if (*s == '(' || *s == ')')
+    {
+        ps->p = s + 1;
+        return *s == '(' ? TOK_LPAREN : TOK_RPAREN;
     }
 
-    char *o = buf;
-    size_t left = bufsz - 1;
-    int q = 0;
+    char *o = ps->tok, *end = ps->tok + sizeof(ps->tok) - 1;
+    int has_op = 0, depth = 0;
     char qc = 0;
-    for (; *s && left > 0; s++)
+    for (; *s; s++)
     {
-        if (!q && isspace((unsigned char)*s))
+        char c = *s;
+        if (qc)
+        {
+            if (c == qc)
+            {
+                qc = 0;
+                continue;
+            }
+        }
+        else if (c == '"' || c == '\'')
+        {
+            qc = c;
+            ps->quoted = 1;
+            continue;
+        }
+        else if (isspace((unsigned char)c))
             break;
-        if (!q && (*s == '"' || *s == '\''))
+        else if (c == '(')
         {
-            q = 1;
-            qc = *s;
+            if (!has_op)
+                break;
+            depth++;
         }
-        else if (q && *s == qc)
+        else if (c == ')')
         {
-            q = 0;
+            if (!has_op || depth == 0)
+                break;
+            depth--;
         }
-        else
+        else if (c == '\\' && has_op && s[1])
         {
-            *o++ = *s;
-            left--;
+            // an escaped parenthesis in a regex does not count
+            if (o + 1 >= end)
+                return qerror(ps, "token too long", NULL);
+            *o++ = c;
+            c = *++s;
         }
+        else if (strchr(QUERY_OP_CHARS, c))
+            has_op = 1;
+        if (o >= end)
+            return qerror(ps, "token too long", NULL);
+        *o++ = c;
     }
     *o = 0;
-    *p = s;
-    return 1;
+    ps->p = s;
+    return TOK_WORD;
 }
 
-// --- public: parse and match ---
+// Token type of what comes next, without consuming it
+static int peek(QParser *ps)
+{
+    const char *save = ps->p;
+    int t = lex(ps);
+    ps->p = save;
+    return t;
+}
 
-int query_parse(const char *expr, int case_insensitive, Query *out, char *errmsg, size_t errmsg_sz)
+static int is_keyword(const QParser *ps, int tok, const char *kw)
 {
-    memset(out, 0, sizeof(*out));
-    out->case_insensitive = case_insensitive;
+    return tok == TOK_WORD && !ps->quoted && str_eq_ci(ps->tok, kw);
+}
 
-    const char *p = expr;
-    char tok[2048];
-    while (next_token(&p, tok, sizeof(tok)))
+static int new_qnode(QParser *ps, int kind, int a, int b)
+{
+    if (ps->nnodes == ps->nodecap)
     {
-        if (out->count >= (int)(sizeof(out->terms) / sizeof(out->terms[0])))
-        {
-            snprintf(errmsg, errmsg_sz, "too many terms");
-            return 0;
-        }
-        char field[64], op[3], val[1024];
-        if (!split_token(tok, field, op, val))
-        {
-            snprintf(errmsg, errmsg_sz, "bad token: %s", tok);
-            return 0;
-        }
-        unquote(val);
+        int ncap = ps->nodecap ? ps->nodecap * 2 : 16;
+        QNode *nn = (QNode *)realloc(ps->nodes, (size_t)ncap * sizeof(QNode));
+        if (!nn)
+            return qerror(ps, "out of memory", NULL);
+        ps->nodes = nn;
+        ps->nodecap = ncap;
+    }
+    ps->nodes[ps->nnodes] = (QNode){kind, -1, a, b};
+    return ps->nnodes++;
+}
 
-        QueryTerm *t = &out->terms[out->count];
-        if (!map_field(field, &t->field))
+// Slot for the next term; it only counts once out->count is bumped
+static QueryTerm *new_term(QParser *ps)
+{
+    Query *out = ps->q;
+    if (out->count == out->cap)
+    {
+        int ncap = out->cap ? out->cap * 2 : 8;
+        QueryTerm *nt = (QueryTerm *)realloc(out->terms, (size_t)ncap * sizeof(QueryTerm));
+        if (!nt)
         {
-            snprintf(errmsg, errmsg_sz, "unknown field: %s", field);
-            return 0;
+            qerror(ps, "out of memory", NULL);
+            return NULL;
         }
+        out->terms = nt;
+        out->cap = ncap;
+    }
+    QueryTerm *t = &out->terms[out->count];
+    memset(t, 0, sizeof(*t));
+    return t;
+}
 
-        if (strcmp(op, ":") == 0)
-            t->op = QOP_CONTAINS; // string contains / wildcard; numeric == for status
-        else if (strcmp(op, "=") == 0)
-            t->op = QOP_EQ;
-        else if (strcmp(op, "!=") == 0)
-            t->op = QOP_NE;
-        else if (strcmp(op, ">") == 0)
-            t->op = QOP_GT;
-        else if (strcmp(op, "<") == 0)
-            t->op = QOP_LT;
-        else if (strcmp(op, ">=") == 0)
-            t->op = QOP_GTE;
-        else if (strcmp(op, "<=") == 0)
-            t->op = QOP_LTE;
-        else
-        {
-            snprintf(errmsg, errmsg_sz, "bad op: %s", op);
-            return 0;
-        }
+// Leaf node for a term that was just filled in at terms[count]
+static int term_node(QParser *ps, QueryTerm *t)
+{
+    t->cost = term_cost(t);
+    int n = new_qnode(ps, QN_TERM, -1, -1);
+    if (n < 0)
+    {
+        match_free(&t->m);
+        return -1;
+    }
+    ps->nodes[n].term = ps->q->count++;
+    return n;
+}
 
-        strncpy(t->value, val, sizeof(t->value) - 1);
+// field<op>value
+static int parse_term(QParser *ps)
+{
+    char field[64], op[3], val[1024];
+    if (!split_token(ps->tok, field, sizeof(field), op, val, sizeof(val)))
+        return qerror(ps, "bad token", ps->tok);
+    unquote(val);
 
-        // pre-parse numeric/time
-        if (t->field == QF_STATUS)
-        {
-            t->value_i = atoi(val);
-            t->has_i = 1;
-        }
-        else if (t->field == QF_TIMESTAMP)
+    QueryTerm *t = new_term(ps);
+    if (!t)
+        return -1;
+    if (!map_field(field, &t->field))
+        return qerror(ps, "unknown field", field);
+
+    if (strcmp(op, ":") == 0)
+        t->op = QOP_CONTAINS; // string contains / wildcard; numeric == for status
+    else if (strcmp(op, "=") == 0)
+        t->op = QOP_EQ;
+    else if (strcmp(op, "!=") == 0)
+        t->op = QOP_NE;
+    else if (strcmp(op, ">") == 0)
+        t->op = QOP_GT;
+    else if (strcmp(op, "<") == 0)
+        t->op = QOP_LT;
+    else if (strcmp(op, ">=") == 0)
+        t->op = QOP_GTE;
+    else if (strcmp(op, "<=") == 0)
+        t->op = QOP_LTE;
+    else if (strcmp(op, "~") == 0)
+        t->op = QOP_REGEX;
+    else
+        return qerror(ps, "bad op", op);
+
+    strncpy(t->value, val, sizeof(t->value) - 1);
+
+    // pre-parse numeric/time
+    if (t->field == QF_BYTES || t->field == QF_REQUEST_TIME)
+    {
+        char *endp;
+        if (t->op == QOP_REGEX)
+            return qerror(ps, "numeric field takes =, !=, <, <=, >, >=", field);
+        if (t->op == QOP_CONTAINS)
+            t->op = QOP_EQ;
+        t->value_d = strtod(val, &endp);
+        if (endp == val || *endp)
+            return qerror(ps, "expected a number", val);
+    }
+    else if (t->field == QF_STATUS)
+    {
+        t->value_i = atoi(val);
+        t->has_i = 1;
+    }
+    else if (t->field == QF_TIMESTAMP && t->op != QOP_REGEX)
+    {
+        time_t tt;
+        if (parse_iso_utc(val, &tt) || parse_apache_time(val, strlen(val), &tt))
         {
-            time_t tt;
-            if (parse_iso_utc(val, &tt))
-            {
-                t->value_t = tt;
-                t->has_t = 1;
-            }
-            // else leave as string; you could also support Apache format later
+            t->value_t = tt;
+            t->has_t = 1;
         }
-        out->count++;
+        // else leave as string and match it as a glob
     }
-    return 1;
+    if (!compile_term(t, ps->ci, ps->err, ps->errsz))
+    {
+        match_free(&t->m);
+        return -1;
+    }
+    return term_node(ps, t);
 }
 
-static int cmp_int(int a, QueryOp op, int b)
+// ip IN addr[/len] or ip IN @file: a single word instead of a list
+static int parse_in_addr(QParser *ps, QueryTerm *t)
 {
-    switch (op)
+    if (lex(ps) != TOK_WORD)
+        return qerror(ps, "expected ( after IN", NULL);
+    snprintf(t->value, sizeof(t->value), "%.*s", (int)sizeof(t->value) - 1, ps->tok);
+    t->m.trie = iptrie_new();
+    if (!t->m.trie)
+        return qerror(ps, "out of memory", NULL);
+    if (ps->tok[0] == '@')
     {
-    case QOP_EQ:
-        return a == b;
-    case QOP_NE:
+        if (!iptrie_load(t->m.trie, ps->tok + 1, ps->err, ps->errsz))
+        {
+            match_free(&t->m);
+            return -1;
+        }
+    }
+    else if (!iptrie_add(t->m.trie, ps->tok, strlen(ps->tok)))
+    {
+        match_free(&t->m);
+        return qerror(ps, "bad address", ps->tok);
+    }
+    t->op = QOP_IN;
+    t->m.kind = QM_CIDR;
+    if (!iptrie_build(t->m.trie))
+    {
+        match_free(&t->m);
+        return qerror(ps, "out of memory", NULL);
+    }
+    return term_node(ps, t);
+}
+
+// A trie for an ip IN list whose members are all addresses or CIDRs, else NULL
+static struct IpTrie *addr_list(const char *items, size_t size)
+{
+    struct IpTrie *trie = iptrie_new();
+    if (!trie)
+        return NULL;
+    for (const char *p = items; p < items + size; p += strlen(p) + 1)
+        if (!iptrie_add(trie, p, strlen(p)))
+        {
+            iptrie_free(trie);
+            return NULL;
+        }
+    if (!iptrie_build(trie))
+    {
+        iptrie_free(trie);
+        return NULL;
+    }
+    return trie;
+}
+
+/*
+ * field IN (v1, v2, ...): the '(' is next. Members are separated by commas
+ * and/or spaces and may be quoted. Status members are normalized to the
+ * decimal text the status is matched as ("0404" is "404"). For ip, a list
+ * of addresses and CIDRs becomes a trie (so ::1 and 0::1 are the same
+ * member), and a single addr[/len] or @file needs no parentheses.
+ */
+static int parse_in(QParser *ps, const char *field)
+{
+    QueryTerm *t = new_term(ps);
+    if (!t)
+        return -1;
+    if (!map_field(field, &t->field))
+        return qerror(ps, "unknown field", field);
+    if (t->field == QF_BYTES || t->field == QF_REQUEST_TIME)
+        return qerror(ps, "IN is not supported for numeric field", field);
+    if (t->field == QF_IP && peek(ps) == TOK_WORD)
+        return parse_in_addr(ps, t);
+    if (lex(ps) != TOK_LPAREN)
+        return qerror(ps, "expected ( after IN", NULL);
+
+    const char *s = ps->p, *list = s;
+    char *items = NULL;
+    size_t size = 0, cap = 0;
+    int nitems = 0;
+    for (;;)
+    {
+        while (*s && (isspace((unsigned char)*s) || *s == ','))
+            s++;
+        if (*s == ')')
+            break;
+        if (!*s)
+        {
+            free(items);
+            return qerror(ps, "missing ) after IN list", NULL);
+        }
+        char item[QUERY_SET_MAX_ITEM];
+        size_t len = 0;
+        char qc = 0;
+        for (; *s; s++)
+        {
+            if (qc)
+            {
+                if (*s == qc)
+                {
+                    qc = 0;
+                    continue;
+                }
+            }
+            else if (*s == '"' || *s == '\'')
+            {
+                qc = *s;
+                continue;
+            }
+            else if (isspace((unsigned char)*s) || *s == ',' || *s == ')')
+                break;
+            if (len + 1 >= sizeof(item))
+            {
+                free(items);
+                return qerror(ps, "IN value too long", NULL);
+            }
+            item[len++] = *s;
+        }
+        item[len] = '\0';
+        if (t->field == QF_STATUS && len > 0 && len <= 9 && strspn(item, "0123456789") == len)
+            len = fmt_int(item, atoi(item));
+
+        if (size + len + 1 > cap)
+        {
+            size_t ncap = cap ? cap * 2 : 256;
+            while (ncap < size + len + 1)
+                ncap *= 2;
+            char *ni = (char *)realloc(items, ncap);
+            if (!ni)
+            {
+                free(items);
+                return qerror(ps, "out of memory", NULL);
+            }
+            items = ni;
+            cap = ncap;
+        }
+        memcpy(items + size, item, len);
+        items[size + len] = '\0';
+        size += len + 1;
+        nitems++;
+    }
+    size_t vlen = (size_t)(s - list);
+    if (vlen >= sizeof(t->value))
+        vlen = sizeof(t->value) - 1;
+    memcpy(t->value, list, vlen);
+    ps->p = s + 1;
+
+    t->op = QOP_IN;
+    if (t->field == QF_IP && nitems > 0 && (t->m.trie = addr_list(items, size)) != NULL)
+    {
+        free(items);
+        t->m.kind = QM_CIDR;
+        return term_node(ps, t);
+    }
+    t->m.kind = QM_SET;
+    t->m.ci = t->field == QF_STATUS ? 0 : ps->ci;
+    t->m.set = set_build(items, size, nitems, t->m.ci);
+    free(items);
+    if (!t->m.set)
+        return qerror(ps, "out of memory", NULL);
+    return term_node(ps, t);
+}
+
+static int parse_or(QParser *ps);
+
+// NOT x | ( expr ) | term | field [NOT] IN (list)
+static int parse_unary(QParser *ps)
+{
+    int tok = lex(ps);
+    switch (tok)
+    {
+    case TOK_ERROR:
+        return -1;
+    case TOK_END:
+        return qerror(ps, "missing term at end of query", NULL);
+    case TOK_RPAREN:
+        return qerror(ps, "unexpected )", NULL);
+    case TOK_LPAREN:
+    {
+        if (++ps->depth > QUERY_MAX_DEPTH)
+            return qerror(ps, "query nested too deeply", NULL);
+        int n = parse_or(ps);
+        ps->depth--;
+        if (n < 0)
+            return -1;
+        if (lex(ps) != TOK_RPAREN)
+            return qerror(ps, "missing )", NULL);
+        return n;
+    }
+    default:
+        break;
+    }
+    if (is_keyword(ps, tok, "NOT"))
+    {
+        if (++ps->depth > QUERY_MAX_DEPTH)
+            return qerror(ps, "query nested too deeply", NULL);
+        int n = parse_unary(ps);
+        ps->depth--;
+        return n < 0 ? -1 : new_qnode(ps, QN_NOT, n, -1);
+    }
+    if (is_keyword(ps, tok, "AND") || is_keyword(ps, tok, "OR") || is_keyword(ps, tok, "IN"))
+        return qerror(ps, "unexpected", ps->tok);
+    if (ps->tok[strcspn(ps->tok, QUERY_OP_CHARS)])
+        return parse_term(ps);
+
+    // a bare field name: only IN lists take one
+    char field[64];
+    size_t flen = strlen(ps->tok);
+    if (flen >= sizeof(field))
+        return qerror(ps, "bad token", ps->tok);
+    memcpy(field, ps->tok, flen + 1);
+    int neg = 0;
+    tok = lex(ps);
+    if (is_keyword(ps, tok, "NOT"))
+    {
+        neg = 1;
+        tok = lex(ps);
+    }
+    if (!is_keyword(ps, tok, "IN"))
+        return qerror(ps, "bad token", field);
+    int n = parse_in(ps, field);
+    return n < 0 || !neg ? n : new_qnode(ps, QN_NOT, n, -1);
+}
+
+// Operands next to each other are ANDed; "AND" may also be written out
+static int parse_and(QParser *ps)
+{
+    int left = parse_unary(ps);
+    while (left >= 0)
+    {
+        int tok = peek(ps);
+        if (tok == TOK_END || tok == TOK_RPAREN || tok == TOK_ERROR || is_keyword(ps, tok, "OR"))
+            break;
+        if (is_keyword(ps, tok, "AND"))
+            lex(ps);
+        int right = parse_unary(ps);
+        if (right < 0)
+            return -1;
+        left = new_qnode(ps, QN_AND, left, right);
+    }
+    return left;
+}
+
+static int parse_or(QParser *ps)
+{
+    int left = parse_and(ps);
+    while (left >= 0 && is_keyword(ps, peek(ps), "OR"))
+    {
+        lex(ps);
+        int right = parse_and(ps);
+        if (right < 0)
+            return -1;
+        left = new_qnode(ps, QN_OR, left, right);
+    }
+    return left;
+}
+
+// Marks the terms every match must satisfy: leaves of the top-level AND chain
+static void mark_required(const QParser *ps, int n, char *req)
+{
+    const QNode *nd = &ps->nodes[n];
+    if (nd->kind == QN_TERM)
+        req[nd->term] = 1;
+    else if (nd->kind == QN_AND)
+    {
+        mark_required(ps, nd->a, req);
+        mark_required(ps, nd->b, req);
+    }
+}
+
+static int node_cost(const QParser *ps, int n)
+{
+    const QNode *nd = &ps->nodes[n];
+    switch (nd->kind)
+    {
+    case QN_TERM:
+        return ps->q->terms[nd->term].cost + 1;
+    case QN_NOT:
+        return node_cost(ps, nd->a);
+    default:
+        return node_cost(ps, nd->a) + node_cost(ps, nd->b);
+    }
+}
+
+// Operands of a chain of same-kind AND/OR nodes, left to right
+static void collect_operands(const QParser *ps, int n, int kind, int *ops, int *count)
+{
+    const QNode *nd = &ps->nodes[n];
+    if (nd->kind != kind)
+    {
+        if (ops)
+            ops[*count] = n;
+        (*count)++;
+        return;
+    }
+    collect_operands(ps, nd->a, kind, ops, count);
+    collect_operands(ps, nd->b, kind, ops, count);
+}
+
+static int emit_insn(QParser *ps, QueryInsnOp op, int arg)
+{
+    Query *q = ps->q;
+    if (q->ncode == ps->codecap)
+    {
+        int ncap = ps->codecap ? ps->codecap * 2 : 16;
+        QueryInsn *nc = (QueryInsn *)realloc(q->code, (size_t)ncap * sizeof(QueryInsn));
+        if (!nc)
+            return qerror(ps, "out of memory", NULL);
+        q->code = nc;
+        ps->codecap = ncap;
+    }
+    q->code[q->ncode].op = op;
+    q->code[q->ncode].arg = arg;
+    return q->ncode++;
+}
+
+/*
+ * AND/OR: operands run cheapest first, each followed by a jump to the end
+ * of the chain taken as soon as the result is decided (false for AND, true
+ * for OR). The jump leaves that result in the accumulator.
+ */
+static int emit_node(QParser *ps, int n)
+{
+    const QNode *nd = &ps->nodes[n];
+    if (nd->kind == QN_TERM)
+        return emit_insn(ps, QI_TERM, nd->term) < 0 ? -1 : 0;
+    if (nd->kind == QN_NOT)
+        return emit_node(ps, nd->a) < 0 || emit_insn(ps, QI_NOT, 0) < 0 ? -1 : 0;
+
+    int kind = nd->kind, count = 0;
+    collect_operands(ps, n, kind, NULL, &count);
+    int *ops = (int *)malloc((size_t)count * 2 * sizeof(int));
+    if (!ops)
+        return qerror(ps, "out of memory", NULL);
+    int *cost = ops + count, k = 0;
+    collect_operands(ps, n, kind, ops, &k);
+    for (int i = 0; i < count; i++)
+        cost[i] = node_cost(ps, ops[i]);
+    for (int i = 1; i < count; i++) // stable: equal costs keep written order
+    {
+        int o = ops[i], c = cost[i], j = i;
+        for (; j > 0 && cost[j - 1] > c; j--)
+        {
+            ops[j] = ops[j - 1];
+            cost[j] = cost[j - 1];
+        }
+        ops[j] = o;
+        cost[j] = c;
+    }
+
+    int rc = 0, first_jump = ps->q->ncode;
+    for (int i = 0; i < count && rc == 0; i++)
+    {
+        rc = emit_node(ps, ops[i]);
+        if (rc == 0 && i + 1 < count && emit_insn(ps, kind == QN_AND ? QI_JF : QI_JT, -1) < 0)
+            rc = -1;
+    }
+    free(ops);
+    if (rc < 0)
+        return -1;
+    // operand code never jumps to -1, so the unpatched jumps are this chain's
+    for (int pc = first_jump; pc < ps->q->ncode; pc++)
+        if ((ps->q->code[pc].op == QI_JF || ps->q->code[pc].op == QI_JT) && ps->q->code[pc].arg == -1)
+            ps->q->code[pc].arg = ps->q->ncode;
+    return 0;
+}
+
+// Longest run of a glob's segments that has no '?' in it
+static size_t glob_literal(const QueryGlob *g, const char **lit)
+{
+    size_t best = 0;
+    for (int i = 0; i < g->nsegs; i++)
+    {
+        const char *p = g->segs[i].p, *end = p + g->segs[i].len;
+        while (p < end)
+        {
+            const char *q = (const char *)memchr(p, '?', (size_t)(end - p));
+            size_t n = (size_t)((q ? q : end) - p);
+            if (n > best)
+            {
+                best = n;
+                *lit = p;
+            }
+            p += n + 1;
+        }
+    }
+    return best;
+}
+
+// Literal a line must contain for t to match, into buf (NUL-terminated); 0 if there is none
+static size_t term_literal(const QueryTerm *t, char *buf, size_t bufsz, int *ci)
+{
+    const char *lit = NULL;
+    size_t n = 0;
+    char num[16], rebuf[256];
+
+    *ci = 0;
+    if (t->op == QOP_NE)
+        return 0;
+    if (t->field == QF_STATUS)
+    {
+        long long v;
+        if (t->m.kind == QM_CMP && t->op == QOP_EQ)
+            v = t->value_i;
+        else if (t->m.kind == QM_RANGES && t->m.nranges == 1 && t->m.ranges[0].lo == t->m.ranges[0].hi)
+            v = t->m.ranges[0].lo;
+        else
+            return 0;
+        if (v < 0)
+            return 0; // "-05" parses as -5 but does not contain "-5"
+        n = fmt_int(num, (int)v);
+        lit = num;
+    }
+    else if (t->m.kind == QM_GLOB)
+        n = glob_literal(t->m.glob, &lit);
+    else if (t->m.kind == QM_REGEX)
+    {
+        int rci;
+        n = lfre_required_literal(t->m.re, rebuf, sizeof(rebuf), &rci);
+        lit = rebuf;
+    }
+    else if (t->m.lit)
+    {
+        lit = t->m.lit;
+        n = t->m.lit_len;
+    }
+    if (n >= bufsz)
+        n = bufsz - 1;
+    if (n)
+        memcpy(buf, lit, n);
+    buf[n] = '\0';
+    *ci = n && t->field != QF_STATUS && t->m.ci;
+    return n;
+}
+
+// Candidate literal set: terms whose literals cover every match
+typedef struct
+{
+    int n; // -1: no set
+    int terms[QUERY_MAX_LITERALS];
+    size_t min_len; // shortest literal, which decides how many lines get through
+    int cs;         // all literals are case-sensitive
+} LitSet;
+
+// Longer shortest literal first, then fewer literals, then case-sensitive ones
+static int litset_better(const LitSet *a, const LitSet *b)
+{
+    if (a->n < 0 || b->n < 0)
+        return a->n >= 0;
+    if (a->min_len != b->min_len)
+        return a->min_len > b->min_len;
+    if (a->n != b->n)
+        return a->n < b->n;
+    return a->cs && !b->cs;
+}
+
+static LitSet pick_literals(const QParser *ps, int n)
+{
+    const QNode *nd = &ps->nodes[n];
+    LitSet r, a, b;
+    r.n = -1;
+    switch (nd->kind)
+    {
+    case QN_TERM:
+    {
+        char buf[256];
+        int ci;
+        size_t len = term_literal(&ps->q->terms[nd->term], buf, sizeof(buf), &ci);
+        if (len)
+        {
+            r.n = 1;
+            r.terms[0] = nd->term;
+            r.min_len = len;
+            r.cs = !ci;
+        }
+        return r;
+    }
+    case QN_AND:
+        a = pick_literals(ps, nd->a);
+        b = pick_literals(ps, nd->b);
+        return litset_better(&b, &a) ? b : a;
+    case QN_OR:
+        a = pick_literals(ps, nd->a);
+        b = pick_literals(ps, nd->b);
+        if (a.n < 0 || b.n < 0 || a.n + b.n > QUERY_MAX_LITERALS)
+            return r; // a branch that needs no literal lets any line through
+        memcpy(a.terms + a.n, b.terms, (size_t)b.n * sizeof(int));
+        a.n += b.n;
+        a.min_len = a.min_len < b.min_len ? a.min_len : b.min_len;
+        a.cs = a.cs && b.cs;
+        return a;
+    default:
+        return r; // NOT
+    }
+}
+
+/*
+ * Moves the required terms to the front of terms[] (cheapest first, for
+ * query_time_bounds() and the index), picks the prefilter literals and
+ * compiles the tree.
+ */
+static int finish_query(QParser *ps, int root)
+{
+    Query *q = ps->q;
+    if (root < 0)
+        return 0; // empty query: no code, matches everything
+    int n = q->count;
+    char *req = (char *)calloc((size_t)n, 1);
+    int *order = (int *)malloc((size_t)n * 2 * sizeof(int));
+    QueryTerm *terms = (QueryTerm *)malloc((size_t)n * sizeof(QueryTerm));
+    if (!req || !order || !terms)
+    {
+        free(req);
+        free(order);
+        free(terms);
+        return qerror(ps, "out of memory", NULL);
+    }
+    int *pos = order + n, k = 0;
+    mark_required(ps, root, req);
+    for (int i = 0; i < n; i++)
+        if (req[i])
+        {
+            int j = k++;
+            for (; j > 0 && q->terms[order[j - 1]].cost > q->terms[i].cost; j--)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+    q->nand = k;
+    for (int i = 0; i < n; i++)
+        if (!req[i])
+            order[k++] = i;
+    for (int i = 0; i < n; i++)
+    {
+        terms[i] = q->terms[order[i]];
+        pos[order[i]] = i;
+    }
+    memcpy(q->terms, terms, (size_t)n * sizeof(QueryTerm));
+    for (int i = 0; i < ps->nnodes; i++)
+        if (ps->nodes[i].kind == QN_TERM)
+            ps->nodes[i].term = pos[ps->nodes[i].term];
+    free(req);
+    free(order);
+    free(terms);
+    LitSet lits = pick_literals(ps, root);
+    if (lits.n > 0)
+    {
+        memcpy(q->lits, lits.terms, (size_t)lits.n * sizeof(int));
+        q->nlits = lits.n;
+    }
+    return emit_node(ps, root);
+}
+
+// --- public: parse and match ---
+
+/**
+ * @brief Parses a query expression.
+ *
+ * Terms are field<op>value with op one of : = != > < >= <= ~, or
+ * field [NOT] IN (v1,v2,...), or ip [NOT] IN addr[/len] | @file. They combine with AND (also implied by
+ * juxtaposition), OR and NOT (case-insensitive keywords) and parentheses;
+ * NOT binds tightest, then AND, then OR.
+ *
+ * @return 1 on success; 0 with a message in errmsg otherwise.
+ */
+int query_parse(const char *expr, int case_insensitive, Query *out, char *errmsg, size_t errmsg_sz)
+{
+    memset(out, 0, sizeof(*out));
+    out->case_insensitive = case_insensitive;
+
+    QParser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = expr;
+    ps.q = out;
+    ps.ci = case_insensitive;
+    ps.err = errmsg;
+    ps.errsz = errmsg_sz;
+
+    int root = -1, rc = 0;
+    int tok = peek(&ps);
+    if (tok == TOK_ERROR)
+        rc = -1;
+    else if (tok != TOK_END)
+    {
+        root = parse_or(&ps);
+        if (root < 0)
+            rc = -1;
+        else if ((tok = lex(&ps)) != TOK_END)
+            rc = tok == TOK_ERROR ? -1 : qerror(&ps, "unexpected )", NULL);
+    }
+    if (rc == 0)
+        rc = finish_query(&ps, root);
+    free(ps.nodes);
+    if (rc < 0)
+    {
+        query_free(out);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Releases the compiled matchers, program and term array of a parsed query.
+ */
+void query_free(Query *q)
+{
+    for (int i = 0; i < q->count; i++)
+        match_free(&q->terms[i].m);
+    free(q->terms);
+    free(q->code);
+    q->terms = NULL;
+    q->code = NULL;
+    q->count = q->cap = q->nand = q->ncode = q->nlits = 0;
+}
+
+static int cmp_int(int a, QueryOp op, int b)
+{
+    switch (op)
+    {
+    case QOP_EQ:
+        return a == b;
+    case QOP_NE:
+        return a != b;
+    case QOP_GT:
+        return a > b;
+    case QOP_LT:
+        return a < b;
+    case QOP_GTE:
+        return a >= b;
+    case QOP_LTE:
+        return a <= b;
+    default:
+        return 0;
+    }
+}
+static int cmp_num(double a, QueryOp op, double b)
+{
+    switch (op)
+    {
+    case QOP_EQ:
+        return a == b;
+    case QOP_NE:
+        return a != b;
+    case QOP_GT:
+        return a > b;
+    case QOP_LT:
+        return a < b;
+    case QOP_GTE:
+        return a >= b;
+    case QOP_LTE:
+        return a <= b;
+    default:
+        return 0;
+    }
+}
+static int cmp_time(time_t a, QueryOp op, time_t b)
+{
+    switch (op)
+    {
+    case QOP_EQ:
+        return a == b;
+    case QOP_NE:
         return a != b;
     case QOP_GT:
         return a > b;
@@ -298,105 +1599,236 @@ static int cmp_int(int a, QueryOp op, int b)
         return 0;
     }
 }
-static int cmp_time(time_t a, QueryOp op, time_t b) { return cmp_int((int)a, op, (int)b); }
 
-int query_match(const LogEntry *e, const Query *q)
+/**
+ * @brief Derives the time window implied by the query's timestamp terms.
+ *
+ * Only top-level AND terms are considered: each must hold, so the window
+ * is the intersection of their timestamp comparisons. Lines outside
+ * [*lo, *hi] can never match.
+ *
+ * @return 1 if at least one bound was found, 0 if the query is unbounded in time.
+ */
+int query_time_bounds(const Query *q, time_t *lo, time_t *hi)
 {
-    for (int i = 0; i < q->count; i++)
+    int found = 0;
+    time_t l = (time_t)LLONG_MIN, h = (time_t)LLONG_MAX;
+    for (int i = 0; i < q->nand; i++)
     {
         const QueryTerm *t = &q->terms[i];
-        int ok = 0;
-        switch (t->field)
-        {
-        case QF_STATUS:
+        if (t->field != QF_TIMESTAMP || !t->has_t)
+            continue;
+        time_t v = t->value_t;
+        switch (t->op)
         {
-            if (t->op == QOP_CONTAINS || !t->has_i)
-            { // treat as string contains on decimal
-                char buf[16];
-                snprintf(buf, sizeof(buf), "%d", e->status);
-                ok = wildcard_match(buf, t->value, 1);
-            }
-            else
-            {
-                ok = cmp_int(e->status, t->op, t->value_i);
-            }
+        case QOP_EQ:
+            l = v > l ? v : l;
+            h = v < h ? v : h;
+            break;
+        case QOP_GT:
+            l = v + 1 > l ? v + 1 : l;
+            break;
+        case QOP_GTE:
+            l = v > l ? v : l;
+            break;
+        case QOP_LT:
+            h = v - 1 < h ? v - 1 : h;
+            break;
+        case QOP_LTE:
+            h = v < h ? v : h;
+            break;
+        default:
+            continue;
         }
-        break;
-        case QF_TIMESTAMP:
+        found = 1;
+    }
+    *lo = l;
+    *hi = h;
+    return found;
+}
+
+/**
+ * @brief Literals of which every line matching the query contains at least one.
+ *
+ * Field values are slices of the raw line, so a literal a term requires in
+ * its field is also required in the line. For an AND the better of its
+ * operands' sets is used; an OR whose branches all require literals gives
+ * the union of their sets (up to QUERY_MAX_LITERALS); NOT gives none. The
+ * set is chosen when the query is parsed; see pick_literals(). "!=" terms,
+ * IN lists and time comparisons have no literal. Case-insensitive literals
+ * are returned lowercased, truncated literals are still required.
+ *
+ * @param out  Receives up to QUERY_MAX_LITERALS literals.
+ * @return     How many were stored; 0 if the query requires none.
+ */
+int query_required_literals(const Query *q, QueryLiteral *out)
+{
+    for (int i = 0; i < q->nlits; i++)
+        out[i].len = term_literal(&q->terms[q->lits[i]], out[i].s, sizeof(out[i].s), &out[i].ci);
+    return q->nlits;
+}
+
+// LF_BIT() mask of the entry fields a query reads
+unsigned query_fields(const Query *q)
+{
+    unsigned mask = 0;
+    for (int i = 0; i < q->count; i++)
+    {
+        switch (q->terms[i].field)
         {
-            if (t->has_t)
-                ok = cmp_time(e->epoch, t->op, t->value_t);
-            else
-                ok = wildcard_match(e->timestamp, t->value, q->case_insensitive);
-        }
-        break;
+        case QF_STATUS:
+            mask |= LF_BIT(LF_STATUS);
+            break;
         case QF_IP:
-            ok = wildcard_match(e->ip, t->value, q->case_insensitive);
+            mask |= LF_BIT(LF_IP);
             break;
         case QF_METHOD:
-            ok = wildcard_match(e->method, t->value, q->case_insensitive);
+            mask |= LF_BIT(LF_METHOD);
             break;
         case QF_URL:
-            ok = wildcard_match(e->url, t->value, q->case_insensitive);
+            mask |= LF_BIT(LF_URL);
+            break;
+        case QF_TIMESTAMP:
+            mask |= LF_BIT(LF_TIMESTAMP);
             break;
         case QF_USERAGENT:
-            ok = wildcard_match(e->userAgent, t->value, q->case_insensitive);
+            mask |= LF_BIT(LF_USERAGENT);
+            break;
+        case QF_BYTES:
+            mask |= LF_BIT(LF_BYTES);
+            break;
+        case QF_REQUEST_TIME:
+            mask |= LF_BIT(LF_REQUEST_TIME);
             break;
         }
-        if (!ok)
-            return 0; // AND semantics
     }
-    return 1;
+    return mask;
 }
 
-// Case-insensitive substring search (portable)
-static int contains_ci(const char *hay, const char *needle)
+/**
+ * @brief Applies a status term to a status code.
+ *
+ * Also used by the sidecar index to test the codes recorded for a block.
+ */
+int query_status_match(const QueryTerm *t, int status)
 {
-    if (!hay || !needle)
+    switch (t->m.kind)
+    {
+    case QM_CMP:
+        return cmp_int(status, t->op, t->value_i);
+    case QM_RANGES:
+        for (int i = 0; i < t->m.nranges; i++)
+            if (status >= t->m.ranges[i].lo && status <= t->m.ranges[i].hi)
+                return 1;
         return 0;
-    size_t hn = strlen(hay), nn = strlen(needle);
-    if (nn == 0)
-        return 1;
-    for (size_t i = 0; i + nn <= hn; i++)
+    default:
     {
-        size_t j = 0;
-        while (j < nn)
-        {
-            unsigned char a = (unsigned char)hay[i + j];
-            unsigned char b = (unsigned char)needle[j];
-            if (a >= 'A' && a <= 'Z')
-                a = (unsigned char)(a + 32);
-            if (b >= 'A' && b <= 'Z')
-                b = (unsigned char)(b + 32);
-            if (a != b)
-                break;
-            j++;
-        }
-        if (j == nn)
-            return 1;
+        // pattern that has no range form: match the decimal text
+        char buf[16];
+        return text_match(&t->m, buf, fmt_int(buf, status));
+    }
     }
-    return 0;
 }
 
-int matches(const LogEntry *e, const char *needle, int case_insensitive)
+/**
+ * @brief Applies a string term's compiled pattern to arbitrary text.
+ *
+ * Ignores the operator, so "!=" terms report whether the pattern matches.
+ */
+int query_text_match(const QueryTerm *t, const char *s, size_t n)
 {
-    if (!needle || needle[0] == '\0')
-        return 1; // no filter -> match all
+    return text_match(&t->m, s, n);
+}
 
-    if (case_insensitive)
+// String terms: ':' and '=' match the pattern, "!=" its negation
+static int term_text(const QueryTerm *t, LogSlice v)
+{
+    int ok = text_match(&t->m, v.p, v.len);
+    return t->op == QOP_NE ? !ok : ok;
+}
+
+static int term_match(LogEntry *e, const QueryTerm *t)
+{
+    switch (t->field)
     {
-        return contains_ci(e->method, needle) ||
-               contains_ci(e->url, needle) ||
-               contains_ci(e->userAgent, needle) ||
-               contains_ci(e->timestamp, needle) ||
-               contains_ci(e->ip, needle);
+    case QF_STATUS:
+        return query_status_match(t, e->status);
+    case QF_TIMESTAMP:
+    {
+        time_t ep;
+        if (t->has_t)
+            return logentry_epoch(e, &ep) && cmp_time(ep, t->op, t->value_t);
+        return term_text(t, e->timestamp);
     }
-    else
+    case QF_IP:
+        if (t->m.kind == QM_CIDR) // parsed once per entry, however many tries ask
+            return logentry_addr(e) && iptrie_contains(t->m.trie, e->addr, e->addr_v6);
+        return term_text(t, e->ip);
+    case QF_METHOD:
+        return term_text(t, e->method);
+    case QF_URL:
+        return term_text(t, e->url);
+    case QF_USERAGENT:
+        return term_text(t, logentry_field(e, LF_USERAGENT));
+    case QF_BYTES:
+        logentry_load(e, LF_BIT(LF_BYTES));
+        return cmp_num((double)e->bytes, t->op, t->value_d);
+    case QF_REQUEST_TIME:
+        logentry_load(e, LF_BIT(LF_REQUEST_TIME));
+        return e->request_time >= 0 && cmp_num(e->request_time, t->op, t->value_d);
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs the compiled expression against an entry.
+ *
+ * Jumps skip the rest of an AND/OR chain once its result is known, so
+ * terms that cannot change the outcome are never evaluated.
+ */
+int query_match(LogEntry *e, const Query *q)
+{
+    int acc = 1;
+    for (int pc = 0; pc < q->ncode;)
     {
-        return (e->method && strstr(e->method, needle)) ||
-               (e->url && strstr(e->url, needle)) ||
-               (e->userAgent && strstr(e->userAgent, needle)) ||
-               (e->timestamp && strstr(e->timestamp, needle)) ||
-               (e->ip && strstr(e->ip, needle));
+        const QueryInsn *in = &q->code[pc++];
+        switch (in->op)
+        {
+        case QI_TERM:
+            acc = term_match(e, &q->terms[in->arg]);
+            break;
+        case QI_NOT:
+            acc = !acc;
+            break;
+        case QI_JF:
+            if (!acc)
+                pc = in->arg;
+            break;
+        case QI_JT:
+            if (acc)
+                pc = in->arg;
+            break;
+        }
     }
-}
\ No newline at end of file
+    return acc;
+}
+
+// Substring search over a slice, optionally ASCII case-insensitive
+static int slice_contains(LogSlice hay, const char *needle, size_t nn, int ci)
+{
+    return lit_find(hay.p, hay.len, needle, nn, ci) != NULL;
+}
+
+int matches(LogEntry *e, const char *needle, int case_insensitive)
+{
+    if (!needle || needle[0] == '\0')
+        return 1; // no filter -> match all
+
+    // User-Agent last: it is the only field that may need locating first
+    size_t nn = strlen(needle);
+    return slice_contains(e->method, needle, nn, case_insensitive) ||
+           slice_contains(e->url, needle, nn, case_insensitive) ||
+           slice_contains(e->timestamp, needle, nn, case_insensitive) ||
+           slice_contains(e->ip, needle, nn, case_insensitive) ||
+           slice_contains(logentry_field(e, LF_USERAGENT), needle, nn, case_insensitive);
+}
@@ -0,0 +1,254 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <string.h>
+#include "strsearch.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LF_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static inline unsigned char fold(unsigned char c)
+{
+    return (unsigned char)(c + (((unsigned)(c - 'A') < 26u) << 5));
+}
+
+static inline int is_alpha(unsigned char c)
+{
+    return (unsigned)(fold(c) - 'a') < 26u;
+}
+
+// Compares m bytes, folding both sides when ci
+static inline int equal_at(const char *a, const char *b, size_t m, int ci)
+{
+    if (!ci)
+        return memcmp(a, b, m) == 0;
+    for (size_t i = 0; i < m; i++)
+        if (fold((unsigned char)a[i]) != fold((unsigned char)b[i]))
+            return 0;
+    return 1;
+}
+
+// Candidate at hay[i] whose first and last bytes already matched
+static inline int verify(const char *h, const char *needle, size_t m, int ci)
+{
+    return m <= 2 || equal_at(h + 1, needle + 1, m - 2, ci);
+}
+
+static const char *search_scalar(const char *hay, size_t n, const char *needle, size_t m, int ci)
+{
+    if (n < m)
+        return NULL;
+    const char *last = hay + (n - m);
+    unsigned char first = (unsigned char)needle[0], tail = (unsigned char)needle[m - 1];
+
+    if (!ci)
+    {
+        for (const char *p = hay; p <= last; p++)
+        {
+            p = (const char *)memchr(p, first, (size_t)(last - p) + 1);
+            if (!p)
+                return NULL;
+            if ((unsigned char)p[m - 1] == tail && verify(p, needle, m, 0))
+                return p;
+        }
+        return NULL;
+    }
+    first = fold(first);
+    tail = fold(tail);
+    for (const char *p = hay; p <= last; p++)
+        if (fold((unsigned char)*p) == first && fold((unsigned char)p[m - 1]) == tail &&
+            verify(p, needle, m, 1))
+            return p;
+    return NULL;
+}
+
+#ifdef LF_X86_SIMD
+/*
+ * For a letter, (byte | 0x20) == lowercase letter holds exactly for its two
+ * cases, so one OR and one compare handle case-insensitive bytes. Non-letters
+ * are compared as they are (OR mask 0).
+ */
+__attribute__((target("sse2"))) static unsigned
+candidates_sse2(const char *p, size_t m, __m128i first, __m128i last, __m128i or0, __m128i or1)
+{
+    __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)p), or0);
+    __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + m - 1)), or1);
+    return (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+}
+
+__attribute__((target("sse2"))) static const char *
+search_sse2(const char *hay, size_t n, const char *needle, size_t m, int ci)
+{
+    unsigned char c0 = (unsigned char)needle[0], c1 = (unsigned char)needle[m - 1];
+    char o0 = (char)(ci && is_alpha(c0) ? 0x20 : 0), o1 = (char)(ci && is_alpha(c1) ? 0x20 : 0);
+    if (ci)
+    {
+        c0 = fold(c0);
+        c1 = fold(c1);
+    }
+    const __m128i first = _mm_set1_epi8((char)c0), last = _mm_set1_epi8((char)c1);
+    const __m128i or0 = _mm_set1_epi8(o0), or1 = _mm_set1_epi8(o1);
+    size_t npos = n - m + 1; // candidate start positions
+
+    if (npos < 16)
+        return search_scalar(hay, n, needle, m, ci);
+    for (size_t i = 0;; i += 16)
+    {
+        unsigned mask;
+        if (i + 16 > npos)
+        {
+            if (i >= npos)
+                return NULL;
+            // last, overlapping window: drop the positions already checked
+            size_t j = npos - 16;
+            mask = candidates_sse2(hay + j, m, first, last, or0, or1) & ~((1u << (i - j)) - 1u);
+            i = j;
+        }
+        else
+            mask = candidates_sse2(hay + i, m, first, last, or0, or1);
+        while (mask)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (verify(hay + i + bit, needle, m, ci))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+        if (i + 16 >= npos)
+            return NULL;
+    }
+}
+
+__attribute__((target("avx2"))) static unsigned
+candidates_avx2(const char *p, size_t m, __m256i first, __m256i last, __m256i or0, __m256i or1)
+{
+    __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)p), or0);
+    __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(p + m - 1)), or1);
+    return (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+}
+
+// Same scheme as search_sse2() with 32 positions per step; needs n - m + 1 >= 32
+__attribute__((target("avx2"))) static const char *
+search_avx2(const char *hay, size_t n, const char *needle, size_t m, int ci)
+{
+    unsigned char c0 = (unsigned char)needle[0], c1 = (unsigned char)needle[m - 1];
+    char o0 = (char)(ci && is_alpha(c0) ? 0x20 : 0), o1 = (char)(ci && is_alpha(c1) ? 0x20 : 0);
+    if (ci)
+    {
+        c0 = fold(c0);
+        c1 = fold(c1);
+    }
+    const __m256i first = _mm256_set1_epi8((char)c0), last = _mm256_set1_epi8((char)c1);
+    const __m256i or0 = _mm256_set1_epi8(o0), or1 = _mm256_set1_epi8(o1);
+    size_t npos = n - m + 1;
+
+    for (size_t i = 0;; i += 32)
+    {
+        unsigned mask;
+        if (i + 32 > npos)
+        {
+            if (i >= npos)
+                return NULL;
+            size_t j = npos - 32;
+            mask = candidates_avx2(hay + j, m, first, last, or0, or1) & ~((1u << (i - j)) - 1u);
+            i = j;
+        }
+        else
+            mask = candidates_avx2(hay + i, m, first, last, or0, or1);
+        while (mask)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (verify(hay + i + bit, needle, m, ci))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+        if (i + 32 >= npos)
+            return NULL;
+    }
+}
+#endif
+
+/**
+ * @brief Returns the best search kernel this CPU supports.
+ *
+ * Detected once via CPUID (__builtin_cpu_supports); the result is cached.
+ */
+LfSimdLevel lf_simd_level(void)
+{
+    static int level = -1; // racing initializers all store the same value
+    if (level < 0)
+    {
+#ifdef LF_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = LF_SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            level = LF_SIMD_SSE2;
+        else
+            level = LF_SIMD_SCALAR;
+#else
+        level = LF_SIMD_SCALAR;
+#endif
+    }
+    return (LfSimdLevel)level;
+}
+
+const char *lf_simd_name(LfSimdLevel level)
+{
+    switch (level)
+    {
+    case LF_SIMD_AVX2:
+        return "avx2";
+    case LF_SIMD_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+/**
+ * @brief Finds a needle using a specific kernel (for benchmarks and tests).
+ *
+ * Levels the build or the CPU cannot run fall back to the scalar kernel.
+ *
+ * @return Pointer to the first occurrence in hay, or NULL. An empty needle
+ *         matches at hay.
+ */
+const char *lf_memmem_at(LfSimdLevel level, int ci, const char *hay, size_t n,
+                         const char *needle, size_t m)
+{
+    if (m == 0)
+        return hay;
+    if (n < m)
+        return NULL;
+#ifdef LF_X86_SIMD
+    if (level > lf_simd_level())
+        level = lf_simd_level();
+    if (level == LF_SIMD_AVX2 && n - m >= 64) // short strings: the 16-byte kernel wins
+        return search_avx2(hay, n, needle, m, ci);
+    if (level >= LF_SIMD_SSE2)
+        return search_sse2(hay, n, needle, m, ci);
+#else
+    (void)level;
+#endif
+    return search_scalar(hay, n, needle, m, ci);
+}
+
+/**
+ * @brief Case-sensitive substring search.
+ */
+const char *lf_memmem(const char *hay, size_t n, const char *needle, size_t m)
+{
+    return lf_memmem_at(lf_simd_level(), 0, hay, n, needle, m);
+}
+
+/**
+ * @brief ASCII case-insensitive substring search. The needle may be in any case.
+ */
+const char *lf_memmem_ci(const char *hay, size_t n, const char *needle, size_t m)
+{
+    return lf_memmem_at(lf_simd_level(), 1, hay, n, needle, m);
+}
@@ -2,172 +2,918 @@
  * SPDX-License-Identifier: AGPL-3.0-or-later
  */
 #define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <time.h>
 #ifdef _WIN32
 #include <windows.h>
 static void msleep(int ms) { Sleep(ms); }
 #else
+#include <dirent.h>
+#include <fnmatch.h>
+#include <glob.h>
 #include <unistd.h>
 static void msleep(int ms) { usleep(ms * 1000); }
 #endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#endif
 
+#include "agg.h"
 #include "cli.h"
+#include "hash.h"
 #include "logstore.h"
-#include "query.h"
-#include "parser.h"
-#include "formatter.h"
+#include "logfire.h"
+#include "pipeline.h"
+#include "tail.h"
+
+#define TAIL_READ (64u << 10)   // bytes per read(); also the line buffer a file starts with
+#define TAIL_POLL_MS 200        // without inotify: how often the files are checked
+#define TAIL_CHECKPOINT_SEC 5   // --state-file is rewritten this often while lines come in
+#define TAIL_FP_LEN 1024        // leading bytes hashed to recognise a file again
+#define TAIL_STATE_MAGIC "logfire-state 1"
+
+/*
+ * Follows any number of files, given as paths or glob patterns.
+ *
+ * With inotify, each followed file is watched for writes, renames and
+ * unlinks, and the directory of each pattern for files created or renamed
+ * into place. An epoll loop waits for those events (or the next aggregate
+ * snapshot), so appended lines are read as soon as they are written:
+ *
+ *   - a name that matches a pattern and is new is followed from its start;
+ *   - a new file at a followed path (rotation) takes over once the old one
+ *     has been read to its end; a renamed-away file is still read until
+ *     then, since writers keep appending to it for a while;
+ *   - a file that shrinks (copytruncate) is read again from the start.
+ *
+ * Without inotify (or if the event queue overflows) the same checks run
+ * on every file by stat(), every TAIL_POLL_MS.
+ *
+ * With --state-file, the offset up to which each file has been processed
+ * is checkpointed with the file's device, inode and a hash of its first
+ * bytes, together with the running aggregate. Checkpoints are written
+ * every TAIL_CHECKPOINT_SEC while lines come in and on SIGINT/SIGTERM,
+ * after the output they cover has been flushed, and replace the previous
+ * one atomically. On restart each file resumes at its offset; a file that
+ * was rotated meanwhile is looked up by inode in its directory and read to
+ * its end before its successor is read from the start. The file is text:
+ *
+ *   logfire-state 1
+ *   file <dev> <inode> <offset> <fingerprint bytes> <fingerprint> <path>
+ *   agg <size>
+ *
+ * with one "file" line per followed file, and the "agg" line (only when
+ * aggregating) followed by <size> bytes written by agg_save().
+ */
+
+typedef struct
+{
+    char *path;
+    int fd; // -1 while the path is missing
+    dev_t dev;
+    ino_t ino;
+    off_t pos;   // bytes read from fd
+    int wd;      // inotify watch on the open file, or -1
+    int dirty;   // written to since it was last read
+    char *buf;   // unfinished last line
+    size_t len, cap;
+} TailFile;
+
+typedef struct
+{
+    char *pattern; // as given
+    char *prefix;  // directory part as given ("" or ending in '/')
+    char *name;    // file-name part, may hold wildcards
+    int wd;        // inotify watch on the directory, or -1
+} TailPattern;
+
+// A file as the last checkpoint left it
+typedef struct
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t offset; // bytes processed: only whole lines
+    size_t fp_len;
+    uint64_t fp;
+    int used; // matched to a file at startup
+} TailRecord;
+
+typedef struct
+{
+    const CLIOptions *opt;
+    ScanPlan plan;
+    ScanStats st; // st.agg: the running aggregate, if any
+    OutBuf ob;
+    TailFile *files;
+    int nfiles, files_cap;
+    TailPattern *pats;
+    int npats;
+    int ifd; // inotify descriptor, or -1 when polling
+    TailRecord *recs; // loaded from --state-file
+    int nrecs;
+    int changed; // read something since the last checkpoint
+    Pipeline *pipe; // --threads: lines are parsed on worker threads, or NULL
+} Tail;
+
+static volatile sig_atomic_t tail_stop; // SIGINT/SIGTERM: checkpoint and return
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    tail_stop = 1;
+}
+
+static void *xrealloc(void *p, size_t n)
+{
+    void *q = realloc(p, n ? n : 1);
+    if (!q)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return q;
+}
+
+static char *xstrndup(const char *s, size_t n)
+{
+    char *p = (char *)xrealloc(NULL, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+static int has_wildcard(const char *s)
+{
+    return strpbrk(s, "*?[") != NULL;
+}
 
-char *read_line_dyn(FILE *fp);
+// Prints the running aggregate, headed by the local time in text mode
+static void tail_snapshot(const Agg *agg, const CLIOptions *opt, FILE *out)
+{
+    if (opt->format == FORMAT_TEXT)
+    {
+        char ts[32];
+        time_t now = time(NULL);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        fprintf(out, "[%s]\n", ts);
+    }
+    agg_write(agg, opt->format, out);
+    if (opt->format == FORMAT_TEXT)
+        fputc('\n', out);
+    fflush(out);
+}
 
-static int stat_inode(const char *path, dev_t *dev, ino_t *ino, off_t *size)
+static TailFile *tail_find(Tail *t, const char *path)
+{
+    for (int i = 0; i < t->nfiles; i++)
+        if (strcmp(t->files[i].path, path) == 0)
+            return &t->files[i];
+    return NULL;
+}
+
+static TailFile *tail_add(Tail *t, const char *path)
+{
+    if (t->nfiles == t->files_cap)
+    {
+        t->files_cap = t->files_cap ? t->files_cap * 2 : 8;
+        t->files = (TailFile *)xrealloc(t->files, (size_t)t->files_cap * sizeof(TailFile));
+    }
+    TailFile *f = &t->files[t->nfiles++];
+    memset(f, 0, sizeof(*f));
+    f->path = xstrndup(path, strlen(path));
+    f->fd = -1;
+    f->wd = -1;
+    return f;
+}
+
+// Watches the open file itself (through its descriptor, so a rename in between cannot fool it)
+static void tail_watch_file(Tail *t, TailFile *f)
+{
+#ifdef __linux__
+    if (t->ifd < 0)
+        return;
+    char self[64];
+    snprintf(self, sizeof(self), "/proc/self/fd/%d", f->fd);
+    uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    f->wd = inotify_add_watch(t->ifd, self, mask);
+    if (f->wd < 0)
+        f->wd = inotify_add_watch(t->ifd, f->path, mask);
+#else
+    (void)t;
+    (void)f;
+#endif
+}
+
+// Opens f->path, at its end or at its start; 0 if it cannot be opened
+static int tail_open(Tail *t, TailFile *f, int at_end)
 {
     struct stat st;
-    if (stat(path, &st) != 0)
+    int fd = open(f->path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
         return 0;
-    if (dev)
-        *dev = st.st_dev;
-    if (ino)
-        *ino = st.st_ino;
-    if (size)
-        *size = st.st_size;
+    }
+    f->fd = fd;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->pos = at_end ? lseek(fd, 0, SEEK_END) : 0;
+    if (f->pos < 0)
+        f->pos = 0;
+    f->len = 0;
+    f->dirty = 0;
+    tail_watch_file(t, f);
     return 1;
 }
 
-/**
- * @brief Continuously tails a log file, optionally filtering and formatting output.
- *
- * This function opens the specified log file and continuously reads new lines as they are appended,
- * similar to the Unix `tail -f` command. It supports filtering log entries using a query or search term,
- * and can output results in different formats (text, JSON, CSV). The function also handles log rotation
- * by detecting file truncation or inode changes and reopening the file as needed.
- *
- * @param path         Path to the log file to tail.
- * @param from_start   If non-zero, start reading from the beginning of the file; otherwise, start from the end.
- * @param opt          Pointer to CLIOptions structure containing user options (query, search term, format, etc.).
- * @param out          Output stream to write matching log entries.
- *
- * The function will print warnings to stderr if parsing fails and the 'strict' option is enabled.
- * It uses helper functions for parsing log lines, matching queries, and formatting output.
- */
-void tail_file(const char *path, int from_start, const CLIOptions *opt, FILE *out)
+// Scans whole lines read from a file, here or on the pipeline's workers
+static void tail_scan(Tail *t, const char *p, size_t n, const char *label)
 {
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
+    if (t->pipe)
+        pipeline_submit(t->pipe, p, n, label);
+    else
+        scan_block(&t->plan, p, n, label, &t->ob, stderr, NULL, &t->st);
+}
+
+// Shows what matched so far; the pipeline's writer does this itself whenever it catches up
+static void tail_flush(Tail *t)
+{
+    if (!t->pipe)
+        outbuf_flush(&t->ob);
+}
+
+// Reads everything appended since the last call; whole lines are scanned, a partial one is kept
+static void tail_read(Tail *t, TailFile *f)
+{
+    struct stat st;
+    f->dirty = 0;
+    if (f->fd < 0)
+        return;
+    if (fstat(f->fd, &st) == 0 && st.st_size < f->pos)
+    {
+        // truncated in place (copytruncate): what is there now is new
+        lseek(f->fd, 0, SEEK_SET);
+        f->pos = 0;
+        f->len = 0;
+        t->changed = 1;
+    }
+    for (;;)
     {
-        perror(path);
+        if (f->cap - f->len < TAIL_READ)
+        {
+            f->cap = f->len + TAIL_READ;
+            f->buf = (char *)xrealloc(f->buf, f->cap);
+        }
+        ssize_t n = read(f->fd, f->buf + f->len, TAIL_READ);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fprintf(stderr, "[warn] read error (%s): %s\n", f->path, strerror(errno));
+        if (n <= 0)
+            break;
+        f->pos += n;
+        t->changed = 1;
+
+        size_t end = f->len + (size_t)n, whole = end;
+        while (whole > f->len && f->buf[whole - 1] != '\n')
+            whole--;
+        if (whole > f->len) // the new bytes complete at least one line
+        {
+            tail_scan(t, f->buf, whole, f->path);
+            memmove(f->buf, f->buf + whole, end - whole);
+            end -= whole;
+        }
+        f->len = end;
+    }
+}
+
+// Stops following f, leaving any unread part (and an unfinished line) unprocessed
+static void tail_release(Tail *t, TailFile *f)
+{
+    if (f->fd < 0)
         return;
+    f->len = 0;
+#ifdef __linux__
+    if (f->wd >= 0)
+    {
+        // the same inode may still be followed under another name
+        int shared = 0;
+        for (int i = 0; i < t->nfiles; i++)
+            shared |= &t->files[i] != f && t->files[i].wd == f->wd;
+        if (!shared)
+            inotify_rm_watch(t->ifd, f->wd);
     }
+#endif
+    f->wd = -1;
+    close(f->fd);
+    f->fd = -1;
+}
 
-    dev_t cur_dev = 0;
-    ino_t cur_ino = 0;
-    off_t cur_size = 0;
-    stat_inode(path, &cur_dev, &cur_ino, &cur_size);
+// Reads f to its end, including a last line without a newline, and stops following it
+static void tail_close(Tail *t, TailFile *f)
+{
+    if (f->fd < 0)
+        return;
+    tail_read(t, f);
+    if (f->len)
+        tail_scan(t, f->buf, f->len, f->path);
+    tail_release(t, f);
+}
 
-    if (!from_start)
-        fseeko(fp, 0, SEEK_END);
+// path exists (again) or matches a pattern: follow it, taking over from a rotated file
+static void tail_appeared(Tail *t, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+    TailFile *f = tail_find(t, path);
+    if (!f)
+        f = tail_add(t, path);
+    else if (f->fd >= 0 && f->dev == st.st_dev && f->ino == st.st_ino)
+        return;
+    tail_close(t, f); // rotated: the old file is finished first
+    if (tail_open(t, f, 0)) // a new file is read from its start
+        tail_read(t, f);
+}
 
-    Query q;
-    int use_q = 0;
-    char qerr[128] = {0};
-    if (opt->query && *opt->query)
+// Checks every file and pattern by stat()/glob(): the polling mode, and recovery from lost events
+static void tail_rescan(Tail *t)
+{
+    for (int i = 0; i < t->nfiles; i++)
     {
-        if (query_parse(opt->query, opt->case_insensitive, &q, qerr, sizeof(qerr)))
+        TailFile *f = &t->files[i];
+        struct stat st;
+        if (stat(f->path, &st) != 0)
         {
-            use_q = 1;
+            if (f->fd >= 0 && fstat(f->fd, &st) == 0 && st.st_nlink == 0)
+                tail_close(t, f);
+            else
+                tail_read(t, f); // renamed away: read it until a new file takes the path
+            continue;
         }
+        if (f->fd >= 0 && f->dev == st.st_dev && f->ino == st.st_ino)
+            tail_read(t, f);
         else
+            tail_appeared(t, f->path);
+    }
+#ifndef _WIN32
+    for (int i = 0; i < t->npats; i++)
+    {
+        TailPattern *p = &t->pats[i];
+        if (!has_wildcard(p->name))
+            continue;
+        glob_t g;
+        if (glob(p->pattern, 0, NULL, &g) == 0)
         {
-            fprintf(stderr, "query parse error: %s\n", qerr);
+            for (size_t k = 0; k < g.gl_pathc; k++)
+                if (!tail_find(t, g.gl_pathv[k]))
+                    tail_appeared(t, g.gl_pathv[k]);
+            globfree(&g);
         }
     }
+#endif
+}
 
-    for (;;)
+/* ---------- --state-file ---------- */
+
+// Hash of the first (up to) want bytes of fd; *len gets how many there were
+static uint64_t fingerprint(int fd, size_t want, size_t *len)
+{
+    char buf[TAIL_FP_LEN];
+    ssize_t n = pread(fd, buf, want < sizeof(buf) ? want : sizeof(buf), 0);
+    *len = n > 0 ? (size_t)n : 0;
+    return lf_hash64(buf, *len);
+}
+
+// Whether fd holds the file rec was taken from (inode numbers get reused)
+static int same_file(int fd, const TailRecord *rec)
+{
+    struct stat st;
+    size_t len;
+    return fstat(fd, &st) == 0 && st.st_dev == rec->dev && st.st_ino == rec->ino &&
+           st.st_size >= rec->offset && fingerprint(fd, rec->fp_len, &len) == rec->fp &&
+           len == rec->fp_len;
+}
+
+static TailRecord *tail_record(Tail *t, const char *path)
+{
+    for (int i = 0; i < t->nrecs; i++)
+        if (strcmp(t->recs[i].path, path) == 0)
+            return &t->recs[i];
+    return NULL;
+}
+
+// The file at rec->path was replaced while we were stopped: finish the old one if it is still around
+static void tail_drain_rotated(Tail *t, const TailRecord *rec)
+{
+#ifndef _WIN32
+    const char *slash = strrchr(rec->path, '/');
+    char *dir = slash ? xstrndup(rec->path, (size_t)(slash + 1 - rec->path)) : xstrndup("", 0);
+    DIR *d = opendir(slash ? dir : ".");
+    struct dirent *de;
+    int found = 0;
+    while (d && !found && (de = readdir(d)) != NULL)
     {
-        long pos_before = ftello(fp);
-        char *line = read_line_dyn(fp);
+        size_t n = strlen(dir) + strlen(de->d_name);
+        char *path = (char *)xrealloc(NULL, n + 1);
+        struct stat st;
+        snprintf(path, n + 1, "%s%s", dir, de->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_dev == rec->dev && st.st_ino == rec->ino)
+        {
+            TailFile old;
+            memset(&old, 0, sizeof(old));
+            old.path = path;
+            old.wd = -1;
+            old.fd = open(path, O_RDONLY);
+            if (old.fd >= 0 && same_file(old.fd, rec))
+            {
+                old.pos = lseek(old.fd, rec->offset, SEEK_SET);
+                tail_close(t, &old);
+                found = 1;
+            }
+            else if (old.fd >= 0)
+                close(old.fd);
+            free(old.buf);
+        }
+        free(path);
+    }
+    if (d)
+        closedir(d);
+    free(dir);
+    if (found)
+        return;
+#endif
+    fprintf(stderr, "[warn] %s was rotated while logfire was stopped and the old file is gone; "
+                    "lines after byte %lld of it are lost\n",
+            rec->path, (long long)rec->offset);
+}
+
+// Opens a file found at startup where the last checkpoint left it, else at its end (or start)
+static int tail_start(Tail *t, TailFile *f, int from_start)
+{
+    TailRecord *rec = tail_record(t, f->path);
+    if (!rec)
+        return tail_open(t, f, !from_start);
+    rec->used = 1;
+    if (!tail_open(t, f, 0))
+    {
+        tail_drain_rotated(t, rec);
+        return 0;
+    }
+    if (same_file(f->fd, rec))
+    {
+        f->pos = lseek(f->fd, rec->offset, SEEK_SET);
+        return 1;
+    }
+    if (f->dev != rec->dev || f->ino != rec->ino)
+        tail_drain_rotated(t, rec);
+    return 1; // a new file, or rewritten in place: read it from the start
+}
 
-        if (!line)
+// Reads the checkpoint, if there is one; the aggregate goes to t->st.agg
+static void tail_state_load(Tail *t, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        if (errno != ENOENT)
+            fprintf(stderr, "[warn] cannot read state file %s: %s\n", path, strerror(errno));
+        return;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&line, &cap, fp);
+    if (n <= 0 || strncmp(line, TAIL_STATE_MAGIC "\n", (size_t)n) != 0)
+    {
+        fprintf(stderr, "[warn] %s is not a logfire state file; starting over\n", path);
+        free(line);
+        fclose(fp);
+        return;
+    }
+    int cap_recs = 0;
+    while ((n = getline(&line, &cap, fp)) > 0)
+    {
+        unsigned long long dev, ino, fp_len, hash;
+        long long off;
+        int at = 0;
+        if (line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (sscanf(line, "file %llu %llu %lld %llu %llx %n", &dev, &ino, &off, &fp_len, &hash, &at) == 5 &&
+            at > 0 && fp_len <= TAIL_FP_LEN && off >= 0)
         {
-            dev_t new_dev = 0;
-            ino_t new_ino = 0;
-            off_t new_size = 0;
-            if (stat_inode(path, &new_dev, &new_ino, &new_size))
+            if (t->nrecs == cap_recs)
             {
-                if (new_size < pos_before)
-                {
-                    fclose(fp);
-                    fp = fopen(path, "rb");
-                    if (!fp)
-                    {
-                        msleep(250);
-                        continue;
-                    }
-                    if (!from_start)
-                        fseeko(fp, 0, SEEK_END);
-                    cur_dev = new_dev;
-                    cur_ino = new_ino;
-                    cur_size = new_size;
-                }
-                else if (new_ino != cur_ino || new_dev != cur_dev)
-                {
-                    fclose(fp);
-                    fp = fopen(path, "rb");
-                    if (!fp)
-                    {
-                        msleep(250);
-                        continue;
-                    }
-                    if (!from_start)
-                        fseeko(fp, 0, SEEK_END);
-                    cur_dev = new_dev;
-                    cur_ino = new_ino;
-                    cur_size = new_size;
-                }
+                cap_recs = cap_recs ? cap_recs * 2 : 8;
+                t->recs = (TailRecord *)xrealloc(t->recs, (size_t)cap_recs * sizeof(TailRecord));
             }
-            msleep(200);
-            continue;
+            TailRecord *r = &t->recs[t->nrecs++];
+            r->path = xstrndup(line + at, strlen(line + at));
+            r->dev = (dev_t)dev;
+            r->ino = (ino_t)ino;
+            r->offset = (off_t)off;
+            r->fp_len = (size_t)fp_len;
+            r->fp = hash;
+            r->used = 0;
+        }
+        else if (strncmp(line, "agg ", 4) == 0)
+        {
+            if (t->plan.agg && !(t->st.agg = agg_load(t->plan.agg, fp)))
+                fprintf(stderr, "[warn] %s: the saved aggregate is for other groups or columns (or damaged); "
+                                "counting from zero\n",
+                        path);
+            break;
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Writes a checkpoint: flushes the output it covers, then replaces the state file atomically
+static void tail_state_save(Tail *t, const char *path)
+{
+    if (t->pipe)
+        pipeline_sync(t->pipe);
+    outbuf_flush(&t->ob);
+    fflush(t->ob.fp);
+    t->changed = 0;
+
+    char *blob = NULL;
+    size_t blob_len = 0;
+    if (t->st.agg)
+    {
+        FILE *mem = open_memstream(&blob, &blob_len);
+        if (!mem || !agg_save(t->st.agg, mem) || fclose(mem) != 0)
+        {
+            fprintf(stderr, "[warn] cannot save the aggregate to %s\n", path);
+            free(blob);
+            return;
+        }
+    }
+
+    size_t n = strlen(path) + 5;
+    char *tmp = (char *)xrealloc(NULL, n);
+    snprintf(tmp, n, "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    int ok = fp != NULL;
+    if (ok)
+    {
+        fprintf(fp, "%s\n", TAIL_STATE_MAGIC);
+        for (int i = 0; i < t->nfiles; i++)
+        {
+            TailFile *f = &t->files[i];
+            size_t len;
+            if (f->fd < 0 || strchr(f->path, '\n'))
+                continue;
+            uint64_t hash = fingerprint(f->fd, TAIL_FP_LEN, &len);
+            fprintf(fp, "file %llu %llu %lld %zu %llx %s\n", (unsigned long long)f->dev,
+                    (unsigned long long)f->ino, (long long)(f->pos - (off_t)f->len), len,
+                    (unsigned long long)hash, f->path);
+        }
+        if (blob)
+        {
+            fprintf(fp, "agg %zu\n", blob_len);
+            fwrite(blob, 1, blob_len, fp);
         }
+        ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+        ok = fclose(fp) == 0 && ok;
+    }
+    if (!ok || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "[warn] cannot write state file %s: %s\n", path, strerror(errno));
+        remove(tmp);
+    }
+    free(tmp);
+    free(blob);
+}
+
+// Adds a path or glob pattern: its current files, and a watch for new ones
+static void tail_pattern(Tail *t, const char *pattern, int from_start)
+{
+    TailPattern *p = &t->pats[t->npats++];
+    const char *slash = strrchr(pattern, '/');
+    p->pattern = xstrndup(pattern, strlen(pattern));
+    size_t plen = slash ? (size_t)(slash + 1 - pattern) : 0;
+    p->prefix = xstrndup(pattern, plen);
+    p->name = xstrndup(pattern + plen, strlen(pattern + plen));
+    p->wd = -1;
 
-        LogEntry e;
-        char perr[256] = {0};
-        if (parse_apache_or_nginx(line, &e, perr, sizeof(perr)))
+#ifdef __linux__
+    if (t->ifd >= 0)
+    {
+        const char *dir = plen ? p->prefix : ".";
+        p->wd = inotify_add_watch(t->ifd, dir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+        if (p->wd < 0)
+            fprintf(stderr, "[warn] cannot watch %s for new files: %s\n", dir, strerror(errno));
+    }
+#endif
+
+#ifndef _WIN32
+    if (has_wildcard(p->name))
+    {
+        glob_t g;
+        if (glob(pattern, 0, NULL, &g) == 0)
         {
-            int ok = 1;
-            if (use_q)
-                ok = query_match(&e, &q);
-            else if (opt->searchTerm && *opt->searchTerm)
-                ok = matches(&e, opt->searchTerm, opt->case_insensitive);
+            for (size_t k = 0; k < g.gl_pathc; k++)
+            {
+                struct stat st;
+                if (tail_find(t, g.gl_pathv[k]) || stat(g.gl_pathv[k], &st) != 0 || !S_ISREG(st.st_mode))
+                    continue;
+                tail_start(t, tail_add(t, g.gl_pathv[k]), from_start);
+            }
+            globfree(&g);
+        }
+        return;
+    }
+#endif
+    if (tail_find(t, pattern))
+        return;
+    TailFile *f = tail_add(t, pattern);
+    if (!tail_start(t, f, from_start))
+        fprintf(stderr, "[warn] %s: %s; following it once it appears\n", pattern, strerror(errno));
+}
 
-            if (ok)
+#ifdef __linux__
+// Handles the queued inotify events: rotation and new files first, then reads of the files written to
+static void tail_events(Tail *t)
+{
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        ssize_t n = read(t->ifd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (char *p = buf; p < buf + n;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
             {
-                if (opt->format == FORMAT_JSON)
-                {
-                    printLogJSON(&e, out);
-                    fputc('\n', out);
-                }
-                else if (opt->format == FORMAT_CSV)
+                tail_rescan(t);
+                continue;
+            }
+            if (ev->len && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                for (int i = 0; i < t->npats; i++)
                 {
-                    printLogCSV(&e, out);
-                    fputc('\n', out);
+                    TailPattern *pt = &t->pats[i];
+                    if (pt->wd != ev->wd || fnmatch(pt->name, ev->name, FNM_PERIOD) != 0)
+                        continue;
+                    size_t len = strlen(pt->prefix) + strlen(ev->name);
+                    char *path = (char *)xrealloc(NULL, len + 1);
+                    snprintf(path, len + 1, "%s%s", pt->prefix, ev->name);
+                    tail_appeared(t, path);
+                    free(path);
                 }
+                continue;
+            }
+            for (int i = 0; i < t->nfiles; i++)
+            {
+                TailFile *f = &t->files[i];
+                if (f->wd != ev->wd || f->fd < 0)
+                    continue;
+                struct stat st;
+                if (ev->mask & IN_IGNORED)
+                    f->wd = -1;
+                if ((ev->mask & (IN_DELETE_SELF | IN_IGNORED)) ||
+                    ((ev->mask & IN_ATTRIB) && fstat(f->fd, &st) == 0 && st.st_nlink == 0))
+                    tail_close(t, f); // unlinked: nothing more will be written to it
                 else
-                {
-                    printLogText(&e, out);
-                    fputc('\n', out);
-                }
+                    f->dirty = 1;
             }
         }
-        else if (opt->strict)
+    }
+    for (int i = 0; i < t->nfiles; i++)
+        if (t->files[i].dirty)
+            tail_read(t, &t->files[i]);
+}
+#endif
+
+// With an aggregate: prints it (or its finished buckets) every --interval seconds
+static void tail_tick(Tail *t, double *next_snapshot, long long *seen)
+{
+    Agg *agg = t->st.agg;
+    if (!agg || now_sec() < *next_snapshot)
+        return;
+    if (t->pipe)
+        pipeline_sync(t->pipe); // all lines read so far are in the aggregate
+    long long fresh = agg_added(agg) - *seen; // matches since the last snapshot
+    if (t->plan.agg->bucket)
+    {
+        // one row per bucket, printed once the bucket has ended
+        Agg *done = agg_take_closed(agg, time(NULL), fresh > 0);
+        if (done)
+            tail_snapshot(done, t->opt, t->ob.fp);
+        agg_free(done);
+    }
+    else if (fresh)
+        tail_snapshot(agg, t->opt, t->ob.fp);
+    *seen = agg_added(agg);
+    *next_snapshot = now_sec() + t->opt->interval;
+}
+
+// A recorded file that is gone now but matches a pattern was rotated away while we were stopped
+static int tail_covers(const Tail *t, const char *path)
+{
+    for (int i = 0; i < t->npats; i++)
+    {
+#ifndef _WIN32
+        if (fnmatch(t->pats[i].pattern, path, FNM_PATHNAME | FNM_PERIOD) == 0)
+            return 1;
+#else
+        if (strcmp(t->pats[i].pattern, path) == 0)
+            return 1;
+#endif
+    }
+    return 0;
+}
+
+// Milliseconds until the next snapshot or checkpoint is due; -1 if neither is
+static int tail_timeout(const Tail *t, double next_snapshot, double next_checkpoint)
+{
+    double due = -1;
+    if (t->st.agg)
+        due = next_snapshot;
+    if (t->opt->state_file && t->changed && (due < 0 || next_checkpoint < due))
+        due = next_checkpoint;
+    if (due < 0)
+        return -1;
+    double left = due - now_sec();
+    return left > 0 ? (int)(left * 1000) + 1 : 0;
+}
+
+/**
+ * @brief Continuously tails log files, optionally filtering and formatting output.
+ *
+ * Follows every path and glob pattern given, like `tail -F`: existing files from their end (or
+ * their start with from_start), and files that appear later, or replace a followed one when logs
+ * are rotated, from their start. On Linux, inotify events delivered through epoll drive the
+ * reads, so lines are handled as soon as they are written; elsewhere the files are polled.
+ * Matches are written as they are found, as NDJSON for --format json.
+ *
+ * With --state-file, files resume where the last run's checkpoint left them instead (see the
+ * comment at the top). Returns after SIGINT or SIGTERM, once the output is flushed and the
+ * final checkpoint is written.
+ *
+ * @param paths        Files or glob patterns to follow (wildcards in the file name only).
+ * @param npaths       Number of entries in paths.
+ * @param from_start   If non-zero, read the files that exist now from the beginning.
+ * @param opt          Pointer to CLIOptions structure containing user options (query, search term, format, etc.).
+ * @param out          Output stream to write matching log entries.
+ *
+ * With --group-by/--agg/--top, matches are aggregated instead, and the running totals since
+ * the start are printed every --interval seconds (when something new matched). With --bucket,
+ * each time bucket is printed once instead, at the first interval after it has ended.
+ *
+ * Lines that do not parse are reported on stderr when the 'strict' option is enabled.
+ */
+void tail_files(const char *const *paths, int npaths, int from_start, const CLIOptions *opt, FILE *out)
+{
+    Tail t;
+    memset(&t, 0, sizeof(t));
+    t.opt = opt;
+    t.ifd = -1;
+    scan_plan_init(&t.plan, opt);
+    outbuf_init(&t.ob, out);
+    t.pats = (TailPattern *)xrealloc(NULL, (size_t)npaths * sizeof(TailPattern));
+    if (opt->state_file)
+        tail_state_load(&t, opt->state_file);
+    if (t.plan.agg && !t.st.agg)
+        t.st.agg = agg_new(t.plan.agg);
+    long long seen = t.st.agg ? agg_added(t.st.agg) : 0; // restored matches were reported last run
+
+    tail_stop = 0;
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop; // no SA_RESTART: waits return early
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+#else
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
+#endif
+
+#ifdef __linux__
+    int ep = -1;
+    sigset_t stop_sigs, wait_mask;
+    // delivered only inside epoll_pwait(), so a signal cannot slip in just before it blocks
+    sigemptyset(&stop_sigs);
+    sigaddset(&stop_sigs, SIGINT);
+    sigaddset(&stop_sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_sigs, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    t.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (t.ifd >= 0)
+    {
+        struct epoll_event ev = {.events = EPOLLIN};
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, t.ifd, &ev) != 0)
         {
-            fprintf(stderr, "[tail warn] %s\n", perr[0] ? perr : "parse failed");
-            fprintf(stderr, "  >> %s\n", line);
+            close(t.ifd);
+            t.ifd = -1;
         }
+    }
+    if (t.ifd < 0)
+    {
+        fprintf(stderr, "[warn] inotify unavailable (%s); polling every %d ms\n", strerror(errno), TAIL_POLL_MS);
+        sigprocmask(SIG_UNBLOCK, &stop_sigs, NULL);
+    }
+#endif
+    if (opt->threads > 1)
+        t.pipe = pipeline_open(&t.plan, opt->threads, &t.ob, NULL, &t.st);
 
-        free(line);
+    for (int i = 0; i < npaths; i++)
+        tail_pattern(&t, paths[i], from_start);
+    for (int i = 0; i < t.nrecs; i++)
+    {
+        struct stat st;
+        if (!t.recs[i].used && stat(t.recs[i].path, &st) != 0 && tail_covers(&t, t.recs[i].path))
+            tail_drain_rotated(&t, &t.recs[i]);
     }
+    for (int i = 0; i < t.nfiles; i++)
+        tail_read(&t, &t.files[i]);
+    tail_flush(&t);
 
-    fclose(fp);
+    double next_snapshot = now_sec() + opt->interval;
+    double next_checkpoint = now_sec() + TAIL_CHECKPOINT_SEC;
+    while (!tail_stop)
+    {
+        tail_tick(&t, &next_snapshot, &seen);
+        if (opt->state_file && t.changed && now_sec() >= next_checkpoint)
+        {
+            tail_state_save(&t, opt->state_file);
+            next_checkpoint = now_sec() + TAIL_CHECKPOINT_SEC;
+        }
+#ifdef __linux__
+        if (t.ifd >= 0)
+        {
+            struct epoll_event ev;
+            int n = epoll_pwait(ep, &ev, 1, tail_timeout(&t, next_snapshot, next_checkpoint), &wait_mask);
+            if (n < 0 && errno != EINTR)
+            {
+                perror("epoll_wait");
+                break;
+            }
+            if (n > 0)
+                tail_events(&t);
+            tail_flush(&t); // caught up: show what matched so far
+            continue;
+        }
+#endif
+        tail_rescan(&t);
+        tail_flush(&t);
+        if (!tail_stop)
+            msleep(TAIL_POLL_MS);
+    }
+
+    if (t.pipe)
+    {
+        pipeline_close(t.pipe);
+        t.pipe = NULL;
+    }
+    if (opt->state_file)
+        tail_state_save(&t, opt->state_file);
+    for (int i = 0; i < t.nfiles; i++)
+    {
+        tail_release(&t, &t.files[i]); // an unfinished last line is left for the next run
+        free(t.files[i].path);
+        free(t.files[i].buf);
+    }
+    for (int i = 0; i < t.npats; i++)
+    {
+        free(t.pats[i].pattern);
+        free(t.pats[i].prefix);
+        free(t.pats[i].name);
+    }
+    for (int i = 0; i < t.nrecs; i++)
+        free(t.recs[i].path);
+#ifdef __linux__
+    if (t.ifd >= 0)
+    {
+        close(ep);
+        close(t.ifd);
+    }
+    sigprocmask(SIG_UNBLOCK, &stop_sigs, NULL);
+#endif
+    free(t.files);
+    free(t.pats);
+    free(t.recs);
+    outbuf_free(&t.ob);
+    agg_free(t.st.agg);
+    scan_plan_free(&t.plan);
 }
@@ -0,0 +1,134 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "timeseek.h"
+#include "parser.h"
+
+/*
+ * Time-range seek for chronologically ordered logs.
+ *
+ * Access logs are written in (roughly) time order, so the lines that can
+ * satisfy "timestamp>=A timestamp<B" form one contiguous byte range. We
+ * bisect the mapped file on the timestamps of the lines found at probe
+ * offsets, widening the window by a slack on both ends for lines that were
+ * logged slightly out of order.
+ */
+
+#define SEEK_LINEAR (64u << 10) // finish with a linear walk below this span
+#define SEEK_PROBE_LINES 64     // undecodable lines to skip per probe
+#define ORDER_SAMPLES 16        // probes used to sanity-check ordering
+
+// Offset of the first line starting at or after off
+static size_t line_start_at(const char *data, size_t len, size_t off)
+{
+    if (off == 0 || off >= len)
+        return off >= len ? len : 0;
+    if (data[off - 1] == '\n')
+        return off;
+    const char *nl = (const char *)memchr(data + off, '\n', len - off);
+    return nl ? (size_t)(nl - data) + 1 : len;
+}
+
+/*
+ * Epoch of the first line at or after off (a line start) that has a
+ * decodable timestamp, giving up at limit or after SEEK_PROBE_LINES lines.
+ * at and next receive the start of that line and of the one after it;
+ * on failure next is where the probe stopped.
+ */
+static int probe_epoch(const char *data, size_t limit, size_t off, time_t *t,
+                       size_t *at, size_t *next)
+{
+    for (int k = 0; k < SEEK_PROBE_LINES && off < limit; k++)
+    {
+        const char *nl = (const char *)memchr(data + off, '\n', limit - off);
+        size_t n = nl ? (size_t)(nl - data) - off : limit - off;
+        size_t after = nl ? off + n + 1 : limit;
+        LogEntry e;
+        if (parse_apache_or_nginx(data + off, n, &e, NULL, 0) && logentry_epoch(&e, t))
+        {
+            *at = off;
+            *next = after;
+            return 1;
+        }
+        off = after;
+    }
+    *next = off;
+    return 0;
+}
+
+// First line start whose timestamp is >= target (len if there is none)
+static size_t seek_first(const char *data, size_t len, time_t target)
+{
+    size_t lo = 0, hi = len, at, next;
+    time_t t;
+
+    // invariant: every decodable line before lo is older than target
+    while (hi - lo > SEEK_LINEAR)
+    {
+        size_t half = lo + (hi - lo) / 2;
+        size_t mid = line_start_at(data, len, half);
+        if (mid >= hi || !probe_epoch(data, hi, mid, &t, &at, &next))
+            hi = half;
+        else if (t < target)
+            lo = next;
+        else
+            hi = mid;
+    }
+    for (size_t off = lo; off < len; off = next)
+    {
+        if (probe_epoch(data, len, off, &t, &at, &next) && t >= target)
+            return at;
+    }
+    return len;
+}
+
+// Spot-check that timestamps are non-decreasing (within slack) across the file
+static int looks_ordered(const char *data, size_t len, long slack)
+{
+    time_t prev = 0, t;
+    size_t at, next;
+    int have = 0;
+    for (int i = 0; i <= ORDER_SAMPLES; i++)
+    {
+        size_t off = line_start_at(data, len, (size_t)((double)len * i / (ORDER_SAMPLES + 1)));
+        if (!probe_epoch(data, len, off, &t, &at, &next))
+            continue;
+        if (have && t + slack < prev)
+            return 0;
+        prev = t;
+        have = 1;
+    }
+    return have;
+}
+
+/**
+ * @brief Finds the byte range of a time-ordered log that can hold [lo, hi].
+ *
+ * @param data, len  Mapped file contents.
+ * @param lo, hi     Inclusive epoch bounds from the query.
+ * @param slack      Seconds of out-of-order tolerance added on both sides.
+ * @param start      Receives the first line start to scan.
+ * @param end        Receives the offset to stop scanning at.
+ * @return           1 if a range was computed, 0 if the file does not look
+ *                   time-ordered (scan everything).
+ */
+int time_seek_range(const char *data, size_t len, time_t lo, time_t hi, long slack,
+                    size_t *start, size_t *end)
+{
+    if (!looks_ordered(data, len, slack))
+        return 0;
+
+    *start = 0;
+    *end = len;
+    if (lo != (time_t)LLONG_MIN)
+        *start = seek_first(data, len, lo - slack);
+    if (hi != (time_t)LLONG_MAX)
+        *end = seek_first(data, len, hi + slack + 1);
+    if (*end < *start)
+        *end = *start;
+    return 1;
+}
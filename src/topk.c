@@ -0,0 +1,410 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topk.h"
+#include "hash.h"
+
+typedef struct
+{
+    char *key; // grown on demand, never shrunk: replacing a key rarely allocates
+    uint32_t len, cap;
+    uint64_t hash;
+    long long count;
+    long long err;
+    uint32_t heap; // position in TopK.heap
+} Counter;
+
+struct TopK
+{
+    Counter *c;
+    size_t m, n;     // capacity, counters in use
+    uint32_t *heap;  // counter indices, min-heap on count
+    uint32_t *slots; // counter index + 1; 0 = empty
+    size_t nslots;   // power of two, at least 2m
+    long long total; // additions so far
+};
+
+/**
+ * @brief Creates an empty summary with a fixed number of counters.
+ *
+ * Memory is about counters * (48 bytes + the longest key each counter has
+ * held); counts overstate by at most (additions / counters).
+ */
+TopK *topk_new(size_t counters)
+{
+    TopK *t = (TopK *)calloc(1, sizeof(TopK));
+    if (!t)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    t->m = counters ? counters : 1;
+    t->nslots = 16;
+    while (t->nslots < 2 * t->m)
+        t->nslots *= 2;
+    t->c = (Counter *)calloc(t->m, sizeof(Counter));
+    t->heap = (uint32_t *)malloc(t->m * sizeof(uint32_t));
+    t->slots = (uint32_t *)calloc(t->nslots, sizeof(uint32_t));
+    if (!t->c || !t->heap || !t->slots)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    return t;
+}
+
+void topk_free(TopK *t)
+{
+    if (!t)
+        return;
+    for (size_t i = 0; i < t->n; i++)
+        free(t->c[i].key);
+    free(t->c);
+    free(t->heap);
+    free(t->slots);
+    free(t);
+}
+
+long long topk_total(const TopK *t)
+{
+    return t->total;
+}
+
+size_t topk_capacity(const TopK *t)
+{
+    return t->m;
+}
+
+/* ---------- hash table ---------- */
+
+// Slot holding the key, or the empty slot where it would go
+static size_t find_slot(const TopK *t, const char *key, size_t len, uint64_t hash)
+{
+    size_t mask = t->nslots - 1, i = (size_t)hash & mask;
+    while (t->slots[i])
+    {
+        const Counter *c = &t->c[t->slots[i] - 1];
+        if (c->hash == hash && c->len == len && (len == 0 || memcmp(c->key, key, len) == 0))
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Removes a counter from the table, shifting later probes back into the gap
+static void unlink_slot(TopK *t, uint32_t idx)
+{
+    size_t mask = t->nslots - 1;
+    const Counter *c = &t->c[idx];
+    size_t i = find_slot(t, c->key, c->len, c->hash);
+    size_t j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        if (!t->slots[j])
+            break;
+        size_t home = (size_t)t->c[t->slots[j] - 1].hash & mask;
+        // the entry at j may move to i unless its home lies cyclically in (i, j]
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+        {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i] = 0;
+}
+
+/* ---------- min-heap on count ---------- */
+
+static void heap_swap(TopK *t, size_t a, size_t b)
+{
+    uint32_t x = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = x;
+    t->c[t->heap[a]].heap = (uint32_t)a;
+    t->c[t->heap[b]].heap = (uint32_t)b;
+}
+
+static void sift_down(TopK *t, size_t i)
+{
+    for (;;)
+    {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < t->n && t->c[t->heap[l]].count < t->c[t->heap[min]].count)
+            min = l;
+        if (r < t->n && t->c[t->heap[r]].count < t->c[t->heap[min]].count)
+            min = r;
+        if (min == i)
+            return;
+        heap_swap(t, i, min);
+        i = min;
+    }
+}
+
+static void sift_up(TopK *t, size_t i)
+{
+    while (i > 0)
+    {
+        size_t p = (i - 1) / 2;
+        if (t->c[t->heap[p]].count <= t->c[t->heap[i]].count)
+            return;
+        heap_swap(t, i, p);
+        i = p;
+    }
+}
+
+static void set_key(Counter *c, const char *key, size_t len, uint64_t hash)
+{
+    if (len > c->cap)
+    {
+        uint32_t cap = c->cap ? c->cap : 16;
+        while (cap < len)
+            cap *= 2;
+        char *k = (char *)realloc(c->key, cap);
+        if (!k)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        c->key = k;
+        c->cap = cap;
+    }
+    if (len)
+        memcpy(c->key, key, len);
+    c->len = (uint32_t)len;
+    c->hash = hash;
+}
+
+// Takes a fresh counter; only while n < m
+static void place(TopK *t, const char *key, size_t len, uint64_t hash, size_t slot,
+                  long long count, long long err)
+{
+    uint32_t idx = (uint32_t)t->n++;
+    Counter *c = &t->c[idx];
+    set_key(c, key, len, hash);
+    c->count = count;
+    c->err = err;
+    t->slots[slot] = idx + 1;
+    t->heap[idx] = idx;
+    c->heap = idx;
+    sift_up(t, idx);
+}
+
+/**
+ * @brief Counts one occurrence of a key.
+ */
+void topk_add(TopK *t, const char *key, size_t len)
+{
+    uint64_t hash = lf_hash64(key, len);
+    size_t slot = find_slot(t, key, len, hash);
+    t->total++;
+
+    if (t->slots[slot])
+    {
+        Counter *c = &t->c[t->slots[slot] - 1];
+        c->count++;
+        sift_down(t, c->heap);
+        return;
+    }
+    if (t->n < t->m)
+    {
+        place(t, key, len, hash, slot, 1, 0);
+        return;
+    }
+
+    // evict the smallest counter; the newcomer inherits its count as error
+    uint32_t idx = t->heap[0];
+    Counter *c = &t->c[idx];
+    unlink_slot(t, idx);
+    set_key(c, key, len, hash);
+    c->err = c->count;
+    c->count++;
+    t->slots[find_slot(t, key, len, hash)] = idx + 1;
+    sift_down(t, 0);
+}
+
+typedef struct
+{
+    const Counter *c;
+    long long count, err;
+} MergeItem;
+
+static int cmp_merge(const void *pa, const void *pb)
+{
+    const MergeItem *a = (const MergeItem *)pa, *b = (const MergeItem *)pb;
+    if (a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+    // ties by key, so the counters kept do not depend on the merge order
+    size_t n = a->c->len < b->c->len ? a->c->len : b->c->len;
+    int c = n ? memcmp(a->c->key, b->c->key, n) : 0;
+    if (c)
+        return c;
+    return (a->c->len > b->c->len) - (a->c->len < b->c->len);
+}
+
+/**
+ * @brief Folds src into dst (same capacity). src is unchanged.
+ *
+ * A key missing from a full summary may still have occurred up to that
+ * summary's minimum count, so that minimum is added to both its count and
+ * its error (Agarwal et al., "Mergeable Summaries"). The largest counts are
+ * kept. Summaries that never evicted anything merge exactly.
+ */
+void topk_merge(TopK *dst, const TopK *src)
+{
+    long long min_d = dst->n == dst->m && dst->n ? dst->c[dst->heap[0]].count : 0;
+    long long min_s = src->n == src->m && src->n ? src->c[src->heap[0]].count : 0;
+    size_t ni = 0;
+    MergeItem *items = (MergeItem *)malloc((dst->n + src->n + 1) * sizeof(MergeItem));
+    if (!items)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < dst->n; i++)
+    {
+        const Counter *c = &dst->c[i];
+        size_t s = find_slot(src, c->key, c->len, c->hash);
+        const Counter *o = src->slots[s] ? &src->c[src->slots[s] - 1] : NULL;
+        items[ni].c = c;
+        items[ni].count = c->count + (o ? o->count : min_s);
+        items[ni].err = c->err + (o ? o->err : min_s);
+        ni++;
+    }
+    for (size_t i = 0; i < src->n; i++)
+    {
+        const Counter *c = &src->c[i];
+        if (dst->slots[find_slot(dst, c->key, c->len, c->hash)])
+            continue;
+        items[ni].c = c;
+        items[ni].count = c->count + min_d;
+        items[ni].err = c->err + min_d;
+        ni++;
+    }
+    qsort(items, ni, sizeof(MergeItem), cmp_merge);
+
+    TopK *out = topk_new(dst->m);
+    for (size_t i = 0; i < ni && i < out->m; i++)
+    {
+        const Counter *c = items[i].c;
+        place(out, c->key, c->len, c->hash, find_slot(out, c->key, c->len, c->hash),
+              items[i].count, items[i].err);
+    }
+    out->total = dst->total + src->total;
+    free(items);
+
+    // swap the merged contents into dst
+    TopK old = *dst;
+    *dst = *out;
+    *out = old;
+    topk_free(out);
+}
+
+/**
+ * @brief Writes the summary (host byte order) for topk_load().
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+int topk_save(const TopK *t, FILE *fp)
+{
+    uint64_t head[3] = {t->m, t->n, (uint64_t)t->total};
+    int ok = fwrite(head, sizeof(head), 1, fp) == 1;
+    for (size_t i = 0; i < t->n && ok; i++)
+    {
+        const Counter *c = &t->c[i];
+        long long v[2] = {c->count, c->err};
+        ok = fwrite(&c->len, sizeof(c->len), 1, fp) == 1 && fwrite(v, sizeof(v), 1, fp) == 1 &&
+             (c->len == 0 || fwrite(c->key, 1, c->len, fp) == c->len);
+    }
+    return ok;
+}
+
+/**
+ * @brief Restores a summary written by topk_save() into an empty one of the same capacity.
+ *
+ * @return 1 on success, 0 on a short read or a mismatch.
+ */
+int topk_load(TopK *t, FILE *fp)
+{
+    uint64_t head[3];
+    char *key = NULL;
+    int ok = fread(head, sizeof(head), 1, fp) == 1 && head[0] == t->m && head[1] <= t->m && t->n == 0;
+    for (uint64_t i = 0; ok && i < head[1]; i++)
+    {
+        uint32_t len;
+        long long v[2];
+        ok = fread(&len, sizeof(len), 1, fp) == 1 && fread(v, sizeof(v), 1, fp) == 1 && len <= (1u << 24);
+        if (!ok)
+            break;
+        char *k = (char *)realloc(key, len ? len : 1);
+        if (!k)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        key = k;
+        if (len && fread(key, 1, len, fp) != len)
+        {
+            ok = 0;
+            break;
+        }
+        uint64_t hash = lf_hash64(key, len);
+        size_t slot = find_slot(t, key, len, hash);
+        if (t->slots[slot]) // duplicate key: not something topk_save() writes
+        {
+            ok = 0;
+            break;
+        }
+        place(t, key, len, hash, slot, v[0], v[1]);
+    }
+    free(key);
+    if (ok)
+        t->total = (long long)head[2];
+    return ok;
+}
+
+static int cmp_items(const void *pa, const void *pb)
+{
+    const TopKItem *a = (const TopKItem *)pa, *b = (const TopKItem *)pb;
+    if (a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+    size_t n = a->len < b->len ? a->len : b->len;
+    int c = n ? memcmp(a->key, b->key, n) : 0;
+    if (c)
+        return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/**
+ * @brief Lists the k largest counters, largest first (ties by key).
+ *
+ * @param items  Room for k items.
+ * @return       Number of items filled in (fewer than k if fewer keys were seen).
+ */
+size_t topk_list(const TopK *t, TopKItem *items, size_t k)
+{
+    TopKItem *all = (TopKItem *)malloc((t->n + 1) * sizeof(TopKItem));
+    if (!all)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < t->n; i++)
+    {
+        all[i].key = t->c[i].key;
+        all[i].len = t->c[i].len;
+        all[i].count = t->c[i].count;
+        all[i].err = t->c[i].err;
+    }
+    qsort(all, t->n, sizeof(TopKItem), cmp_items);
+    if (k > t->n)
+        k = t->n;
+    memcpy(items, all, k * sizeof(TopKItem));
+    free(all);
+    return k;
+}
@@ -0,0 +1,357 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ * Copyright (c) 2025 Adolph Mapunda and contributors
+ */
+#define _GNU_SOURCE // fopencookie()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "zout.h"
+
+#define ZOUT_GZIP_BLOCK (1u << 20) // input bytes per gzip member
+#define ZOUT_ZSTD_BLOCK (4u << 20) // input bytes per zstd frame (larger window, better ratio)
+#define ZOUT_GZIP_LEVEL 6          // gzip's default
+#define ZOUT_ZSTD_LEVEL 3          // zstd's default
+#define ZOUT_INFLIGHT_PER_THREAD 2 // blocks queued or being compressed, per worker
+
+typedef struct ZBlock
+{
+    struct ZBlock *next;
+    char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    int done;
+} ZBlock;
+
+// Per-thread compressor state, reused across blocks
+typedef struct
+{
+    z_stream zs;
+    int zs_ready;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+#endif
+} ZCoder;
+
+typedef struct
+{
+    ZoutKind kind;
+    FILE *dest;
+    size_t block; // input bytes per block
+    char *cur;    // block being filled
+    size_t cur_len;
+    int blocks; // blocks handed in so far
+
+    pthread_t *tids;
+    int started;
+    ZCoder inline_coder; // used when no worker could be started
+    int inflight, max_inflight;
+    ZBlock *head, *tail; // in submission order; head is written next
+    ZBlock *todo;        // first block no worker has taken yet
+    int stop;
+
+    pthread_mutex_t mu;
+    pthread_cond_t cv_work; // a block was queued, or stop
+    pthread_cond_t cv_done; // a block was compressed
+} ZOut;
+
+/**
+ * @brief Output compression chosen by the file name: .gz or .zst.
+ */
+ZoutKind zout_kind(const char *path)
+{
+    size_t n = strlen(path);
+    if (n > 3 && strcmp(path + n - 3, ".gz") == 0)
+        return ZOUT_GZIP;
+    if (n > 4 && strcmp(path + n - 4, ".zst") == 0)
+        return ZOUT_ZSTD;
+    return ZOUT_NONE;
+}
+
+/**
+ * @brief Whether this build can write the given format.
+ */
+int zout_supported(ZoutKind kind)
+{
+#ifndef HAVE_ZSTD
+    if (kind == ZOUT_ZSTD)
+        return 0;
+#endif
+    return 1;
+}
+
+static void *xmalloc(size_t n)
+{
+    void *p = malloc(n ? n : 1);
+    if (!p)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+// Compresses b->in into b->out as one self-contained member/frame
+static void compress_block(ZOut *z, ZCoder *c, ZBlock *b)
+{
+    if (z->kind == ZOUT_GZIP)
+    {
+        if (!c->zs_ready)
+        {
+            memset(&c->zs, 0, sizeof(c->zs));
+            if (deflateInit2(&c->zs, ZOUT_GZIP_LEVEL, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                fprintf(stderr, "gzip: cannot start compressor\n");
+                exit(1);
+            }
+            c->zs_ready = 1;
+        }
+        else
+            deflateReset(&c->zs);
+        size_t cap = deflateBound(&c->zs, (uLong)b->in_len);
+        b->out = (unsigned char *)xmalloc(cap);
+        c->zs.next_in = (Bytef *)b->in;
+        c->zs.avail_in = (uInt)b->in_len;
+        c->zs.next_out = b->out;
+        c->zs.avail_out = (uInt)cap;
+        if (deflate(&c->zs, Z_FINISH) != Z_STREAM_END)
+        {
+            fprintf(stderr, "gzip: compression failed\n");
+            exit(1);
+        }
+        b->out_len = cap - c->zs.avail_out;
+    }
+#ifdef HAVE_ZSTD
+    else
+    {
+        if (!c->cctx && !(c->cctx = ZSTD_createCCtx()))
+        {
+            fprintf(stderr, "zstd: cannot start compressor\n");
+            exit(1);
+        }
+        size_t cap = ZSTD_compressBound(b->in_len);
+        b->out = (unsigned char *)xmalloc(cap);
+        size_t r = ZSTD_compressCCtx(c->cctx, b->out, cap, b->in, b->in_len, ZOUT_ZSTD_LEVEL);
+        if (ZSTD_isError(r))
+        {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(r));
+            exit(1);
+        }
+        b->out_len = r;
+    }
+#endif
+    free(b->in);
+    b->in = NULL;
+}
+
+static void coder_free(ZCoder *c)
+{
+    if (c->zs_ready)
+        deflateEnd(&c->zs);
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(c->cctx);
+#endif
+}
+
+static void *compress_worker(void *arg)
+{
+    ZOut *z = (ZOut *)arg;
+    ZCoder c;
+    memset(&c, 0, sizeof(c));
+    pthread_mutex_lock(&z->mu);
+    for (;;)
+    {
+        while (!z->todo && !z->stop)
+            pthread_cond_wait(&z->cv_work, &z->mu);
+        if (!z->todo)
+            break;
+        ZBlock *b = z->todo;
+        z->todo = b->next;
+        pthread_mutex_unlock(&z->mu);
+
+        compress_block(z, &c, b);
+
+        pthread_mutex_lock(&z->mu);
+        b->done = 1;
+        pthread_cond_broadcast(&z->cv_done);
+    }
+    pthread_mutex_unlock(&z->mu);
+    coder_free(&c);
+    return NULL;
+}
+
+// Writes and frees the head block once it is compressed; called with mu held
+static void write_head(ZOut *z)
+{
+    ZBlock *b = z->head;
+    while (!b->done)
+        pthread_cond_wait(&z->cv_done, &z->mu);
+    z->head = b->next;
+    if (!z->head)
+        z->tail = NULL;
+    z->inflight--;
+    pthread_mutex_unlock(&z->mu);
+
+    if (fwrite(b->out, 1, b->out_len, z->dest) != b->out_len)
+    {
+        perror("write");
+        exit(1);
+    }
+    free(b->out);
+    free(b);
+
+    pthread_mutex_lock(&z->mu);
+}
+
+// Queues the current block, first writing out finished ones while too many are in flight
+static void submit(ZOut *z)
+{
+    ZBlock *b = (ZBlock *)calloc(1, sizeof(ZBlock));
+    if (!b)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    b->in = z->cur;
+    b->in_len = z->cur_len;
+    z->cur = NULL;
+    z->cur_len = 0;
+    z->blocks++;
+
+    if (z->started == 0)
+    {
+        compress_block(z, &z->inline_coder, b);
+        b->done = 1;
+    }
+
+    pthread_mutex_lock(&z->mu);
+    if (z->tail)
+        z->tail->next = b;
+    else
+        z->head = b;
+    z->tail = b;
+    if (!b->done && !z->todo)
+        z->todo = b;
+    z->inflight++;
+    pthread_cond_signal(&z->cv_work);
+    while (z->head && (z->inflight > z->max_inflight || z->head->done))
+        write_head(z);
+    pthread_mutex_unlock(&z->mu);
+}
+
+static ssize_t zout_write(void *cookie, const char *buf, size_t n)
+{
+    ZOut *z = (ZOut *)cookie;
+    size_t left = n;
+    while (left)
+    {
+        if (!z->cur)
+            z->cur = (char *)xmalloc(z->block);
+        size_t take = z->block - z->cur_len;
+        if (take > left)
+            take = left;
+        memcpy(z->cur + z->cur_len, buf, take);
+        z->cur_len += take;
+        buf += take;
+        left -= take;
+        if (z->cur_len == z->block)
+            submit(z);
+    }
+    return (ssize_t)n;
+}
+
+static int zout_close(void *cookie)
+{
+    ZOut *z = (ZOut *)cookie;
+    if (z->cur_len || z->blocks == 0) // an empty file still gets one (empty) member
+    {
+        if (!z->cur)
+            z->cur = (char *)xmalloc(1);
+        submit(z);
+    }
+
+    pthread_mutex_lock(&z->mu);
+    while (z->head)
+        write_head(z);
+    z->stop = 1;
+    pthread_cond_broadcast(&z->cv_work);
+    pthread_mutex_unlock(&z->mu);
+    for (int i = 0; i < z->started; i++)
+        pthread_join(z->tids[i], NULL);
+
+    coder_free(&z->inline_coder);
+    pthread_mutex_destroy(&z->mu);
+    pthread_cond_destroy(&z->cv_work);
+    pthread_cond_destroy(&z->cv_done);
+    free(z->tids);
+    int rc = fclose(z->dest);
+    free(z);
+    return rc;
+}
+
+#if !defined(__GLIBC__) && (defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__))
+static int zout_write_bsd(void *cookie, const char *buf, int n)
+{
+    return (int)zout_write(cookie, buf, (size_t)n);
+}
+#endif
+
+/**
+ * @brief Wraps dest in a stream that compresses what is written to it.
+ *
+ * Closing the returned stream writes the last block and closes dest. Exits
+ * on failure; the format must be zout_supported().
+ *
+ * @param dest     Open output file, owned by the returned stream.
+ * @param kind     ZOUT_GZIP or ZOUT_ZSTD.
+ * @param threads  Compression worker threads (at least one is used).
+ */
+FILE *zout_open(FILE *dest, ZoutKind kind, int threads)
+{
+    ZOut *z = (ZOut *)calloc(1, sizeof(ZOut));
+    if (!z)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    z->kind = kind;
+    z->dest = dest;
+    z->block = kind == ZOUT_ZSTD ? ZOUT_ZSTD_BLOCK : ZOUT_GZIP_BLOCK;
+    if (threads < 1)
+        threads = 1;
+    z->max_inflight = threads * ZOUT_INFLIGHT_PER_THREAD;
+    pthread_mutex_init(&z->mu, NULL);
+    pthread_cond_init(&z->cv_work, NULL);
+    pthread_cond_init(&z->cv_done, NULL);
+
+    z->tids = (pthread_t *)xmalloc((size_t)threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&z->tids[i], NULL, compress_worker, z) != 0)
+            break;
+        z->started++;
+    }
+    if (z->started == 0)
+        fprintf(stderr, "[warn] could not start compression threads; compressing inline\n");
+
+    FILE *fp = NULL;
+#if defined(__GLIBC__)
+    cookie_io_functions_t io = {NULL, zout_write, NULL, zout_close};
+    fp = fopencookie(z, "w", io);
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    fp = funopen(z, NULL, zout_write_bsd, NULL, zout_close);
+#endif
+    if (!fp)
+    {
+        fprintf(stderr, "compressed output is not supported on this platform\n");
+        exit(1);
+    }
+    return fp;
+}